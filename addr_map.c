@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include "addr_map.h"
+#include "logger.h"
+
+#define INITIAL_CAPACITY 16
+
+// grow once the map is more than 3/4 full to keep probe sequences short
+#define MAX_LOAD_NUM 3
+#define MAX_LOAD_DEN 4
+
+// Allocates an empty slot array with the given capacity
+static int alloc_entries(AddrMap *map, size_t capacity)
+{
+    AddrMapEntry *entries = calloc(capacity, sizeof(AddrMapEntry));
+    if (entries == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory. ERRNO: %d", errno);
+        return -1;
+    }
+
+    map->entries = entries;
+    map->capacity = capacity;
+    map->shift = 64 - __builtin_ctzll(capacity);
+    return 0;
+}
+
+// Creates an instance of an empty map of addresses to void pointers
+AddrMap *new_addr_map()
+{
+    AddrMap *map = malloc(sizeof(AddrMap));
+    if (map == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory. ERRNO: %d", errno);
+        return NULL;
+    }
+
+    map->size = 0;
+    if (alloc_entries(map, INITIAL_CAPACITY) == -1)
+    {
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+// Frees the map. The stored values are not freed.
+void free_addr_map(AddrMap *map)
+{
+    free(map->entries);
+    free(map);
+}
+
+// Hashes the key with fibonacci hashing. Addresses tend to share their low bits (e.g. alignment)
+// so the multiply spreads them across the top bits which we use as the slot index.
+static inline size_t slot_for(AddrMap *map, uint64_t key)
+{
+    return (size_t)((key * 0x9E3779B97F4A7C15ull) >> map->shift);
+}
+
+// Returns the slot holding the key or the empty slot where it should be inserted
+static inline size_t find_slot(AddrMap *map, uint64_t key)
+{
+    size_t mask = map->capacity - 1;
+    size_t idx = slot_for(map, key);
+    while (map->entries[idx].val != NULL && map->entries[idx].key != key)
+    {
+        idx = (idx + 1) & mask;
+    }
+    return idx;
+}
+
+// Doubles the number of slots and reinserts every element
+static int grow(AddrMap *map)
+{
+    AddrMapEntry *old_entries = map->entries;
+    size_t old_capacity = map->capacity;
+
+    if (alloc_entries(map, old_capacity * 2) == -1)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (old_entries[i].val != NULL)
+        {
+            map->entries[find_slot(map, old_entries[i].key)] = old_entries[i];
+        }
+    }
+    free(old_entries);
+    return 0;
+}
+
+// Adds an element to the map replacing any existing element with the same key.
+// The element must not be NULL. Returns -1 if the map could not grow.
+int am_set(AddrMap *map, uint64_t key, void *elem)
+{
+    if ((map->size + 1) * MAX_LOAD_DEN > map->capacity * MAX_LOAD_NUM)
+    {
+        if (grow(map) == -1)
+        {
+            return -1;
+        }
+    }
+
+    size_t idx = find_slot(map, key);
+    if (map->entries[idx].val == NULL)
+    {
+        map->size++;
+    }
+    map->entries[idx].key = key;
+    map->entries[idx].val = elem;
+    return 0;
+}
+
+// Returns the element stored at the given key or NULL if there isnt one
+void *am_get(AddrMap *map, uint64_t key)
+{
+    return map->entries[find_slot(map, key)].val;
+}
+
+// Removes an element from the map. Returns -1 if the key is not in the map.
+int am_remove(AddrMap *map, uint64_t key)
+{
+    size_t mask = map->capacity - 1;
+    size_t hole = find_slot(map, key);
+    if (map->entries[hole].val == NULL)
+    {
+        return -1;
+    }
+
+    // Rather than leaving a tombstone we shift back any following elements that would
+    // no longer be reachable from their home slot once the hole is emptied.
+    size_t idx = hole;
+    while (true)
+    {
+        idx = (idx + 1) & mask;
+        if (map->entries[idx].val == NULL)
+        {
+            break;
+        }
+
+        size_t home = slot_for(map, map->entries[idx].key);
+        // distance from the home slot to the current slot and to the hole, accounting for wrap around
+        if (((idx - home) & mask) >= ((idx - hole) & mask))
+        {
+            map->entries[hole] = map->entries[idx];
+            hole = idx;
+        }
+    }
+
+    map->entries[hole].val = NULL;
+    map->entries[hole].key = 0;
+    map->size--;
+    return 0;
+}
+
+// Returns the number of elements in the map
+size_t am_size(AddrMap *map)
+{
+    return map->size;
+}
+
+// Returns true if the map is empty
+bool am_is_empty(AddrMap *map)
+{
+    return map->size == 0;
+}
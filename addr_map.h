@@ -0,0 +1,46 @@
+#ifndef ADDR_MAP_H
+#define ADDR_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A slot in the map. Empty slots have a NULL value.
+typedef struct AddrMapEntry {
+    uint64_t key;
+    void * val;
+} AddrMapEntry;
+
+// Growable open addressing map of addresses to non NULL void pointers
+typedef struct AddrMap {
+    size_t size;
+    // number of slots, always a power of two
+    size_t capacity;
+    // shift used to reduce the 64 bit hash to a slot index
+    int shift;
+    AddrMapEntry * entries;
+} AddrMap;
+
+// Creates an instance of an empty map of addresses to void pointers
+AddrMap *new_addr_map();
+
+// Frees the map. The stored values are not freed.
+void free_addr_map(AddrMap *map);
+
+// Adds an element to the map replacing any existing element with the same key.
+// The element must not be NULL. Returns -1 if the map could not grow.
+int am_set(AddrMap *map, uint64_t key, void *elem);
+
+// Returns the element stored at the given key or NULL if there isnt one
+void * am_get(AddrMap *map, uint64_t key);
+
+// Removes an element from the map. Returns -1 if the key is not in the map.
+int am_remove(AddrMap *map, uint64_t key);
+
+// Returns the number of elements in the map
+size_t am_size(AddrMap *map);
+
+// Returns true if the map is empty
+bool am_is_empty(AddrMap *map);
+
+#endif
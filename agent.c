@@ -0,0 +1,915 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/user.h>
+
+#include "agent.h"
+#include "inject.h"
+#include "logger.h"
+#include "unwind.h"
+#include "utils.h"
+#include "x86_insn.h"
+
+#define AGENT_LIBRARY "edb_agent.so"
+// size of the ring the agent records into
+#define AGENT_RING_SIZE (16 * 1024 * 1024)
+#define MAPS_PATH_SIZE 32
+#define MAPS_LINE_SIZE 512
+#define STT_FUNC 2
+#define SHN_UNDEF 0
+
+// page in the tracee holding the strings passed to the calls that load the agent
+#define SCRATCH_SIZE (2 * PATH_MAX)
+#define SCRATCH_MEM_PATH 0
+#define SCRATCH_LIB_PATH PATH_MAX
+#define SCRATCH_NAME (SCRATCH_SIZE - 256)
+#define MAX_ERROR_SIZE 256
+
+// length of the jump written over a tracepoint
+#define JUMP_LEN 5
+#define JMP_REL32 0xe9
+#define CALL_REL32 0xe8
+#define INT3 0xcc
+// executable memory for the trampolines, each gets a fixed share of it
+#define TRAMPOLINE_SIZE 512
+#define CODE_AREA_SIZE (AGENT_MAX_POINTS * TRAMPOLINE_SIZE)
+// how far below a tracepoint the trampolines are placed, tried in turn
+#define CODE_AREA_STEP (64ull * 1024 * 1024)
+#define CODE_AREA_TRIES 16
+// larger functions arent searched for branches into a patch
+#define MAX_FUNC_SCAN (1024 * 1024)
+// bytes below the stack pointer the tracee may be using
+#define RED_ZONE_SIZE 128
+#define FRAME_SIZE (RED_ZONE_SIZE + sizeof(struct user_regs_struct))
+
+// x86 register numbers of the general purpose registers the trampolines save and where
+// they go in the saved struct user_regs_struct
+typedef struct SavedReg {
+	uint8_t num;
+	size_t offset;
+} SavedReg;
+
+static const SavedReg SAVED_REGS[] = {
+	{0, offsetof(struct user_regs_struct, rax)},
+	{1, offsetof(struct user_regs_struct, rcx)},
+	{2, offsetof(struct user_regs_struct, rdx)},
+	{3, offsetof(struct user_regs_struct, rbx)},
+	{5, offsetof(struct user_regs_struct, rbp)},
+	{6, offsetof(struct user_regs_struct, rsi)},
+	{7, offsetof(struct user_regs_struct, rdi)},
+	{8, offsetof(struct user_regs_struct, r8)},
+	{9, offsetof(struct user_regs_struct, r9)},
+	{10, offsetof(struct user_regs_struct, r10)},
+	{11, offsetof(struct user_regs_struct, r11)},
+	{12, offsetof(struct user_regs_struct, r12)},
+	{13, offsetof(struct user_regs_struct, r13)},
+	{14, offsetof(struct user_regs_struct, r14)},
+	{15, offsetof(struct user_regs_struct, r15)},
+};
+
+// Finds the path and load address of libc in the tracee. Returns -1 if it isnt loaded.
+static int find_libc(int pid, char *path, uint64_t *base)
+{
+	char maps_path[MAPS_PATH_SIZE];
+	snprintf(maps_path, MAPS_PATH_SIZE, "/proc/%d/maps", pid);
+	FILE *maps = fopen(maps_path, "r");
+	if (maps == NULL)
+	{
+		logger(ERROR, "Failed to open %s. %s", maps_path, strerror(errno));
+		return -1;
+	}
+
+	int res = -1;
+	char line[MAPS_LINE_SIZE];
+	while (res == -1 && fgets(line, MAPS_LINE_SIZE, maps) != NULL)
+	{
+		unsigned long start, offset;
+		int path_start;
+		if (sscanf(line, "%lx-%*x %*s %lx %*s %*s %n", &start, &offset, &path_start) != 2 || offset != 0)
+		{
+			continue;
+		}
+
+		char *name = strrchr(line + path_start, '/');
+		if (name != NULL && (has_prefix(name, "/libc.so") || has_prefix(name, "/libc-")))
+		{
+			line[strcspn(line, "\n")] = '\0';
+			snprintf(path, PATH_MAX, "%s", line + path_start);
+			// libc is linked at 0 so its first mapping is where it was loaded
+			*base = start;
+			res = 0;
+		}
+	}
+	fclose(maps);
+	return res;
+}
+
+// Returns the address of the named function in a shared library's dynamic symbols relative
+// to where it is loaded, 0 if there isnt one
+static uint64_t dynamic_func(const ElfImage *image, const char *name)
+{
+	ElfSymbolTable table;
+	if (elf_symbol_table(image, ".dynsym", &table) == -1)
+	{
+		return 0;
+	}
+
+	for (size_t i = 0; i < table.count; i++)
+	{
+		const ElfSymbol *symbol = &table.symbols[i];
+		if ((symbol->st_info & 0xf) == STT_FUNC && symbol->st_shndx != SHN_UNDEF && symbol->st_name < table.names_size &&
+			strcmp(table.names + symbol->st_name, name) == 0)
+		{
+			return symbol->st_value;
+		}
+	}
+	return 0;
+}
+
+// The functions of the tracee's libc used to load the agent. dlerror may be 0.
+typedef struct LoaderFuncs {
+	uint64_t dlopen;
+	uint64_t dlsym;
+	uint64_t dlerror;
+} LoaderFuncs;
+
+// Finds dlopen and dlsym in the tracee's libc, which only has private versions of them
+// before glibc 2.34. Returns -1 if they cant be found.
+static int find_loader(DebugSession *session, LoaderFuncs *funcs)
+{
+	char path[PATH_MAX];
+	uint64_t base;
+	if (find_libc(session->pid, path, &base) == -1)
+	{
+		logger(WARN, "libc isnt loaded yet, run the program until main first.");
+		return -1;
+	}
+
+	ElfImage *libc = elf_open(path);
+	if (libc == NULL)
+	{
+		return -1;
+	}
+
+	funcs->dlopen = dynamic_func(libc, "dlopen");
+	funcs->dlsym = dynamic_func(libc, "dlsym");
+	funcs->dlerror = dynamic_func(libc, "dlerror");
+	if (funcs->dlopen == 0 || funcs->dlsym == 0)
+	{
+		funcs->dlopen = dynamic_func(libc, "__libc_dlopen_mode");
+		funcs->dlsym = dynamic_func(libc, "__libc_dlsym");
+		funcs->dlerror = 0;
+	}
+	elf_close(libc);
+
+	if (funcs->dlopen == 0 || funcs->dlsym == 0)
+	{
+		logger(WARN, "Couldnt find dlopen in %s.", path);
+		return -1;
+	}
+
+	funcs->dlopen += base;
+	funcs->dlsym += base;
+	funcs->dlerror += funcs->dlerror != 0 ? base : 0;
+	return 0;
+}
+
+// Runs a system call in the tracee and logs it if it fails. Returns -1 for errors.
+static int tracee_syscall(DebugSession *session, long number, const uint64_t *args, size_t arg_count, long *result)
+{
+	if (inject_syscall(session, number, args, arg_count, result) == -1)
+	{
+		return -1;
+	}
+	if (*result < 0 && *result > -4096)
+	{
+		logger(ERROR, "System call %d failed in process %d. %s", (int)number, session->pid, strerror((int)-*result));
+		return -1;
+	}
+	return 0;
+}
+
+// Looks up a symbol of the loaded agent in the tracee. Returns -1 if it isnt there.
+static int agent_symbol(DebugSession *session, const LoaderFuncs *funcs, uint64_t handle, uint64_t scratch, const char *name, uint64_t *addr)
+{
+	uint64_t args[] = {handle, scratch + SCRATCH_NAME};
+	if (write_memory(&session->mem, scratch + SCRATCH_NAME, name, strlen(name) + 1) == -1 ||
+		inject_call(session, funcs->dlsym, args, 2, addr) == -1)
+	{
+		return -1;
+	}
+	if (*addr == 0)
+	{
+		logger(ERROR, "The agent doesnt define %s.", (char *)name);
+		return -1;
+	}
+	return 0;
+}
+
+// Maps the shared memory into the tracee, loads the library and points it at the shared
+// memory, using the scratch page for the strings the calls need. Returns -1 for errors.
+static int setup_tracee(Agent *agent, DebugSession *session, const LoaderFuncs *funcs, uint64_t scratch, const char *lib_path)
+{
+	// the tracee opens our memfd through /proc
+	char mem_path[MAPS_PATH_SIZE * 2];
+	snprintf(mem_path, sizeof(mem_path), "/proc/%d/fd/%d", (int)getpid(), agent->fd);
+	if (write_memory(&session->mem, scratch + SCRATCH_MEM_PATH, mem_path, strlen(mem_path) + 1) == -1 ||
+		write_memory(&session->mem, scratch + SCRATCH_LIB_PATH, lib_path, strlen(lib_path) + 1) == -1)
+	{
+		return -1;
+	}
+
+	long fd;
+	long remote_shared;
+	uint64_t open_args[] = {(uint64_t)AT_FDCWD, scratch + SCRATCH_MEM_PATH, O_RDWR | O_CLOEXEC};
+	if (tracee_syscall(session, SYS_openat, open_args, 3, &fd) == -1)
+	{
+		return -1;
+	}
+	uint64_t mmap_args[] = {0, agent->shared_size, PROT_READ | PROT_WRITE, MAP_SHARED, (uint64_t)fd, 0};
+	uint64_t close_args[] = {(uint64_t)fd};
+	long closed;
+	int mapped = tracee_syscall(session, SYS_mmap, mmap_args, 6, &remote_shared);
+	if (tracee_syscall(session, SYS_close, close_args, 1, &closed) == -1 || mapped == -1)
+	{
+		return -1;
+	}
+
+	uint64_t handle;
+	uint64_t dlopen_args[] = {scratch + SCRATCH_LIB_PATH, RTLD_NOW};
+	if (inject_call(session, funcs->dlopen, dlopen_args, 2, &handle) == -1)
+	{
+		return -1;
+	}
+
+	if (handle == 0)
+	{
+		char error[MAX_ERROR_SIZE] = "";
+		uint64_t error_addr;
+		if (funcs->dlerror != 0 && inject_call(session, funcs->dlerror, NULL, 0, &error_addr) == 0 && error_addr != 0)
+		{
+			read_memory(&session->mem, error_addr, error, MAX_ERROR_SIZE - 1);
+			error[MAX_ERROR_SIZE - 1] = '\0';
+		}
+		logger(ERROR, "Failed to load %s into process %d. %s", (char *)lib_path, session->pid, error);
+		return -1;
+	}
+
+	uint64_t shared_var;
+	if (agent_symbol(session, funcs, handle, scratch, AGENT_HIT_FUNC, &agent->hit_func) == -1 ||
+		agent_symbol(session, funcs, handle, scratch, AGENT_SHARED_VAR, &shared_var) == -1)
+	{
+		return -1;
+	}
+	return write_memory(&session->mem, shared_var, &remote_shared, sizeof(remote_shared));
+}
+
+// Loads the agent library at the given path, or the one next to edb if path is empty, into
+// the stopped tracee and shares a ring buffer with it. The tracee must have loaded libc.
+// Returns NULL if it couldnt be loaded.
+Agent *load_agent(DebugSession *session, const char *path)
+{
+	char given[PATH_MAX];
+	if (strcmp(path, "") != 0)
+	{
+		snprintf(given, PATH_MAX, "%s", path);
+	}
+	else
+	{
+		ssize_t len = readlink("/proc/self/exe", given, PATH_MAX - 1);
+		given[len > 0 ? len : 0] = '\0';
+		char *dir_end = strrchr(given, '/');
+		snprintf(dir_end != NULL ? dir_end + 1 : given, PATH_MAX - (dir_end != NULL ? dir_end + 1 - given : 0), "%s", AGENT_LIBRARY);
+	}
+
+	// the tracee may have a different working directory
+	char lib_path[PATH_MAX];
+	if (realpath(given, lib_path) == NULL)
+	{
+		logger(WARN, "No agent library at %s.", given);
+		return NULL;
+	}
+
+	LoaderFuncs funcs;
+	if (find_loader(session, &funcs) == -1)
+	{
+		return NULL;
+	}
+
+	Agent *agent = (Agent *)calloc(1, sizeof(Agent));
+	if (agent == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for agent. %s", strerror(errno));
+		return NULL;
+	}
+
+	agent->shared_size = sizeof(AgentShared) + AGENT_RING_SIZE;
+	agent->fd = memfd_create("edb-agent", MFD_CLOEXEC);
+	if (agent->fd == -1 || ftruncate(agent->fd, (off_t)agent->shared_size) == -1)
+	{
+		logger(ERROR, "Failed to create memory to share with the agent. %s", strerror(errno));
+		if (agent->fd != -1)
+		{
+			close(agent->fd);
+		}
+		free(agent);
+		return NULL;
+	}
+
+	agent->shared = (AgentShared *)mmap(NULL, agent->shared_size, PROT_READ | PROT_WRITE, MAP_SHARED, agent->fd, 0);
+	if (agent->shared == MAP_FAILED)
+	{
+		logger(ERROR, "Failed to map memory to share with the agent. %s", strerror(errno));
+		close(agent->fd);
+		free(agent);
+		return NULL;
+	}
+	agent->shared->magic = AGENT_MAGIC;
+	agent->shared->pid = session->pid;
+	agent->shared->capacity = AGENT_RING_SIZE;
+
+	long scratch;
+	uint64_t scratch_args[] = {0, SCRATCH_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, (uint64_t)-1, 0};
+	if (tracee_syscall(session, SYS_mmap, scratch_args, 6, &scratch) == -1)
+	{
+		free_agent(agent);
+		return NULL;
+	}
+
+	int res = setup_tracee(agent, session, &funcs, (uint64_t)scratch, lib_path);
+
+	long unmapped;
+	uint64_t unmap_args[] = {(uint64_t)scratch, SCRATCH_SIZE};
+	if (session->active)
+	{
+		tracee_syscall(session, SYS_munmap, unmap_args, 2, &unmapped);
+	}
+
+	if (res == -1)
+	{
+		free_agent(agent);
+		return NULL;
+	}
+
+	agent->tsc_base = __builtin_ia32_rdtsc();
+	agent->ns_base = monotonic_ns();
+	logger(INFO, "Loaded agent %s into process %d.", lib_path, session->pid);
+	return agent;
+}
+
+// Frees our side of the agent. Nothing in the tracee is touched.
+void free_agent(Agent *agent)
+{
+	munmap(agent->shared, agent->shared_size);
+	close(agent->fd);
+	free(agent);
+}
+
+// Makes sure there is executable memory in the tracee for another trampoline within reach of
+// a rel32 jump from the given address. Returns 1 if there isnt any and -1 for errors.
+static int reserve_trampoline(Agent *agent, DebugSession *session, uint64_t addr)
+{
+	if (agent->code_addr == 0)
+	{
+		// the trampolines are placed below the executable where there is usually free space
+		for (int i = 1; i <= CODE_AREA_TRIES && agent->code_addr == 0; i++)
+		{
+			uint64_t hint = (addr & ~(uint64_t)0xfff) - i * CODE_AREA_STEP;
+			uint64_t args[] = {hint, CODE_AREA_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, (uint64_t)-1, 0};
+			long area;
+			if (inject_syscall(session, SYS_mmap, args, 6, &area) == -1)
+			{
+				return -1;
+			}
+			if (area == (long)hint)
+			{
+				agent->code_addr = (uint64_t)area;
+			}
+			else if (area >= 0 || area < -4095)
+			{
+				// older kernels treat the flag as a hint and can put the area anywhere
+				uint64_t unmap_args[] = {(uint64_t)area, CODE_AREA_SIZE};
+				inject_syscall(session, SYS_munmap, unmap_args, 2, &area);
+			}
+		}
+		if (agent->code_addr == 0)
+		{
+			logger(WARN, "No room for trampolines near %p.", (void *)addr);
+			return 1;
+		}
+	}
+
+	int64_t distance = (int64_t)(agent->code_addr - addr);
+	if (agent->code_used + TRAMPOLINE_SIZE > CODE_AREA_SIZE || distance != (int32_t)distance)
+	{
+		return 1;
+	}
+	return 0;
+}
+
+// Writes a copy of the instruction that does the same thing when run from new_addr. A direct
+// call pushes the original return address and jumps, a return into the trampoline couldnt be
+// unwound through. Returns the length of the copy or -1 if it cant be moved.
+static int relocate_insn(const uint8_t *code, const X86Insn *insn, uint64_t old_addr, uint64_t new_addr, uint8_t *out)
+{
+	if (insn->map != MAP_ONE_BYTE || insn->opcode != CALL_REL32)
+	{
+		// indirect calls would return into the trampoline
+		return insn_is_call(code, insn) ? -1 : insn_relocate(code, insn, old_addr, new_addr, out);
+	}
+
+	// lea rsp, [rsp - 8], then the return address is stored a half at a time
+	const uint8_t push_ret[] = {0x48, 0x8d, 0x64, 0x24, 0xf8, 0xc7, 0x04, 0x24, 0, 0, 0, 0, 0xc7, 0x44, 0x24, 0x04};
+	uint64_t ret_addr = old_addr + insn->len;
+	uint32_t low = (uint32_t)ret_addr;
+	uint32_t high = (uint32_t)(ret_addr >> 32);
+	memcpy(out, push_ret, sizeof(push_ret));
+	memcpy(out + 8, &low, sizeof(low));
+	memcpy(out + sizeof(push_ret), &high, sizeof(high));
+	size_t len = sizeof(push_ret) + sizeof(high);
+	out[len] = JMP_REL32;
+	len += 5;
+
+	int64_t rel = (int64_t)(insn_branch_target(code, insn, old_addr) - (new_addr + len));
+	if (rel != (int32_t)rel)
+	{
+		return -1;
+	}
+	int32_t rel32 = (int32_t)rel;
+	memcpy(out + len - sizeof(rel32), &rel32, sizeof(rel32));
+	return (int)len;
+}
+
+static size_t emit_bytes(uint8_t *out, size_t pos, const uint8_t *bytes, size_t len)
+{
+	memcpy(out + pos, bytes, len);
+	return pos + len;
+}
+
+static size_t emit_u32(uint8_t *out, size_t pos, uint32_t val)
+{
+	return emit_bytes(out, pos, (const uint8_t *)&val, sizeof(val));
+}
+
+static size_t emit_u64(uint8_t *out, size_t pos, uint64_t val)
+{
+	return emit_bytes(out, pos, (const uint8_t *)&val, sizeof(val));
+}
+
+// Emits a move between a register and [rsp + offset], opcode 0x89 stores and 0x8b loads
+static size_t emit_frame_mov(uint8_t *out, size_t pos, uint8_t opcode, uint8_t reg, size_t offset)
+{
+	uint8_t insn[] = {0x48 | (reg >= 8 ? 0x04 : 0), opcode, 0x84 | ((reg & 0x07) << 3), 0x24};
+	pos = emit_bytes(out, pos, insn, sizeof(insn));
+	return emit_u32(out, pos, (uint32_t)offset);
+}
+
+// Emits lea rsp or rax, [rsp + offset]
+static size_t emit_lea(uint8_t *out, size_t pos, bool to_rsp, int32_t offset)
+{
+	uint8_t insn[] = {0x48, 0x8d, to_rsp ? 0xa4 : 0x84, 0x24};
+	pos = emit_bytes(out, pos, insn, sizeof(insn));
+	return emit_u32(out, pos, (uint32_t)offset);
+}
+
+// Emits the start of a trampoline. It saves the tracee's registers as a struct
+// user_regs_struct below the red zone, calls the agent with them on an aligned stack and
+// restores them. Only lea and mov touch the stack pointer and registers until the flags are
+// saved and after they are restored so the flags pass through unchanged.
+static size_t emit_agent_call(uint8_t *out, uint32_t point_idx, uint64_t site, uint64_t hit_func)
+{
+	size_t pos = emit_lea(out, 0, true, -(int32_t)FRAME_SIZE);
+	for (size_t i = 0; i < sizeof(SAVED_REGS) / sizeof(SAVED_REGS[0]); i++)
+	{
+		pos = emit_frame_mov(out, pos, 0x89, SAVED_REGS[i].num, SAVED_REGS[i].offset);
+	}
+
+	// pushfq, pop rax
+	const uint8_t save_flags[] = {0x9c, 0x58};
+	pos = emit_bytes(out, pos, save_flags, sizeof(save_flags));
+	pos = emit_frame_mov(out, pos, 0x89, 0, offsetof(struct user_regs_struct, eflags));
+
+	// the stack pointer and ip the tracee had at the tracepoint
+	pos = emit_lea(out, pos, false, (int32_t)FRAME_SIZE);
+	pos = emit_frame_mov(out, pos, 0x89, 0, offsetof(struct user_regs_struct, rsp));
+	const uint8_t mov_rax_imm[] = {0x48, 0xb8};
+	pos = emit_bytes(out, pos, mov_rax_imm, sizeof(mov_rax_imm));
+	pos = emit_u64(out, pos, site);
+	pos = emit_frame_mov(out, pos, 0x89, 0, offsetof(struct user_regs_struct, rip));
+
+	// cld, mov rbx, rsp, and rsp, -16, mov rsi, rbx
+	const uint8_t align_stack[] = {0xfc, 0x48, 0x89, 0xe3, 0x48, 0x83, 0xe4, 0xf0, 0x48, 0x89, 0xde};
+	pos = emit_bytes(out, pos, align_stack, sizeof(align_stack));
+	// mov edi, point_idx
+	const uint8_t mov_edi_imm[] = {0xbf};
+	pos = emit_bytes(out, pos, mov_edi_imm, sizeof(mov_edi_imm));
+	pos = emit_u32(out, pos, point_idx);
+	pos = emit_bytes(out, pos, mov_rax_imm, sizeof(mov_rax_imm));
+	pos = emit_u64(out, pos, hit_func);
+	// call rax, mov rsp, rbx
+	const uint8_t call[] = {0xff, 0xd0, 0x48, 0x89, 0xdc};
+	pos = emit_bytes(out, pos, call, sizeof(call));
+
+	pos = emit_frame_mov(out, pos, 0x8b, 0, offsetof(struct user_regs_struct, eflags));
+	// push rax, popfq
+	const uint8_t restore_flags[] = {0x50, 0x9d};
+	pos = emit_bytes(out, pos, restore_flags, sizeof(restore_flags));
+	for (size_t i = 0; i < sizeof(SAVED_REGS) / sizeof(SAVED_REGS[0]); i++)
+	{
+		pos = emit_frame_mov(out, pos, 0x8b, SAVED_REGS[i].num, SAVED_REGS[i].offset);
+	}
+	return emit_lea(out, pos, true, (int32_t)FRAME_SIZE);
+}
+
+// Returns true if the trampolines save the register
+static bool is_saved_reg(Reg reg)
+{
+	return reg <= RDI || reg == RIP || reg == RSP || reg == EFLAGS;
+}
+
+// Returns 1 if a direct branch in the function lands inside the instructions at [addr, addr + len)
+// rather than at their start, or 2 if the function has an indirect jump such as through a jump
+// table which could. Returns -1 if the function cant be decoded.
+static int has_branch_into(const uint8_t *code, size_t size, uint64_t func_addr, uint64_t addr, size_t len)
+{
+	bool at_boundary = false;
+	size_t pos = 0;
+	while (pos < size)
+	{
+		X86Insn insn;
+		if (decode_insn(code + pos, size - pos, &insn) == -1)
+		{
+			return -1;
+		}
+
+		at_boundary |= func_addr + pos == addr;
+		int op = insn_ff_op(code + pos, &insn);
+		if (op == 4 || op == 5)
+		{
+			return 2;
+		}
+		if (insn.rel_size != 0)
+		{
+			uint64_t target = insn_branch_target(code + pos, &insn, func_addr + pos);
+			if (target > addr && target < addr + len)
+			{
+				return 1;
+			}
+		}
+		pos += insn.len;
+	}
+	// a tracepoint part way through an instruction cant be moved
+	return at_boundary ? 0 : -1;
+}
+
+// Reads the function containing the address with our int3s and jumps replaced by the
+// original code. Returns NULL if there is no known function there.
+static uint8_t *read_function(Agent *agent, DebugSession *session, BreakPointStore *store, uint64_t addr, uint64_t *func_addr, size_t *size)
+{
+	const Symbol *func = lookup_symbol(session, addr);
+	if (func == NULL || func->type != STT_FUNC || func->size == 0 || func->size > MAX_FUNC_SCAN)
+	{
+		return NULL;
+	}
+	*func_addr = func->addr + session->load_bias;
+	*size = func->size;
+
+	uint8_t *code = (uint8_t *)malloc(*size);
+	if (code == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for code. %s", strerror(errno));
+		return NULL;
+	}
+	if (read_memory(&session->mem, *func_addr, code, *size) == -1)
+	{
+		free(code);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < store->count; i++)
+	{
+		if ((store->flags[i] & BP_ENABLED) && store->addrs[i] >= *func_addr && store->addrs[i] < *func_addr + *size)
+		{
+			code[store->addrs[i] - *func_addr] = store->saved_bytes[i];
+		}
+	}
+	for (size_t i = 0; i < agent->point_count; i++)
+	{
+		const FastTracepoint *point = &agent->points[i];
+		if (point->active && point->addr >= *func_addr && point->addr + point->len <= *func_addr + *size)
+		{
+			memcpy(code + (point->addr - *func_addr), point->saved, point->len);
+		}
+	}
+	return code;
+}
+
+// Works out the whole instructions a jump at the address replaces and checks that they can be
+// moved: they are in a known function with no indirect jumps, no direct branch or exception
+// landing pad is in the middle of them, no other breakpoint is on them and no thread is part
+// way through them. Copies their original
+// bytes to saved. Returns 0 with their count and length or 1 if they cant be moved.
+static int find_patch(Agent *agent, DebugSession *session, BreakPointStore *store, uint64_t addr, uint8_t *saved, X86Insn *insns, size_t *insn_count, size_t *len)
+{
+	uint64_t func_addr;
+	size_t size;
+	uint8_t *code = read_function(agent, session, store, addr, &func_addr, &size);
+	if (code == NULL)
+	{
+		logger(INFO, "%p isnt in a known function.", (void *)addr);
+		return 1;
+	}
+
+	size_t offset = addr - func_addr;
+	*insn_count = 0;
+	*len = 0;
+	while (*len < JUMP_LEN)
+	{
+		X86Insn *insn = &insns[*insn_count];
+		if (decode_insn(code + offset + *len, size - offset - *len, insn) == -1 || (insn->ends_block && *len + insn->len < JUMP_LEN))
+		{
+			logger(INFO, "Not enough instructions to move at %p.", (void *)addr);
+			free(code);
+			return 1;
+		}
+		*len += insn->len;
+		(*insn_count)++;
+	}
+	memcpy(saved, code + offset, *len);
+
+	int branch = has_branch_into(code, size, func_addr, addr, *len);
+	free(code);
+	if (branch == 2)
+	{
+		logger(INFO, "The function containing %p has indirect jumps that could land inside the jump.", (void *)addr);
+		return 1;
+	}
+	if (branch != 0)
+	{
+		logger(INFO, branch == 1 ? "Code branches into the instructions at %p." : "Couldnt check for branches to %p.", (void *)addr);
+		return 1;
+	}
+
+	// exceptions resume at landing pads found through the call frame info rather than branches
+	int pad = landing_pad_into(session->elf, func_addr - session->load_bias, addr - session->load_bias, *len);
+	if (pad != 0)
+	{
+		logger(INFO, pad == 1 ? "An exception landing pad is inside the instructions at %p." : "Couldnt check for exception landing pads at %p.", (void *)addr);
+		return 1;
+	}
+
+	for (size_t i = 1; i < *len; i++)
+	{
+		if (bp_find(store, addr + i) != -1 || agent_covers(agent, addr + i))
+		{
+			logger(INFO, "Another breakpoint is on the instructions at %p.", (void *)addr);
+			return 1;
+		}
+	}
+	for (size_t i = 0; i < agent->point_count; i++)
+	{
+		if (agent->points[i].active && agent->points[i].addr > addr && agent->points[i].addr < addr + *len)
+		{
+			logger(INFO, "Another breakpoint is on the instructions at %p.", (void *)addr);
+			return 1;
+		}
+	}
+
+	// every thread has to be stopped while the jump is written, none can be left inside it
+	ThreadTable *threads = session->threads;
+	for (size_t i = 0; i < threads->count; i++)
+	{
+		TraceeThread *thread = threads->threads[i];
+		uint64_t ip = thread->state == THREAD_STOPPED ? (uint64_t)get_ip(&thread->regs) : 0;
+		if (ip > addr && ip < addr + *len)
+		{
+			logger(INFO, "Thread %d is stopped inside the instructions at %p.", thread->tid, (void *)addr);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Fills in what the agent collects for a tracepoint. Returns 1 if an item uses a register
+// the trampolines dont save.
+static int set_agent_point(AgentPoint *point, const TraceSpec *spec, uint32_t spec_idx, uint64_t load_bias, uint64_t hits)
+{
+	// where each register is saved is its offset in the register cache
+	RegCache layout = {.valid = true};
+	for (size_t i = 0; i < spec->item_count; i++)
+	{
+		const TraceItem *item = &spec->items[i];
+		AgentItem *agent_item = &point->items[i];
+		if (item->kind != TRACE_MEM && !is_saved_reg(item->reg))
+		{
+			logger(INFO, "The agent cant collect %s.", (char *)item->label);
+			return 1;
+		}
+
+		agent_item->kind = item->kind;
+		agent_item->len = item->len;
+		agent_item->addr = item->addr + (item->relocated ? load_bias : 0);
+		agent_item->reg_offset = item->kind == TRACE_MEM ? 0 : (uint16_t)((uint8_t *)get_register(&layout, item->reg) - (uint8_t *)&layout.regs);
+	}
+
+	point->spec = spec_idx;
+	point->record_size = (uint32_t)spec->record_size;
+	point->item_count = (uint32_t)spec->item_count;
+	__atomic_store_n(&point->hits, hits, __ATOMIC_RELAXED);
+	return 0;
+}
+
+// Replaces the int3 of the tracepoint in the given slot with a jump to a trampoline that has
+// the agent record its items. Returns 1 if the site or items cant be handled by the agent,
+// leaving it an int3 tracepoint, and -1 for errors.
+int agent_patch(Agent *agent, DebugSession *session, BreakPointStore *store, size_t slot, const TraceSpec *spec, uint32_t spec_idx)
+{
+	uint64_t addr = store->addrs[slot];
+	if (store->conditions[slot] != NULL)
+	{
+		logger(INFO, "Conditions are checked by the debugger, tracepoint %d keeps its int3.", (int)store->ids[slot]);
+		return 1;
+	}
+	if (agent->point_count == AGENT_MAX_POINTS)
+	{
+		logger(INFO, "The agent serves at most %d tracepoints.", AGENT_MAX_POINTS);
+		return 1;
+	}
+
+	uint32_t point_idx = (uint32_t)agent->point_count;
+	FastTracepoint *point = &agent->points[point_idx];
+	X86Insn insns[JUMP_LEN];
+	size_t insn_count;
+	size_t len;
+	int res = set_agent_point(&agent->shared->points[point_idx], spec, spec_idx, session->load_bias, store->hit_counts[slot]);
+	if (res == 0)
+	{
+		res = find_patch(agent, session, store, addr, point->saved, insns, &insn_count, &len);
+	}
+	if (res == 0)
+	{
+		res = reserve_trampoline(agent, session, addr);
+	}
+	if (res != 0)
+	{
+		return res;
+	}
+
+	uint64_t trampoline = agent->code_addr + agent->code_used;
+	uint8_t code[TRAMPOLINE_SIZE];
+	size_t pos = emit_agent_call(code, point_idx, addr, agent->hit_func);
+	size_t offset = 0;
+	for (size_t i = 0; i < insn_count; i++)
+	{
+		// a call returns to the instruction after it, which has to be past the jump
+		int moved = -1;
+		if (i + 1 == insn_count || !insn_is_call(point->saved + offset, &insns[i]))
+		{
+			moved = relocate_insn(point->saved + offset, &insns[i], addr + offset, trampoline + pos, code + pos);
+		}
+		if (moved == -1)
+		{
+			logger(INFO, "The instructions at %p cant be moved to the trampoline.", (void *)addr);
+			return 1;
+		}
+		offset += insns[i].len;
+		pos += (size_t)moved;
+	}
+
+	// carry on after the replaced instructions
+	code[pos++] = JMP_REL32;
+	pos = emit_u32(code, pos, (uint32_t)(int32_t)(addr + len - (trampoline + pos + sizeof(uint32_t))));
+
+	uint8_t jump[MAX_PATCH_LEN];
+	memset(jump, INT3, sizeof(jump));
+	jump[0] = JMP_REL32;
+	int32_t rel = (int32_t)(trampoline - (addr + JUMP_LEN));
+	memcpy(jump + 1, &rel, sizeof(rel));
+
+	// the int3 comes out first so its saved byte isnt written over the jump later
+	if (write_memory(&session->mem, trampoline, code, pos) == -1 || bp_disable(store, &session->mem, slot) == -1)
+	{
+		return -1;
+	}
+	if (write_memory(&session->mem, addr, jump, len) == -1)
+	{
+		logger(ERROR, "Failed to write jump at %p.", (void *)addr);
+		bp_enable(store, &session->mem, slot);
+		return -1;
+	}
+
+	logger(DEBUG, "Patched %d bytes at %p to jump to %p", (int)len, (void *)addr, (void *)trampoline);
+	agent->code_used += TRAMPOLINE_SIZE;
+	point->bp_id = store->ids[slot];
+	point->addr = addr;
+	point->len = (uint8_t)len;
+	point->active = true;
+	agent->point_count++;
+	store->flags[slot] |= BP_FAST;
+	return 0;
+}
+
+// Puts back the instructions replaced by the jump of the fast tracepoint in the given slot.
+// It then holds neither a jump nor an int3. Returns -1 for errors.
+int agent_unpatch(Agent *agent, DebugSession *session, BreakPointStore *store, size_t slot)
+{
+	for (size_t i = 0; i < agent->point_count; i++)
+	{
+		FastTracepoint *point = &agent->points[i];
+		if (!point->active || point->bp_id != store->ids[slot])
+		{
+			continue;
+		}
+
+		if (write_memory(&session->mem, point->addr, point->saved, point->len) == -1)
+		{
+			logger(ERROR, "Failed to restore the instructions at %p.", (void *)point->addr);
+			return -1;
+		}
+		point->active = false;
+		store->flags[slot] &= ~BP_FAST;
+		return 0;
+	}
+	return 0;
+}
+
+// Returns true if the address is inside the instructions a jump replaced, other than at
+// the start of them
+bool agent_covers(const Agent *agent, uint64_t addr)
+{
+	for (size_t i = 0; i < agent->point_count; i++)
+	{
+		const FastTracepoint *point = &agent->points[i];
+		if (point->active && addr > point->addr && addr < point->addr + point->len)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Returns true once the agent's ring is half full
+bool agent_needs_drain(const Agent *agent)
+{
+	uint64_t head = __atomic_load_n(&agent->shared->head, __ATOMIC_ACQUIRE);
+	return head - agent->shared->tail > agent->shared->capacity / 2;
+}
+
+// Moves the records the agent has made into the log and brings the hit counts of fast
+// tracepoints up to date. Returns -1 if the shared ring was corrupt.
+int agent_drain(Agent *agent, TraceLog *log, BreakPointStore *store)
+{
+	AgentShared *shared = agent->shared;
+	uint64_t head = __atomic_load_n(&shared->head, __ATOMIC_ACQUIRE);
+	uint64_t tail = shared->tail;
+
+	// the counter rate is measured over everything since the agent was loaded
+	uint64_t tsc_now = __builtin_ia32_rdtsc();
+	uint64_t ns_now = monotonic_ns();
+	double ns_per_tick = tsc_now > agent->tsc_base ? (double)(ns_now - agent->ns_base) / (double)(tsc_now - agent->tsc_base) : 0;
+
+	int res = 0;
+	while (tail != head)
+	{
+		uint64_t offset = tail % shared->capacity;
+		const TraceRecord *record = (const TraceRecord *)(shared->ring + offset);
+		if (head - tail > shared->capacity || record->size < sizeof(uint64_t) || record->size % sizeof(uint64_t) != 0 ||
+			record->size > shared->capacity - offset || record->size > head - tail)
+		{
+			logger(ERROR, "The agent's trace buffer is corrupt, dropping its records.");
+			tail = head;
+			res = -1;
+			break;
+		}
+
+		if (record->spec != AGENT_PAD_RECORD)
+		{
+			int64_t ticks = (int64_t)(record->time_ns - agent->tsc_base);
+			if (trace_append(log, record, agent->ns_base + (uint64_t)((double)ticks * ns_per_tick)) == -1)
+			{
+				res = -1;
+			}
+		}
+		tail += record->size;
+	}
+	__atomic_store_n(&shared->tail, tail, __ATOMIC_RELEASE);
+
+	for (size_t i = 0; i < agent->point_count; i++)
+	{
+		long slot = agent->points[i].active ? bp_find_id(store, agent->points[i].bp_id) : -1;
+		if (slot != -1)
+		{
+			store->hit_counts[slot] = __atomic_load_n(&shared->points[i].hits, __ATOMIC_RELAXED);
+		}
+	}
+	return res;
+}
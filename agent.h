@@ -0,0 +1,77 @@
+#ifndef AGENT_H
+#define AGENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "agent_abi.h"
+#include "breakpoint.h"
+#include "session.h"
+#include "trace.h"
+
+// most bytes of whole instructions a jump can replace, a jump is 5 bytes and the last
+// instruction it covers can be up to 15
+#define MAX_PATCH_LEN 20
+
+// A tracepoint whose site jumps to a trampoline that calls the agent rather than trapping
+typedef struct FastTracepoint {
+	uint32_t bp_id;
+	uint64_t addr;
+	// the instructions the jump replaced
+	uint8_t len;
+	uint8_t saved[MAX_PATCH_LEN];
+	// cleared once the jump is removed. The slot isnt reused as a thread could still be in
+	// its trampoline.
+	bool active;
+} FastTracepoint;
+
+// The agent library loaded into the tracee and the fast tracepoints it serves
+typedef struct Agent {
+	// memfd shared with the tracee and our mapping of it
+	int fd;
+	AgentShared *shared;
+	size_t shared_size;
+	// the agent's entry point in the tracee
+	uint64_t hit_func;
+	// executable memory in the tracee the trampolines are written to, 0 until the first
+	// tracepoint is patched
+	uint64_t code_addr;
+	size_t code_used;
+	FastTracepoint points[AGENT_MAX_POINTS];
+	size_t point_count;
+	// time stamp counter and monotonic time when the agent was loaded. The agent stamps
+	// records with the counter which is converted to time against these.
+	uint64_t tsc_base;
+	uint64_t ns_base;
+} Agent;
+
+// Loads the agent library at the given path, or the one next to edb if path is empty, into
+// the stopped tracee and shares a ring buffer with it. The tracee must have loaded libc.
+// Returns NULL if it couldnt be loaded.
+Agent *load_agent(DebugSession *session, const char *path);
+
+// Frees our side of the agent. Nothing in the tracee is touched.
+void free_agent(Agent *agent);
+
+// Replaces the int3 of the tracepoint in the given slot with a jump to a trampoline that has
+// the agent record its items. Returns 1 if the site or items cant be handled by the agent,
+// leaving it an int3 tracepoint, and -1 for errors.
+int agent_patch(Agent *agent, DebugSession *session, BreakPointStore *store, size_t slot, const TraceSpec *spec, uint32_t spec_idx);
+
+// Puts back the instructions replaced by the jump of the fast tracepoint in the given slot.
+// It then holds neither a jump nor an int3. Returns -1 for errors.
+int agent_unpatch(Agent *agent, DebugSession *session, BreakPointStore *store, size_t slot);
+
+// Returns true if the address is inside the instructions a jump replaced, other than at
+// the start of them
+bool agent_covers(const Agent *agent, uint64_t addr);
+
+// Returns true once the agent's ring is half full
+bool agent_needs_drain(const Agent *agent);
+
+// Moves the records the agent has made into the log and brings the hit counts of fast
+// tracepoints up to date. Returns -1 if the shared ring was corrupt.
+int agent_drain(Agent *agent, TraceLog *log, BreakPointStore *store);
+
+#endif
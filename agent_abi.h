@@ -0,0 +1,60 @@
+#ifndef AGENT_ABI_H
+#define AGENT_ABI_H
+
+#include <stdint.h>
+
+#include "trace.h"
+
+// Layout of the memory shared between edb and the agent library it loads into the tracee.
+// Both sides are built from this header so the layouts always match.
+
+#define AGENT_MAGIC 0x746e656761626465ull
+// most fast tracepoints one agent can serve, slots are never reused
+#define AGENT_MAX_POINTS 256
+// spec of the filler the agent writes when a record wont fit before the end of the ring
+#define AGENT_PAD_RECORD UINT32_MAX
+// function the trampolines call and the variable edb points at the shared memory
+#define AGENT_HIT_FUNC "edb_agent_hit"
+#define AGENT_SHARED_VAR "edb_agent_shared"
+
+// Something a fast tracepoint collects, resolved so the agent only has to copy it
+typedef struct AgentItem {
+	uint8_t kind;
+	// offset of the register in the saved struct user_regs_struct
+	uint16_t reg_offset;
+	uint32_t len;
+	// address of a fixed memory item with the load bias already added
+	uint64_t addr;
+} AgentItem;
+
+// A tracepoint served by the agent
+typedef struct AgentPoint {
+	// trace spec the records are decoded with
+	uint32_t spec;
+	uint32_t record_size;
+	uint32_t item_count;
+	// every hit including ones dropped while the ring was full
+	uint64_t hits;
+	AgentItem items[MAX_TRACE_ITEMS];
+} AgentPoint;
+
+// The agent adds records at head and edb takes them from tail. Both only ever grow so the
+// ring holds head - tail bytes starting at tail % capacity. Records are in the TraceRecord
+// format with the raw time stamp counter in place of the time, and are never split across
+// the end of the ring.
+typedef struct AgentShared {
+	uint64_t magic;
+	// the tracee, which the agent reads memory items from
+	int32_t pid;
+	// held by the agent while it adds a record
+	uint32_t lock;
+	uint64_t capacity;
+	uint64_t head;
+	uint64_t tail;
+	// hits that werent recorded because the ring was full or busy
+	uint64_t dropped;
+	AgentPoint points[AGENT_MAX_POINTS];
+	uint8_t ring[];
+} AgentShared;
+
+#endif
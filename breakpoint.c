@@ -1,106 +1,685 @@
 #include <stdlib.h>
 #include <errno.h>
-#include <sys/ptrace.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "breakpoint.h"
 #include "logger.h"
-#include "utils.h"
 
 // the x86 opcode for int3
 #define int_3 0xCC
 
-BreakPoint *new_bp(int pid, BreakPointType type, unsigned int break_pos)
+#define INITIAL_CAPACITY 64
+
+// Nearby breakpoints are patched with a single read and write of the memory between them.
+// Spans are capped so that sparse breakpoints dont drag in large amounts of unrelated memory.
+#define MAX_SPAN_GAP 64
+#define MAX_SPAN_SIZE 4096
+
+// Creates an empty breakpoint store
+BreakPointStore *new_bp_store()
 {
-    BreakPoint *bp = (BreakPoint *)malloc(sizeof(BreakPoint));
-    if (bp == NULL)
+    BreakPointStore *store = (BreakPointStore *)calloc(1, sizeof(BreakPointStore));
+    if (store == NULL)
     {
-        logger(ERROR, "Failed to allocate heap memory for breakpoint. ERRNO: %d", errno);
+        logger(ERROR, "Failed to allocate heap memory for breakpoints. ERRNO: %d", errno);
         return NULL;
     }
-    bp->enabled = false;
-    bp->type = type;
-    bp->pos = break_pos;
-    bp->pid = pid;
-    return bp;
+
+    store->index = new_addr_map();
+    if (store->index == NULL)
+    {
+        free(store);
+        return NULL;
+    }
+    return store;
+}
+
+// Frees the store. The breakpoints are not removed from the tracee.
+void free_bp_store(BreakPointStore *store)
+{
+    free(store->addrs);
+    free(store->saved_bytes);
+    free(store->flags);
+    for (size_t i = 0; i < store->count; i++)
+    {
+        bp_set_condition(store, i, NULL);
+        free(store->stats[i]);
+    }
+    free(store->conditions);
+    free(store->ids);
+    free(store->hit_counts);
+    free(store->ignore_counts);
+    free(store->stats);
+    free(store->trace_specs);
+    free_addr_map(store->index);
+    free(store);
+}
+
+// Returns the slot of the breakpoint at the given address or -1 if there isnt one
+long bp_find(BreakPointStore *store, uint64_t addr)
+{
+    // slots are stored off by one as the map cant hold NULL
+    uintptr_t slot = (uintptr_t)am_get(store->index, addr);
+    return (long)slot - 1;
 }
 
-// allows the program to stop when reaching the given instruction
-int enable(BreakPoint *bp)
+// Returns the slot of the breakpoint with the given id or -1 if there isnt one
+long bp_find_id(BreakPointStore *store, uint32_t id)
 {
-    switch (bp->type)
+    for (size_t i = 0; i < store->count; i++)
     {
-    case ADDR:
-        // get the instruction at the specified address
-        ErrResult peek_res = ptrace_with_error(PTRACE_PEEKDATA, bp->pid, (void *)bp->pos, NULL);
-        if (!peek_res.success)
+        if (store->ids[i] == id)
         {
-            logger(ERROR, "Failed to get instruction at breakpoint %d", bp->pos);
-            return -1;
-        };
+            return (long)i;
+        }
+    }
+    return -1;
+}
 
-        unsigned long instruction = (unsigned long)peek_res.val;
+// Makes sure there is room for at least count more breakpoints
+static int reserve(BreakPointStore *store, size_t count)
+{
+    if (store->count + count <= store->capacity)
+    {
+        return 0;
+    }
 
-        // save the first byte of the instruction so we can restore it later
-        bp->saved_data = (char)(instruction & (unsigned long)0xff);
+    size_t capacity = store->capacity == 0 ? INITIAL_CAPACITY : store->capacity;
+    while (capacity < store->count + count)
+    {
+        capacity *= 2;
+    }
 
-        // insert the interrupt into the instruction
-        unsigned long int3_instruction = ((instruction & ~0xff) | (unsigned long)int_3);
-        logger(DEBUG, "Inserting breakpoint at %p. Editing instruction %p -> %p", (void *)bp->pos, (void *)instruction, (void *)int3_instruction);
+    uint64_t *addrs = realloc(store->addrs, capacity * sizeof(uint64_t));
+    if (addrs == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory for breakpoints. ERRNO: %d", errno);
+        return -1;
+    }
+    store->addrs = addrs;
 
-        ErrResult poke_res = ptrace_with_error(PTRACE_POKEDATA, bp->pid, (void *)bp->pos, (void *)int3_instruction);
-        if (!poke_res.success)
+    uint8_t *saved_bytes = realloc(store->saved_bytes, capacity);
+    if (saved_bytes == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory for breakpoints. ERRNO: %d", errno);
+        return -1;
+    }
+    store->saved_bytes = saved_bytes;
+
+    uint8_t *flags = realloc(store->flags, capacity);
+    if (flags == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory for breakpoints. ERRNO: %d", errno);
+        return -1;
+    }
+    store->flags = flags;
+
+    Condition **conditions = realloc(store->conditions, capacity * sizeof(Condition *));
+    if (conditions == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory for breakpoints. ERRNO: %d", errno);
+        return -1;
+    }
+    store->conditions = conditions;
+
+    uint32_t *ids = realloc(store->ids, capacity * sizeof(uint32_t));
+    if (ids == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory for breakpoints. ERRNO: %d", errno);
+        return -1;
+    }
+    store->ids = ids;
+
+    uint64_t *hit_counts = realloc(store->hit_counts, capacity * sizeof(uint64_t));
+    if (hit_counts == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory for breakpoints. ERRNO: %d", errno);
+        return -1;
+    }
+    store->hit_counts = hit_counts;
+
+    uint64_t *ignore_counts = realloc(store->ignore_counts, capacity * sizeof(uint64_t));
+    if (ignore_counts == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory for breakpoints. ERRNO: %d", errno);
+        return -1;
+    }
+    store->ignore_counts = ignore_counts;
+
+    BreakPointStats **stats = realloc(store->stats, capacity * sizeof(BreakPointStats *));
+    if (stats == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory for breakpoints. ERRNO: %d", errno);
+        return -1;
+    }
+    store->stats = stats;
+
+    uint32_t *trace_specs = realloc(store->trace_specs, capacity * sizeof(uint32_t));
+    if (trace_specs == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory for breakpoints. ERRNO: %d", errno);
+        return -1;
+    }
+    store->trace_specs = trace_specs;
+
+    store->capacity = capacity;
+    return 0;
+}
+
+static int compare_addrs(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// A breakpoint's address paired with its slot so slots can be visited in address order
+typedef struct SlotAddr {
+    uint64_t addr;
+    size_t slot;
+} SlotAddr;
+
+static int compare_slot_addrs(const void *a, const void *b)
+{
+    return compare_addrs(&((const SlotAddr *)a)->addr, &((const SlotAddr *)b)->addr);
+}
+
+// Writes new_bytes[i] to addrs[i] for each of the sorted addresses, storing the byte that was
+// there in old_bytes[i] when old_bytes isnt NULL. Nearby addresses are grouped into spans and
+// every span is read in one batched call then written back with one write each. If a write
+// fails every span is put back as it was so no patched byte is left behind.
+static int patch_bytes(TraceeMem *mem, const uint64_t *addrs, const uint8_t *new_bytes, uint8_t *old_bytes, size_t count)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    MemRange *spans = (MemRange *)malloc(count * sizeof(MemRange));
+    if (spans == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory for patching. ERRNO: %d", errno);
+        return -1;
+    }
+
+    // group the addresses into spans
+    size_t span_count = 0;
+    size_t total_size = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (span_count > 0)
         {
-            logger(ERROR, "Failed to insert interrupt at breakpoint %d", bp->pos);
-            return -1;
-        };
+            MemRange *span = &spans[span_count - 1];
+            uint64_t span_end = span->addr + span->len;
+            if (addrs[i] - span_end < MAX_SPAN_GAP && addrs[i] + 1 - span->addr <= MAX_SPAN_SIZE)
+            {
+                total_size += addrs[i] + 1 - span_end;
+                span->len = addrs[i] + 1 - span->addr;
+                continue;
+            }
+        }
+
+        spans[span_count].addr = addrs[i];
+        spans[span_count].len = 1;
+        span_count++;
+        total_size++;
+    }
+
+    // the original contents of the spans are kept after the patched copy
+    uint8_t *buf = (uint8_t *)malloc(2 * total_size);
+    if (buf == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory for patching. ERRNO: %d", errno);
+        free(spans);
+        return -1;
+    }
+
+    size_t offset = 0;
+    for (size_t i = 0; i < span_count; i++)
+    {
+        spans[i].buf = buf + offset;
+        offset += spans[i].len;
+    }
+
+    int res = read_memory_v(mem, spans, (int)span_count);
+    if (res == 0)
+    {
+        memcpy(buf + total_size, buf, total_size);
+
+        // apply the patches to the local copy of each span
+        size_t span = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            while (addrs[i] >= spans[span].addr + spans[span].len)
+            {
+                span++;
+            }
+            uint8_t *byte = (uint8_t *)spans[span].buf + (addrs[i] - spans[span].addr);
+            if (old_bytes != NULL)
+            {
+                old_bytes[i] = *byte;
+            }
+            *byte = new_bytes[i];
+        }
+
+        logger(DEBUG, "Patching %d bytes using %d writes", (int)count, (int)span_count);
+        res = write_memory_v(mem, spans, (int)span_count);
+        if (res == -1)
+        {
+            for (size_t i = 0; i < span_count; i++)
+            {
+                spans[i].buf = (uint8_t *)spans[i].buf + total_size;
+            }
+            if (write_memory_v(mem, spans, (int)span_count) == -1)
+            {
+                logger(ERROR, "Failed to undo a partly written patch at %p.", (void *)addrs[0]);
+            }
+        }
+    }
+
+    free(buf);
+    free(spans);
+    return res;
+}
+
+// Adds a breakpoint with the given flags at each of the given addresses and writes them into
+// the tracee in batches. Addresses that already have a breakpoint are skipped. Returns the
+// number of breakpoints added or -1 for errors.
+long bp_insert_bulk(BreakPointStore *store, TraceeMem *mem, const uint64_t *addrs, size_t count, uint8_t flags)
+{
+    uint64_t *new_addrs = (uint64_t *)malloc(count * sizeof(uint64_t));
+    uint8_t *patch = (uint8_t *)malloc(count);
+    if (new_addrs == NULL || patch == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory for breakpoints. ERRNO: %d", errno);
+        free(new_addrs);
+        free(patch);
+        return -1;
+    }
+
+    memcpy(new_addrs, addrs, count * sizeof(uint64_t));
+    qsort(new_addrs, count, sizeof(uint64_t), compare_addrs);
+
+    // drop duplicates and addresses that already have a breakpoint
+    size_t new_count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if ((new_count > 0 && new_addrs[new_count - 1] == new_addrs[i]) || bp_find(store, new_addrs[i]) != -1)
+        {
+            continue;
+        }
+        new_addrs[new_count] = new_addrs[i];
+        patch[new_count] = int_3;
+        new_count++;
+    }
+
+    long res = -1;
+    if (reserve(store, new_count) == 0 &&
+        patch_bytes(mem, new_addrs, patch, store->saved_bytes + store->count, new_count) == 0)
+    {
+        for (size_t i = 0; i < new_count; i++)
+        {
+            size_t slot = store->count + i;
+            store->addrs[slot] = new_addrs[i];
+            store->flags[slot] = flags | BP_ENABLED;
+            store->conditions[slot] = NULL;
+            store->ids[slot] = ++store->next_id;
+            store->hit_counts[slot] = 0;
+            store->ignore_counts[slot] = 0;
+            store->stats[slot] = NULL;
+            store->trace_specs[slot] = 0;
+            if (am_set(store->index, new_addrs[i], (void *)(uintptr_t)(slot + 1)) == -1)
+            {
+                // keep the breakpoints that made it into the index and take the int3s of the
+                // rest back out so none is left in the tracee untracked
+                logger(ERROR, "Failed to index breakpoint at %p", (void *)new_addrs[i]);
+                if (patch_bytes(mem, new_addrs + i, store->saved_bytes + slot, NULL, new_count - i) == -1)
+                {
+                    logger(ERROR, "Failed to remove breakpoints that couldnt be indexed.");
+                }
+                new_count = i;
+                break;
+            }
+        }
+        store->count += new_count;
+        res = (long)new_count;
+    }
 
-        break;
+    free(new_addrs);
+    free(patch);
+    return res;
+}
+
+// Moves the last breakpoint into the given slot
+static void remove_slot(BreakPointStore *store, size_t slot)
+{
+    am_remove(store->index, store->addrs[slot]);
+    bp_set_condition(store, slot, NULL);
+    free(store->stats[slot]);
+
+    size_t last = store->count - 1;
+    if (slot != last)
+    {
+        store->addrs[slot] = store->addrs[last];
+        store->saved_bytes[slot] = store->saved_bytes[last];
+        store->flags[slot] = store->flags[last];
+        store->conditions[slot] = store->conditions[last];
+        store->ids[slot] = store->ids[last];
+        store->hit_counts[slot] = store->hit_counts[last];
+        store->ignore_counts[slot] = store->ignore_counts[last];
+        store->stats[slot] = store->stats[last];
+        store->trace_specs[slot] = store->trace_specs[last];
+        am_set(store->index, store->addrs[slot], (void *)(uintptr_t)(slot + 1));
+    }
+    store->count--;
+}
+
+// Removes the breakpoints at each of the given addresses restoring the original
+// instructions in batches. Unknown addresses are skipped. Returns the number of
+// breakpoints removed or -1 for errors.
+long bp_remove_bulk(BreakPointStore *store, TraceeMem *mem, const uint64_t *addrs, size_t count)
+{
+    uint64_t *restore_addrs = (uint64_t *)malloc(count * sizeof(uint64_t));
+    uint8_t *restore_bytes = (uint8_t *)malloc(count);
+    if (restore_addrs == NULL || restore_bytes == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory for breakpoints. ERRNO: %d", errno);
+        free(restore_addrs);
+        free(restore_bytes);
+        return -1;
+    }
+
+    memcpy(restore_addrs, addrs, count * sizeof(uint64_t));
+    qsort(restore_addrs, count, sizeof(uint64_t), compare_addrs);
+
+    // only breakpoints that are currently written to the tracee need restoring
+    size_t restore_count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        long slot = bp_find(store, restore_addrs[i]);
+        if (slot == -1 || !(store->flags[slot] & BP_ENABLED))
+        {
+            continue;
+        }
+        restore_addrs[restore_count] = restore_addrs[i];
+        restore_bytes[restore_count] = store->saved_bytes[slot];
+        restore_count++;
     }
 
-    bp->enabled = true;
+    long res = -1;
+    if (patch_bytes(mem, restore_addrs, restore_bytes, NULL, restore_count) == 0)
+    {
+        res = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            long slot = bp_find(store, addrs[i]);
+            if (slot != -1)
+            {
+                remove_slot(store, (size_t)slot);
+                res++;
+            }
+        }
+    }
+
+    free(restore_addrs);
+    free(restore_bytes);
+    return res;
+}
+
+// Replaces the index with one built from the current addresses
+static int rebuild_index(BreakPointStore *store)
+{
+    AddrMap *index = new_addr_map();
+    if (index == NULL)
+    {
+        return -1;
+    }
 
+    for (size_t i = 0; i < store->count; i++)
+    {
+        if (am_set(index, store->addrs[i], (void *)(uintptr_t)(i + 1)) == -1)
+        {
+            free_addr_map(index);
+            return -1;
+        }
+    }
+
+    free_addr_map(store->index);
+    store->index = index;
     return 0;
 }
 
-// Disables the given breakpoint. Returns 1 if the breakpoint is already disabled.
-// Returns -1 for errors.
-int disable(BreakPoint *bp)
+// Installs every breakpoint into a new run of the program. The addresses are moved by
+// delta if the program was loaded somewhere else and the original bytes are read again
+// from the new tracee. Fast tracepoints go back to being int3s. Returns the number of
+// breakpoints installed or -1 for errors.
+long bp_rearm_all(BreakPointStore *store, TraceeMem *mem, int64_t delta)
 {
-    if (!bp->enabled)
+    if (store->count == 0)
     {
-        return 1;
+        return 0;
     }
 
-    // get the edited instruction
-    ErrResult peek_res = ptrace_with_error(PTRACE_PEEKDATA, bp->pid, (void *)bp->pos, NULL);
-    if (!peek_res.success)
+    SlotAddr *order = (SlotAddr *)malloc(store->count * sizeof(SlotAddr));
+    uint64_t *addrs = (uint64_t *)malloc(store->count * sizeof(uint64_t));
+    uint8_t *patch = (uint8_t *)malloc(store->count);
+    uint8_t *saved = (uint8_t *)malloc(store->count);
+    if (order == NULL || addrs == NULL || patch == NULL || saved == NULL)
     {
-        logger(ERROR, "Failed to get instruction at breakpoint %d", bp->pos);
+        logger(ERROR, "Failed to allocate heap memory for breakpoints. ERRNO: %d", errno);
+        free(order);
+        free(addrs);
+        free(patch);
+        free(saved);
         return -1;
-    };
+    }
 
-    unsigned long current_instruction = (unsigned long)peek_res.val;
+    for (size_t i = 0; i < store->count; i++)
+    {
+        order[i].addr = store->addrs[i] + delta;
+        order[i].slot = i;
+    }
+    qsort(order, store->count, sizeof(SlotAddr), compare_slot_addrs);
 
-    // zero the last byte containing our injected int3 
-    unsigned long current_intstruction_zeroed = (unsigned long)(current_instruction & ~0xff);
+    for (size_t i = 0; i < store->count; i++)
+    {
+        addrs[i] = order[i].addr;
+        patch[i] = int_3;
+    }
 
-    // restore the saved byte of the instruction making sure to first zero all the unessecary bits
-    unsigned long restored_instruction = current_intstruction_zeroed | ((unsigned long)bp->saved_data & 0xff);
+    // the new tracee hasnt run yet so every int3 goes in with one batched read and write
+    long res = -1;
+    if (patch_bytes(mem, addrs, patch, saved, store->count) == 0)
+    {
+        for (size_t i = 0; i < store->count; i++)
+        {
+            size_t slot = order[i].slot;
+            store->addrs[slot] = order[i].addr;
+            store->saved_bytes[slot] = saved[i];
+            // the new tracee doesnt have the agent the jumps went to
+            store->flags[slot] = (store->flags[slot] & ~BP_FAST) | BP_ENABLED;
+            // the gap between runs isnt a time between hits
+            if (store->stats[slot] != NULL)
+            {
+                store->stats[slot]->last_hit_ns = 0;
+            }
+        }
+        res = delta != 0 && rebuild_index(store) == -1 ? -1 : (long)store->count;
+    }
 
-    logger(DEBUG, "Restoring instruction at breakpoint: %p", (void *) restored_instruction);
+    free(order);
+    free(addrs);
+    free(patch);
+    free(saved);
+    return res;
+}
 
-    // write back the restored instruction
-    ErrResult poke_res = ptrace_with_error(PTRACE_POKEDATA, bp->pid, (void *)bp->pos, (void *)restored_instruction);
-    if (!poke_res.success)
+// Restores the original instruction under every int3 written to the tracee in one batch.
+// The breakpoints are kept, disabled, so they can be installed again with bp_rearm_all.
+// Returns the number of breakpoints restored or -1 for errors.
+long bp_disarm_all(BreakPointStore *store, TraceeMem *mem)
+{
+    if (store->count == 0)
     {
-        logger(ERROR, "Failed to restore instruction at address %d", bp->pos);
+        return 0;
+    }
+
+    SlotAddr *order = (SlotAddr *)malloc(store->count * sizeof(SlotAddr));
+    uint64_t *addrs = (uint64_t *)malloc(store->count * sizeof(uint64_t));
+    uint8_t *restore = (uint8_t *)malloc(store->count);
+    if (order == NULL || addrs == NULL || restore == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory for breakpoints. ERRNO: %d", errno);
+        free(order);
+        free(addrs);
+        free(restore);
         return -1;
-    };
+    }
 
-    bp->enabled = false;
-    bp->saved_data = 0;
+    size_t enabled = 0;
+    for (size_t i = 0; i < store->count; i++)
+    {
+        if (store->flags[i] & BP_ENABLED)
+        {
+            order[enabled].addr = store->addrs[i];
+            order[enabled].slot = i;
+            enabled++;
+        }
+    }
+    qsort(order, enabled, sizeof(SlotAddr), compare_slot_addrs);
 
+    for (size_t i = 0; i < enabled; i++)
+    {
+        addrs[i] = order[i].addr;
+        restore[i] = store->saved_bytes[order[i].slot];
+    }
+
+    long res = -1;
+    if (patch_bytes(mem, addrs, restore, NULL, enabled) == 0)
+    {
+        for (size_t i = 0; i < enabled; i++)
+        {
+            store->flags[order[i].slot] &= ~BP_ENABLED;
+        }
+        res = (long)enabled;
+    }
+
+    free(order);
+    free(addrs);
+    free(restore);
+    return res;
+}
+
+// Forgets every breakpoint without touching the tracee
+int bp_clear(BreakPointStore *store)
+{
+    for (size_t i = 0; i < store->count; i++)
+    {
+        bp_set_condition(store, i, NULL);
+        free(store->stats[i]);
+    }
+    store->count = 0;
+    return rebuild_index(store);
+}
+
+// allows the program to stop when reaching the breakpoint in the given slot
+int bp_enable(BreakPointStore *store, TraceeMem *mem, size_t slot)
+{
+    if (store->flags[slot] & BP_ENABLED)
+    {
+        return 0;
+    }
+
+    // the original byte was saved when the breakpoint was installed so a single write is enough
+    uint8_t int3_instruction = int_3;
+    logger(DEBUG, "Inserting breakpoint at %p", (void *)store->addrs[slot]);
+    if (write_memory(mem, store->addrs[slot], &int3_instruction, 1) == -1)
+    {
+        logger(ERROR, "Failed to insert interrupt at breakpoint %p", (void *)store->addrs[slot]);
+        return -1;
+    }
+
+    store->flags[slot] |= BP_ENABLED;
+    return 0;
+}
+
+// Disables the breakpoint in the given slot. Returns 1 if it is already disabled.
+int bp_disable(BreakPointStore *store, TraceeMem *mem, size_t slot)
+{
+    if (!(store->flags[slot] & BP_ENABLED))
+    {
+        return 1;
+    }
+
+    logger(DEBUG, "Restoring byte %d at breakpoint %p", store->saved_bytes[slot], (void *)store->addrs[slot]);
+    if (write_memory(mem, store->addrs[slot], &store->saved_bytes[slot], 1) == -1)
+    {
+        logger(ERROR, "Failed to restore instruction at address %p", (void *)store->addrs[slot]);
+        return -1;
+    }
+
+    store->flags[slot] &= ~BP_ENABLED;
     return 0;
 }
+
+// Makes the breakpoint in the given slot stop only when the condition is true, taking
+// ownership of it. A NULL condition makes it stop every time.
+void bp_set_condition(BreakPointStore *store, size_t slot, Condition *cond)
+{
+    if (store->conditions[slot] != NULL)
+    {
+        free_condition(store->conditions[slot]);
+    }
+    store->conditions[slot] = cond;
+}
+
+// Returns the histogram bucket for a time in nanoseconds
+static size_t hist_bucket(uint64_t ns)
+{
+    size_t bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+    return bucket < BP_HIST_BUCKETS ? bucket : BP_HIST_BUCKETS - 1;
+}
+
+// Counts a hit on the breakpoint in the given slot at the given monotonic time, recording
+// the time since its last hit. Returns -1 for errors.
+int bp_record_hit(BreakPointStore *store, size_t slot, uint64_t now_ns)
+{
+    store->hit_counts[slot]++;
+
+    BreakPointStats *stats = store->stats[slot];
+    if (stats == NULL)
+    {
+        stats = (BreakPointStats *)calloc(1, sizeof(BreakPointStats));
+        if (stats == NULL)
+        {
+            logger(ERROR, "Failed to allocate heap memory for breakpoint stats. ERRNO: %d", errno);
+            return -1;
+        }
+        store->stats[slot] = stats;
+    }
+
+    if (stats->last_hit_ns != 0)
+    {
+        uint64_t interval = now_ns - stats->last_hit_ns;
+        stats->interval_total_ns += interval;
+        stats->interval_count++;
+        stats->interval_hist[hist_bucket(interval)]++;
+    }
+    stats->last_hit_ns = now_ns;
+    return 0;
+}
+
+// Records the time the debugger spent handling a hit on the breakpoint in the given slot
+void bp_record_overhead(BreakPointStore *store, size_t slot, uint64_t overhead_ns)
+{
+    BreakPointStats *stats = store->stats[slot];
+    if (stats == NULL)
+    {
+        return;
+    }
+
+    stats->overhead_total_ns += overhead_ns;
+    stats->overhead_count++;
+    stats->overhead_hist[hist_bucket(overhead_ns)]++;
+}
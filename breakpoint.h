@@ -2,37 +2,118 @@
 #define BP_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-#define MAX_BREAKPOINTS 64
+#include "addr_map.h"
+#include "condition.h"
+#include "mem.h"
 
-typedef enum BreakPointType {
-	LINE,
-	ADDR,
-} BreakPointType;
+// Per breakpoint flags
+// The int3 is currently written to the tracee
+#define BP_ENABLED 0x01
+// The breakpoint is removed the first time it is hit rather than being stepped over
+#define BP_ONE_SHOT 0x02
+// A tracepoint whose site jumps to the agent in the tracee instead of holding an int3
+#define BP_FAST 0x04
 
-// Information about the break point. Only the fields that correspond
-// the the appropriate type will be filled.
-typedef struct BreakPoint {
-	// process id we are inserting the breakpoint for
-	int pid;
-	BreakPointType type;
-	// The position in the program we should break at. Can either be
-	// a line number or a memory address depending on the type.
-	unsigned int pos;
-	// Is the breakpoint set?
-	bool enabled;
-	// The last byte of the instruction that has been temporarily replaced 
-    // with the an interrupt
-	char saved_data;
+// log2 buckets of nanoseconds, bucket i counts times in [2^i, 2^(i+1)) ns
+#define BP_HIST_BUCKETS 40
 
-} BreakPoint;
+// Timing of a breakpoint's hits. Only allocated once the breakpoint is hit as it is
+// much larger than the rest of a breakpoint.
+typedef struct BreakPointStats {
+    // monotonic time of the last hit, 0 before the first hit of a run
+    uint64_t last_hit_ns;
+    uint64_t interval_total_ns;
+    uint64_t interval_count;
+    // wall time between consecutive hits
+    uint32_t interval_hist[BP_HIST_BUCKETS];
+    uint64_t overhead_total_ns;
+    uint64_t overhead_count;
+    // time the debugger spent handling each hit while the tracee was stopped
+    uint32_t overhead_hist[BP_HIST_BUCKETS];
+} BreakPointStats;
 
-BreakPoint * new_bp(int pid, BreakPointType type, unsigned int break_pos);
+// Software breakpoints stored as parallel arrays indexed by slot so that the
+// fields touched on every hit stay densely packed even with 100k+ breakpoints.
+// Slots are not stable, removing a breakpoint moves the last one into its slot.
+typedef struct BreakPointStore {
+    size_t count;
+    size_t capacity;
+    // address the int3 is written to
+    uint64_t *addrs;
+    // the first byte of the instruction that has been replaced with the interrupt
+    uint8_t *saved_bytes;
+    uint8_t *flags;
+    // number the user refers to the breakpoint by. Unlike slots these dont change.
+    uint32_t *ids;
+    // times the tracee trapped on the breakpoint
+    uint64_t *hit_counts;
+    // hits with a true condition still to be skipped without stopping
+    uint64_t *ignore_counts;
+    // NULL until the breakpoint is first hit
+    BreakPointStats **stats;
+    // index + 1 of the trace spec of a tracepoint, which records what it collects and
+    // carries on rather than stopping. 0 for other breakpoints.
+    uint32_t *trace_specs;
+    // compiled condition the tracee only stops for when true, NULL to always stop
+    Condition **conditions;
+    // maps an address to its slot + 1
+    AddrMap *index;
+    uint32_t next_id;
+} BreakPointStore;
 
-// allows the program to stop when reaching the given instruction
-int enable(BreakPoint * bp);
+// Creates an empty breakpoint store
+BreakPointStore *new_bp_store();
 
-// disables the given breakpoint
-int disable(BreakPoint *bp);
+// Frees the store. The breakpoints are not removed from the tracee.
+void free_bp_store(BreakPointStore *store);
 
-#endif
\ No newline at end of file
+// Returns the slot of the breakpoint at the given address or -1 if there isnt one
+long bp_find(BreakPointStore *store, uint64_t addr);
+
+// Returns the slot of the breakpoint with the given id or -1 if there isnt one
+long bp_find_id(BreakPointStore *store, uint32_t id);
+
+// Adds a breakpoint with the given flags at each of the given addresses and writes them into
+// the tracee in batches. Addresses that already have a breakpoint are skipped. Returns the
+// number of breakpoints added or -1 for errors.
+long bp_insert_bulk(BreakPointStore *store, TraceeMem *mem, const uint64_t *addrs, size_t count, uint8_t flags);
+
+// Removes the breakpoints at each of the given addresses restoring the original
+// instructions in batches. Unknown addresses are skipped. Returns the number of
+// breakpoints removed or -1 for errors.
+long bp_remove_bulk(BreakPointStore *store, TraceeMem *mem, const uint64_t *addrs, size_t count);
+
+// Installs every breakpoint into a new run of the program. The addresses are moved by
+// delta if the program was loaded somewhere else and the original bytes are read again
+// from the new tracee. Fast tracepoints go back to being int3s. Returns the number of breakpoints installed or -1 for errors.
+long bp_rearm_all(BreakPointStore *store, TraceeMem *mem, int64_t delta);
+
+// Restores the original instruction under every int3 written to the tracee in one batch.
+// The breakpoints are kept, disabled, so they can be installed again with bp_rearm_all.
+// Returns the number of breakpoints restored or -1 for errors.
+long bp_disarm_all(BreakPointStore *store, TraceeMem *mem);
+
+// Forgets every breakpoint without touching the tracee
+int bp_clear(BreakPointStore *store);
+
+// Makes the breakpoint in the given slot stop only when the condition is true, taking
+// ownership of it. A NULL condition makes it stop every time.
+void bp_set_condition(BreakPointStore *store, size_t slot, Condition *cond);
+
+// Counts a hit on the breakpoint in the given slot at the given monotonic time, recording
+// the time since its last hit. Returns -1 for errors.
+int bp_record_hit(BreakPointStore *store, size_t slot, uint64_t now_ns);
+
+// Records the time the debugger spent handling a hit on the breakpoint in the given slot
+void bp_record_overhead(BreakPointStore *store, size_t slot, uint64_t overhead_ns);
+
+// allows the program to stop when reaching the breakpoint in the given slot
+int bp_enable(BreakPointStore *store, TraceeMem *mem, size_t slot);
+
+// Disables the breakpoint in the given slot. Returns 1 if it is already disabled.
+int bp_disable(BreakPointStore *store, TraceeMem *mem, size_t slot);
+
+#endif
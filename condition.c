@@ -0,0 +1,633 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "condition.h"
+#include "logger.h"
+#include "session.h"
+
+// deepest the evaluation stack can get, enough for any condition typed at the prompt
+#define MAX_STACK_DEPTH 32
+// loads from fixed addresses batched into one read, later ones are read when reached
+#define MAX_STATIC_LOADS 16
+#define MAX_NAME_SIZE 256
+#define INITIAL_CODE_SIZE 16
+
+// symbol types whose name means the address rather than the value
+#define STT_FUNC 2
+#define STT_GNU_IFUNC 10
+
+typedef enum CondOp {
+	// push consts[arg]
+	OP_CONST,
+	// push consts[arg] plus the load bias
+	OP_SYM_ADDR,
+	// push the register arg
+	OP_REG,
+	// push the value of loads[arg]
+	OP_LOAD_STATIC,
+	// pop an address and push the size bytes there
+	OP_LOAD,
+	OP_NEG,
+	OP_NOT,
+	OP_BIT_NOT,
+	OP_ADD,
+	OP_SUB,
+	OP_MUL,
+	OP_DIV,
+	OP_MOD,
+	OP_SHL,
+	OP_SHR,
+	OP_LT,
+	OP_LE,
+	OP_GT,
+	OP_GE,
+	OP_EQ,
+	OP_NE,
+	OP_BIT_AND,
+	OP_BIT_XOR,
+	OP_BIT_OR,
+	// pop a value, if it is zero push 0 and jump to arg
+	OP_AND_JUMP,
+	// pop a value, if it isnt zero push 1 and jump to arg
+	OP_OR_JUMP,
+	// replace the top of the stack with 0 or 1
+	OP_BOOL,
+} CondOp;
+
+typedef struct BinaryOp {
+	const char *text;
+	uint8_t op;
+	int prec;
+} BinaryOp;
+
+// C precedence, higher binds tighter. Longer operators come first so they match before
+// their prefixes.
+static const BinaryOp BINARY_OPS[] = {
+	{"||", OP_OR_JUMP, 1},
+	{"&&", OP_AND_JUMP, 2},
+	{"==", OP_EQ, 6},
+	{"!=", OP_NE, 6},
+	{"<=", OP_LE, 7},
+	{">=", OP_GE, 7},
+	{"<<", OP_SHL, 8},
+	{">>", OP_SHR, 8},
+	{"|", OP_BIT_OR, 3},
+	{"^", OP_BIT_XOR, 4},
+	{"&", OP_BIT_AND, 5},
+	{"<", OP_LT, 7},
+	{">", OP_GT, 7},
+	{"+", OP_ADD, 9},
+	{"-", OP_SUB, 9},
+	{"*", OP_MUL, 10},
+	{"/", OP_DIV, 10},
+	{"%", OP_MOD, 10},
+};
+
+// Explicitly sized memory loads
+typedef struct LoadKeyword {
+	const char *name;
+	uint8_t size;
+} LoadKeyword;
+
+static const LoadKeyword LOAD_KEYWORDS[] = {
+	{"byte", 1},
+	{"word", 2},
+	{"dword", 4},
+	{"qword", 8},
+};
+
+// State while compiling one expression
+typedef struct Compiler {
+	const char *pos;
+	Condition *cond;
+	size_t code_capacity;
+	size_t const_capacity;
+	struct DebugSession *session;
+	// stack depth after the code emitted so far and the most it reached
+	int depth;
+	int max_depth;
+	bool failed;
+} Compiler;
+
+static void parse_binary(Compiler *c, int min_prec);
+
+// Grows a heap array so it can hold one more element. Returns -1 for errors.
+static int grow(void **array, size_t count, size_t *capacity, size_t elem_size)
+{
+	if (count < *capacity)
+	{
+		return 0;
+	}
+
+	size_t new_capacity = *capacity == 0 ? INITIAL_CODE_SIZE : *capacity * 2;
+	void *grown = realloc(*array, new_capacity * elem_size);
+	if (grown == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for condition. %s", strerror(errno));
+		return -1;
+	}
+	*array = grown;
+	*capacity = new_capacity;
+	return 0;
+}
+
+// Logs a syntax error at the current position, only the first error is reported
+static void fail(Compiler *c, const char *msg)
+{
+	if (!c->failed)
+	{
+		logger(WARN, "Bad condition at \"%s\". %s", (char *)c->pos, (char *)msg);
+	}
+	c->failed = true;
+}
+
+// Appends an instruction that changes the stack depth by the given amount. Returns its
+// index or -1 for errors.
+static long emit(Compiler *c, uint8_t op, uint8_t size, uint32_t arg, int depth_change)
+{
+	if (c->failed || grow((void **)&c->cond->code, c->cond->len, &c->code_capacity, sizeof(CondInsn)) == -1)
+	{
+		c->failed = true;
+		return -1;
+	}
+
+	c->depth += depth_change;
+	if (c->depth > c->max_depth)
+	{
+		c->max_depth = c->depth;
+	}
+
+	CondInsn *insn = &c->cond->code[c->cond->len];
+	insn->op = op;
+	insn->size = size;
+	insn->arg = arg;
+	return (long)c->cond->len++;
+}
+
+// Pushes a constant, or the address of a symbol if relocated is set
+static void emit_const(Compiler *c, int64_t val, bool relocated)
+{
+	if (c->failed || grow((void **)&c->cond->consts, c->cond->const_count, &c->const_capacity, sizeof(int64_t)) == -1)
+	{
+		c->failed = true;
+		return;
+	}
+
+	c->cond->consts[c->cond->const_count] = val;
+	emit(c, relocated ? OP_SYM_ADDR : OP_CONST, 0, (uint32_t)c->cond->const_count++, 1);
+}
+
+// Loads size bytes from the address on top of the stack. A load from an address known now
+// is turned into a static load so it can be batched with the others.
+static void emit_load(Compiler *c, uint8_t size)
+{
+	Condition *cond = c->cond;
+	CondInsn *last = cond->len > 0 ? &cond->code[cond->len - 1] : NULL;
+	if (c->failed || last == NULL || (last->op != OP_CONST && last->op != OP_SYM_ADDR) || cond->load_count == MAX_STATIC_LOADS)
+	{
+		emit(c, OP_LOAD, size, 0, 0);
+		return;
+	}
+
+	if (cond->loads == NULL)
+	{
+		cond->loads = (StaticLoad *)malloc(MAX_STATIC_LOADS * sizeof(StaticLoad));
+		if (cond->loads == NULL)
+		{
+			logger(ERROR, "Failed to allocate heap memory for condition. %s", strerror(errno));
+			c->failed = true;
+			return;
+		}
+	}
+
+	StaticLoad *load = &cond->loads[cond->load_count];
+	load->addr = (uint64_t)cond->consts[last->arg];
+	load->size = size;
+	load->relocated = last->op == OP_SYM_ADDR;
+
+	last->op = OP_LOAD_STATIC;
+	last->arg = (uint32_t)cond->load_count++;
+}
+
+static void skip_space(Compiler *c)
+{
+	while (isspace((unsigned char)*c->pos))
+	{
+		c->pos++;
+	}
+}
+
+// Reads a name made of letters, digits, '_', '.' and ':' so C++ and local symbols can be
+// named. Returns false if there isnt one.
+static bool read_name(Compiler *c, char *name)
+{
+	size_t len = 0;
+	while (isalnum((unsigned char)c->pos[len]) || c->pos[len] == '_' || c->pos[len] == '.' || c->pos[len] == ':')
+	{
+		len++;
+	}
+
+	if (len == 0 || len >= MAX_NAME_SIZE)
+	{
+		return false;
+	}
+	memcpy(name, c->pos, len);
+	name[len] = '\0';
+	c->pos += len;
+	return true;
+}
+
+// Pushes the value of a global variable, or the address of a function or of a variable
+// too large to load
+static void emit_symbol(Compiler *c, const char *name, bool address_of)
+{
+	SymbolTable *symbols = get_symbols(c->session);
+	const Symbol *symbol = symbols != NULL ? symbol_by_name(symbols, name) : NULL;
+	if (symbol == NULL)
+	{
+		fail(c, "Unknown symbol.");
+		return;
+	}
+
+	emit_const(c, (int64_t)symbol->addr, true);
+
+	bool loadable = symbol->size == 1 || symbol->size == 2 || symbol->size == 4 || symbol->size == 8;
+	if (!address_of && loadable && symbol->type != STT_FUNC && symbol->type != STT_GNU_IFUNC)
+	{
+		emit_load(c, (uint8_t)symbol->size);
+	}
+}
+
+// Parses a number, register, symbol, sized load or bracketed expression
+static void parse_primary(Compiler *c)
+{
+	skip_space(c);
+	char name[MAX_NAME_SIZE];
+
+	if (*c->pos == '(')
+	{
+		c->pos++;
+		parse_binary(c, 0);
+		skip_space(c);
+		if (*c->pos != ')')
+		{
+			fail(c, "Expected ')'.");
+			return;
+		}
+		c->pos++;
+		return;
+	}
+
+	if (isdigit((unsigned char)*c->pos))
+	{
+		char *end;
+		errno = 0;
+		uint64_t val = strtoull(c->pos, &end, 0);
+		if (errno != 0)
+		{
+			fail(c, "Number out of range.");
+			return;
+		}
+		c->pos = end;
+		emit_const(c, (int64_t)val, false);
+		return;
+	}
+
+	if (*c->pos == '$')
+	{
+		c->pos++;
+		Reg reg;
+		if (!read_name(c, name) || find_reg_by_name(name, &reg) == -1)
+		{
+			fail(c, "Unknown register.");
+			return;
+		}
+		emit(c, OP_REG, 0, (uint32_t)reg, 1);
+		return;
+	}
+
+	if (!read_name(c, name))
+	{
+		fail(c, "Expected a value.");
+		return;
+	}
+
+	skip_space(c);
+	for (size_t i = 0; i < sizeof(LOAD_KEYWORDS) / sizeof(LoadKeyword); i++)
+	{
+		if (*c->pos == '[' && strcmp(name, LOAD_KEYWORDS[i].name) == 0)
+		{
+			c->pos++;
+			parse_binary(c, 0);
+			skip_space(c);
+			if (*c->pos != ']')
+			{
+				fail(c, "Expected ']'.");
+				return;
+			}
+			c->pos++;
+			emit_load(c, LOAD_KEYWORDS[i].size);
+			return;
+		}
+	}
+
+	emit_symbol(c, name, false);
+}
+
+// Parses an expression with any prefix operators
+static void parse_unary(Compiler *c)
+{
+	skip_space(c);
+	char op = *c->pos;
+	if (op == '-' || op == '!' || op == '~' || op == '*')
+	{
+		c->pos++;
+		parse_unary(c);
+		if (op == '*')
+		{
+			emit_load(c, 8);
+		}
+		else
+		{
+			emit(c, op == '-' ? OP_NEG : op == '!' ? OP_NOT : OP_BIT_NOT, 0, 0, 0);
+		}
+		return;
+	}
+
+	if (op == '&')
+	{
+		c->pos++;
+		skip_space(c);
+		char name[MAX_NAME_SIZE];
+		if (!read_name(c, name))
+		{
+			fail(c, "Expected a symbol after '&'.");
+			return;
+		}
+		emit_symbol(c, name, true);
+		return;
+	}
+
+	parse_primary(c);
+}
+
+// Returns the binary operator at the current position or NULL if there isnt one
+static const BinaryOp *match_binary(Compiler *c)
+{
+	for (size_t i = 0; i < sizeof(BINARY_OPS) / sizeof(BinaryOp); i++)
+	{
+		if (strncmp(c->pos, BINARY_OPS[i].text, strlen(BINARY_OPS[i].text)) == 0)
+		{
+			return &BINARY_OPS[i];
+		}
+	}
+	return NULL;
+}
+
+// Parses operators binding at least as tightly as min_prec using precedence climbing
+static void parse_binary(Compiler *c, int min_prec)
+{
+	parse_unary(c);
+
+	while (!c->failed)
+	{
+		skip_space(c);
+		const BinaryOp *op = match_binary(c);
+		if (op == NULL || op->prec < min_prec)
+		{
+			return;
+		}
+		c->pos += strlen(op->text);
+
+		if (op->op == OP_AND_JUMP || op->op == OP_OR_JUMP)
+		{
+			// the right hand side is skipped once the result is known
+			long jump = emit(c, op->op, 0, 0, -1);
+			parse_binary(c, op->prec + 1);
+			emit(c, OP_BOOL, 0, 0, 0);
+			if (jump != -1)
+			{
+				c->cond->code[jump].arg = (uint32_t)c->cond->len;
+			}
+			continue;
+		}
+
+		parse_binary(c, op->prec + 1);
+		emit(c, op->op, 0, 0, -1);
+	}
+}
+
+// Compiles a C like expression over registers ($rax), constants, global variables by name,
+// their addresses (&name), memory loads (*addr or byte/word/dword/qword[addr]) and the usual
+// arithmetic, comparison and logical operators. Returns NULL for errors.
+Condition *compile_condition(const char *expr, struct DebugSession *session)
+{
+	Condition *cond = (Condition *)calloc(1, sizeof(Condition));
+	if (cond == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for condition. %s", strerror(errno));
+		return NULL;
+	}
+
+	Compiler c = {.pos = expr, .cond = cond, .session = session};
+	cond->source = strdup(expr);
+	if (cond->source == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for condition. %s", strerror(errno));
+		c.failed = true;
+	}
+
+	parse_binary(&c, 0);
+	skip_space(&c);
+	if (*c.pos != '\0')
+	{
+		fail(&c, "Unexpected text.");
+	}
+
+	if (!c.failed && c.max_depth > MAX_STACK_DEPTH)
+	{
+		logger(WARN, "Condition is nested too deeply.");
+		c.failed = true;
+	}
+
+	if (c.failed)
+	{
+		free_condition(cond);
+		return NULL;
+	}
+	return cond;
+}
+
+void free_condition(Condition *cond)
+{
+	free(cond->code);
+	free(cond->consts);
+	free(cond->loads);
+	free(cond->source);
+	free(cond);
+}
+
+// Widens a value loaded from memory treating it as signed
+static int64_t sign_extend(uint64_t val, uint8_t size)
+{
+	int shift = 64 - size * 8;
+	return (int64_t)(val << shift) >> shift;
+}
+
+// Evaluates the condition against the tracee's current stop. Returns -1 if it couldnt be
+// evaluated, such as for a load from an unmapped address.
+int eval_condition(const Condition *cond, RegCache *regs, TraceeMem *mem, uint64_t load_bias, int64_t *result)
+{
+	// every load from a fixed address is fetched with a single read
+	uint64_t loaded[MAX_STATIC_LOADS] = {0};
+	MemRange ranges[MAX_STATIC_LOADS];
+	for (size_t i = 0; i < cond->load_count; i++)
+	{
+		const StaticLoad *load = &cond->loads[i];
+		ranges[i].addr = load->addr + (load->relocated ? load_bias : 0);
+		ranges[i].buf = &loaded[i];
+		ranges[i].len = load->size;
+	}
+	if (cond->load_count > 0 && read_memory_v(mem, ranges, (int)cond->load_count) == -1)
+	{
+		return -1;
+	}
+
+	int64_t stack[MAX_STACK_DEPTH];
+	size_t sp = 0;
+	for (size_t pc = 0; pc < cond->len; pc++)
+	{
+		const CondInsn *insn = &cond->code[pc];
+		// arithmetic is done unsigned so overflow wraps rather than being undefined
+		uint64_t rhs = sp > 0 ? (uint64_t)stack[sp - 1] : 0;
+		uint64_t lhs = sp > 1 ? (uint64_t)stack[sp - 2] : 0;
+		int64_t val;
+
+		switch (insn->op)
+		{
+		case OP_CONST:
+			stack[sp++] = cond->consts[insn->arg];
+			break;
+		case OP_SYM_ADDR:
+			stack[sp++] = (int64_t)((uint64_t)cond->consts[insn->arg] + load_bias);
+			break;
+		case OP_REG:
+		{
+			unsigned long long *reg = get_register(regs, (Reg)insn->arg);
+			if (reg == NULL)
+			{
+				return -1;
+			}
+			stack[sp++] = (int64_t)*reg;
+			break;
+		}
+		case OP_LOAD_STATIC:
+			stack[sp++] = sign_extend(loaded[insn->arg], cond->loads[insn->arg].size);
+			break;
+		case OP_LOAD:
+		{
+			uint64_t word = 0;
+			if (read_memory(mem, rhs, &word, insn->size) == -1)
+			{
+				return -1;
+			}
+			stack[sp - 1] = sign_extend(word, insn->size);
+			break;
+		}
+		case OP_NEG:
+			stack[sp - 1] = (int64_t)(0 - rhs);
+			break;
+		case OP_NOT:
+			stack[sp - 1] = rhs == 0;
+			break;
+		case OP_BIT_NOT:
+			stack[sp - 1] = (int64_t)~rhs;
+			break;
+		case OP_AND_JUMP:
+		case OP_OR_JUMP:
+			sp--;
+			if ((insn->op == OP_AND_JUMP) == (rhs == 0))
+			{
+				stack[sp++] = insn->op == OP_OR_JUMP;
+				pc = insn->arg - 1;
+			}
+			break;
+		case OP_BOOL:
+			stack[sp - 1] = rhs != 0;
+			break;
+		default:
+			switch (insn->op)
+			{
+			case OP_ADD:
+				val = (int64_t)(lhs + rhs);
+				break;
+			case OP_SUB:
+				val = (int64_t)(lhs - rhs);
+				break;
+			case OP_MUL:
+				val = (int64_t)(lhs * rhs);
+				break;
+			case OP_DIV:
+			case OP_MOD:
+				if (rhs == 0)
+				{
+					logger(WARN, "Division by zero in condition.");
+					return -1;
+				}
+				// INT64_MIN / -1 overflows so negate instead
+				if ((int64_t)rhs == -1)
+				{
+					val = insn->op == OP_DIV ? (int64_t)(0 - lhs) : 0;
+				}
+				else
+				{
+					val = insn->op == OP_DIV ? (int64_t)lhs / (int64_t)rhs : (int64_t)lhs % (int64_t)rhs;
+				}
+				break;
+			case OP_SHL:
+				val = (int64_t)(lhs << (rhs & 63));
+				break;
+			case OP_SHR:
+				val = (int64_t)lhs >> (rhs & 63);
+				break;
+			case OP_LT:
+				val = (int64_t)lhs < (int64_t)rhs;
+				break;
+			case OP_LE:
+				val = (int64_t)lhs <= (int64_t)rhs;
+				break;
+			case OP_GT:
+				val = (int64_t)lhs > (int64_t)rhs;
+				break;
+			case OP_GE:
+				val = (int64_t)lhs >= (int64_t)rhs;
+				break;
+			case OP_EQ:
+				val = lhs == rhs;
+				break;
+			case OP_NE:
+				val = lhs != rhs;
+				break;
+			case OP_BIT_AND:
+				val = (int64_t)(lhs & rhs);
+				break;
+			case OP_BIT_XOR:
+				val = (int64_t)(lhs ^ rhs);
+				break;
+			case OP_BIT_OR:
+				val = (int64_t)(lhs | rhs);
+				break;
+			default:
+				logger(ERROR, "Unknown condition op %d.", insn->op);
+				return -1;
+			}
+			stack[--sp - 1] = val;
+			break;
+		}
+	}
+
+	*result = stack[0];
+	return 0;
+}
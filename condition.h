@@ -0,0 +1,54 @@
+#ifndef CONDITION_H
+#define CONDITION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mem.h"
+#include "reg.h"
+
+// One instruction of a compiled condition. What arg holds depends on the op.
+typedef struct CondInsn {
+	uint8_t op;
+	// width in bytes of a memory load
+	uint8_t size;
+	uint32_t arg;
+} CondInsn;
+
+// A memory load whose address is known when the condition is compiled. These are all
+// fetched in one batch before the condition runs.
+typedef struct StaticLoad {
+	uint64_t addr;
+	uint8_t size;
+	// the address is from the symbol table and moves with the load bias
+	bool relocated;
+} StaticLoad;
+
+// A breakpoint condition compiled to bytecode for a small stack machine so hits can be
+// checked without parsing the expression again
+typedef struct Condition {
+	CondInsn *code;
+	size_t len;
+	int64_t *consts;
+	size_t const_count;
+	StaticLoad *loads;
+	size_t load_count;
+	// the expression as the user typed it
+	char *source;
+} Condition;
+
+struct DebugSession;
+
+// Compiles a C like expression over registers ($rax), constants, global variables by name,
+// their addresses (&name), memory loads (*addr or byte/word/dword/qword[addr]) and the usual
+// arithmetic, comparison and logical operators. Returns NULL for errors.
+Condition *compile_condition(const char *expr, struct DebugSession *session);
+
+void free_condition(Condition *cond);
+
+// Evaluates the condition against the tracee's current stop. Returns -1 if it couldnt be
+// evaluated, such as for a load from an unmapped address.
+int eval_condition(const Condition *cond, RegCache *regs, TraceeMem *mem, uint64_t load_bias, int64_t *result);
+
+#endif
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include "coverage.h"
+#include "logger.h"
+
+#define COV_MAGIC "EDBCOV1"
+
+// A site resolved to its source line
+typedef struct CovLine {
+	const char *file;
+	uint32_t line;
+	uint8_t hit;
+} CovLine;
+
+static int compare_sites(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+// Creates a coverage record for the given addresses. Duplicates are dropped.
+Coverage *new_coverage(const uint64_t *sites, size_t count)
+{
+	Coverage *cov = (Coverage *)calloc(1, sizeof(Coverage));
+	uint64_t *sorted = (uint64_t *)malloc((count > 0 ? count : 1) * sizeof(uint64_t));
+	if (cov == NULL || sorted == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for coverage. %s", strerror(errno));
+		free(cov);
+		free(sorted);
+		return NULL;
+	}
+
+	memcpy(sorted, sites, count * sizeof(uint64_t));
+	qsort(sorted, count, sizeof(uint64_t), compare_sites);
+
+	size_t unique = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (unique == 0 || sorted[unique - 1] != sorted[i])
+		{
+			sorted[unique++] = sorted[i];
+		}
+	}
+
+	cov->hits = (uint8_t *)calloc((unique + 7) / 8 + 1, 1);
+	if (cov->hits == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for coverage. %s", strerror(errno));
+		free(sorted);
+		free(cov);
+		return NULL;
+	}
+
+	cov->sites = sorted;
+	cov->count = unique;
+	return cov;
+}
+
+void free_coverage(Coverage *cov)
+{
+	free(cov->sites);
+	free(cov->hits);
+	free(cov);
+}
+
+// Marks the given address as executed. Addresses that arent tracked are ignored.
+void cov_record(Coverage *cov, uint64_t addr)
+{
+	size_t low = 0;
+	size_t high = cov->count;
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+		if (cov->sites[mid] < addr)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	if (low == cov->count || cov->sites[low] != addr)
+	{
+		return;
+	}
+
+	uint8_t bit = 1 << (low % 8);
+	if (!(cov->hits[low / 8] & bit))
+	{
+		cov->hits[low / 8] |= bit;
+		cov->hit_count++;
+	}
+}
+
+// Writes the raw coverage bitmap along with the site addresses it indexes. The file is
+// the magic string, the site count, the sorted sites and then one bit per site.
+int cov_write_bitmap(Coverage *cov, const char *path)
+{
+	FILE *file = fopen(path, "wb");
+	if (file == NULL)
+	{
+		logger(ERROR, "Failed to open %s. %s", (char *)path, strerror(errno));
+		return -1;
+	}
+
+	uint64_t count = cov->count;
+	size_t bitmap_size = (cov->count + 7) / 8;
+	int res = 0;
+	if (fwrite(COV_MAGIC, 1, sizeof(COV_MAGIC), file) != sizeof(COV_MAGIC) ||
+		fwrite(&count, sizeof(count), 1, file) != 1 ||
+		fwrite(cov->sites, sizeof(uint64_t), cov->count, file) != cov->count ||
+		fwrite(cov->hits, 1, bitmap_size, file) != bitmap_size)
+	{
+		logger(ERROR, "Failed to write coverage bitmap. %s", strerror(errno));
+		res = -1;
+	}
+
+	if (fclose(file) != 0)
+	{
+		logger(ERROR, "Failed to close file. %s", strerror(errno));
+		res = -1;
+	}
+	return res;
+}
+
+static int compare_lines(const void *a, const void *b)
+{
+	const CovLine *x = (const CovLine *)a;
+	const CovLine *y = (const CovLine *)b;
+	int file_cmp = strcmp(x->file, y->file);
+	if (file_cmp != 0)
+	{
+		return file_cmp;
+	}
+	return (x->line > y->line) - (x->line < y->line);
+}
+
+// Writes an lcov tracefile using the session's line information to map sites to lines
+int cov_write_lcov(Coverage *cov, DebugSession *session, const char *path)
+{
+	CovLine *lines = (CovLine *)malloc((cov->count > 0 ? cov->count : 1) * sizeof(CovLine));
+	if (lines == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for coverage. %s", strerror(errno));
+		return -1;
+	}
+
+	// decode everything up front so the file names looked up below stay where they are
+	if (session->line_table != NULL && line_table_load_all(session->line_table) == -1)
+	{
+		free(lines);
+		return -1;
+	}
+
+	size_t line_count = 0;
+	for (size_t i = 0; i < cov->count; i++)
+	{
+		LineNumberInfo info;
+		if (lookup_line(session, cov->sites[i], &info) == -1)
+		{
+			continue;
+		}
+		lines[line_count].file = info.file;
+		lines[line_count].line = info.line_number;
+		lines[line_count].hit = (cov->hits[i / 8] >> (i % 8)) & 1;
+		line_count++;
+	}
+
+	if (line_count == 0)
+	{
+		logger(WARN, "No line information for coverage sites, skipping lcov report.");
+		free(lines);
+		return 0;
+	}
+
+	// a line is covered if any of its sites were executed
+	qsort(lines, line_count, sizeof(CovLine), compare_lines);
+
+	FILE *file = fopen(path, "w");
+	if (file == NULL)
+	{
+		logger(ERROR, "Failed to open %s. %s", (char *)path, strerror(errno));
+		free(lines);
+		return -1;
+	}
+
+	fprintf(file, "TN:\n");
+	size_t i = 0;
+	while (i < line_count)
+	{
+		const char *current_file = lines[i].file;
+		int found = 0;
+		int hit = 0;
+		fprintf(file, "SF:%s\n", current_file);
+		while (i < line_count && strcmp(lines[i].file, current_file) == 0)
+		{
+			uint32_t line = lines[i].line;
+			uint8_t line_hit = 0;
+			while (i < line_count && lines[i].line == line && strcmp(lines[i].file, current_file) == 0)
+			{
+				line_hit |= lines[i].hit;
+				i++;
+			}
+			fprintf(file, "DA:%u,%u\n", line, line_hit);
+			found++;
+			hit += line_hit;
+		}
+		fprintf(file, "LF:%d\nLH:%d\nend_of_record\n", found, hit);
+	}
+
+	free(lines);
+	if (fclose(file) != 0)
+	{
+		logger(ERROR, "Failed to close file. %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
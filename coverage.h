@@ -0,0 +1,34 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "session.h"
+
+// Record of which of a set of code addresses have been executed
+typedef struct Coverage {
+	// number of addresses being tracked
+	size_t count;
+	// sorted addresses of every site
+	uint64_t *sites;
+	// one bit per site, set once the site has been executed
+	uint8_t *hits;
+	size_t hit_count;
+} Coverage;
+
+// Creates a coverage record for the given addresses. Duplicates are dropped.
+Coverage *new_coverage(const uint64_t *sites, size_t count);
+
+void free_coverage(Coverage *cov);
+
+// Marks the given address as executed. Addresses that arent tracked are ignored.
+void cov_record(Coverage *cov, uint64_t addr);
+
+// Writes the raw coverage bitmap along with the site addresses it indexes
+int cov_write_bitmap(Coverage *cov, const char *path);
+
+// Writes an lcov tracefile using the session's line information to map sites to lines
+int cov_write_lcov(Coverage *cov, DebugSession *session, const char *path);
+
+#endif
@@ -6,20 +6,47 @@
 #include <sys/ptrace.h>
 #include <sys/personality.h>
 #include <unistd.h>
+#include <limits.h>
 #include <signal.h>
 
 #include "logger.h"
 #include "breakpoint.h"
+#include "coverage.h"
 #include "debugger.h"
-#include "map.h"
 #include "utils.h"
 #include "reg.h"
+#include "inject.h"
+#include "x86_insn.h"
 
-#define MAX_LINE_SIZE 64
+// long enough for most mangled symbol names
+#define MAX_LINE_SIZE 256
 #define MAX_PROG_NAME_SIZE 32
 #define MAX_COMMAND_PARTS 5
-#define MAX_PART_SIZE 32
-#define WAIT_OPTIONS 0
+// a part can never be longer than the line
+#define MAX_PART_SIZE MAX_LINE_SIZE
+#define BYTES_PER_DUMP_LINE 16
+// most bytes x will dump, which is already more than a screen
+#define MAX_DUMP_LEN (64 * 1024)
+// max number of addresses a single location can resolve to
+#define MAX_LOCATIONS 64
+#define COVERAGE_BITMAP_FILE "edb.cov"
+#define COVERAGE_LCOV_FILE "edb.info"
+// most pages one access can span, a misaligned 16 byte access can touch two
+#define MAX_LIFTED_PAGES 4
+// size of the ring buffer tracepoints record into
+#define TRACE_BUFFER_SIZE (16 * 1024 * 1024)
+// most frames bt will walk
+#define MAX_BACKTRACE_FRAMES (1024 * 1024)
+#define PROC_PATH_SIZE 32
+#define INT3 0xcc
+// run_until_stop result while the tracee hasnt stopped yet
+#define TRACEE_RUNNING 2
+// how often the agent's ring is emptied while the tracee runs
+#define AGENT_DRAIN_PERIOD_NS (100 * 1000 * 1000)
+// si_code of a debug register trap, only declared by glibc for _GNU_SOURCE
+#ifndef TRAP_HWBKPT
+#define TRAP_HWBKPT 4
+#endif
 
 Debugger *new_debugger()
 {
@@ -30,15 +57,214 @@ Debugger *new_debugger()
 		return NULL;
 	}
 
-	Map *break_points = new_map();
+	BreakPointStore *break_points = new_bp_store();
+	if (break_points == NULL)
+	{
+		free(debugger);
+		return NULL;
+	}
 	debugger->break_points = break_points;
+
+	debugger->hw_break_points = new_hw_store();
+	if (debugger->hw_break_points == NULL)
+	{
+		free_bp_store(break_points);
+		free(debugger);
+		return NULL;
+	}
+
+	debugger->page_watches = new_page_watch_store();
+	if (debugger->page_watches == NULL)
+	{
+		free_hw_store(debugger->hw_break_points);
+		free_bp_store(break_points);
+		free(debugger);
+		return NULL;
+	}
 	debugger->session = NULL;
+	debugger->coverage = NULL;
+	debugger->traces = NULL;
+	debugger->agent = NULL;
+	debugger->unwinder = NULL;
+	debugger->hit_id = 0;
+	debugger->hit_overhead_ns = 0;
+	debugger->non_stop = false;
+	debugger->events = NULL;
+	debugger->running = false;
 	return debugger;
 }
 
-// Creates a new break point. Returns 1 if the max number of break points has
-// already been reached. Returns -1 for errors.
-int add_break_point(Debugger *db, char *cmd_arg)
+// Returns true if the string is a non empty run of decimal digits
+bool is_number(const char *str)
+{
+	if (*str == '\0')
+	{
+		return false;
+	}
+	for (; *str != '\0'; str++)
+	{
+		if (*str < '0' || *str > '9')
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Resolves a breakpoint location typed by the user to the addresses to break at. Locations
+// are either a hex address, file:line, a line in the file we are stopped in or a symbol
+// name, which for C++ can be demangled and resolves to every overload when the parameters
+// are left out. Returns the number of addresses or -1 for errors.
+long resolve_location(Debugger *db, char *cmd_arg, uint64_t *addrs, size_t max_addrs)
+{
+	if (has_prefix(cmd_arg, "0x"))
+	{
+		addrs[0] = strtoull(cmd_arg, NULL, 16);
+		return 1;
+	}
+
+	// anything not ending in a line number is a symbol, so a C++ name with :: isnt taken for
+	// file:line
+	char *separator = strrchr(cmd_arg, ':');
+	if (!is_number(separator != NULL ? separator + 1 : cmd_arg))
+	{
+		long found = resolve_symbol(db->session, cmd_arg, addrs, max_addrs);
+		if (found == 0)
+		{
+			logger(WARN, "No symbol named %s.", cmd_arg);
+		}
+		return found;
+	}
+
+	if (db->session->line_table == NULL)
+	{
+		logger(WARN, "No line information available.");
+		return 0;
+	}
+
+	char *file = NULL;
+	char *line_str = cmd_arg;
+	LineNumberInfo current;
+	if (separator != NULL)
+	{
+		*separator = '\0';
+		file = cmd_arg;
+		line_str = separator + 1;
+	}
+	else if (lookup_line(db->session, (uint64_t)get_ip(db->session->regs), &current) == 0)
+	{
+		// a bare line number refers to the file we are stopped in
+		file = (char *)current.file;
+	}
+
+	char *end;
+	unsigned long line = strtoul(line_str, &end, 10);
+	if (end == line_str || *end != '\0')
+	{
+		logger(WARN, "Unknown location %s.", cmd_arg);
+		return 0;
+	}
+
+	long found = line_table_resolve(db->session->line_table, file, (uint32_t)line, addrs, max_addrs);
+	for (long i = 0; i < found; i++)
+	{
+		addrs[i] += db->session->load_bias;
+	}
+
+	if (separator != NULL)
+	{
+		*separator = ':';
+	}
+
+	if (found == 0)
+	{
+		logger(WARN, "No code found for %s.", cmd_arg);
+	}
+	return found;
+}
+
+// Removes addresses inside the instructions replaced by the jumps of fast tracepoints as an
+// int3 there would break the jump. Returns the number of addresses left.
+size_t drop_patched_addrs(Debugger *db, uint64_t *addrs, size_t count)
+{
+	if (db->agent == NULL)
+	{
+		return count;
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (agent_covers(db->agent, addrs[i]))
+		{
+			logger(WARN, "%p is inside the jump of a fast tracepoint.", (void *)addrs[i]);
+			continue;
+		}
+		addrs[kept++] = addrs[i];
+	}
+	return kept;
+}
+
+// Collects what the agent has recorded so far. A corrupt ring is reported and dropped by the
+// agent so it isnt treated as an error here.
+void drain_agent(Debugger *db)
+{
+	if (db->agent != NULL && db->traces != NULL)
+	{
+		agent_drain(db->agent, db->traces, db->break_points);
+	}
+}
+
+// Moves a fast tracepoint back to an int3 so the debugger handles its hits. Returns -1 for
+// errors.
+int make_slow(Debugger *db, size_t slot)
+{
+	if (!(db->break_points->flags[slot] & BP_FAST))
+	{
+		return 0;
+	}
+
+	// no thread can be running through the jump while it is written over
+	drain_agent(db);
+	int halted = halt_threads(db->session, true);
+	if (halted != 0)
+	{
+		return halted == 1 ? 0 : -1;
+	}
+
+	int res = agent_unpatch(db->agent, db->session, db->break_points, slot);
+	if (res == 0)
+	{
+		res = bp_enable(db->break_points, &db->session->mem, slot);
+	}
+	if (resume_halted(db->session) == -1)
+	{
+		return -1;
+	}
+	return res;
+}
+
+// Moves a tracepoint onto the agent with every thread stopped, so none is part way through
+// the instructions replaced by the jump. Returns 1 if it has to stay an int3 and -1 for errors.
+int make_fast(Debugger *db, size_t slot, uint32_t spec)
+{
+	int halted = halt_threads(db->session, true);
+	if (halted != 0)
+	{
+		return halted == 1 ? 1 : -1;
+	}
+
+	int res = agent_patch(db->agent, db->session, db->break_points, slot, &db->traces->specs[spec], spec);
+	if (resume_halted(db->session) == -1)
+	{
+		return -1;
+	}
+	return res;
+}
+
+// Creates a new break point, stopping only when the condition is true if one is given.
+// Giving a condition for an existing breakpoint replaces its condition. Returns -1 for errors.
+int add_break_point(Debugger *db, char *cmd_arg, char *cond_expr)
 {
 	if (db->session == NULL)
 	{
@@ -46,231 +272,2324 @@ int add_break_point(Debugger *db, char *cmd_arg)
 		return 0;
 	}
 
-	if (m_is_full(db->break_points))
+	uint64_t addrs[MAX_LOCATIONS];
+	long count = resolve_location(db, cmd_arg, addrs, MAX_LOCATIONS);
+	if (count <= 0)
+	{
+		return count;
+	}
+
+	count = (long)drop_patched_addrs(db, addrs, (size_t)count);
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	// the condition is compiled up front so a bad one doesnt leave a breakpoint behind
+	Condition *cond = NULL;
+	if (cond_expr != NULL)
+	{
+		cond = compile_condition(cond_expr, db->session);
+		if (cond == NULL)
+		{
+			return 0;
+		}
+	}
+
+	// Parsing the location means "0x401000" and "0x0401000" are the same breakpoint
+	long added = bp_insert_bulk(db->break_points, &db->session->mem, addrs, (size_t)count, 0);
+	if (added == -1)
+	{
+		logger(ERROR, "failed to enable breakpoint: %s", cmd_arg);
+		if (cond != NULL)
+		{
+			free_condition(cond);
+		}
+		return -1;
+	}
+
+	if (added == 0 && cond == NULL)
+	{
+		logger(WARN, "Breakpoint already set at %s.", cmd_arg);
+		return 0;
+	}
+
+	for (long i = 0; i < count; i++)
+	{
+		long slot = bp_find(db->break_points, addrs[i]);
+		if (cond == NULL)
+		{
+			logger(INFO, "Breakpoint %d set at %p.", (int)db->break_points->ids[slot], (void *)addrs[i]);
+			continue;
+		}
+
+		// each breakpoint owns its condition
+		Condition *slot_cond = i == 0 ? cond : compile_condition(cond_expr, db->session);
+		if (slot_cond == NULL)
+		{
+			return -1;
+		}
+		bp_set_condition(db->break_points, (size_t)slot, slot_cond);
+
+		// the agent cant evaluate conditions
+		if (make_slow(db, (size_t)slot) == -1)
+		{
+			return -1;
+		}
+		logger(INFO, "Breakpoint %d set at %p if %s.", (int)db->break_points->ids[slot], (void *)addrs[i], slot_cond->source);
+	}
+	return 0;
+}
+
+// Returns the size of the variable or function starting at the address or 0 if there isnt one
+uint64_t symbol_size_at(Debugger *db, uint64_t addr)
+{
+	const Symbol *symbol = lookup_symbol(db->session, addr);
+	return symbol != NULL && symbol->addr + db->session->load_bias == addr ? symbol->size : 0;
+}
+
+// Reads the current contents of the memory a watchpoint covers. Returns -1 for errors.
+int read_watched_value(Debugger *db, const HwBreakPoint *bp, uint64_t *value)
+{
+	*value = 0;
+	if (read_memory(&db->session->mem, bp->addr, value, bp->len) == -1)
+	{
+		logger(ERROR, "Failed to read watched memory at %p.", (void *)bp->addr);
+		return -1;
+	}
+	return 0;
+}
+
+// Programs the debug registers of every thread with the current hardware breakpoints, halting
+// the running threads for it as threads dont share them. Returns -1 for errors.
+static int copy_debug_regs(Debugger *db)
+{
+	DebugSession *session = db->session;
+	int halted = halt_threads(session, true);
+	if (halted != 0)
+	{
+		return halted == 1 ? 0 : -1;
+	}
+
+	int res = 0;
+	ThreadTable *threads = session->threads;
+	for (size_t i = 0; i < threads->count; i++)
+	{
+		TraceeThread *thread = threads->threads[i];
+		if (thread->state != THREAD_STOPPED)
+		{
+			continue;
+		}
+
+		if (hw_program(db->hw_break_points, thread->tid) == -1)
+		{
+			res = -1;
+		}
+		thread->needs_setup = false;
+	}
+
+	if (resume_halted(session) == -1)
+	{
+		return -1;
+	}
+	return res;
+}
+
+// Sets a hardware breakpoint or watchpoint at the given location. Watchpoints on a variable
+// cover as much of it as a debug register can unless a length is given.
+int add_hw_break_point(Debugger *db, char *loc_arg, char *len_arg, HwBreakType type)
+{
+	if (db->session == NULL || !db->session->active)
+	{
+		logger(WARN, "No active debugging session.");
+		return 0;
+	}
+
+	if (strcmp(loc_arg, "") == 0)
+	{
+		logger(WARN, type == HW_EXECUTE ? "Usage: hb <location>" : "Usage: watch|awatch <location> [len]");
+		return 0;
+	}
+
+	long slot = hw_free_slot(db->hw_break_points);
+	if (slot == -1)
+	{
+		logger(WARN, "All %d debug registers are in use.", HW_SLOT_COUNT);
+		return 0;
+	}
+
+	// there are only four registers so a line with several addresses uses the first
+	uint64_t addrs[MAX_LOCATIONS];
+	long count = resolve_location(db, loc_arg, addrs, MAX_LOCATIONS);
+	if (count <= 0)
+	{
+		return count;
+	}
+	uint64_t addr = addrs[0];
+
+	uint8_t len = 1;
+	if (type != HW_EXECUTE && strcmp(len_arg, "") != 0)
+	{
+		len = (uint8_t)strtoul(len_arg, NULL, 0);
+	}
+	else if (type != HW_EXECUTE)
+	{
+		uint64_t size = symbol_size_at(db, addr);
+
+		// the largest aligned power of two the variable fills
+		len = 8;
+		while (len > 1 && ((size != 0 && len > size) || addr % len != 0))
+		{
+			len /= 2;
+		}
+	}
+
+	// a raw address is usually on the heap or stack so it isnt carried into the next run
+	bool rebase = !has_prefix(loc_arg, "0x");
+	if (hw_set(db->hw_break_points, db->session->current->tid, (size_t)slot, addr, type, len, rebase) == -1 ||
+		copy_debug_regs(db) == -1)
+	{
+		return -1;
+	}
+
+	if (type == HW_EXECUTE)
+	{
+		logger(INFO, "Hardware breakpoint %d set at %p.", (int)slot, (void *)addr);
+		return 0;
+	}
+
+	HwBreakPoint *bp = &db->hw_break_points->slots[slot];
+	if (read_watched_value(db, bp, &bp->value) == -1)
+	{
+		return -1;
+	}
+	logger(INFO, "Watchpoint %d set on %d bytes at %p.", (int)slot, (int)len, (void *)addr);
+	return 0;
+}
+
+// Removes the hardware breakpoint or watchpoint with the given number
+int remove_hw_break_point(Debugger *db, char *slot_arg)
+{
+	if (db->session == NULL || !db->session->active)
+	{
+		logger(WARN, "No active debugging session.");
+		return 0;
+	}
+
+	if (!is_number(slot_arg) || strtoul(slot_arg, NULL, 10) >= HW_SLOT_COUNT ||
+		!db->hw_break_points->slots[strtoul(slot_arg, NULL, 10)].used)
+	{
+		logger(WARN, "No hardware breakpoint %s.", slot_arg);
+		return 0;
+	}
+
+	if (hw_remove(db->hw_break_points, db->session->current->tid, strtoul(slot_arg, NULL, 10)) == -1)
+	{
+		return -1;
+	}
+	return copy_debug_regs(db);
+}
+
+// Watches a region of memory for writes by write protecting the pages it is on. Watching a
+// variable covers the whole variable unless a length is given.
+int add_region_watch(Debugger *db, char *loc_arg, char *len_arg)
+{
+	if (db->session == NULL || !db->session->active)
+	{
+		logger(WARN, "No active debugging session.");
+		return 0;
+	}
+
+	if (strcmp(loc_arg, "") == 0)
+	{
+		logger(WARN, "Usage: pwatch <location> [len]");
+		return 0;
+	}
+
+	uint64_t addrs[MAX_LOCATIONS];
+	long count = resolve_location(db, loc_arg, addrs, MAX_LOCATIONS);
+	if (count <= 0)
+	{
+		return count;
+	}
+
+	uint64_t len = strcmp(len_arg, "") != 0 ? strtoull(len_arg, NULL, 0) : symbol_size_at(db, addrs[0]);
+	if (len == 0)
+	{
+		logger(WARN, "Unknown size for %s, give a length.", loc_arg);
+		return 0;
+	}
+
+	long id = pw_add(db->page_watches, db->session, addrs[0], len);
+	if (id == -1)
+	{
+		return -1;
+	}
+
+	logger(INFO, "Region watchpoint %d set on %d bytes at %p.", (int)id, (int)len, (void *)addrs[0]);
+	return 0;
+}
+
+// Forgets the stops of threads that faulted on a page protected for region watchpoints before
+// they were handled. The write is made again when the thread is resumed and only faults again
+// if the page is still protected. Returns -1 for errors.
+static int drop_page_faults(Debugger *db)
+{
+	ThreadTable *threads = db->session->threads;
+	for (size_t i = 0; i < threads->count; i++)
+	{
+		TraceeThread *thread = threads->threads[i];
+		if (!thread->status_pending || (thread->status >> 16) != 0 || WSTOPSIG(thread->status) != SIGSEGV)
+		{
+			continue;
+		}
+
+		siginfo_t info;
+		if (!ptrace_with_error(PTRACE_GETSIGINFO, thread->tid, NULL, &info).success)
+		{
+			return -1;
+		}
+		if (info.si_code == SEGV_ACCERR && pw_find_page(db->page_watches, (uint64_t)info.si_addr) != -1)
+		{
+			thread->status_pending = false;
+		}
+	}
+	return 0;
+}
+
+// Removes the region watchpoint with the given number
+int remove_region_watch(Debugger *db, char *id_arg)
+{
+	if (db->session == NULL || !db->session->active)
+	{
+		logger(WARN, "No active debugging session.");
+		return 0;
+	}
+
+	// faults on its pages that are still to be handled would be taken for the program's own
+	if (drop_page_faults(db) == -1)
+	{
+		return -1;
+	}
+
+	int res = is_number(id_arg) ? pw_remove(db->page_watches, db->session, (uint32_t)strtoul(id_arg, NULL, 10)) : 1;
+	if (res == 1)
+	{
+		logger(WARN, "No region watchpoint %s.", id_arg);
+		return 0;
+	}
+	return res;
+}
+
+// Sets a tracepoint at the given location that records the given items every time it is hit
+// without stopping
+int add_tracepoint(Debugger *db, char *loc_arg, char *items)
+{
+	if (db->session == NULL || !db->session->active)
+	{
+		logger(WARN, "No active debugging session.");
+		return 0;
+	}
+
+	if (strcmp(loc_arg, "") == 0)
+	{
+		logger(WARN, "Usage: trace <location> [$reg | $reg:len | name[:len] | addr:len]...");
+		return 0;
+	}
+
+	if (db->traces == NULL)
+	{
+		db->traces = new_trace_log(TRACE_BUFFER_SIZE);
+		if (db->traces == NULL)
+		{
+			return -1;
+		}
+	}
+
+	uint64_t addrs[MAX_LOCATIONS];
+	long count = resolve_location(db, loc_arg, addrs, MAX_LOCATIONS);
+	if (count <= 0)
+	{
+		return count;
+	}
+
+	count = (long)drop_patched_addrs(db, addrs, (size_t)count);
+	if (bp_insert_bulk(db->break_points, &db->session->mem, addrs, (size_t)count, 0) == -1)
+	{
+		logger(ERROR, "Failed to set tracepoint at %s.", loc_arg);
+		return -1;
+	}
+
+	for (long i = 0; i < count; i++)
+	{
+		long slot = bp_find(db->break_points, addrs[i]);
+		long spec = trace_add_spec(db->traces, items, db->break_points->ids[slot], addrs[i], db->session);
+		if (spec == -1)
+		{
+			// dont leave a plain breakpoint behind for a bad tracepoint
+			if (db->break_points->trace_specs[slot] == 0 && db->break_points->hit_counts[slot] == 0)
+			{
+				bp_remove_bulk(db->break_points, &db->session->mem, &addrs[i], 1);
+			}
+			return 0;
+		}
+
+		db->break_points->trace_specs[slot] = (uint32_t)spec + 1;
+
+		// a tracepoint that is already fast is patched again for its new items
+		int fast = 1;
+		if (db->agent != NULL)
+		{
+			fast = make_slow(db, (size_t)slot) == -1 ? -1 : make_fast(db, (size_t)slot, (uint32_t)spec);
+		}
+		if (fast == -1)
+		{
+			return -1;
+		}
+		logger(INFO, fast == 0 ? "Fast tracepoint %d set at %p." : "Tracepoint %d set at %p.", (int)db->break_points->ids[slot],
+			(void *)addrs[i]);
+	}
+	return 0;
+}
+
+// Loads the agent into the tracee and moves every tracepoint it can handle onto it
+int start_agent(Debugger *db, char *path)
+{
+	if (db->session == NULL || !db->session->active)
+	{
+		logger(WARN, "No active debugging session.");
+		return 0;
+	}
+
+	if (db->agent != NULL)
+	{
+		logger(WARN, "The agent is already loaded.");
+		return 0;
+	}
+
+	db->agent = load_agent(db->session, path);
+	if (db->agent == NULL)
+	{
+		return 0;
+	}
+
+	int total = 0;
+	int fast = 0;
+	for (size_t slot = 0; slot < db->break_points->count; slot++)
+	{
+		uint32_t spec = db->break_points->trace_specs[slot];
+		if (spec == 0)
+		{
+			continue;
+		}
+
+		int res = make_fast(db, slot, spec - 1);
+		if (res == -1)
+		{
+			return -1;
+		}
+		total++;
+		fast += res == 0;
+	}
+
+	if (total > 0)
+	{
+		logger(INFO, "%d of %d tracepoints are now fast.", fast, total);
+	}
+	return 0;
+}
+
+// Prints the newest records of tracepoint hits, or all of them if no count is given
+int dump_traces(Debugger *db, char *count_arg)
+{
+	drain_agent(db);
+	if (db->traces == NULL || db->traces->count == 0)
+	{
+		logger(INFO, "No tracepoint hits recorded.");
+		return 0;
+	}
+
+	trace_dump(db->traces, strtoull(count_arg, NULL, 10));
+	if (db->agent != NULL && db->agent->shared->dropped > 0)
+	{
+		printf("%llu fast tracepoint hits were dropped while the agent's buffer was full.\n",
+			(unsigned long long)db->agent->shared->dropped);
+	}
+	return 0;
+}
+
+// Removes the given break point
+int remove_break_point(Debugger *db, char *cmd_arg)
+{
+	if (db->session == NULL)
+	{
+		logger(WARN, "No active debugging session.");
+		return 0;
+	}
+
+	if (db->break_points->count == 0)
+	{
+		return 1;
+	}
+
+	uint64_t addrs[MAX_LOCATIONS];
+	long count = resolve_location(db, cmd_arg, addrs, MAX_LOCATIONS);
+	if (count <= 0)
+	{
+		return count;
+	}
+
+	// jumps to the agent are taken out before the breakpoints
+	for (long i = 0; i < count; i++)
+	{
+		long slot = bp_find(db->break_points, addrs[i]);
+		if (slot != -1 && make_slow(db, (size_t)slot) == -1)
+		{
+			return -1;
+		}
+	}
+
+	long removed = bp_remove_bulk(db->break_points, &db->session->mem, addrs, (size_t)count);
+	if (removed == -1)
+	{
+		logger(ERROR, "Failed to disable breakpoint %s.", cmd_arg);
+		return -1;
+	}
+
+	if (removed == 0)
+	{
+		logger(ERROR, "Breakpoint not found.");
+		return 1;
+	}
+	return 0;
+}
+
+// Reads a file of whitespace separated hex addresses into a heap allocated array.
+// Returns the number of addresses read or -1 for errors.
+long read_address_file(char *path, uint64_t **addrs)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+	{
+		logger(ERROR, "Failed to open %s. %s", path, strerror(errno));
+		return -1;
+	}
+
+	size_t count = 0;
+	size_t capacity = 1024;
+	uint64_t *buf = (uint64_t *)malloc(capacity * sizeof(uint64_t));
+
+	unsigned long addr;
+	while (buf != NULL && fscanf(file, "%lx", &addr) == 1)
+	{
+		if (count == capacity)
+		{
+			capacity *= 2;
+			uint64_t *grown = (uint64_t *)realloc(buf, capacity * sizeof(uint64_t));
+			if (grown == NULL)
+			{
+				free(buf);
+				buf = NULL;
+				break;
+			}
+			buf = grown;
+		}
+		buf[count++] = addr;
+	}
+	fclose(file);
+
+	if (buf == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for addresses. %s", strerror(errno));
+		return -1;
+	}
+
+	*addrs = buf;
+	return (long)count;
+}
+
+// Sets a breakpoint on every line of the given source file, or at every address listed
+// in the given file, in one batch
+int add_break_point_bulk(Debugger *db, char *path)
+{
+	if (db->session == NULL || !db->session->active)
+	{
+		logger(WARN, "No active debugging session.");
+		return 0;
+	}
+
+	uint64_t *addrs = NULL;
+	long count = -1;
+	long file_idx = db->session->line_table != NULL ? line_table_find_file(db->session->line_table, path) : -1;
+	if (file_idx != -1)
+	{
+		count = line_table_file_addresses(db->session->line_table, (uint32_t)file_idx, &addrs);
+		for (long i = 0; i < count; i++)
+		{
+			addrs[i] += db->session->load_bias;
+		}
+	}
+	else
+	{
+		count = read_address_file(path, &addrs);
+	}
+
+	if (count == -1)
+	{
+		return -1;
+	}
+
+	count = (long)drop_patched_addrs(db, addrs, (size_t)count);
+	long added = bp_insert_bulk(db->break_points, &db->session->mem, addrs, (size_t)count, 0);
+	free(addrs);
+	if (added == -1)
+	{
+		logger(ERROR, "Failed to set breakpoints from %s.", path);
+		return -1;
+	}
+
+	logger(INFO, "Set %d breakpoints.", (int)added);
+	return 0;
+}
+
+// Moves the instruction pointer back onto the breakpoint if the tracee has just stopped
+// after executing one of our int3s. Returns 1 and sets slot if a breakpoint was hit.
+int rewind_breakpoint_hit(Debugger *db, long *slot)
+{
+	if (!WIFSTOPPED(db->session->wait_status) || WSTOPSIG(db->session->wait_status) != SIGTRAP)
+	{
+		return 0;
+	}
+
+	void *next_instruction_addr = get_ip(db->session->regs);
+	if (next_instruction_addr == NULL)
+	{
+		logger(ERROR, "Failed to get instruction pointer");
+		return -1;
+	}
+
+	uint64_t bp_addr = (uint64_t)next_instruction_addr - 1;
+	*slot = bp_find(db->break_points, bp_addr);
+	if (*slot == -1 || !(db->break_points->flags[*slot] & BP_ENABLED))
+	{
+		return 0;
+	}
+
+	logger(DEBUG, "Hit breakpoint at %p", (void *)bp_addr);
+
+	// the new RIP is only written back when the tracee is resumed
+	if (set_ip(db->session->regs, (void *)bp_addr) == -1)
+	{
+		return -1;
+	}
+	return 1;
+}
+
+// Steps the current thread over the breakpoint at addr by running a copy of the original
+// instruction elsewhere, which leaves the breakpoint in for the other threads. Returns 1 if
+// the instruction cant be stepped that way and -1 for errors.
+static int step_breakpoint_out_of_line(Debugger *db, uint64_t addr)
+{
+	uint8_t code[MAX_INSN_LEN];
+	if (read_memory(&db->session->mem, addr, code, sizeof(code)) == -1)
+	{
+		return 1;
+	}
+
+	// the int3 of this breakpoint and of any other under the instruction are swapped back
+	for (size_t i = 0; i < sizeof(code); i++)
+	{
+		long slot = bp_find(db->break_points, addr + i);
+		if (slot != -1 && (db->break_points->flags[slot] & BP_ENABLED))
+		{
+			code[i] = db->break_points->saved_bytes[slot];
+		}
+	}
+	return step_out_of_line(db->session, code, sizeof(code));
+}
+
+// Checks the current instruction for a break point and steps over it if one exists.
+// Returns 1 if the tracee was stepped.
+int step_over_breakpoint(Debugger *db)
+{
+	// use the instruction pointer to check for break points and if one is found
+	// we temporarily disable it.
+	if (!WIFSTOPPED(db->session->wait_status))
+	{
+		return 0;
+	}
+
+	void *current_instruction_addr = get_ip(db->session->regs);
+	if (current_instruction_addr == NULL)
+	{
+		logger(ERROR, "Failed to get instruction pointer");
+		return -1;
+	}
+
+	long slot = bp_find(db->break_points, (uint64_t)current_instruction_addr);
+	if (slot == -1 || !(db->break_points->flags[slot] & BP_ENABLED))
+	{
+		return 0;
+	}
+
+	logger(DEBUG, "Stepping over breakpoint: %p", current_instruction_addr);
+
+	// in non stop mode only this thread is held up by the breakpoint
+	if (db->non_stop)
+	{
+		int stepped = step_breakpoint_out_of_line(db, (uint64_t)current_instruction_addr);
+		if (stepped != 1)
+		{
+			return stepped == 0 ? 1 : -1;
+		}
+	}
+
+	// other threads would run past the breakpoint while it is out
+	int halted = halt_threads(db->session, true);
+	if (halted != 0)
+	{
+		return halted == 1 ? 0 : -1;
+	}
+
+	int res = 1;
+	if (bp_disable(db->break_points, &db->session->mem, (size_t)slot) == -1)
+	{
+		logger(ERROR, "failed to disable breakpoint %p", current_instruction_addr);
+		res = -1;
+	}
+	else
+	{
+		if (resume_tracee(db->session, PTRACE_SINGLESTEP) == -1)
+		{
+			logger(ERROR, "failed stepping to next instruction");
+			res = -1;
+		}
+		else if (wait_for_tracee(db->session) == -1)
+		{
+			res = -1;
+		}
+
+		// the int3 goes back even if the step failed
+		if (bp_enable(db->break_points, &db->session->mem, (size_t)slot) == -1)
+		{
+			logger(ERROR, "failed to re-enable breakpoint %p", current_instruction_addr);
+			res = -1;
+		}
+	}
+
+	if (resume_halted(db->session) == -1)
+	{
+		return -1;
+	}
+	return res;
+}
+
+// Describes an address as " in symbol+offset (file:line)" leaving out whatever isnt known.
+// The line is looked up at line_addr, which is before a return address as the call it
+// follows can end a line.
+static void describe_code_addr(Debugger *db, uint64_t addr, uint64_t line_addr, char *where, size_t size)
+{
+	size_t len = 0;
+	where[0] = '\0';
+
+	const Symbol *symbol = lookup_symbol(db->session, addr);
+	if (symbol != NULL)
+	{
+		const char *name = symbol_display_name(db->session->symbols, symbol);
+		len += snprintf(where, size, " in %s+%llu", name != NULL ? name : symbol_name(db->session->symbols, symbol),
+			(unsigned long long)(addr - db->session->load_bias - symbol->addr));
+	}
+
+	LineNumberInfo info;
+	if (len < size && lookup_line(db->session, line_addr, &info) == 0)
+	{
+		const char *file_name = strrchr(info.file, '/');
+		file_name = file_name != NULL ? file_name + 1 : info.file;
+		snprintf(where + len, size - len, " (%s:%u)", file_name, info.line_number);
+	}
+}
+
+// Describes an address as " in symbol+offset (file:line)" leaving out whatever isnt known
+void describe_addr(Debugger *db, uint64_t addr, char *where, size_t size)
+{
+	describe_code_addr(db, addr, addr, where, size);
+}
+
+// Tells the user what stopped the tracee and where as the symbol and source line when
+// they are known
+void report_stop(Debugger *db, const char *event, uint64_t addr)
+{
+	char where[MAX_LINE_SIZE];
+	describe_addr(db, addr, where, MAX_LINE_SIZE);
+	if (db->session->threads->count > 1)
+	{
+		logger(INFO, "Thread %d: %s hit at %p%s.", db->session->current->tid, (char *)event, (void *)addr, where);
+		return;
+	}
+	logger(INFO, "%s hit at %p%s.", (char *)event, (void *)addr, where);
+}
+
+// Reads the address the tracee faulted on. Returns 1 if the fault was a write to one of the
+// pages protected for region watchpoints and -1 for errors.
+int find_page_fault(Debugger *db, uint64_t *fault_addr, long *page)
+{
+	if (db->page_watches->page_count == 0 || !WIFSTOPPED(db->session->wait_status) ||
+		WSTOPSIG(db->session->wait_status) != SIGSEGV)
+	{
+		return 0;
+	}
+
+	siginfo_t info;
+	if (!ptrace_with_error(PTRACE_GETSIGINFO, db->session->current->tid, NULL, &info).success)
+	{
+		return -1;
+	}
+
+	*fault_addr = (uint64_t)info.si_addr;
+	*page = pw_find_page(db->page_watches, *fault_addr);
+	return info.si_code == SEGV_ACCERR && *page != -1;
+}
+
+// Steps the current thread over the faulting access with the watched pages it touches lifted,
+// recording them in lifted. An access straddling two pages faults again on the second so
+// pages are lifted until it completes. Returns 1 if the thread didnt stop after the step and
+// -1 for errors.
+static int step_with_pages_lifted(Debugger *db, uint64_t *fault_addr, long *page, const WatchRegion **region,
+	long *lifted, size_t *lifted_count)
+{
+	int fault = 1;
+	while (fault == 1 && *lifted_count < MAX_LIFTED_PAGES)
+	{
+		*region = *region != NULL ? *region : pw_find_region(db->page_watches, *fault_addr);
+		if (pw_protect_page(db->page_watches, db->session, (size_t)*page, false) == -1)
+		{
+			return -1;
+		}
+		lifted[(*lifted_count)++] = *page;
+
+		// any int3 under the instruction has to be lifted too
+		int stepped = step_over_breakpoint(db);
+		if (stepped == 0 && (resume_tracee(db->session, PTRACE_SINGLESTEP) == -1 || wait_for_tracee(db->session) == -1))
+		{
+			return -1;
+		}
+		if (stepped == -1)
+		{
+			return -1;
+		}
+		if (!WIFSTOPPED(db->session->wait_status))
+		{
+			return 1;
+		}
+
+		fault = find_page_fault(db, fault_addr, page);
+		if (fault == -1)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Checks whether a write to a page protected for a region watchpoint stopped the tracee.
+// The page is made writable for a single step so the write goes through and then protected
+// again. Returns 1 if the write was inside a watched region, 2 if it was to an unwatched part
+// of a protected page, 0 if the stop wasnt for a protected page and -1 for errors.
+int report_page_hit(Debugger *db)
+{
+	uint64_t fault_addr;
+	long page;
+	int fault = find_page_fault(db, &fault_addr, &page);
+	if (fault != 1)
+	{
+		return fault;
+	}
+
+	uint64_t ip = (uint64_t)get_ip(db->session->regs);
+	const WatchRegion *region = NULL;
+
+	// other threads would write to the pages unseen while they are lifted
+	int halted = halt_threads(db->session, true);
+	if (halted != 0)
+	{
+		return halted == 1 ? 0 : -1;
+	}
+
+	long lifted[MAX_LIFTED_PAGES];
+	size_t lifted_count = 0;
+	int res = step_with_pages_lifted(db, &fault_addr, &page, &region, lifted, &lifted_count);
+
+	// the pages go back even if stepping failed so later writes are still seen
+	for (size_t i = 0; i < lifted_count && res != 1; i++)
+	{
+		if (pw_protect_page(db->page_watches, db->session, (size_t)lifted[i], true) == -1)
+		{
+			res = -1;
+		}
+	}
+	if (resume_halted(db->session) == -1 || res == -1)
+	{
+		return -1;
+	}
+	if (res == 1)
+	{
+		return 0;
+	}
+
+	if (region == NULL)
+	{
+		return 2;
+	}
+
+	report_stop(db, "Region watchpoint", ip);
+
+	char where[MAX_LINE_SIZE];
+	snprintf(where, MAX_LINE_SIZE, "%llu bytes into", (unsigned long long)(fault_addr - region->addr));
+	logger(INFO, "Region watchpoint %d written %s %p.", (int)region->id, where, (void *)region->addr);
+	return 1;
+}
+
+// Checks whether a hardware breakpoint or watchpoint stopped the tracee and tells the
+// user about it. Watchpoints trap after the access so the tracee is already past the
+// instruction that made it. Returns 1 if one fired and -1 for errors.
+int report_hw_hit(Debugger *db)
+{
+	long slot;
+	int hit = hw_find_hit(db->hw_break_points, db->session->current->tid, &slot);
+	if (hit != 1)
+	{
+		return hit;
+	}
+
+	HwBreakPoint *bp = &db->hw_break_points->slots[slot];
+	if (bp->type == HW_EXECUTE)
+	{
+		// the kernel sets the resume flag so continuing doesnt trap on the same instruction
+		report_stop(db, "Hardware breakpoint", bp->addr);
+		return 1;
+	}
+
+	report_stop(db, "Watchpoint", (uint64_t)get_ip(db->session->regs));
+
+	uint64_t value;
+	if (read_watched_value(db, bp, &value) == -1)
+	{
+		return -1;
+	}
+
+	char change[MAX_LINE_SIZE];
+	if (value != bp->value)
+	{
+		snprintf(change, MAX_LINE_SIZE, "changed from %llu to %llu", (unsigned long long)bp->value, (unsigned long long)value);
+	}
+	else
+	{
+		snprintf(change, MAX_LINE_SIZE, "is %llu", (unsigned long long)value);
+	}
+	logger(INFO, "Watchpoint %d on %p %s.", (int)slot, (void *)bp->addr, change);
+
+	bp->value = value;
+	return 1;
+}
+
+// Checks whether any kind of watchpoint stopped the tracee and tells the user about it.
+// Returns 1 if one fired, 2 if the tracee should carry on as only an unwatched part of a
+// protected page was written, 0 if none did and -1 for errors.
+int report_watch_hit(Debugger *db)
+{
+	int hit = report_hw_hit(db);
+	if (hit != 0)
+	{
+		return hit;
+	}
+	return report_page_hit(db);
+}
+
+// Collects the runtime address of every statement in the line table. Returns the number
+// of addresses or -1 for errors.
+long line_table_addresses(DebugSession *session, uint64_t **addrs)
+{
+	LineTable *table = session->line_table;
+	if (line_table_load_all(table) == -1)
+	{
+		return -1;
+	}
+
+	*addrs = (uint64_t *)malloc((table->row_count + 1) * sizeof(uint64_t));
+	if (*addrs == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for addresses. %s", strerror(errno));
+		return -1;
+	}
+
+	size_t count = 0;
+	for (size_t i = 0; i < table->row_count; i++)
+	{
+		if ((table->rows[i].flags & LINE_IS_STMT) && !(table->rows[i].flags & LINE_END_SEQUENCE))
+		{
+			(*addrs)[count++] = table->rows[i].addr + session->load_bias;
+		}
+	}
+	return (long)count;
+}
+
+// Writes out the coverage reports once the tracee has finished
+int finish_coverage(Debugger *db)
+{
+	if (db->coverage == NULL)
+	{
+		return 0;
+	}
+
+	logger(INFO, "Covered %d of %d sites.", (int)db->coverage->hit_count, (int)db->coverage->count);
+
+	int res = cov_write_bitmap(db->coverage, COVERAGE_BITMAP_FILE);
+	if (cov_write_lcov(db->coverage, db->session, COVERAGE_LCOV_FILE) == -1)
+	{
+		res = -1;
+	}
+
+	free_coverage(db->coverage);
+	db->coverage = NULL;
+	return res;
+}
+
+// Records the debugger time spent on the breakpoint hit being handled now that the tracee
+// is about to run again
+void finish_hit_overhead(Debugger *db, uint64_t handling_since)
+{
+	if (db->hit_id == 0)
+	{
+		return;
+	}
+
+	long slot = bp_find_id(db->break_points, db->hit_id);
+	if (slot != -1)
+	{
+		bp_record_overhead(db->break_points, (size_t)slot, db->hit_overhead_ns + monotonic_ns() - handling_since);
+	}
+	db->hit_id = 0;
+}
+
+// Returns true for signals programs commonly get while running normally, which are passed on
+// without stopping
+static bool is_quiet_signal(int sig)
+{
+	return sig == SIGCHLD || sig == SIGALRM || sig == SIGURG || sig == SIGWINCH || sig == SIGIO ||
+		sig == SIGPROF || sig == SIGVTALRM;
+}
+
+// Checks whether the current thread trapped on a breakpoint that has been removed since, which
+// happens when another thread's stop was handled first. The instruction pointer is moved back
+// onto a removed int3 so the original instruction runs. Returns 1 if the trap was for a removed
+// breakpoint and -1 for errors.
+static int skip_stale_trap(Debugger *db)
+{
+	siginfo_t info;
+	if (!ptrace_with_error(PTRACE_GETSIGINFO, db->session->current->tid, NULL, &info).success)
+	{
+		return -1;
+	}
+
+	// a hit on a debug register still in use has been reported already
+	if (info.si_code == TRAP_HWBKPT)
+	{
+		return 1;
+	}
+	if (info.si_code != SI_KERNEL)
+	{
+		return 0;
+	}
+
+	// an int3 that is still there is the program's own
+	uint64_t ip = (uint64_t)get_ip(db->session->regs);
+	uint8_t byte;
+	if (read_memory(&db->session->mem, ip - 1, &byte, 1) == -1)
+	{
+		return -1;
+	}
+	if (byte == INT3)
+	{
+		return 0;
+	}
+
+	logger(DEBUG, "Thread %d hit a removed breakpoint at %p.", db->session->current->tid, (void *)(ip - 1));
+	return set_ip(db->session->regs, (void *)(ip - 1)) == -1 ? -1 : 1;
+}
+
+// Tells the user where the current thread was interrupted
+static void report_interrupt(Debugger *db)
+{
+	char where[MAX_LINE_SIZE];
+	uint64_t ip = (uint64_t)get_ip(db->session->regs);
+	describe_addr(db, ip, where, MAX_LINE_SIZE);
+	if (db->session->threads->count > 1)
+	{
+		logger(INFO, "Interrupted thread %d at %p%s.", db->session->current->tid, (void *)ip, where);
+		return;
+	}
+	logger(INFO, "Interrupted at %p%s.", (void *)ip, where);
+}
+
+// Resumes every stopped thread that has no stop left to handle. New threads get the hardware
+// breakpoints first and threads that reported a breakpoint step past it.
+static int resume_threads(Debugger *db)
+{
+	DebugSession *session = db->session;
+	TraceeThread *current = session->current;
+	prune_threads(session);
+
+	// every thread runs again, including any left halted by an operation that failed
+	session->halt_depth = 0;
+
+	ThreadTable *threads = session->threads;
+	for (size_t i = 0; i < threads->count; i++)
+	{
+		TraceeThread *thread = threads->threads[i];
+		if (thread->state != THREAD_STOPPED || thread->status_pending)
+		{
+			continue;
+		}
+
+		if (thread->needs_setup && db->hw_break_points->dr7 != 0 && hw_program(db->hw_break_points, thread->tid) == -1)
+		{
+			return -1;
+		}
+		thread->needs_setup = false;
+
+		// the current thread has been stepped over its breakpoint already
+		if (thread != current && thread->reported_bp != 0 && thread->reported_bp == (uint64_t)get_ip(&thread->regs))
+		{
+			select_thread(session, thread);
+			int stepped = step_over_breakpoint(db);
+			select_thread(session, current);
+			if (stepped == -1)
+			{
+				return -1;
+			}
+		}
+		thread->reported_bp = 0;
+
+		if (thread->state == THREAD_STOPPED && !thread->status_pending && resume_thread(thread, PTRACE_CONT) == -1)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Runs the tracee until it stops somewhere the user needs to know about. Hits on one shot
+// breakpoints, ignored hits and hits with false conditions are handled without returning.
+// Stops already waiting are handled without blocking, TRACEE_RUNNING is returned once there
+// are none left and the function is called again when the tracee next changes state.
+// handling_since is kept as the time the debugger started handling the latest stop.
+int run_until_stop(Debugger *db, uint64_t *handling_since)
+{
+	while (true)
+	{
+		if (!db->running)
+		{
+			int stepped = step_over_breakpoint(db);
+			if (stepped == -1)
+			{
+				logger(ERROR, "failed to step over breakpoints");
+				return -1;
+			}
+
+			// the instruction under the breakpoint may have tripped a watchpoint
+			if (stepped == 1 && WIFSTOPPED(db->session->wait_status))
+			{
+				int watch_hit = report_watch_hit(db);
+				if (watch_hit == 2)
+				{
+					continue;
+				}
+				if (watch_hit != 0)
+				{
+					return watch_hit == 1 ? 0 : -1;
+				}
+			}
+
+			// the current thread may have exited, leaving the others to wait for
+			if (!tracee_exited(db->session))
+			{
+				if (WIFSTOPPED(db->session->wait_status))
+				{
+					finish_hit_overhead(db, *handling_since);
+				}
+				if (resume_threads(db) == -1)
+				{
+					return -1;
+				}
+				db->running = true;
+			}
+		}
+
+		if (db->running)
+		{
+			int polled = poll_event(db->session);
+			if (polled == 1)
+			{
+				return TRACEE_RUNNING;
+			}
+			db->running = false;
+			if (polled == -1)
+			{
+				return -1;
+			}
+		}
+		*handling_since = monotonic_ns();
+
+		// the agent only records while there is room so it is emptied at any stop
+		if (db->agent != NULL && agent_needs_drain(db->agent))
+		{
+			drain_agent(db);
+		}
+
+		if (tracee_exited(db->session))
+		{
+			return finish_coverage(db);
+		}
+
+		// a new thread stops once before it runs so its debug registers can be set up
+		if ((db->session->wait_status >> 16) == PTRACE_EVENT_STOP)
+		{
+			continue;
+		}
+
+		int watch_hit = report_watch_hit(db);
+		if (watch_hit == 2)
+		{
+			continue;
+		}
+		if (watch_hit != 0)
+		{
+			return watch_hit == 1 ? 0 : -1;
+		}
+
+		// signals are passed on when the thread carries on, only the unusual ones stop
+		int sig = WSTOPSIG(db->session->wait_status);
+		if (sig != SIGTRAP)
+		{
+			// Ctrl-C reaches a tracee sharing the terminal too, which only stops it
+			if (sig == SIGINT)
+			{
+				siginfo_t info;
+				if (!ptrace_with_error(PTRACE_GETSIGINFO, db->session->current->tid, NULL, &info).success)
+				{
+					return -1;
+				}
+				if (info.si_code == SI_KERNEL)
+				{
+					report_interrupt(db);
+					return 0;
+				}
+			}
+
+			db->session->current->pending_signal = sig;
+			if (is_quiet_signal(sig))
+			{
+				continue;
+			}
+			logger(INFO, "Thread %d received signal %d (%s).", db->session->current->tid, sig, strsignal(sig));
+			return 0;
+		}
+
+		long slot;
+		int hit = rewind_breakpoint_hit(db, &slot);
+		if (hit == 0)
+		{
+			hit = skip_stale_trap(db);
+			if (hit == 1)
+			{
+				continue;
+			}
+		}
+		if (hit != 1)
+		{
+			return hit;
+		}
+
+		uint64_t bp_addr = db->break_points->addrs[slot];
+		bool one_shot = db->break_points->flags[slot] & BP_ONE_SHOT;
+		if (!one_shot)
+		{
+			if (bp_record_hit(db->break_points, (size_t)slot, *handling_since) == -1)
+			{
+				return -1;
+			}
+			db->hit_id = db->break_points->ids[slot];
+			db->hit_overhead_ns = 0;
+		}
+
+		// false conditions carry on straight away, the breakpoint is stepped over at the top
+		Condition *cond = db->break_points->conditions[slot];
+		if (cond != NULL)
+		{
+			int64_t result;
+			if (eval_condition(cond, db->session->regs, &db->session->mem, db->session->load_bias, &result) == -1)
+			{
+				logger(WARN, "Failed to evaluate condition %s, stopping.", cond->source);
+			}
+			else if (result == 0)
+			{
+				continue;
+			}
+		}
+
+		// tracepoints record what they collect and carry on
+		uint32_t trace_spec = db->break_points->trace_specs[slot];
+		if (trace_spec != 0)
+		{
+			if (trace_capture(db->traces, trace_spec - 1, db->session->regs, &db->session->mem, db->session->load_bias,
+				*handling_since, db->break_points->hit_counts[slot]) == -1)
+			{
+				return -1;
+			}
+			continue;
+		}
+
+		// only hits that would have stopped are ignored
+		if (db->break_points->ignore_counts[slot] > 0)
+		{
+			db->break_points->ignore_counts[slot]--;
+			continue;
+		}
+
+		if (db->coverage != NULL)
+		{
+			cov_record(db->coverage, bp_addr);
+		}
+
+		if (!one_shot)
+		{
+			db->session->current->reported_bp = bp_addr;
+			report_stop(db, "Breakpoint", bp_addr);
+			return 0;
+		}
+
+		// one shot breakpoints are restored permanently so each site only ever traps once
+		if (bp_disable(db->break_points, &db->session->mem, (size_t)slot) == -1 ||
+			bp_remove_bulk(db->break_points, &db->session->mem, &bp_addr, 1) == -1)
+		{
+			logger(ERROR, "Failed to remove one shot breakpoint %p", (void *)bp_addr);
+			return -1;
+		}
+	}
+}
+
+// Handles whatever the running tracee has done since it was last looked at. Once it has
+// stopped somewhere the user needs to know about the other threads are halted as well in all
+// stop mode and the agent's records collected. Returns -1 for errors.
+static int advance(Debugger *db)
+{
+	uint64_t handling_since = monotonic_ns();
+	int res = run_until_stop(db, &handling_since);
+	if (res == TRACEE_RUNNING)
+	{
+		return 0;
+	}
+
+	// in all stop mode every thread stays stopped while at the prompt
+	if (res == 0 && !db->non_stop && !tracee_exited(db->session))
+	{
+		int halted = halt_threads(db->session, false);
+		if (halted != 0)
+		{
+			res = halted == 1 ? finish_coverage(db) : -1;
+		}
+	}
+	drain_agent(db);
+	el_set_timer(db->events, 0);
+
+	// time spent at the prompt isnt overhead, the rest is recorded once the tracee runs again
+	if (db->hit_id != 0)
+	{
+		db->hit_overhead_ns += monotonic_ns() - handling_since;
+	}
+	return res;
+}
+
+// Restarts a paused process. It runs until it stops somewhere the user needs to know about
+// while the prompt stays usable.
+int continue_execution(Debugger *db)
+{
+	if (db->session == NULL || (db->session != NULL && !db->session->active))
+	{
+		logger(WARN, "No active debugging session.");
+		return 0;
+	}
+
+	if (db->running)
+	{
+		logger(WARN, "Process %d is already running.", db->session->pid);
+		return 0;
+	}
+
+	// the agent only records while there is room in its ring so it is emptied as it runs
+	if (db->agent != NULL && el_set_timer(db->events, AGENT_DRAIN_PERIOD_NS) == -1)
+	{
+		return -1;
+	}
+	return advance(db);
+}
+
+// Stops the running tracee wherever it is, as Ctrl-C does
+int interrupt_execution(Debugger *db)
+{
+	DebugSession *session = db->session;
+	if (session == NULL || !session->active)
+	{
+		logger(WARN, "No active debugging session.");
+		return 0;
+	}
+
+	// in non stop mode threads can be running while at the prompt
+	bool any_running = db->running;
+	for (size_t i = 0; i < session->threads->count && !any_running; i++)
+	{
+		any_running = session->threads->threads[i]->state == THREAD_RUNNING;
+	}
+	if (!any_running)
+	{
+		logger(WARN, "Process %d isnt running.", session->pid);
+		return 0;
+	}
+
+	int halted = halt_threads(session, false);
+	db->running = false;
+	el_set_timer(db->events, 0);
+	drain_agent(db);
+	if (halted != 0)
+	{
+		return halted == 1 ? finish_coverage(db) : -1;
+	}
+
+	// a thread that stopped for something else keeps it to be reported by the next continue
+	TraceeThread *thread = session->current;
+	for (size_t i = 0; i < session->threads->count && (thread->state != THREAD_STOPPED || thread->status_pending); i++)
+	{
+		thread = session->threads->threads[i];
+	}
+	select_thread(session, thread);
+	report_interrupt(db);
+	return 0;
+}
+
+// Starts a coverage run by placing a one shot breakpoint at every line table address, or
+// every address listed in the given file. The reports are written once the tracee exits.
+int start_coverage(Debugger *db, char *path)
+{
+	if (db->session == NULL || !db->session->active)
+	{
+		logger(WARN, "No active debugging session.");
+		return 0;
+	}
+
+	if (db->coverage != NULL)
+	{
+		logger(WARN, "Coverage run already in progress.");
+		return 0;
+	}
+
+	uint64_t *addrs = NULL;
+	long count = strcmp(path, "") == 0 ? line_table_addresses(db->session, &addrs) : read_address_file(path, &addrs);
+	if (count == -1)
+	{
+		return -1;
+	}
+
+	count = (long)drop_patched_addrs(db, addrs, (size_t)count);
+	db->coverage = new_coverage(addrs, (size_t)count);
+	if (db->coverage == NULL)
+	{
+		free(addrs);
+		return -1;
+	}
+
+	long added = bp_insert_bulk(db->break_points, &db->session->mem, addrs, (size_t)count, BP_ONE_SHOT);
+	free(addrs);
+	if (added == -1)
+	{
+		logger(ERROR, "Failed to set coverage breakpoints.");
+		free_coverage(db->coverage);
+		db->coverage = NULL;
+		return -1;
+	}
+
+	logger(INFO, "Tracking coverage of %d sites.", (int)db->coverage->count);
+	return continue_execution(db);
+}
+
+// Prints len bytes of tracee memory starting at the given address as a hex dump
+int examine_memory(Debugger *db, char *addr_arg, char *len_arg)
+{
+	if (db->session == NULL || !db->session->active)
+	{
+		logger(WARN, "No active debugging session.");
+		return 0;
+	}
+
+	if (strcmp(addr_arg, "") == 0)
+	{
+		logger(WARN, "Usage: x <addr> [len]");
+		return 0;
+	}
+
+	uint64_t addr = strtoull(addr_arg, NULL, 16);
+	size_t len = BYTES_PER_DUMP_LINE;
+	if (strcmp(len_arg, "") != 0)
+	{
+		len = strtoull(len_arg, NULL, 0);
+	}
+
+	if (len == 0)
+	{
+		return 0;
+	}
+
+	if (len > MAX_DUMP_LEN)
+	{
+		logger(WARN, "Can dump at most %d bytes at once.", MAX_DUMP_LEN);
+		return 0;
+	}
+
+	uint8_t *buf = (uint8_t *)malloc(len);
+	if (buf == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for memory dump. %s", strerror(errno));
+		return -1;
+	}
+
+	// the whole range is fetched in one go rather than a word at a time
+	if (read_memory(&db->session->mem, addr, buf, len) == -1)
+	{
+		logger(ERROR, "Failed to read memory at %p", (void *)addr);
+		free(buf);
+		return -1;
+	}
+
+	for (size_t line = 0; line < len; line += BYTES_PER_DUMP_LINE)
+	{
+		printf("%016lx: ", (unsigned long)(addr + line));
+		for (size_t i = line; i < line + BYTES_PER_DUMP_LINE; i++)
+		{
+			if (i < len)
+			{
+				printf("%02x ", buf[i]);
+			}
+			else
+			{
+				printf("   ");
+			}
+		}
+
+		printf(" ");
+		for (size_t i = line; i < line + BYTES_PER_DUMP_LINE && i < len; i++)
+		{
+			putchar(buf[i] >= 0x20 && buf[i] < 0x7f ? buf[i] : '.');
+		}
+		printf("\n");
+	}
+
+	free(buf);
+	return 0;
+}
+
+// Prints the tracee's call stack from the innermost frame out, at most count_arg frames of it
+int backtrace(Debugger *db, char *count_arg)
+{
+	if (db->session == NULL || !db->session->active)
+	{
+		logger(WARN, "No active debugging session.");
+		return 0;
+	}
+
+	size_t max_frames = MAX_BACKTRACE_FRAMES;
+	if (strcmp(count_arg, "") != 0)
+	{
+		if (!is_number(count_arg) || strtoul(count_arg, NULL, 10) == 0)
+		{
+			logger(WARN, "Usage: bt [count]");
+			return 0;
+		}
+		unsigned long count = strtoul(count_arg, NULL, 10);
+		max_frames = count < MAX_BACKTRACE_FRAMES ? count : MAX_BACKTRACE_FRAMES;
+	}
+
+	// the unwinder keeps the call frame info it has read for the rest of the session
+	if (db->unwinder == NULL)
+	{
+		db->unwinder = new_unwinder(db->session->pid, &db->session->mem);
+		if (db->unwinder == NULL)
+		{
+			return -1;
+		}
+	}
+
+	if (load_reg_cache(db->session->regs) == -1)
+	{
+		return -1;
+	}
+
+	UnwindFrame *frames = malloc(max_frames * sizeof(UnwindFrame));
+	if (frames == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for the backtrace. %s", strerror(errno));
+		return -1;
+	}
+
+	uint64_t start = monotonic_ns();
+	long count = unwind_stack(db->unwinder, &db->session->regs->regs, frames, max_frames);
+	uint64_t elapsed_ns = monotonic_ns() - start;
+	if (count == -1)
+	{
+		logger(ERROR, "Failed to unwind the stack.");
+		free(frames);
+		return -1;
+	}
+	logger(DEBUG, "Unwound %d frames in %d us.", (int)count, (int)(elapsed_ns / 1000));
+
+	for (long i = 0; i < count; i++)
+	{
+		char where[MAX_LINE_SIZE];
+		uint64_t pc = frames[i].pc;
+		describe_code_addr(db, pc, i > 0 ? pc - 1 : pc, where, MAX_LINE_SIZE);
+
+		// code outside the executable is named by the file it is in
+		const char *path = where[0] == '\0' ? unwind_module_path(db->unwinder, pc) : NULL;
+		const char *file_name = path != NULL ? strrchr(path, '/') + 1 : NULL;
+		printf("#%-4ld 0x%016lx%s%s%s\n", i, (unsigned long)pc, where, file_name != NULL ? " from " : "",
+			file_name != NULL ? file_name : "");
+	}
+
+	free(frames);
+	return 0;
+}
+
+// Lists the functions whose demangled name matches the given extended regular expression
+int list_functions(Debugger *db, char *pattern)
+{
+	if (db->session == NULL)
+	{
+		logger(WARN, "No executable loaded.");
+		return 0;
+	}
+
+	SymbolTable *symbols = get_symbols(db->session);
+	if (symbols == NULL)
+	{
+		logger(WARN, "No symbols available.");
+		return 0;
+	}
+
+	// an empty pattern lists every function
+	size_t *matches;
+	long count = search_functions(symbols, strcmp(pattern, "") == 0 ? "." : pattern, &matches);
+	if (count == -1)
+	{
+		return -1;
+	}
+
+	for (long i = 0; i < count; i++)
+	{
+		const Symbol *symbol = &symbols->symbols[matches[i]];
+		printf("%016lx %s\n", (unsigned long)(symbol->addr + db->session->load_bias),
+			st_get(symbols->display_names, symbols->display_ids[matches[i]] - 1));
+	}
+	free(matches);
+
+	logger(INFO, "%d matching functions.", (int)count);
+	return 0;
+}
+
+// Formats a duration using the largest unit it is at least one of
+void format_ns(uint64_t ns, char *buf, size_t size)
+{
+	if (ns < 1000)
+	{
+		snprintf(buf, size, "%lluns", (unsigned long long)ns);
+	}
+	else if (ns < 1000000)
+	{
+		snprintf(buf, size, "%.1fus", ns / 1e3);
+	}
+	else if (ns < 1000000000)
+	{
+		snprintf(buf, size, "%.1fms", ns / 1e6);
+	}
+	else
+	{
+		snprintf(buf, size, "%.1fs", ns / 1e9);
+	}
+}
+
+// Prints the mean and the non empty buckets of a log2 histogram of nanoseconds
+void print_histogram(const char *title, const uint32_t *hist, uint64_t total_ns, uint64_t count)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	char mean[MAX_PART_SIZE];
+	format_ns(total_ns / count, mean, MAX_PART_SIZE);
+	printf("    %s: mean %s over %llu\n", title, mean, (unsigned long long)count);
+
+	for (size_t i = 0; i < BP_HIST_BUCKETS; i++)
+	{
+		if (hist[i] == 0)
+		{
+			continue;
+		}
+
+		char low[MAX_PART_SIZE];
+		char high[MAX_PART_SIZE];
+		format_ns(1ull << i, low, MAX_PART_SIZE);
+		format_ns(1ull << (i + 1), high, MAX_PART_SIZE);
+		printf("      [%8s, %8s) %u\n", low, high, hist[i]);
+	}
+}
+
+// Lists every breakpoint with how often it was hit, the time between hits and how long the
+// debugger took to handle each hit
+int list_breakpoints(Debugger *db)
+{
+	if (db->session == NULL)
+	{
+		logger(WARN, "No executable loaded.");
+		return 0;
+	}
+
+	drain_agent(db);
+	BreakPointStore *store = db->break_points;
+	size_t one_shot_count = 0;
+	for (size_t slot = 0; slot < store->count; slot++)
+	{
+		// coverage runs can set hundreds of thousands of these
+		if (store->flags[slot] & BP_ONE_SHOT)
+		{
+			one_shot_count++;
+			continue;
+		}
+
+		char where[MAX_LINE_SIZE];
+		describe_addr(db, store->addrs[slot], where, MAX_LINE_SIZE);
+		printf("%-4u %016lx%s\n", store->ids[slot], (unsigned long)store->addrs[slot], where);
+		printf("    hits %llu", (unsigned long long)store->hit_counts[slot]);
+		if (store->ignore_counts[slot] > 0)
+		{
+			printf(", ignoring next %llu", (unsigned long long)store->ignore_counts[slot]);
+		}
+		if (store->conditions[slot] != NULL)
+		{
+			printf(", %s if %s", store->trace_specs[slot] != 0 ? "traces" : "stops", store->conditions[slot]->source);
+		}
+		if (store->trace_specs[slot] != 0)
+		{
+			const TraceSpec *spec = &db->traces->specs[store->trace_specs[slot] - 1];
+			printf(", collecting");
+			for (size_t i = 0; i < spec->item_count; i++)
+			{
+				printf(" %s", spec->items[i].label);
+			}
+			if (store->flags[slot] & BP_FAST)
+			{
+				printf(" in the agent");
+			}
+		}
+		printf("\n");
+
+		const BreakPointStats *stats = store->stats[slot];
+		if (stats != NULL)
+		{
+			print_histogram("between hits", stats->interval_hist, stats->interval_total_ns, stats->interval_count);
+			print_histogram("debugger overhead", stats->overhead_hist, stats->overhead_total_ns, stats->overhead_count);
+		}
+	}
+
+	for (size_t slot = 0; slot < HW_SLOT_COUNT; slot++)
+	{
+		const HwBreakPoint *bp = &db->hw_break_points->slots[slot];
+		if (bp->used)
+		{
+			const char *kind = bp->type == HW_EXECUTE ? "hardware breakpoint" : bp->type == HW_WRITE ? "watchpoint" : "access watchpoint";
+			printf("hw%-2d %016lx %s on %u bytes\n", (int)slot, (unsigned long)bp->addr, kind, bp->len);
+		}
+	}
+
+	for (size_t i = 0; i < db->page_watches->count; i++)
+	{
+		const WatchRegion *region = &db->page_watches->regions[i];
+		printf("pw%-2u %016lx region watchpoint on %llu bytes\n", region->id, (unsigned long)region->addr,
+			(unsigned long long)region->len);
+	}
+
+	if (one_shot_count > 0)
+	{
+		logger(INFO, "%d coverage breakpoints not shown.", (int)one_shot_count);
+	}
+	return 0;
+}
+
+// Skips the next count hits of the breakpoint with the given number that would have stopped
+int ignore_breakpoint(Debugger *db, char *id_arg, char *count_arg)
+{
+	if (!is_number(id_arg) || !is_number(count_arg))
+	{
+		logger(WARN, "Usage: ignore <breakpoint> <count>");
+		return 0;
+	}
+
+	long slot = bp_find_id(db->break_points, (uint32_t)strtoul(id_arg, NULL, 10));
+	if (slot == -1)
+	{
+		logger(WARN, "No breakpoint %s.", id_arg);
+		return 0;
+	}
+
+	db->break_points->ignore_counts[slot] = strtoull(count_arg, NULL, 10);
+	logger(INFO, "Ignoring the next %s hits of breakpoint %s.", count_arg, id_arg);
+	return 0;
+}
+
+// Lists the threads of the tracee and where the stopped ones are, marking the current one
+int list_threads(Debugger *db)
+{
+	if (db->session == NULL || !db->session->active)
+	{
+		logger(WARN, "No active debugging session.");
+		return 0;
+	}
+
+	ThreadTable *threads = db->session->threads;
+	for (size_t i = 0; i < threads->count; i++)
+	{
+		TraceeThread *thread = threads->threads[i];
+		const char *state = thread->state == THREAD_RUNNING ? "running" : thread->state == THREAD_EXITED ? "exited" :
+			thread->state == THREAD_STARTING ? "starting" : "stopped";
+
+		char where[MAX_LINE_SIZE] = "";
+		if (thread->state == THREAD_STOPPED)
+		{
+			uint64_t ip = (uint64_t)get_ip(&thread->regs);
+			size_t len = snprintf(where, MAX_LINE_SIZE, " at %016lx", (unsigned long)ip);
+			describe_addr(db, ip, where + len, MAX_LINE_SIZE - len);
+		}
+		printf("%c %-8d %s%s\n", thread == db->session->current ? '*' : ' ', thread->tid, state, where);
+	}
+	return 0;
+}
+
+// Makes the stopped thread with the given id the one commands act on
+int switch_thread(Debugger *db, char *tid_arg)
+{
+	if (db->session == NULL || !db->session->active)
+	{
+		logger(WARN, "No active debugging session.");
+		return 0;
+	}
+
+	if (!is_number(tid_arg))
+	{
+		logger(WARN, "Usage: thread <tid>");
+		return 0;
+	}
+
+	TraceeThread *thread = thread_find(db->session->threads, (int)strtol(tid_arg, NULL, 10));
+	if (thread == NULL || thread->state != THREAD_STOPPED)
+	{
+		logger(WARN, "No stopped thread %s.", tid_arg);
+		return 0;
+	}
+
+	// the stop is reported by the next continue rather than skipped
+	if (thread->status_pending)
+	{
+		logger(WARN, "Thread %s stopped for something not reported yet, continue to see it.", tid_arg);
+		return 0;
+	}
+
+	select_thread(db->session, thread);
+	char where[MAX_LINE_SIZE];
+	uint64_t ip = (uint64_t)get_ip(db->session->regs);
+	describe_addr(db, ip, where, MAX_LINE_SIZE);
+	logger(INFO, "Switched to thread %d at %p%s.", thread->tid, (void *)ip, where);
+	return 0;
+}
+
+// Turns non stop mode on or off, or shows whether it is on
+int set_non_stop(Debugger *db, char *mode_arg)
+{
+	if (strcmp(mode_arg, "on") == 0)
+	{
+		db->non_stop = true;
+	}
+	else if (strcmp(mode_arg, "off") == 0)
+	{
+		db->non_stop = false;
+
+		// the threads left running are stopped like they would have been
+		if (db->session != NULL && db->session->active && !tracee_exited(db->session) &&
+			halt_threads(db->session, false) == -1)
+		{
+			return -1;
+		}
+	}
+	else if (strcmp(mode_arg, "") != 0)
+	{
+		logger(WARN, "Usage: nonstop [on|off]");
+		return 0;
+	}
+
+	logger(INFO, db->non_stop ? "Non stop mode is on, only the thread that stops is halted." :
+		"Non stop mode is off, every thread is halted when one stops.");
+	return 0;
+}
+
+// Runs the info subcommand given
+int info(Debugger *db, char *subcommand, char *arg)
+{
+	if (has_prefix(subcommand, "func"))
+	{
+		return list_functions(db, arg);
+	}
+
+	if (has_prefix(subcommand, "b"))
+	{
+		return list_breakpoints(db);
+	}
+
+	if (has_prefix(subcommand, "th"))
+	{
+		return list_threads(db);
+	}
+
+	logger(WARN, "Usage: info functions [regex] | info breakpoints | info threads");
+	return 0;
+}
+
+// Deals with the stops of threads that were halted before they could be handled, undoing
+// breakpoint hits so the original instruction runs once the int3 is gone and keeping signals
+// to be passed on. Returns -1 for errors.
+static int settle_pending_stops(Debugger *db)
+{
+	// faults on watched pages go away with the watchpoints
+	if (drop_page_faults(db) == -1)
+	{
+		return -1;
+	}
+
+	DebugSession *session = db->session;
+	TraceeThread *current = session->current;
+	int res = 0;
+	for (size_t i = 0; i < session->threads->count && res == 0; i++)
+	{
+		TraceeThread *thread = session->threads->threads[i];
+		if (!thread->status_pending || (thread->status >> 16) != 0)
+		{
+			continue;
+		}
+		thread->status_pending = false;
+
+		int sig = WSTOPSIG(thread->status);
+		if (sig != SIGTRAP)
+		{
+			thread->pending_signal = sig;
+			continue;
+		}
+
+		long slot;
+		select_thread(session, thread);
+		res = rewind_breakpoint_hit(db, &slot) == -1 ? -1 : 0;
+	}
+	select_thread(session, current);
+	return res;
+}
+
+// Lets go of an attached tracee, first taking out everything the debugger wrote into it so it
+// carries on as if it had never been traced. The breakpoints are kept for the next session.
+// If something cant be taken out the tracee is only let go of when forced. Returns -1 for errors.
+static int release_tracee(Debugger *db, bool force)
+{
+	DebugSession *session = db->session;
+	// every thread has to be stopped, which they arent in non stop mode
+	int halted = halt_threads(session, false);
+	db->running = false;
+	if (halted == 1)
+	{
+		session->active = false;
+		return finish_coverage(db);
+	}
+	if ((halted == -1 || settle_pending_stops(db) == -1) && !force)
+	{
+		return -1;
+	}
+	int res = 0;
+
+	// the jumps go to trampolines that stay behind in the tracee, unused
+	if (db->agent != NULL)
+	{
+		drain_agent(db);
+		for (size_t slot = 0; slot < db->break_points->count; slot++)
+		{
+			if ((db->break_points->flags[slot] & BP_FAST) && agent_unpatch(db->agent, session, db->break_points, slot) == -1)
+			{
+				res = -1;
+			}
+		}
+		free_agent(db->agent);
+		db->agent = NULL;
+	}
+
+	// every int3 goes in one batch, a hit after detaching would kill the process
+	long restored = bp_disarm_all(db->break_points, &session->mem);
+	if (restored == -1 || pw_remove_all(db->page_watches, session) == -1)
+	{
+		res = -1;
+	}
+	for (size_t i = 0; i < session->threads->count; i++)
+	{
+		TraceeThread *thread = session->threads->threads[i];
+		if (thread->state == THREAD_STOPPED && hw_disarm_all(db->hw_break_points, thread->tid) == -1)
+		{
+			res = -1;
+		}
+	}
+
+	if (res == -1)
+	{
+		logger(ERROR, "Failed to restore process %d.", session->pid);
+		if (!force)
+		{
+			return -1;
+		}
+	}
+
+	// the coverage so far is still worth writing out
+	if (finish_coverage(db) == -1)
+	{
+		res = -1;
+	}
+	db->hit_id = 0;
+
+	// a breakpoint stop has already been rewound to the breakpoint in the register cache
+	if (detach_tracee(session) == -1)
+	{
+		return -1;
+	}
+
+	if (db->unwinder != NULL)
+	{
+		free_unwinder(db->unwinder);
+		db->unwinder = NULL;
+	}
+	logger(INFO, "Detached from process %d, removed %d breakpoints.", session->pid, (int)(restored == -1 ? 0 : restored));
+	return res;
+}
+
+// Ends the current session so the given one can replace it. Returns true if the new session
+// took over the old one's debug info, in which case the breakpoints are still valid.
+static bool end_session(Debugger *db, DebugSession *next, uint64_t *old_load_bias)
+{
+	// restarting an unchanged executable keeps the decoded debug info and the breakpoints
+	bool reused = false;
+	if (db->session != NULL)
+	{
+		// attached processes are let go of rather than killed
+		if (db->session->attached && db->session->active)
+		{
+			release_tracee(db, true);
+		}
+
+		// the agent's records outlive the tracee but its jumps dont
+		if (db->agent != NULL)
+		{
+			drain_agent(db);
+			free_agent(db->agent);
+			db->agent = NULL;
+		}
+
+		// the modules and stack belong to the old process
+		if (db->unwinder != NULL)
+		{
+			free_unwinder(db->unwinder);
+			db->unwinder = NULL;
+		}
+
+		kill_tracee(db->session);
+		reused = reuse_debug_info(next, db->session);
+		*old_load_bias = db->session->load_bias;
+
+		logger(DEBUG, "Clearing debug session for program %s. PID: %d", db->session->prog, db->session->pid);
+		remove_debug_session(db->session);
+		db->session = NULL;
+	}
+
+	if (!reused && db->break_points->count > 0)
 	{
-		return 1;
+		// the addresses mean nothing in a different or rebuilt executable
+		logger(WARN, "Executable changed, clearing %d breakpoints.", (int)db->break_points->count);
+		bp_clear(db->break_points);
 	}
 
-	BreakPointType bp_type = LINE;
-	int base = 10;
-	if (has_prefix(cmd_arg, "0x"))
+	if (!reused)
 	{
-		bp_type = ADDR;
-		base = 16;
+		hw_clear(db->hw_break_points);
 	}
 
-	unsigned int pos = strtoll(cmd_arg, NULL, base);
-
-	BreakPoint *bp = new_bp(db->session->pid, bp_type, pos);
-	if (bp == NULL)
+	// like watched regions, raw addresses cant be moved with the executable
+	long raw_hw = hw_clear_raw(db->hw_break_points);
+	if (raw_hw > 0)
 	{
-		logger(ERROR, "failed to create break point %s", cmd_arg);
-		return -1;
+		logger(WARN, "Clearing %d hardware breakpoints set at raw addresses.", (int)raw_hw);
 	}
+	db->hit_id = 0;
 
-	// use the line or address of the bp as the key for the map.
-	m_set(db->break_points, cmd_arg, (void *)bp);
-
-	int enable_ret = enable(bp);
-	if (enable_ret < 0)
+	// watched regions are often on the heap so their addresses mean nothing in a new run
+	if (db->page_watches->count > 0)
 	{
-		logger(ERROR, "failed to enable breakpoint: %s", cmd_arg);
-		return -1;
+		logger(WARN, "Clearing %d region watchpoints.", (int)db->page_watches->count);
 	}
-	return 0;
+	pw_clear(db->page_watches);
+	return reused;
 }
 
-// Removes the given break point
-int remove_break_point(Debugger *db, char *cmd_arg)
+// Installs the breakpoints kept from the last session into the stopped tracee. Returns -1
+// for errors.
+static int rearm_session(Debugger *db, uint64_t old_load_bias)
 {
-	if (db->session == NULL)
+	// the tracee is stopped so every breakpoint goes in at once
+	if (db->break_points->count > 0)
 	{
-		logger(WARN, "No active debugging session.");
-		return 0;
+		long rearmed = bp_rearm_all(db->break_points, &db->session->mem, (int64_t)(db->session->load_bias - old_load_bias));
+		if (rearmed == -1)
+		{
+			logger(ERROR, "Failed to reinstall breakpoints.");
+			return -1;
+		}
+		logger(INFO, "Reinstalled %d breakpoints.", (int)rearmed);
 	}
 
-	if (m_is_empty(db->break_points))
+	// debug registers belong to the old process so they are programmed again
+	long hw_rearmed = hw_rearm_all(db->hw_break_points, db->session->current->tid, (int64_t)(db->session->load_bias - old_load_bias));
+	if (hw_rearmed == -1 || (hw_rearmed > 0 && copy_debug_regs(db) == -1))
 	{
-		return 1;
+		logger(ERROR, "Failed to reinstall hardware breakpoints.");
+		return -1;
 	}
-	BreakPoint *bp = (BreakPoint *)m_get(db->break_points, cmd_arg);
-	if (bp == NULL)
+
+	for (size_t slot = 0; slot < HW_SLOT_COUNT; slot++)
 	{
-		logger(ERROR, "Breakpoint not found.");
-		return 1;
+		HwBreakPoint *bp = &db->hw_break_points->slots[slot];
+		if (bp->used && bp->type != HW_EXECUTE && read_watched_value(db, bp, &bp->value) == -1)
+		{
+			return -1;
+		}
 	}
 
-	int res = disable(bp);
-	if (res < 0)
+	if (hw_rearmed > 0)
 	{
-		logger(ERROR, "Failed to disable breakpoint %s.", cmd_arg);
-		return -1;
+		logger(INFO, "Reinstalled %d hardware breakpoints.", (int)hw_rearmed);
 	}
-
-	m_remove(db->break_points, cmd_arg);
-
-	free(bp);
 	return 0;
 }
 
-// Checks the current instruction for a break point and steps over it if one exists
-int step_over_breakpoint(Debugger *db)
+// Starts a new debugging session by forking the current process and running the given executable.
+int start_debug_session(Debugger *db, char *prog)
 {
-	// use the instruction pointer to check for break points and if one is found
-	// we temporarily disable it.
+	if (prog == NULL)
+	{
+		logger(WARN, "No executable provided.");
+		return 0;
+	}
 
-	void *next_instruction_addr = get_ip(db->session->pid);
-	if (next_instruction_addr == NULL)
+	// the child waits on the pipe until it has been seized
+	int ready[2];
+	if (pipe(ready) == -1)
 	{
-		logger(ERROR, "Failed to get instruction pointer");
+		logger(ERROR, "Failed to create pipe. %s", strerror(errno));
 		return -1;
 	}
 
-	void *current_instruction_addr = next_instruction_addr - 1;
-
-	logger(DEBUG, "Checking for breakpoint at address %p. RIP at %p", current_instruction_addr, next_instruction_addr);
-
-	// check for break point at that address
-	char bp_key[MAX_KEY_SIZE];
-	sprintf(bp_key, "%p", current_instruction_addr);
-
-	BreakPoint *bp = (BreakPoint *)m_get(db->break_points, bp_key);
-
-	if (bp == NULL)
+	// anything buffered would be written twice
+	fflush(stdout);
+	int pid = fork();
+	if (pid == -1)
 	{
-		return 0;
+		logger(ERROR, "Failed to fork. ERRNO: %d\n", errno);
+		close(ready[0]);
+		close(ready[1]);
+		return -1;
 	}
 
-	if (!bp->enabled)
+	if (pid == 0)
 	{
-		return 0;
+		close(ready[1]);
+		// the signal mask survives exec, the program shouldnt start with the debugger's
+		if (db->events != NULL)
+		{
+			sigprocmask(SIG_SETMASK, &db->events->old_mask, NULL);
+		}
+		return start_seized(prog, ready[0]);
 	}
+	close(ready[0]);
 
-	logger(DEBUG, "Found breakpoint: %s", bp_key);
-
-	int set_ip_res = set_ip(db->session->pid, current_instruction_addr);
-	if (set_ip_res == -1)
+	// Since prog still potentially points to the old session at this point need
+	// to create the new session before freeing the old
+	// one so we dont accidently store garbage
+	DebugSession *dbs = new_debug_session(prog, pid);
+	if (dbs == NULL || seize_child(dbs) == -1)
 	{
-		logger(ERROR, "failed to set instruction pointer");
+		// the child would otherwise run the program untraced
+		kill(pid, SIGKILL);
+		close(ready[1]);
+		waitpid(pid, NULL, 0);
+		if (dbs != NULL)
+		{
+			remove_debug_session(dbs);
+		}
 		return -1;
 	}
 
-	logger(DEBUG, "RIP set to %p", current_instruction_addr);
+	// the old tracee is reaped waiting on any thread, so the child only starts afterwards
+	uint64_t old_load_bias = 0;
+	bool reused = end_session(db, dbs, &old_load_bias);
+	close(ready[1]);
 
-	int dis_res = disable(bp);
-	if (dis_res == -1)
-	{
-		logger(ERROR, "failed to disable breakpoint %s", bp_key);
-		return -1;
-	}
+	db->session = dbs;
 
-	ErrResult step_res = ptrace_with_error(PTRACE_SINGLESTEP, db->session->pid, NULL, NULL);
-	if (!step_res.success)
+	if (!reused && parse_dwarf_info(db->session) == -1)
 	{
-		logger(ERROR, "failed stepping to next instruction");
+		logger(ERROR, "Failed to parse DWARF info");
+		// dont leave the forked child stopped behind us
+		kill_tracee(db->session);
 		return -1;
 	}
 
-	int pid_res = waitpid(db->session->pid, &db->session->wait_status, WAIT_OPTIONS);
-	if (pid_res == -1)
+	// we are the parent process so begin debugging
+	logger(INFO, "Debug session started for executable %s. Session PID: %d.", db->session->prog, pid);
+
+	// wait until child process is executing, it stops as it finishes the exec
+	if (wait_for_tracee(db->session) == -1)
 	{
-		logger(ERROR, "failed to wait for process %d. %s", db->session->pid, strerror(errno));
 		return -1;
 	}
 
-	int en_res = enable(bp);
-	if (en_res == -1)
+	if (read_load_bias(db->session) == -1)
 	{
-		logger(ERROR, "failed to re-enable breakpoint %s", bp_key);
-		return -1;
+		logger(WARN, "Failed to find load address, assuming the executable isnt relocated.");
 	}
 
-	return 0;
+	// the tracee is stopped before its first instruction
+	return rearm_session(db, old_load_bias);
 }
 
-// Restarts a paused process
-int continue_execution(Debugger *db)
+// Attaches to the running process with the given pid. Its debug info is loaded while it
+// carries on running so it is only stopped for as long as the interrupt takes.
+int attach(Debugger *db, char *pid_arg)
 {
-	if (db->session == NULL || (db->session != NULL && !db->session->active))
+	char *end;
+	long pid = strtol(pid_arg, &end, 10);
+	if (pid_arg[0] == '\0' || *end != '\0' || pid <= 0)
 	{
-		logger(WARN, "No active debugging session.");
+		logger(WARN, "Usage: attach <pid>");
 		return 0;
 	}
 
-	int step_err = step_over_breakpoint(db);
-	if (step_err == -1)
+	if (db->session != NULL && db->session->active && db->session->pid == pid)
 	{
-		logger(ERROR, "failed to step over breakpoints");
-		return -1;
+		logger(WARN, "Already debugging process %d.", (int)pid);
+		return 0;
+	}
+
+	// the file the process is running, through the link if it has been deleted or replaced
+	char exe_link[PROC_PATH_SIZE];
+	snprintf(exe_link, PROC_PATH_SIZE, "/proc/%d/exe", (int)pid);
+	char prog[PATH_MAX];
+	ssize_t len = readlink(exe_link, prog, PATH_MAX - 1);
+	if (len == -1)
+	{
+		logger(WARN, "Cant find the executable of process %d. %s", (int)pid, strerror(errno));
+		return 0;
+	}
+	prog[len] = '\0';
+	if (access(prog, R_OK) != 0)
+	{
+		strcpy(prog, exe_link);
 	}
 
-	ErrResult cont_res = ptrace_with_error(PTRACE_CONT, db->session->pid, NULL, NULL);
-	if (!cont_res.success)
+	DebugSession *dbs = new_debug_session(prog, (int)pid);
+	if (dbs == NULL)
 	{
 		return -1;
 	}
 
-	int pid_result = waitpid(db->session->pid, &db->session->wait_status, WAIT_OPTIONS);
-	if (pid_result == -1)
+	uint64_t old_load_bias = 0;
+	bool reused = end_session(db, dbs, &old_load_bias);
+	db->session = dbs;
+
+	if (!reused && parse_dwarf_info(dbs) == -1)
 	{
-		logger(ERROR, "failed to wait for process %d. %s", db->session->pid, strerror(errno));
+		logger(ERROR, "Failed to parse DWARF info");
 		return -1;
 	}
-	return 0;
-}
 
-// Starts a new debugging session by forking the current process and running the given executable.
-int start_debug_session(Debugger *db, char *prog)
-{
-	if (prog == NULL)
+	// everything lazily decoded is decoded now rather than while the process waits
+	if (dbs->line_table != NULL && line_table_load_all(dbs->line_table) == -1)
 	{
-		logger(WARN, "No executable provided.");
-		return 0;
+		logger(WARN, "Failed to decode the line table of %s.", dbs->prog);
 	}
+	get_symbols(dbs);
 
-	int pid = fork();
-	if (pid == -1)
+	if (seize_tracee(dbs) == -1)
 	{
-		logger(ERROR, "Failed to fork. ERRNO: %d\n", errno);
 		return -1;
 	}
 
-	if (pid == 0)
+	if (read_load_bias(dbs) == -1)
 	{
-		return start_tracing(prog);
+		logger(WARN, "Failed to find load address, assuming the executable isnt relocated.");
 	}
 
-	// Since prog still potentially points to the old session at this point need
-	// to create the new session before freeing the old
-	// one so we dont accidently store garbage
-	DebugSession *dbs = new_debug_session(prog, pid);
-
-	if (db->session != NULL)
+	uint64_t stop_start = monotonic_ns();
+	int stopped = halt_threads(dbs, false);
+	if (stopped != 0)
 	{
-		logger(DEBUG, "Clearing debug session for program %s. PID: %d", db->session->prog, db->session->pid);
-		remove_debug_session(db->session);
+		if (stopped == 1)
+		{
+			logger(WARN, "Process %d exited before it could be stopped.", (int)pid);
+			return 0;
+		}
+		return -1;
 	}
+	select_thread(dbs, dbs->threads->threads[0]);
 
-	db->session = dbs;
-	db->session->active = true;
-
-	int dwarf_res = parse_dwarf_info(db->session);
-	if (dwarf_res == -1)
+	if (rearm_session(db, old_load_bias) == -1)
 	{
-		logger(ERROR, "Failed to parse DWARF info");
 		return -1;
 	}
 
-	// we are the parent process so begin debugging
-	logger(INFO, "Debug session started for executable %s. Session PID: %d.", db->session->prog, pid);
+	uint64_t stop_us = (monotonic_ns() - stop_start) / 1000;
+	logger(INFO, "Attached to process %d running %s, stopped it in %d us.", (int)pid, dbs->prog, (int)stop_us);
+	return 0;
+}
 
-	// wait until child process is executing
-	if (waitpid(pid, &db->session->wait_status, WAIT_OPTIONS) < 0)
+// Detaches from an attached process, removing everything written into it, and lets it carry on
+int detach(Debugger *db)
+{
+	if (db->session == NULL || !db->session->active)
 	{
-		logger(ERROR, "failed to wait for process %d. %s", db->session->pid, strerror(errno));
-		return -1;
+		logger(WARN, "No active debugging session.");
+		return 0;
 	}
-	return 0;
+
+	if (!db->session->attached)
+	{
+		logger(WARN, "Process %d was started by edb, use run or quit to end it.", db->session->pid);
+		return 0;
+	}
+	return release_tracee(db, false);
 }
 
 int run(Debugger *db, char *prog)
@@ -297,17 +2616,37 @@ int run(Debugger *db, char *prog)
 int quit(Debugger *db)
 {
 	logger(INFO, "Exiting.");
-	if (db->session != NULL && db->session->active)
+
+	// lets the session cache anything it decoded
+	if (db->session != NULL)
 	{
-		int res = kill(db->session->pid, SIGKILL);
-		if (res == -1)
+		if (db->session->attached && db->session->active)
 		{
-			logger(ERROR, "Failed to terminate on going debug session with pid %d. %s", db->session->pid, strerror(errno));
+			release_tracee(db, true);
 		}
+		kill_tracee(db->session);
+		remove_debug_session(db->session);
+		db->session = NULL;
 	}
 	return EXIT;
 }
 
+// Returns the rest of the input after the given number of space separated words. Spaces in
+// single quotes are part of the word.
+char *skip_words(char *input, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		input += strspn(input, " \t");
+		bool quoted = false;
+		for (; *input != '\0' && *input != '\n' && (quoted || (*input != ' ' && *input != '\t')); input++)
+		{
+			quoted ^= *input == '\'';
+		}
+	}
+	return input;
+}
+
 // Parses and runs the given command. Returns 1 if the command was not recognised
 // and -1 for errors.
 int parse_cmd(Debugger *db, char *input)
@@ -324,11 +2663,26 @@ int parse_cmd(Debugger *db, char *input)
 
 	int j = 0;
 	int part_idx = 0;
+	// a word in single quotes can hold spaces, such as a C++ name like 'f(int) const'
+	bool quoted = false;
 	for (int i = 0; i < strlen(input); i++)
 	{
-		if (input[i] == ' ' || input[i] == '\n')
+		if (input[i] == '\'')
+		{
+			quoted = !quoted;
+		}
+		else if (input[i] == '\n' || (!quoted && (input[i] == ' ' || input[i] == '\t')))
 		{
+			// runs of spaces separate words like single ones do
+			if (j == 0)
+			{
+				continue;
+			}
 			command_parts[part_idx][j] = '\0';
+			if (part_idx == MAX_COMMAND_PARTS - 1)
+			{
+				break;
+			}
 			part_idx++;
 			j = 0;
 		}
@@ -345,15 +2699,74 @@ int parse_cmd(Debugger *db, char *input)
 	}
 
 	char *first_arg = command_parts[1];
+	char *second_arg = command_parts[2];
+
+	if (has_prefix(base_command, "cov"))
+	{
+		return start_coverage(db, first_arg);
+	}
 
 	if (has_prefix(base_command, "c"))
 	{
 		return continue_execution(db);
 	}
 
+	if (has_prefix(base_command, "bt"))
+	{
+		return backtrace(db, first_arg);
+	}
+
+	if (has_prefix(base_command, "b-all"))
+	{
+		return add_break_point_bulk(db, first_arg);
+	}
+
 	if (has_prefix(base_command, "b"))
 	{
-		return add_break_point(db, first_arg);
+		// the condition is the rest of the line so it can contain spaces
+		char *cond_expr = NULL;
+		if (strcmp(second_arg, "if") == 0)
+		{
+			cond_expr = skip_words(input, 3);
+			cond_expr += strspn(cond_expr, " \t");
+			cond_expr[strcspn(cond_expr, "\n")] = '\0';
+			if (*cond_expr == '\0')
+			{
+				logger(WARN, "Usage: b <location> if <expr>");
+				return 0;
+			}
+		}
+		return add_break_point(db, first_arg, cond_expr);
+	}
+
+	if (has_prefix(base_command, "pwatch"))
+	{
+		return add_region_watch(db, first_arg, second_arg);
+	}
+
+	if (has_prefix(base_command, "pdel"))
+	{
+		return remove_region_watch(db, first_arg);
+	}
+
+	if (has_prefix(base_command, "hdel"))
+	{
+		return remove_hw_break_point(db, first_arg);
+	}
+
+	if (has_prefix(base_command, "hb"))
+	{
+		return add_hw_break_point(db, first_arg, second_arg, HW_EXECUTE);
+	}
+
+	if (has_prefix(base_command, "watch"))
+	{
+		return add_hw_break_point(db, first_arg, second_arg, HW_WRITE);
+	}
+
+	if (has_prefix(base_command, "awatch"))
+	{
+		return add_hw_break_point(db, first_arg, second_arg, HW_READ_WRITE);
 	}
 
 	if (has_prefix(base_command, "del"))
@@ -361,11 +2774,67 @@ int parse_cmd(Debugger *db, char *input)
 		return remove_break_point(db, first_arg);
 	}
 
+	if (has_prefix(base_command, "x"))
+	{
+		return examine_memory(db, first_arg, second_arg);
+	}
+
+	if (has_prefix(base_command, "attach"))
+	{
+		return attach(db, first_arg);
+	}
+
+	if (has_prefix(base_command, "detach"))
+	{
+		return detach(db);
+	}
+
 	if (has_prefix(base_command, "run"))
 	{
 		return run(db, first_arg);
 	}
 
+	if (has_prefix(base_command, "thread"))
+	{
+		return switch_thread(db, first_arg);
+	}
+
+	if (has_prefix(base_command, "nonstop"))
+	{
+		return set_non_stop(db, first_arg);
+	}
+
+	if (has_prefix(base_command, "trace"))
+	{
+		// the items to collect are the rest of the line
+		return add_tracepoint(db, first_arg, skip_words(input, 2));
+	}
+
+	if (has_prefix(base_command, "tdump"))
+	{
+		return dump_traces(db, first_arg);
+	}
+
+	if (has_prefix(base_command, "agent"))
+	{
+		return start_agent(db, first_arg);
+	}
+
+	if (has_prefix(base_command, "ignore"))
+	{
+		return ignore_breakpoint(db, first_arg, second_arg);
+	}
+
+	if (has_prefix(base_command, "interrupt"))
+	{
+		return interrupt_execution(db);
+	}
+
+	if (has_prefix(base_command, "info"))
+	{
+		return info(db, first_arg, second_arg);
+	}
+
 	if (has_prefix(base_command, "q"))
 	{
 		return quit(db);
@@ -373,51 +2842,161 @@ int parse_cmd(Debugger *db, char *input)
 	return 1;
 }
 
-// starts the main debugging loop.
-int run_cmd_loop(Debugger *db, const char *prog)
+// Returns true for the commands that can run while the tracee is running
+static bool runs_while_running(const char *line)
+{
+	char *command = (char *)line + strspn(line, " ");
+	return *command == '\n' || *command == '\0' || has_prefix(command, "interrupt") || has_prefix(command, "info") ||
+		has_prefix(command, "tdump") || has_prefix(command, "q");
+}
+
+// Returns true for an interrupt command
+static bool is_interrupt(const char *line)
+{
+	return has_prefix((char *)line + strspn(line, " "), "interrupt");
+}
+
+// Runs the given command line, reporting what went wrong. Returns EXIT once the debugger
+// should exit.
+static int run_line(Debugger *db, char *line)
 {
-	// intially try to debug the given program
-	switch (start_debug_session(db, (char *)prog))
+	// Run the command but dont exit on failure
+	int cmd_result = parse_cmd(db, line);
+	switch (cmd_result)
 	{
+	case 1:
+		logger(WARN, "Command not recognised: %s", line);
+		break;
 	case -1:
-		logger(ERROR, "Failed to start debug session for executable %s.", prog);
+		logger(ERROR, "Failed to run command: %s", line);
 		break;
 	case EXIT:
-		return 0;
+		return EXIT;
+	default:
+		break;
+	}
+	return 0;
+}
+
+// Handles whatever the event loop found ready other than input. Ctrl-C interrupts the tracee
+// and the tracee's stops are handled as they happen
+static void handle_events(Debugger *db, int ready)
+{
+	DebugSession *session = db->session;
+	bool active = session != NULL && session->active;
+
+	// a tracee started from this terminal shares its process group so it gets the Ctrl-C too
+	// and stops for it on its own
+	if ((ready & EL_INTERRUPT) && active && (session->attached || getpgid(session->pid) != getpgrp()))
+	{
+		if (interrupt_execution(db) == -1)
+		{
+			logger(ERROR, "Failed to interrupt process %d.", session->pid);
+		}
+	}
+
+	if ((ready & EL_TRACEE) && active && db->running && advance(db) == -1)
+	{
+		logger(ERROR, "Failed to handle the stop of process %d.", session->pid);
+	}
+
+	if ((ready & EL_TIMER) && db->running)
+	{
+		drain_agent(db);
+	}
+}
+
+// starts the main debugging loop, attaching to the process with the given pid if there is one
+// and otherwise starting the given program.
+int run_cmd_loop(Debugger *db, const char *prog, const char *pid)
+{
+	// signals are blocked before anything is traced so no stop is missed
+	db->events = new_event_loop(STDIN_FILENO);
+	if (db->events == NULL)
+	{
+		return -1;
+	}
+
+	int res = 0;
+	if (pid != NULL)
+	{
+		if (attach(db, (char *)pid) == -1)
+		{
+			logger(ERROR, "Failed to attach to process %s.", (char *)pid);
+		}
+	}
+	else
+	{
+		// intially try to debug the given program
+		switch (start_debug_session(db, (char *)prog))
+		{
+		case -1:
+			logger(ERROR, "Failed to start debug session for executable %s.", prog);
+			break;
+		case EXIT:
+			free_event_loop(db->events);
+			db->events = NULL;
+			return 0;
+		}
 	}
 
+	// scripts wait for each stop before their next command while a user at a terminal can
+	// look around or interrupt as the tracee runs
+	bool interactive = isatty(STDIN_FILENO);
+	bool prompted = false;
 	char current_line[MAX_LINE_SIZE];
 
 	do
 	{
 		// exit if the child process terminates
-		if (db->session != NULL && db->session->wait_status == 0 && db->session->active)
+		if (db->session != NULL && db->session->active && tracee_exited(db->session))
 		{
 			logger(INFO, "Debug session for executable %s has terminated. Session PID: %d.", db->session->prog, db->session->pid);
 			db->session->active = false;
+			db->running = false;
 		}
 
-		fputs("edb> ", stdout);
-		// fgets will stop hanging when either a \n or a EOF is found
-		fgets(current_line, MAX_LINE_SIZE, stdin);
+		if (!db->running && !prompted)
+		{
+			fputs("edb> ", stdout);
+			fflush(stdout);
+			prompted = true;
+		}
 
-		// Run the command but dont exit on failure
-		int cmd_result = parse_cmd(db, current_line);
-		switch (cmd_result)
+		bool (*accept)(const char *line) = db->running && !interactive ? is_interrupt : NULL;
+		if (el_take_line(db->events, current_line, MAX_LINE_SIZE, accept))
 		{
-		case 1:
-			logger(WARN, "Command not recognised: %s", current_line);
-			break;
-		case -1:
-			logger(ERROR, "Failed to run command: %s", current_line);
+			prompted = false;
+			if (db->running && !runs_while_running(current_line))
+			{
+				logger(WARN, "Process %d is running, interrupt it first.", db->session->pid);
+				continue;
+			}
+			if (run_line(db, current_line) == EXIT)
+			{
+				break;
+			}
+			continue;
+		}
+
+		// treat end of input like quit so the tracee isnt left behind
+		if (db->events->input_closed && !db->running)
+		{
+			quit(db);
 			break;
-		case EXIT:
-			return 0;
-		default:
+		}
+
+		int ready = el_wait(db->events);
+		if (ready == -1)
+		{
+			quit(db);
+			res = -1;
 			break;
 		}
-	} while (current_line != NULL);
+		handle_events(db, ready);
+	} while (true);
 
-	logger(ERROR, "Failed to read line", strerror(errno));
-	return -1;
-}
\ No newline at end of file
+	free_event_loop(db->events);
+	db->events = NULL;
+	return res;
+}
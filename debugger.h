@@ -1,13 +1,43 @@
 #include <stdbool.h>
 
-#include "map.h"
+#include "agent.h"
+#include "breakpoint.h"
+#include "coverage.h"
+#include "event_loop.h"
+#include "hw_break.h"
+#include "page_watch.h"
+#include "trace.h"
+#include "unwind.h"
 #include "session.h"
 
 typedef struct Debugger {
 	DebugSession * session;
-	Map * break_points;
+	BreakPointStore * break_points;
+	// breakpoints and watchpoints held in the debug registers
+	HwBreakStore * hw_break_points;
+	// regions watched by write protecting their pages
+	PageWatchStore * page_watches;
+	// id of the breakpoint whose hit the debugger is still handling, 0 if there isnt one,
+	// and the debugger time spent on it so far
+	uint32_t hit_id;
+	uint64_t hit_overhead_ns;
+	// records of tracepoint hits, created with the first tracepoint
+	TraceLog * traces;
+	// library loaded into the tracee that records fast tracepoints, NULL until it is loaded
+	Agent * agent;
+	// walks the tracee's stack for bt, created with the first backtrace
+	Unwinder * unwinder;
+	// set while a coverage run is in progress
+	Coverage * coverage;
+	// only the thread that stopped is halted, the others keep running while at the prompt
+	bool non_stop;
+	// waits on the input and the tracee together, created when the command loop starts
+	EventLoop * events;
+	// the tracee has been continued and its next stop not handled yet, the prompt stays
+	// usable in the meantime
+	bool running;
 } Debugger;
 
 Debugger * new_debugger();
 
-int run_cmd_loop(Debugger *db, const char * prog);
\ No newline at end of file
+int run_cmd_loop(Debugger *db, const char * prog, const char * pid);
\ No newline at end of file
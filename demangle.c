@@ -0,0 +1,22 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "demangle.h"
+
+// the demangler from the C++ runtime
+extern char *__cxa_demangle(const char *mangled_name, char *output_buffer, size_t *length, int *status);
+
+// Demangles a C++ symbol name. Returns a heap allocated string the caller frees or NULL
+// if the name isnt mangled.
+char *demangle(const char *name)
+{
+	// every Itanium ABI mangled name starts with _Z
+	if (strncmp(name, "_Z", 2) != 0)
+	{
+		return NULL;
+	}
+
+	int status;
+	char *demangled = __cxa_demangle(name, NULL, NULL, &status);
+	return status == 0 ? demangled : NULL;
+}
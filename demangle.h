@@ -0,0 +1,8 @@
+#ifndef DEMANGLE_H
+#define DEMANGLE_H
+
+// Demangles a C++ symbol name. Returns a heap allocated string the caller frees or NULL
+// if the name isnt mangled.
+char *demangle(const char *name);
+
+#endif
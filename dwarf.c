@@ -0,0 +1,2084 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "dwarf.h"
+#include "logger.h"
+#include "thread_pool.h"
+
+// standard opcodes
+#define DW_LNS_copy 0x01
+#define DW_LNS_advance_pc 0x02
+#define DW_LNS_advance_line 0x03
+#define DW_LNS_set_file 0x04
+#define DW_LNS_set_column 0x05
+#define DW_LNS_negate_stmt 0x06
+#define DW_LNS_set_basic_block 0x07
+#define DW_LNS_const_add_pc 0x08
+#define DW_LNS_fixed_advance_pc 0x09
+#define DW_LNS_set_prologue_end 0x0a
+
+// extended opcodes
+#define DW_LNE_end_sequence 0x01
+#define DW_LNE_set_address 0x02
+#define DW_LNE_define_file 0x03
+
+// DWARF 5 directory and file entry content types
+#define DW_LNCT_path 0x1
+#define DW_LNCT_directory_index 0x2
+
+// attribute forms that can appear in DWARF 5 directory and file entries
+#define DW_FORM_data2 0x05
+#define DW_FORM_data4 0x06
+#define DW_FORM_data8 0x07
+#define DW_FORM_string 0x08
+#define DW_FORM_block 0x09
+#define DW_FORM_data1 0x0b
+#define DW_FORM_strp 0x0e
+#define DW_FORM_udata 0x0f
+#define DW_FORM_data16 0x1e
+#define DW_FORM_line_strp 0x1f
+
+// the remaining forms that can appear in a compilation unit's first entry
+#define DW_FORM_addr 0x01
+#define DW_FORM_block2 0x03
+#define DW_FORM_block4 0x04
+#define DW_FORM_block1 0x0a
+#define DW_FORM_flag 0x0c
+#define DW_FORM_sdata 0x0d
+#define DW_FORM_ref_addr 0x10
+#define DW_FORM_ref1 0x11
+#define DW_FORM_ref2 0x12
+#define DW_FORM_ref4 0x13
+#define DW_FORM_ref8 0x14
+#define DW_FORM_ref_udata 0x15
+#define DW_FORM_indirect 0x16
+#define DW_FORM_sec_offset 0x17
+#define DW_FORM_exprloc 0x18
+#define DW_FORM_flag_present 0x19
+#define DW_FORM_strx 0x1a
+#define DW_FORM_addrx 0x1b
+#define DW_FORM_ref_sup4 0x1c
+#define DW_FORM_strp_sup 0x1d
+#define DW_FORM_ref_sig8 0x20
+#define DW_FORM_implicit_const 0x21
+#define DW_FORM_loclistx 0x22
+#define DW_FORM_rnglistx 0x23
+#define DW_FORM_ref_sup8 0x24
+#define DW_FORM_strx1 0x25
+#define DW_FORM_strx2 0x26
+#define DW_FORM_strx3 0x27
+#define DW_FORM_strx4 0x28
+#define DW_FORM_addrx1 0x29
+#define DW_FORM_addrx2 0x2a
+#define DW_FORM_addrx3 0x2b
+#define DW_FORM_addrx4 0x2c
+#define DW_FORM_GNU_addr_index 0x1f01
+#define DW_FORM_GNU_str_index 0x1f02
+#define DW_FORM_GNU_ref_alt 0x1f20
+#define DW_FORM_GNU_strp_alt 0x1f21
+
+// DWARF 5 unit types with extra header fields
+#define DW_UT_type 0x02
+#define DW_UT_skeleton 0x04
+#define DW_UT_split_compile 0x05
+#define DW_UT_split_type 0x06
+
+#define DW_AT_stmt_list 0x10
+
+#define MAX_ENTRY_FORMATS 16
+#define INITIAL_ROWS 256
+#define INITIAL_FILES 16
+#define INITIAL_RANGES 64
+// units are only decoded in parallel when each thread gets at least this many
+#define MIN_UNITS_PER_THREAD 4
+
+// Which pending units to decode
+#define LOAD_ALL 0
+#define LOAD_UNRANGED 1
+#define LOAD_FILE 2
+
+// Bounds checked reader over a section
+typedef struct Cursor {
+	const uint8_t *data;
+	uint64_t size;
+	uint64_t pos;
+	// set once a read runs past the end of the data
+	bool overflow;
+} Cursor;
+
+// The parts of a line number program header needed to run the program
+typedef struct LineProgramHeader {
+	uint16_t version;
+	// 64 bit DWARF uses 8 byte section offsets
+	bool is_64;
+	uint8_t min_instruction_length;
+	uint8_t default_is_stmt;
+	int8_t line_base;
+	uint8_t line_range;
+	uint8_t opcode_base;
+	// number of uleb arguments taken by each standard opcode
+	uint8_t std_opcode_lengths[256];
+	// offset of the first opcode and the end of the unit within .debug_line
+	uint64_t program_start;
+	uint64_t unit_end;
+} LineProgramHeader;
+
+// Rows and file names decoded from a single compilation unit. File indexes in the rows
+// are local to the unit until the units are merged into a LineTable.
+typedef struct LineUnit {
+	LineRow *rows;
+	size_t row_count;
+	size_t row_capacity;
+	// full path of each file, NULL for indexes the unit doesnt define
+	char **files;
+	size_t file_count;
+	size_t file_capacity;
+	// index of each file in the merged table's file names
+	uint32_t *file_ids;
+	// local index of the unit's main source file
+	uint32_t primary_file;
+} LineUnit;
+
+// Units being decoded by the worker threads. Each unit is decoded into its own slot so
+// the workers share nothing but the read only sections.
+typedef struct DecodeJob {
+	const LineTable *table;
+	const uint32_t *unit_idxs;
+	LineUnit *units;
+	int *results;
+} DecodeJob;
+
+// A run of rows with increasing addresses ended by an end_sequence row
+typedef struct Sequence {
+	uint64_t low_addr;
+	const LineRow *rows;
+	size_t row_count;
+	// unit whose file indexes the rows use, NULL for rows already in the table
+	const LineUnit *unit;
+} Sequence;
+
+static inline bool can_read(Cursor *c, uint64_t n)
+{
+	if (c->overflow || n > c->size - c->pos)
+	{
+		c->overflow = true;
+		return false;
+	}
+	return true;
+}
+
+// Reads a little endian value of n bytes
+static uint64_t read_fixed(Cursor *c, int n)
+{
+	if (!can_read(c, n))
+	{
+		return 0;
+	}
+
+	uint64_t val = 0;
+	for (int i = 0; i < n; i++)
+	{
+		val |= (uint64_t)c->data[c->pos + i] << (8 * i);
+	}
+	c->pos += n;
+	return val;
+}
+
+static uint64_t read_uleb(Cursor *c)
+{
+	uint64_t val = 0;
+	int shift = 0;
+	while (can_read(c, 1))
+	{
+		uint8_t byte = c->data[c->pos++];
+		if (shift < 64)
+		{
+			val |= (uint64_t)(byte & 0x7f) << shift;
+		}
+		shift += 7;
+		if (!(byte & 0x80))
+		{
+			break;
+		}
+	}
+	return val;
+}
+
+static int64_t read_sleb(Cursor *c)
+{
+	int64_t val = 0;
+	int shift = 0;
+	uint8_t byte = 0;
+	while (can_read(c, 1))
+	{
+		byte = c->data[c->pos++];
+		if (shift < 64)
+		{
+			val |= (int64_t)(byte & 0x7f) << shift;
+		}
+		shift += 7;
+		if (!(byte & 0x80))
+		{
+			break;
+		}
+	}
+
+	// sign extend
+	if (shift < 64 && (byte & 0x40))
+	{
+		val |= -((int64_t)1 << shift);
+	}
+	return val;
+}
+
+static void skip(Cursor *c, uint64_t n)
+{
+	if (can_read(c, n))
+	{
+		c->pos += n;
+	}
+}
+
+// Returns the NUL terminated string at the cursor
+static const char *read_str(Cursor *c)
+{
+	const char *str = (const char *)c->data + c->pos;
+	const void *nul = c->pos < c->size ? memchr(str, '\0', c->size - c->pos) : NULL;
+	if (nul == NULL)
+	{
+		c->overflow = true;
+		return NULL;
+	}
+	c->pos += (const char *)nul - str + 1;
+	return str;
+}
+
+// Returns the string at the given offset in a string section or NULL if it is out of bounds
+static const char *section_str(const uint8_t *section, uint64_t size, uint64_t offset)
+{
+	if (section == NULL || offset >= size || memchr(section + offset, '\0', size - offset) == NULL)
+	{
+		return NULL;
+	}
+	return (const char *)section + offset;
+}
+
+// Joins a directory and a file name. Absolute names are returned as they are.
+static char *join_path(const char *dir, const char *name)
+{
+	if (name[0] == '/' || dir == NULL || dir[0] == '\0')
+	{
+		return strdup(name);
+	}
+
+	size_t dir_len = strlen(dir);
+	size_t name_len = strlen(name);
+	char *path = (char *)malloc(dir_len + name_len + 2);
+	if (path == NULL)
+	{
+		return NULL;
+	}
+	memcpy(path, dir, dir_len);
+	path[dir_len] = '/';
+	memcpy(path + dir_len + 1, name, name_len + 1);
+	return path;
+}
+
+// Stores the path of the file with the given local index
+static int set_unit_file(LineUnit *unit, uint64_t idx, char *path)
+{
+	if (path == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for file name. %s", strerror(errno));
+		return -1;
+	}
+
+	if (idx >= unit->file_capacity)
+	{
+		size_t capacity = unit->file_capacity == 0 ? INITIAL_FILES : unit->file_capacity;
+		while (capacity <= idx)
+		{
+			capacity *= 2;
+		}
+		char **files = (char **)realloc(unit->files, capacity * sizeof(char *));
+		if (files == NULL)
+		{
+			logger(ERROR, "Failed to allocate heap memory for file table. %s", strerror(errno));
+			free(path);
+			return -1;
+		}
+		memset(files + unit->file_capacity, 0, (capacity - unit->file_capacity) * sizeof(char *));
+		unit->files = files;
+		unit->file_capacity = capacity;
+	}
+
+	free(unit->files[idx]);
+	unit->files[idx] = path;
+	if (idx >= unit->file_count)
+	{
+		unit->file_count = idx + 1;
+	}
+	return 0;
+}
+
+static int append_row(LineUnit *unit, uint64_t addr, uint32_t file_idx, uint32_t line, uint8_t flags)
+{
+	if (unit->row_count == unit->row_capacity)
+	{
+		size_t capacity = unit->row_capacity == 0 ? INITIAL_ROWS : unit->row_capacity * 2;
+		LineRow *rows = (LineRow *)realloc(unit->rows, capacity * sizeof(LineRow));
+		if (rows == NULL)
+		{
+			logger(ERROR, "Failed to allocate heap memory for line rows. %s", strerror(errno));
+			return -1;
+		}
+		unit->rows = rows;
+		unit->row_capacity = capacity;
+	}
+
+	LineRow *row = &unit->rows[unit->row_count++];
+	row->addr = addr;
+	row->file_idx = file_idx;
+	row->line = line;
+	row->flags = flags;
+	return 0;
+}
+
+static void free_line_unit(LineUnit *unit)
+{
+	for (size_t i = 0; i < unit->file_count; i++)
+	{
+		free(unit->files[i]);
+	}
+	free(unit->files);
+	free(unit->file_ids);
+	free(unit->rows);
+}
+
+// Reads the value of a DWARF 5 entry attribute. Strings are returned through str and
+// everything else through val.
+static int read_form(Cursor *c, const DwarfSections *sections, bool is_64, uint64_t form, const char **str, uint64_t *val)
+{
+	*str = NULL;
+	*val = 0;
+	switch (form)
+	{
+	case DW_FORM_string:
+		*str = read_str(c);
+		break;
+	case DW_FORM_line_strp:
+		*str = section_str(sections->debug_line_str, sections->debug_line_str_size, read_fixed(c, is_64 ? 8 : 4));
+		break;
+	case DW_FORM_strp:
+		*str = section_str(sections->debug_str, sections->debug_str_size, read_fixed(c, is_64 ? 8 : 4));
+		break;
+	case DW_FORM_udata:
+		*val = read_uleb(c);
+		break;
+	case DW_FORM_data1:
+		*val = read_fixed(c, 1);
+		break;
+	case DW_FORM_data2:
+		*val = read_fixed(c, 2);
+		break;
+	case DW_FORM_data4:
+		*val = read_fixed(c, 4);
+		break;
+	case DW_FORM_data8:
+		*val = read_fixed(c, 8);
+		break;
+	case DW_FORM_data16:
+		skip(c, 16);
+		break;
+	case DW_FORM_block:
+		skip(c, read_uleb(c));
+		break;
+	default:
+		logger(WARN, "Unsupported form %d in line table header", (int)form);
+		return -1;
+	}
+	return c->overflow ? -1 : 0;
+}
+
+// Reads a DWARF 5 directory or file name table. Each entry's path and directory index are
+// returned through paths and dir_idxs which are allocated by this function.
+static long read_entry_table(Cursor *c, const DwarfSections *sections, bool is_64, const char ***paths, uint64_t **dir_idxs)
+{
+	uint8_t format_count = read_fixed(c, 1);
+	if (format_count > MAX_ENTRY_FORMATS)
+	{
+		logger(WARN, "Too many entry formats in line table header");
+		return -1;
+	}
+
+	uint64_t content_types[MAX_ENTRY_FORMATS];
+	uint64_t forms[MAX_ENTRY_FORMATS];
+	for (int i = 0; i < format_count; i++)
+	{
+		content_types[i] = read_uleb(c);
+		forms[i] = read_uleb(c);
+	}
+
+	uint64_t count = read_uleb(c);
+	// every entry takes at least a byte so a larger count means the header is corrupt
+	if (c->overflow || count > c->size - c->pos)
+	{
+		return -1;
+	}
+
+	*paths = (const char **)calloc(count + 1, sizeof(char *));
+	*dir_idxs = (uint64_t *)calloc(count + 1, sizeof(uint64_t));
+	if (*paths == NULL || *dir_idxs == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for file table. %s", strerror(errno));
+		return -1;
+	}
+
+	for (uint64_t i = 0; i < count; i++)
+	{
+		for (int j = 0; j < format_count; j++)
+		{
+			const char *str;
+			uint64_t val;
+			if (read_form(c, sections, is_64, forms[j], &str, &val) == -1)
+			{
+				return -1;
+			}
+
+			if (content_types[j] == DW_LNCT_path)
+			{
+				(*paths)[i] = str;
+			}
+			else if (content_types[j] == DW_LNCT_directory_index)
+			{
+				(*dir_idxs)[i] = val;
+			}
+		}
+	}
+	return (long)count;
+}
+
+// Builds the full path of every file in the DWARF 5 directory and file tables
+static int add_v5_files(LineUnit *unit, const char **dirs, long dir_count, const char **names, const uint64_t *dir_idxs, long file_count)
+{
+	for (long i = 0; i < file_count; i++)
+	{
+		if (names[i] == NULL)
+		{
+			continue;
+		}
+
+		// directory 0 is the compilation directory which other relative directories are based on
+		const char *dir = dir_idxs[i] < (uint64_t)dir_count ? dirs[dir_idxs[i]] : NULL;
+		char *full_dir = NULL;
+		if (dir != NULL && dir[0] != '/' && dir_idxs[i] != 0 && dirs[0] != NULL)
+		{
+			full_dir = join_path(dirs[0], dir);
+			dir = full_dir;
+		}
+
+		int set_res = set_unit_file(unit, i, join_path(dir, names[i]));
+		free(full_dir);
+		if (set_res == -1)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Reads the DWARF 5 directory and file tables into the unit
+static int read_v5_file_tables(Cursor *c, const DwarfSections *sections, bool is_64, LineUnit *unit)
+{
+	const char **dirs = NULL;
+	const char **names = NULL;
+	uint64_t *unused = NULL;
+	uint64_t *dir_idxs = NULL;
+
+	int res = -1;
+	long dir_count = read_entry_table(c, sections, is_64, &dirs, &unused);
+	if (dir_count != -1)
+	{
+		long file_count = read_entry_table(c, sections, is_64, &names, &dir_idxs);
+		if (file_count != -1)
+		{
+			res = add_v5_files(unit, dirs, dir_count, names, dir_idxs, file_count);
+		}
+	}
+
+	free(dirs);
+	free(unused);
+	free(names);
+	free(dir_idxs);
+	return res;
+}
+
+// Reads the pre DWARF 5 include directory and file name tables into the unit. File
+// indexes start at 1 in these versions.
+static int read_legacy_file_tables(Cursor *c, LineUnit *unit)
+{
+	size_t dir_count = 0;
+	size_t dirs_start = c->pos;
+	while (!c->overflow)
+	{
+		const char *dir = read_str(c);
+		if (dir == NULL || dir[0] == '\0')
+		{
+			break;
+		}
+		dir_count++;
+	}
+
+	const char **dirs = (const char **)calloc(dir_count + 1, sizeof(char *));
+	if (dirs == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for file table. %s", strerror(errno));
+		return -1;
+	}
+
+	// directory 0 is the compilation directory which isnt recorded in the line table
+	Cursor dir_cursor = {.data = c->data, .size = c->size, .pos = dirs_start};
+	for (size_t i = 1; i <= dir_count; i++)
+	{
+		dirs[i] = read_str(&dir_cursor);
+	}
+
+	uint64_t file_idx = 1;
+	while (!c->overflow)
+	{
+		const char *name = read_str(c);
+		if (name == NULL || name[0] == '\0')
+		{
+			break;
+		}
+
+		uint64_t dir_idx = read_uleb(c);
+		// modification time and file length
+		read_uleb(c);
+		read_uleb(c);
+
+		const char *dir = dir_idx <= dir_count ? dirs[dir_idx] : NULL;
+		if (set_unit_file(unit, file_idx++, join_path(dir, name)) == -1)
+		{
+			free(dirs);
+			return -1;
+		}
+	}
+
+	free(dirs);
+	return c->overflow ? -1 : 0;
+}
+
+// Reads the header of the line number program starting at the cursor along with its file
+// table. Returns 1 if the unit is padding.
+static int read_line_header(Cursor *c, const DwarfSections *sections, LineProgramHeader *header, LineUnit *unit)
+{
+	uint64_t unit_length = read_fixed(c, 4);
+	header->is_64 = false;
+	if (unit_length == 0xffffffff)
+	{
+		header->is_64 = true;
+		unit_length = read_fixed(c, 8);
+	}
+
+	if (c->overflow || unit_length > c->size - c->pos)
+	{
+		logger(WARN, "Line table unit at offset %p is truncated", (void *)c->pos);
+		return -1;
+	}
+
+	if (unit_length == 0)
+	{
+		return 1;
+	}
+
+	header->unit_end = c->pos + unit_length;
+	header->version = read_fixed(c, 2);
+	if (header->version < 2 || header->version > 5)
+	{
+		logger(WARN, "Unsupported line table version %d", header->version);
+		return -1;
+	}
+
+	if (header->version >= 5)
+	{
+		// address and segment selector sizes
+		skip(c, 2);
+	}
+
+	uint64_t header_length = read_fixed(c, header->is_64 ? 8 : 4);
+	header->program_start = c->pos + header_length;
+
+	header->min_instruction_length = read_fixed(c, 1);
+	if (header->version >= 4)
+	{
+		// maximum operations per instruction is always 1 on x86
+		skip(c, 1);
+	}
+	header->default_is_stmt = read_fixed(c, 1);
+	header->line_base = (int8_t)read_fixed(c, 1);
+	header->line_range = read_fixed(c, 1);
+	header->opcode_base = read_fixed(c, 1);
+
+	memset(header->std_opcode_lengths, 0, sizeof(header->std_opcode_lengths));
+	for (int i = 1; i < header->opcode_base; i++)
+	{
+		header->std_opcode_lengths[i] = read_fixed(c, 1);
+	}
+
+	if (c->overflow || header->line_range == 0 || header->program_start > header->unit_end)
+	{
+		logger(WARN, "Malformed line table header");
+		return -1;
+	}
+
+	// DWARF 5 stores the main source file at index 0, earlier versions start at 1
+	unit->primary_file = header->version >= 5 ? 0 : 1;
+
+	// the tables must not run into the opcodes
+	Cursor tables = {.data = c->data, .size = header->program_start, .pos = c->pos};
+	int table_res = header->version >= 5 ? read_v5_file_tables(&tables, sections, header->is_64, unit) : read_legacy_file_tables(&tables, unit);
+	if (table_res == -1)
+	{
+		logger(WARN, "Malformed file table in line table header");
+		return -1;
+	}
+	return 0;
+}
+
+// Runs the line number program of the unit appending a row to the unit for every
+// row of the line number matrix.
+static int run_line_program(Cursor *c, const LineProgramHeader *header, LineUnit *unit)
+{
+	uint64_t addr = 0;
+	// DWARF 5 numbers files from 0 but the initial file is still 1
+	uint64_t file = 1;
+	int64_t line = 1;
+	bool is_stmt = header->default_is_stmt;
+	bool prologue_end = false;
+	size_t seq_start = unit->row_count;
+
+	while (c->pos < c->size && !c->overflow)
+	{
+		uint8_t opcode = read_fixed(c, 1);
+		bool emit = false;
+		bool end_sequence = false;
+
+		if (opcode >= header->opcode_base)
+		{
+			// special opcodes advance the address and line together then emit a row
+			uint8_t adjusted = opcode - header->opcode_base;
+			addr += (adjusted / header->line_range) * header->min_instruction_length;
+			line += header->line_base + (adjusted % header->line_range);
+			emit = true;
+		}
+		else if (opcode == 0)
+		{
+			uint64_t len = read_uleb(c);
+			uint64_t ext_start = c->pos;
+			uint8_t ext_opcode = len > 0 ? read_fixed(c, 1) : 0;
+			switch (ext_opcode)
+			{
+			case DW_LNE_end_sequence:
+				emit = true;
+				end_sequence = true;
+				break;
+			case DW_LNE_set_address:
+				addr = read_fixed(c, len - 1 > 8 ? 8 : (int)(len - 1));
+				break;
+			case DW_LNE_define_file:
+			{
+				const char *name = read_str(c);
+				if (name != NULL && set_unit_file(unit, unit->file_count, strdup(name)) == -1)
+				{
+					return -1;
+				}
+				break;
+			}
+			default:
+				break;
+			}
+			// skip anything we didnt read such as discriminators
+			c->pos = ext_start;
+			skip(c, len);
+		}
+		else
+		{
+			switch (opcode)
+			{
+			case DW_LNS_copy:
+				emit = true;
+				break;
+			case DW_LNS_advance_pc:
+				addr += read_uleb(c) * header->min_instruction_length;
+				break;
+			case DW_LNS_advance_line:
+				line += read_sleb(c);
+				break;
+			case DW_LNS_set_file:
+				file = read_uleb(c);
+				break;
+			case DW_LNS_negate_stmt:
+				is_stmt = !is_stmt;
+				break;
+			case DW_LNS_const_add_pc:
+				addr += ((255 - header->opcode_base) / header->line_range) * header->min_instruction_length;
+				break;
+			case DW_LNS_fixed_advance_pc:
+				addr += read_fixed(c, 2);
+				break;
+			case DW_LNS_set_prologue_end:
+				prologue_end = true;
+				break;
+			default:
+				// column, basic block and anything unknown are skipped using the
+				// argument counts from the header
+				for (int i = 0; i < header->std_opcode_lengths[opcode]; i++)
+				{
+					read_uleb(c);
+				}
+				break;
+			}
+		}
+
+		if (!emit)
+		{
+			continue;
+		}
+
+		uint8_t flags = (is_stmt ? LINE_IS_STMT : 0) | (end_sequence ? LINE_END_SEQUENCE : 0) | (prologue_end ? LINE_PROLOGUE_END : 0);
+		if (append_row(unit, addr, (uint32_t)file, (uint32_t)line, flags) == -1)
+		{
+			return -1;
+		}
+		prologue_end = false;
+
+		if (end_sequence)
+		{
+			// sequences for code removed by the linker are left at address 0
+			if (unit->rows[seq_start].addr == 0)
+			{
+				unit->row_count = seq_start;
+			}
+			seq_start = unit->row_count;
+
+			addr = 0;
+			file = 1;
+			line = 1;
+			is_stmt = header->default_is_stmt;
+		}
+	}
+
+	// drop any trailing rows that werent terminated by an end_sequence
+	unit->row_count = seq_start;
+	return c->overflow ? -1 : 0;
+}
+
+// Decodes the compilation unit starting at the given offset of .debug_line. Sets next to
+// the offset of the following unit. Returns 1 for padding and -1 if the unit is malformed.
+static int decode_line_unit(const DwarfSections *sections, uint64_t offset, LineUnit *unit, uint64_t *next)
+{
+	memset(unit, 0, sizeof(LineUnit));
+
+	Cursor c = {.data = sections->debug_line, .size = sections->debug_line_size, .pos = offset};
+	LineProgramHeader header;
+	int header_res = read_line_header(&c, sections, &header, unit);
+	if (header_res != 0)
+	{
+		// the rest of the section cant be trusted once a length is wrong
+		*next = sections->debug_line_size;
+		return header_res;
+	}
+
+	*next = header.unit_end;
+
+	Cursor program = {.data = sections->debug_line, .size = header.unit_end, .pos = header.program_start};
+	if (run_line_program(&program, &header, unit) == -1)
+	{
+		logger(WARN, "Malformed line number program at offset %p", (void *)offset);
+		return -1;
+	}
+	return 0;
+}
+
+static int compare_sequences(const void *a, const void *b)
+{
+	const Sequence *x = (const Sequence *)a;
+	const Sequence *y = (const Sequence *)b;
+	return (x->low_addr > y->low_addr) - (x->low_addr < y->low_addr);
+}
+
+// Adds the unit's file names to the table's file names and records the id of each
+static int intern_unit_files(StrTable *files, LineUnit *unit)
+{
+	unit->file_ids = (uint32_t *)malloc((unit->file_count + 1) * sizeof(uint32_t));
+	if (unit->file_ids == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for line table. %s", strerror(errno));
+		return -1;
+	}
+
+	for (size_t i = 0; i < unit->file_count; i++)
+	{
+		const char *path = unit->files[i] != NULL ? unit->files[i] : "<unknown>";
+		long id = st_intern(files, path);
+		if (id == -1)
+		{
+			return -1;
+		}
+		unit->file_ids[i] = (uint32_t)id;
+	}
+	return 0;
+}
+
+static size_t count_sequences(const LineRow *rows, size_t row_count)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < row_count; i++)
+	{
+		count += (rows[i].flags & LINE_END_SEQUENCE) != 0;
+	}
+	return count;
+}
+
+// Splits the rows into sequences starting at seqs[seq_idx]. Returns the index after the last one.
+static size_t collect_sequences(const LineRow *rows, size_t row_count, const LineUnit *unit, Sequence *seqs, size_t seq_idx)
+{
+	size_t start = 0;
+	for (size_t i = 0; i < row_count; i++)
+	{
+		if (rows[i].flags & LINE_END_SEQUENCE)
+		{
+			seqs[seq_idx].low_addr = rows[start].addr;
+			seqs[seq_idx].rows = rows + start;
+			seqs[seq_idx].row_count = i + 1 - start;
+			seqs[seq_idx].unit = unit;
+			seq_idx++;
+			start = i + 1;
+		}
+	}
+	return seq_idx;
+}
+
+// Merges the rows of the units into the rows already in the table ordering the sequences by
+// address and replacing each unit's file indexes with indexes into the table's file names.
+static int merge_line_units(LineTable *table, LineUnit *units, size_t unit_count)
+{
+	size_t total_rows = table->row_count;
+	size_t seq_count = count_sequences(table->rows, table->row_count);
+	for (size_t i = 0; i < unit_count; i++)
+	{
+		total_rows += units[i].row_count;
+		seq_count += count_sequences(units[i].rows, units[i].row_count);
+	}
+
+	Sequence *seqs = (Sequence *)malloc((seq_count + 1) * sizeof(Sequence));
+	LineRow *rows = (LineRow *)malloc((total_rows + 1) * sizeof(LineRow));
+	if (seqs == NULL || rows == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for line table. %s", strerror(errno));
+		free(seqs);
+		free(rows);
+		return -1;
+	}
+
+	size_t seq_idx = collect_sequences(table->rows, table->row_count, NULL, seqs, 0);
+	for (size_t i = 0; i < unit_count; i++)
+	{
+		seq_idx = collect_sequences(units[i].rows, units[i].row_count, &units[i], seqs, seq_idx);
+	}
+
+	qsort(seqs, seq_count, sizeof(Sequence), compare_sequences);
+
+	size_t row_count = 0;
+	for (size_t i = 0; i < seq_count; i++)
+	{
+		const LineUnit *unit = seqs[i].unit;
+		for (size_t j = 0; j < seqs[i].row_count; j++)
+		{
+			LineRow row = seqs[i].rows[j];
+			if (unit != NULL)
+			{
+				row.file_idx = row.file_idx < unit->file_count ? unit->file_ids[row.file_idx] : 0;
+			}
+			rows[row_count++] = row;
+		}
+	}
+
+	free(seqs);
+	free(table->rows);
+	table->rows = rows;
+	table->row_count = row_count;
+	return 0;
+}
+
+// Reads the header of the unit at the given offset of .debug_line and records its file
+// names. Sets next to the offset of the following unit. Returns 1 for padding and -1 if the
+// unit is malformed.
+static int scan_line_unit(LineTable *table, uint64_t offset, LineUnitInfo *info, uint64_t *next)
+{
+	LineUnit unit;
+	memset(&unit, 0, sizeof(LineUnit));
+
+	Cursor c = {.data = table->sections.debug_line, .size = table->sections.debug_line_size, .pos = offset};
+	LineProgramHeader header;
+	int header_res = read_line_header(&c, &table->sections, &header, &unit);
+	if (header_res != 0)
+	{
+		// the rest of the section cant be trusted once a length is wrong
+		free_line_unit(&unit);
+		*next = table->sections.debug_line_size;
+		return header_res;
+	}
+
+	*next = header.unit_end;
+
+	if (intern_unit_files(table->files, &unit) == -1)
+	{
+		free_line_unit(&unit);
+		return -1;
+	}
+
+	info->offset = offset;
+	info->file_ids = unit.file_ids;
+	info->file_count = (uint32_t)unit.file_count;
+	info->state = UNIT_PENDING;
+	info->has_ranges = false;
+
+	if (table->unit_count == 0 && unit.primary_file < unit.file_count)
+	{
+		table->primary_file = unit.file_ids[unit.primary_file];
+	}
+
+	unit.file_ids = NULL;
+	free_line_unit(&unit);
+	return 0;
+}
+
+// Skips over an attribute value of the given form. Returns -1 if the form is unknown.
+static int skip_form(Cursor *c, uint64_t form, bool is_64, uint8_t addr_size, uint16_t version)
+{
+	int offset_size = is_64 ? 8 : 4;
+	switch (form)
+	{
+	case DW_FORM_flag_present:
+	case DW_FORM_implicit_const:
+		break;
+	case DW_FORM_data1:
+	case DW_FORM_ref1:
+	case DW_FORM_flag:
+	case DW_FORM_strx1:
+	case DW_FORM_addrx1:
+		skip(c, 1);
+		break;
+	case DW_FORM_data2:
+	case DW_FORM_ref2:
+	case DW_FORM_strx2:
+	case DW_FORM_addrx2:
+		skip(c, 2);
+		break;
+	case DW_FORM_strx3:
+	case DW_FORM_addrx3:
+		skip(c, 3);
+		break;
+	case DW_FORM_data4:
+	case DW_FORM_ref4:
+	case DW_FORM_ref_sup4:
+	case DW_FORM_strx4:
+	case DW_FORM_addrx4:
+		skip(c, 4);
+		break;
+	case DW_FORM_data8:
+	case DW_FORM_ref8:
+	case DW_FORM_ref_sig8:
+	case DW_FORM_ref_sup8:
+		skip(c, 8);
+		break;
+	case DW_FORM_data16:
+		skip(c, 16);
+		break;
+	case DW_FORM_addr:
+		skip(c, addr_size);
+		break;
+	case DW_FORM_ref_addr:
+		// DWARF 2 sized references like addresses
+		skip(c, version == 2 ? addr_size : offset_size);
+		break;
+	case DW_FORM_strp:
+	case DW_FORM_line_strp:
+	case DW_FORM_sec_offset:
+	case DW_FORM_strp_sup:
+	case DW_FORM_GNU_ref_alt:
+	case DW_FORM_GNU_strp_alt:
+		skip(c, offset_size);
+		break;
+	case DW_FORM_sdata:
+		read_sleb(c);
+		break;
+	case DW_FORM_udata:
+	case DW_FORM_ref_udata:
+	case DW_FORM_strx:
+	case DW_FORM_addrx:
+	case DW_FORM_loclistx:
+	case DW_FORM_rnglistx:
+	case DW_FORM_GNU_addr_index:
+	case DW_FORM_GNU_str_index:
+		read_uleb(c);
+		break;
+	case DW_FORM_string:
+		read_str(c);
+		break;
+	case DW_FORM_block1:
+		skip(c, read_fixed(c, 1));
+		break;
+	case DW_FORM_block2:
+		skip(c, read_fixed(c, 2));
+		break;
+	case DW_FORM_block4:
+		skip(c, read_fixed(c, 4));
+		break;
+	case DW_FORM_block:
+	case DW_FORM_exprloc:
+		skip(c, read_uleb(c));
+		break;
+	case DW_FORM_indirect:
+		return skip_form(c, read_uleb(c), is_64, addr_size, version);
+	default:
+		return -1;
+	}
+	return c->overflow ? -1 : 0;
+}
+
+// Skips the attribute and form pairs of an abbreviation
+static void skip_attr_specs(Cursor *c)
+{
+	while (!c->overflow)
+	{
+		uint64_t attr = read_uleb(c);
+		uint64_t form = read_uleb(c);
+		if (form == DW_FORM_implicit_const)
+		{
+			read_sleb(c);
+		}
+		if (attr == 0 && form == 0)
+		{
+			break;
+		}
+	}
+}
+
+// Finds the .debug_line offset of the compilation unit at the given offset of .debug_info
+// from the DW_AT_stmt_list attribute of the unit's first entry. Returns -1 if the unit
+// has no line number program.
+static int read_stmt_list(const DwarfSections *sections, uint64_t info_offset, uint64_t *stmt_list)
+{
+	if (info_offset >= sections->debug_info_size)
+	{
+		return -1;
+	}
+
+	Cursor c = {.data = sections->debug_info, .size = sections->debug_info_size, .pos = info_offset};
+	uint64_t unit_length = read_fixed(&c, 4);
+	bool is_64 = false;
+	if (unit_length == 0xffffffff)
+	{
+		is_64 = true;
+		unit_length = read_fixed(&c, 8);
+	}
+	if (c.overflow || unit_length > c.size - c.pos)
+	{
+		return -1;
+	}
+	c.size = c.pos + unit_length;
+
+	uint16_t version = read_fixed(&c, 2);
+	uint64_t abbrev_offset;
+	uint8_t addr_size;
+	if (version == 5)
+	{
+		uint8_t unit_type = read_fixed(&c, 1);
+		addr_size = read_fixed(&c, 1);
+		abbrev_offset = read_fixed(&c, is_64 ? 8 : 4);
+		// skeleton and split units carry an id, type units a signature and type offset
+		if (unit_type == DW_UT_skeleton || unit_type == DW_UT_split_compile)
+		{
+			skip(&c, 8);
+		}
+		else if (unit_type == DW_UT_type || unit_type == DW_UT_split_type)
+		{
+			skip(&c, is_64 ? 16 : 12);
+		}
+	}
+	else if (version >= 2 && version <= 4)
+	{
+		abbrev_offset = read_fixed(&c, is_64 ? 8 : 4);
+		addr_size = read_fixed(&c, 1);
+	}
+	else
+	{
+		return -1;
+	}
+
+	uint64_t code = read_uleb(&c);
+	if (c.overflow || code == 0 || abbrev_offset >= sections->debug_abbrev_size)
+	{
+		return -1;
+	}
+
+	// find the abbreviation describing the entry
+	Cursor abbrev = {.data = sections->debug_abbrev, .size = sections->debug_abbrev_size, .pos = abbrev_offset};
+	while (!abbrev.overflow)
+	{
+		uint64_t abbrev_code = read_uleb(&abbrev);
+		if (abbrev_code == 0)
+		{
+			return -1;
+		}
+		// tag and children flag
+		read_uleb(&abbrev);
+		skip(&abbrev, 1);
+		if (abbrev_code == code)
+		{
+			break;
+		}
+		skip_attr_specs(&abbrev);
+	}
+
+	// walk the entry's attributes until the line program offset
+	while (!abbrev.overflow && !c.overflow)
+	{
+		uint64_t attr = read_uleb(&abbrev);
+		uint64_t form = read_uleb(&abbrev);
+		if (form == DW_FORM_implicit_const)
+		{
+			read_sleb(&abbrev);
+		}
+		if (attr == 0 && form == 0)
+		{
+			return -1;
+		}
+
+		if (attr == DW_AT_stmt_list)
+		{
+			if (form == DW_FORM_sec_offset)
+			{
+				*stmt_list = read_fixed(&c, is_64 ? 8 : 4);
+			}
+			else if (form == DW_FORM_data4 || form == DW_FORM_data8)
+			{
+				*stmt_list = read_fixed(&c, form == DW_FORM_data4 ? 4 : 8);
+			}
+			else
+			{
+				return -1;
+			}
+			return c.overflow ? -1 : 0;
+		}
+
+		if (skip_form(&c, form, is_64, addr_size, version) == -1)
+		{
+			return -1;
+		}
+	}
+	return -1;
+}
+
+// Returns the index of the unit whose header is at the given offset of .debug_line or -1
+static long find_unit(const LineTable *table, uint64_t offset)
+{
+	// units are scanned front to back so they are sorted by offset
+	size_t low = 0;
+	size_t high = table->unit_count;
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+		if (table->units[mid].offset < offset)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+	return low < table->unit_count && table->units[low].offset == offset ? (long)low : -1;
+}
+
+static int append_range(LineTable *table, size_t *capacity, uint64_t low, uint64_t high, uint32_t unit)
+{
+	if (table->range_count == *capacity)
+	{
+		size_t grown_capacity = *capacity == 0 ? INITIAL_RANGES : *capacity * 2;
+		UnitRange *ranges = (UnitRange *)realloc(table->ranges, grown_capacity * sizeof(UnitRange));
+		if (ranges == NULL)
+		{
+			logger(ERROR, "Failed to allocate heap memory for address ranges. %s", strerror(errno));
+			return -1;
+		}
+		table->ranges = ranges;
+		*capacity = grown_capacity;
+	}
+
+	UnitRange *range = &table->ranges[table->range_count++];
+	range->low = low;
+	range->high = high;
+	range->unit = unit;
+	return 0;
+}
+
+static int compare_ranges(const void *a, const void *b)
+{
+	const UnitRange *x = (const UnitRange *)a;
+	const UnitRange *y = (const UnitRange *)b;
+	return (x->low > y->low) - (x->low < y->low);
+}
+
+// Reads the address ranges of each compilation unit from .debug_aranges. A malformed set
+// leaves the remaining units without ranges. Returns -1 for errors.
+static int read_aranges(LineTable *table)
+{
+	const DwarfSections *sections = &table->sections;
+	size_t range_capacity = 0;
+
+	Cursor c = {.data = sections->debug_aranges, .size = sections->debug_aranges_size, .pos = 0};
+	while (c.pos < c.size && !c.overflow)
+	{
+		uint64_t set_start = c.pos;
+		uint64_t set_length = read_fixed(&c, 4);
+		bool is_64 = false;
+		if (set_length == 0xffffffff)
+		{
+			is_64 = true;
+			set_length = read_fixed(&c, 8);
+		}
+
+		if (c.overflow || set_length > c.size - c.pos)
+		{
+			logger(WARN, "Address range set at offset %p is truncated", (void *)set_start);
+			break;
+		}
+
+		uint64_t set_end = c.pos + set_length;
+		// version
+		read_fixed(&c, 2);
+		uint64_t info_offset = read_fixed(&c, is_64 ? 8 : 4);
+		uint8_t addr_size = read_fixed(&c, 1);
+		// segment selector size
+		skip(&c, 1);
+
+		uint64_t stmt_list;
+		long unit = -1;
+		if ((addr_size == 4 || addr_size == 8) && read_stmt_list(sections, info_offset, &stmt_list) == 0)
+		{
+			unit = find_unit(table, stmt_list);
+		}
+
+		if (unit != -1)
+		{
+			// the tuples start at a multiple of their size from the start of the set
+			uint64_t tuple_size = 2 * addr_size;
+			uint64_t tuples_start = set_start + (c.pos - set_start + tuple_size - 1) / tuple_size * tuple_size;
+			Cursor tuples = {.data = c.data, .size = set_end, .pos = tuples_start < set_end ? tuples_start : set_end};
+			while (can_read(&tuples, tuple_size))
+			{
+				uint64_t addr = read_fixed(&tuples, addr_size);
+				uint64_t len = read_fixed(&tuples, addr_size);
+				if (addr == 0 && len == 0)
+				{
+					break;
+				}
+
+				// ranges for code removed by the linker are left at address 0
+				if (addr == 0 || len == 0)
+				{
+					continue;
+				}
+
+				if (append_range(table, &range_capacity, addr, addr + len, (uint32_t)unit) == -1)
+				{
+					return -1;
+				}
+				table->units[unit].has_ranges = true;
+			}
+		}
+
+		c.pos = set_end;
+	}
+
+	qsort(table->ranges, table->range_count, sizeof(UnitRange), compare_ranges);
+	return 0;
+}
+
+// Reads the header of every compilation unit in .debug_line and the address ranges
+// of the units. No line number programs are run until they are needed.
+LineTable *build_line_table(const DwarfSections *sections)
+{
+	LineTable *table = (LineTable *)calloc(1, sizeof(LineTable));
+	if (table == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for line table. %s", strerror(errno));
+		return NULL;
+	}
+
+	table->sections = *sections;
+	table->files = new_str_table();
+	if (table->files == NULL)
+	{
+		free(table);
+		return NULL;
+	}
+
+	// make sure index 0 always exists for rows that reference an unknown file
+	if (st_intern(table->files, "<unknown>") == -1)
+	{
+		free_line_table(table);
+		return NULL;
+	}
+
+	size_t unit_capacity = INITIAL_FILES;
+	table->units = (LineUnitInfo *)malloc(unit_capacity * sizeof(LineUnitInfo));
+
+	uint64_t offset = 0;
+	while (table->units != NULL && offset < sections->debug_line_size)
+	{
+		if (table->unit_count == unit_capacity)
+		{
+			unit_capacity *= 2;
+			LineUnitInfo *grown = (LineUnitInfo *)realloc(table->units, unit_capacity * sizeof(LineUnitInfo));
+			if (grown == NULL)
+			{
+				break;
+			}
+			table->units = grown;
+		}
+
+		uint64_t next;
+		// keep going with the next unit if one is malformed
+		if (scan_line_unit(table, offset, &table->units[table->unit_count], &next) == 0)
+		{
+			table->unit_count++;
+		}
+		offset = next;
+	}
+
+	if (table->units == NULL || offset < sections->debug_line_size)
+	{
+		logger(ERROR, "Failed to allocate heap memory for line table. %s", strerror(errno));
+		free_line_table(table);
+		return NULL;
+	}
+
+	if (read_aranges(table) == -1)
+	{
+		free_line_table(table);
+		return NULL;
+	}
+
+	logger(DEBUG, "Found %d line table units and %d address ranges.", (int)table->unit_count, (int)table->range_count);
+	return table;
+}
+
+void free_line_table(LineTable *table)
+{
+	if (table->index != NULL)
+	{
+		free_line_index(table->index);
+	}
+	for (size_t i = 0; i < table->unit_count; i++)
+	{
+		free(table->units[i].file_ids);
+	}
+	free(table->units);
+	free(table->ranges);
+	if (table->mapping != NULL)
+	{
+		munmap(table->mapping, table->mapping_size);
+	}
+	else
+	{
+		free(table->rows);
+	}
+	free_str_table(table->files);
+	free(table);
+}
+
+static int compare_line_addrs(const void *a, const void *b)
+{
+	const LineAddr *x = (const LineAddr *)a;
+	const LineAddr *y = (const LineAddr *)b;
+	if (x->line != y->line)
+	{
+		return (x->line > y->line) - (x->line < y->line);
+	}
+	return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+void free_line_index(LineIndex *index)
+{
+	for (size_t i = 0; i < index->file_count; i++)
+	{
+		free(index->files[i].entries);
+	}
+	free(index->files);
+	free(index->name_starts);
+	free(index->name_files);
+	if (index->names != NULL)
+	{
+		free_str_table(index->names);
+	}
+	free(index);
+}
+
+// Returns the part of the path after the last slash
+static const char *base_name(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash != NULL ? slash + 1 : path;
+}
+
+// Gives every file in the table a slot and groups the files by base name so "file.c" can be
+// found without scanning every path. Returns -1 for errors.
+static int index_file_names(LineIndex *index, const LineTable *table)
+{
+	size_t file_count = table->files->count;
+	if (file_count > index->file_count)
+	{
+		FileLines *files = (FileLines *)realloc(index->files, file_count * sizeof(FileLines));
+		if (files == NULL)
+		{
+			logger(ERROR, "Failed to allocate heap memory for line index. %s", strerror(errno));
+			return -1;
+		}
+		memset(files + index->file_count, 0, (file_count - index->file_count) * sizeof(FileLines));
+		index->files = files;
+		index->file_count = file_count;
+	}
+
+	// the names are grouped again from scratch, there are far fewer files than statements
+	if (index->names != NULL)
+	{
+		free_str_table(index->names);
+	}
+	free(index->name_starts);
+	free(index->name_files);
+	index->names = new_str_table();
+	index->name_starts = NULL;
+	index->name_files = NULL;
+	uint32_t *name_ids = (uint32_t *)malloc((file_count + 1) * sizeof(uint32_t));
+	if (index->names == NULL || name_ids == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for line index. %s", strerror(errno));
+		free(name_ids);
+		return -1;
+	}
+
+	for (size_t i = 0; i < file_count; i++)
+	{
+		long id = st_intern(index->names, base_name(st_get(table->files, i)));
+		if (id == -1)
+		{
+			free(name_ids);
+			return -1;
+		}
+		name_ids[i] = (uint32_t)id;
+	}
+
+	size_t name_count = index->names->count;
+	index->name_starts = (size_t *)calloc(name_count + 1, sizeof(size_t));
+	index->name_files = (uint32_t *)malloc((file_count + 1) * sizeof(uint32_t));
+	size_t *fill = (size_t *)malloc((name_count + 1) * sizeof(size_t));
+	if (index->name_starts == NULL || index->name_files == NULL || fill == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for line index. %s", strerror(errno));
+		free(fill);
+		free(name_ids);
+		return -1;
+	}
+
+	for (size_t i = 0; i < file_count; i++)
+	{
+		index->name_starts[name_ids[i] + 1]++;
+	}
+	for (size_t i = 0; i < name_count; i++)
+	{
+		index->name_starts[i + 1] += index->name_starts[i];
+	}
+	memcpy(fill, index->name_starts, name_count * sizeof(size_t));
+	for (size_t i = 0; i < file_count; i++)
+	{
+		index->name_files[fill[name_ids[i]]++] = (uint32_t)i;
+	}
+
+	free(fill);
+	free(name_ids);
+	return 0;
+}
+
+// Sorts the statements added to the file after its first old_count ones, which are already
+// sorted, and merges the two. Returns -1 for errors.
+static int merge_file_lines(FileLines *lines, size_t old_count)
+{
+	size_t new_count = lines->count - old_count;
+	qsort(lines->entries + old_count, new_count, sizeof(LineAddr), compare_line_addrs);
+	if (old_count == 0)
+	{
+		return 0;
+	}
+
+	LineAddr *added = (LineAddr *)malloc(new_count * sizeof(LineAddr));
+	if (added == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for line index. %s", strerror(errno));
+		return -1;
+	}
+	memcpy(added, lines->entries + old_count, new_count * sizeof(LineAddr));
+
+	// merge from the back so no old entry is overwritten before it is moved
+	size_t old_idx = old_count;
+	size_t new_idx = new_count;
+	size_t out = lines->count;
+	while (new_idx > 0)
+	{
+		if (old_idx > 0 && compare_line_addrs(&lines->entries[old_idx - 1], &added[new_idx - 1]) > 0)
+		{
+			lines->entries[--out] = lines->entries[--old_idx];
+		}
+		else
+		{
+			lines->entries[--out] = added[--new_idx];
+		}
+	}
+	free(added);
+	return 0;
+}
+
+// Adds the statement rows to the index. unit maps the rows' file indexes to the table's, it
+// is NULL for rows that are already in the table. Only the files the rows are in are sorted
+// again. Returns -1 for errors.
+static int index_rows(LineIndex *index, const LineRow *rows, size_t row_count, const LineUnit *unit)
+{
+	// how many statements each file had before, SIZE_MAX for files the rows arent in
+	size_t *old_counts = (size_t *)malloc((index->file_count + 1) * sizeof(size_t));
+	uint32_t *touched = (uint32_t *)malloc((index->file_count + 1) * sizeof(uint32_t));
+	if (old_counts == NULL || touched == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for line index. %s", strerror(errno));
+		free(old_counts);
+		free(touched);
+		return -1;
+	}
+	for (size_t i = 0; i < index->file_count; i++)
+	{
+		old_counts[i] = SIZE_MAX;
+	}
+
+	int res = 0;
+	size_t touched_count = 0;
+	for (size_t i = 0; i < row_count && res == 0; i++)
+	{
+		const LineRow *row = &rows[i];
+		if (row->flags & LINE_END_SEQUENCE)
+		{
+			index->next_seq++;
+			continue;
+		}
+
+		uint32_t file_idx = row->file_idx;
+		if (unit != NULL)
+		{
+			file_idx = file_idx < unit->file_count ? unit->file_ids[file_idx] : 0;
+		}
+		if (!(row->flags & LINE_IS_STMT) || file_idx >= index->file_count)
+		{
+			continue;
+		}
+
+		FileLines *lines = &index->files[file_idx];
+		if (old_counts[file_idx] == SIZE_MAX)
+		{
+			old_counts[file_idx] = lines->count;
+			touched[touched_count++] = file_idx;
+		}
+		if (lines->count == lines->capacity)
+		{
+			size_t capacity = lines->capacity == 0 ? 16 : lines->capacity * 2;
+			LineAddr *entries = (LineAddr *)realloc(lines->entries, capacity * sizeof(LineAddr));
+			if (entries == NULL)
+			{
+				logger(ERROR, "Failed to allocate heap memory for line index. %s", strerror(errno));
+				res = -1;
+				break;
+			}
+			lines->entries = entries;
+			lines->capacity = capacity;
+		}
+
+		LineAddr *entry = &lines->entries[lines->count++];
+		entry->line = row->line;
+		entry->seq = index->next_seq;
+		entry->addr = row->addr;
+	}
+
+	for (size_t i = 0; i < touched_count && res == 0; i++)
+	{
+		res = merge_file_lines(&index->files[touched[i]], old_counts[touched[i]]);
+	}
+
+	free(old_counts);
+	free(touched);
+	return res;
+}
+
+// Groups the statement rows of every file by line and the files by their base name
+static LineIndex *build_line_index(const LineTable *table)
+{
+	LineIndex *index = (LineIndex *)calloc(1, sizeof(LineIndex));
+	if (index == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for line index. %s", strerror(errno));
+		return NULL;
+	}
+
+	if (index_file_names(index, table) == -1 || index_rows(index, table->rows, table->row_count, NULL) == -1)
+	{
+		free_line_index(index);
+		return NULL;
+	}
+
+	size_t statements = 0;
+	for (size_t i = 0; i < index->file_count; i++)
+	{
+		statements += index->files[i].count;
+	}
+	logger(DEBUG, "Indexed %d statements across %d files.", (int)statements, (int)index->file_count);
+	return index;
+}
+
+// Adds the rows of newly decoded units to the index so it doesnt have to be built again.
+// Returns -1 for errors.
+static int index_units(LineIndex *index, const LineTable *table, const LineUnit *units, size_t count)
+{
+	// files are only ever appended so existing slots keep their statements
+	if (table->files->count > index->file_count && index_file_names(index, table) == -1)
+	{
+		return -1;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (index_rows(index, units[i].rows, units[i].row_count, &units[i]) == -1)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void decode_job_unit(void *ctx, size_t i)
+{
+	DecodeJob *job = (DecodeJob *)ctx;
+	uint64_t next;
+	job->results[i] = decode_line_unit(&job->table->sections, job->table->units[job->unit_idxs[i]].offset, &job->units[i], &next);
+}
+
+// Runs the line number programs of the given units and merges their rows into the table.
+// The units are independent so they are decoded in parallel, then their file names are
+// interned and their rows merged on the calling thread. Returns -1 for errors.
+static int load_units(LineTable *table, const uint32_t *unit_idxs, size_t count)
+{
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	LineUnit *units = (LineUnit *)malloc(count * sizeof(LineUnit));
+	int *results = (int *)malloc(count * sizeof(int));
+	if (units == NULL || results == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for line table. %s", strerror(errno));
+		free(units);
+		free(results);
+		return -1;
+	}
+
+	DecodeJob job = {.table = table, .unit_idxs = unit_idxs, .units = units, .results = results};
+	run_parallel(count, MIN_UNITS_PER_THREAD, decode_job_unit, &job);
+
+	size_t decoded = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (results[i] != 0)
+		{
+			// any rows from a malformed unit cant be trusted
+			free_line_unit(&units[i]);
+			table->units[unit_idxs[i]].state = UNIT_FAILED;
+			continue;
+		}
+		units[decoded++] = units[i];
+	}
+
+	int res = 0;
+	for (size_t i = 0; i < decoded && res == 0; i++)
+	{
+		res = intern_unit_files(table->files, &units[i]);
+	}
+	if (res == 0 && decoded > 0)
+	{
+		res = merge_line_units(table, units, decoded);
+	}
+	if (res == 0 && decoded > 0)
+	{
+		// an index that cant be updated is built again the next time it is needed
+		if (table->index != NULL && index_units(table->index, table, units, decoded) == -1)
+		{
+			free_line_index(table->index);
+			table->index = NULL;
+		}
+		logger(DEBUG, "Decoded %d line table units, %d rows in total.", (int)decoded, (int)table->row_count);
+	}
+
+	// units are only decoded once their rows are in the table, otherwise they are tried again
+	for (size_t i = 0; i < count; i++)
+	{
+		if (results[i] == 0)
+		{
+			table->units[unit_idxs[i]].state = res == 0 ? UNIT_DECODED : UNIT_PENDING;
+		}
+	}
+
+	for (size_t i = 0; i < decoded; i++)
+	{
+		free_line_unit(&units[i]);
+	}
+	free(units);
+	free(results);
+	return res;
+}
+
+static bool unit_has_file(const LineUnitInfo *info, uint32_t file_idx)
+{
+	for (uint32_t i = 0; i < info->file_count; i++)
+	{
+		if (info->file_ids[i] == file_idx)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Decodes the pending units selected by which. Returns -1 for errors.
+static int load_pending_units(LineTable *table, int which, uint32_t file_idx)
+{
+	uint32_t *unit_idxs = (uint32_t *)malloc((table->unit_count + 1) * sizeof(uint32_t));
+	if (unit_idxs == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for line table. %s", strerror(errno));
+		return -1;
+	}
+
+	size_t count = 0;
+	for (size_t i = 0; i < table->unit_count; i++)
+	{
+		const LineUnitInfo *info = &table->units[i];
+		if (info->state != UNIT_PENDING || (which == LOAD_UNRANGED && info->has_ranges) || (which == LOAD_FILE && !unit_has_file(info, file_idx)))
+		{
+			continue;
+		}
+		unit_idxs[count++] = (uint32_t)i;
+	}
+
+	int res = load_units(table, unit_idxs, count);
+	free(unit_idxs);
+	return res;
+}
+
+// Decodes every unit that hasnt been decoded yet. Returns -1 for errors.
+int line_table_load_all(LineTable *table)
+{
+	table->unranged_loaded = true;
+	return load_pending_units(table, LOAD_ALL, 0);
+}
+
+// Returns true once every unit has been decoded
+bool line_table_complete(const LineTable *table)
+{
+	for (size_t i = 0; i < table->unit_count; i++)
+	{
+		if (table->units[i].state == UNIT_PENDING)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Returns the index of the range containing the address or -1
+static long find_range(const LineTable *table, uint64_t addr)
+{
+	// find the first range starting past the address, the range before it may contain it
+	size_t low = 0;
+	size_t high = table->range_count;
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+		if (table->ranges[mid].low <= addr)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+	return low > 0 && addr < table->ranges[low - 1].high ? (long)(low - 1) : -1;
+}
+
+// Finds the decoded row describing the address
+static const LineRow *find_row(const LineTable *table, uint64_t addr)
+{
+	// find the first row past the address, the row before it covers the address
+	size_t low = 0;
+	size_t high = table->row_count;
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+		if (table->rows[mid].addr <= addr)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	if (low == 0)
+	{
+		return NULL;
+	}
+
+	// an end_sequence row marks the first address after the sequence
+	const LineRow *row = &table->rows[low - 1];
+	if (row->flags & LINE_END_SEQUENCE)
+	{
+		return NULL;
+	}
+	return row;
+}
+
+// Returns the row describing the given address or NULL if the address isnt covered.
+// The row is only valid until the next lookup.
+const LineRow *line_table_lookup(LineTable *table, uint64_t addr)
+{
+	long range = find_range(table, addr);
+	if (range != -1 && table->units[table->ranges[range].unit].state == UNIT_PENDING)
+	{
+		load_units(table, &table->ranges[range].unit, 1);
+	}
+
+	const LineRow *row = find_row(table, addr);
+	if (row == NULL && !table->unranged_loaded)
+	{
+		// units missing from .debug_aranges could cover any address
+		table->unranged_loaded = true;
+		load_pending_units(table, LOAD_UNRANGED, 0);
+		row = find_row(table, addr);
+	}
+	return row;
+}
+
+// Returns true if the path is the given name or ends with it as whole path components
+static bool path_matches(const char *path, const char *name)
+{
+	size_t path_len = strlen(path);
+	size_t name_len = strlen(name);
+	if (name_len > path_len || strcmp(path + path_len - name_len, name) != 0)
+	{
+		return false;
+	}
+	return name_len == path_len || path[path_len - name_len - 1] == '/';
+}
+
+// Adds the address of the given line in one file to addrs. If the line has no code the
+// next line that does is used instead. Only the lowest address in each sequence is taken
+// so a line that is split across several blocks of one function is only stopped at once.
+static size_t resolve_file_line(const LineIndex *index, uint32_t file_idx, uint32_t line, uint64_t *addrs, size_t found, size_t max_addrs)
+{
+	if (file_idx >= index->file_count)
+	{
+		return found;
+	}
+
+	const LineAddr *entries = index->files[file_idx].entries;
+	size_t low = 0;
+	size_t high = index->files[file_idx].count;
+	size_t end = high;
+
+	// find the first entry at or after the line
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+		if (entries[mid].line < line)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	if (low == end)
+	{
+		return found;
+	}
+
+	uint32_t target_line = entries[low].line;
+	uint32_t last_seq = UINT32_MAX;
+	for (size_t i = low; i < end && entries[i].line == target_line && found < max_addrs; i++)
+	{
+		// entries for a line are sorted by address so each sequence's entries are adjacent
+		if (entries[i].seq != last_seq)
+		{
+			addrs[found++] = entries[i].addr;
+			last_seq = entries[i].seq;
+		}
+	}
+	return found;
+}
+
+// Returns the file and line index, building it the first time it is needed. Units decoded
+// after that add their rows to it as they are decoded.
+static LineIndex *get_line_index(LineTable *table)
+{
+	if (table->index == NULL)
+	{
+		table->index = build_line_index(table);
+	}
+	return table->index;
+}
+
+// Decodes the units of every file whose path ends with the given name. Sets name_id to the
+// id of the file's base name in the returned index or -1 if there are no such files.
+// Returns NULL for errors.
+static LineIndex *load_named_files(LineTable *table, const char *file, long *name_id)
+{
+	LineIndex *index = get_line_index(table);
+	if (index == NULL)
+	{
+		return NULL;
+	}
+
+	*name_id = st_find(index->names, base_name(file));
+	if (*name_id == -1)
+	{
+		return index;
+	}
+
+	for (size_t i = index->name_starts[*name_id]; i < index->name_starts[*name_id + 1]; i++)
+	{
+		uint32_t file_idx = index->name_files[i];
+		if (path_matches(st_get(table->files, file_idx), file) && load_pending_units(table, LOAD_FILE, file_idx) == -1)
+		{
+			return NULL;
+		}
+	}
+
+	// file names are only ever appended so the name id stays the same
+	return get_line_index(table);
+}
+
+// Finds the addresses of the given line in every file whose path ends with the given name.
+// A NULL file means the main source file. Returns the number of addresses written to addrs
+// or -1 for errors.
+long line_table_resolve(LineTable *table, const char *file, uint32_t line, uint64_t *addrs, size_t max_addrs)
+{
+	if (file == NULL)
+	{
+		if (load_pending_units(table, LOAD_FILE, table->primary_file) == -1)
+		{
+			return -1;
+		}
+		LineIndex *index = get_line_index(table);
+		return index != NULL ? (long)resolve_file_line(index, table->primary_file, line, addrs, 0, max_addrs) : -1;
+	}
+
+	long name_id;
+	LineIndex *index = load_named_files(table, file, &name_id);
+	if (index == NULL)
+	{
+		return -1;
+	}
+	if (name_id == -1)
+	{
+		return 0;
+	}
+
+	size_t found = 0;
+	for (size_t i = index->name_starts[name_id]; i < index->name_starts[name_id + 1]; i++)
+	{
+		uint32_t file_idx = index->name_files[i];
+		if (path_matches(st_get(table->files, file_idx), file))
+		{
+			found = resolve_file_line(index, file_idx, line, addrs, found, max_addrs);
+		}
+	}
+	return (long)found;
+}
+
+// Finds the id of the file whose path ends with the given name. Returns -1 if no file
+// matches.
+long line_table_find_file(LineTable *table, const char *file)
+{
+	long name_id;
+	LineIndex *index = load_named_files(table, file, &name_id);
+	if (index == NULL || name_id == -1)
+	{
+		return -1;
+	}
+
+	for (size_t i = index->name_starts[name_id]; i < index->name_starts[name_id + 1]; i++)
+	{
+		if (path_matches(st_get(table->files, index->name_files[i]), file))
+		{
+			return index->name_files[i];
+		}
+	}
+	return -1;
+}
+
+// Collects the address of every line in the given file, one per line and sequence.
+// Returns the number of addresses or -1 for errors.
+long line_table_file_addresses(LineTable *table, uint32_t file_idx, uint64_t **addrs)
+{
+	LineIndex *index = get_line_index(table);
+	if (index == NULL || file_idx >= index->file_count)
+	{
+		return -1;
+	}
+	const LineAddr *entries = index->files[file_idx].entries;
+	size_t start = 0;
+	size_t end = index->files[file_idx].count;
+
+	*addrs = (uint64_t *)malloc((end - start + 1) * sizeof(uint64_t));
+	if (*addrs == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for addresses. %s", strerror(errno));
+		return -1;
+	}
+
+	size_t count = 0;
+	for (size_t i = start; i < end; i++)
+	{
+		if (i == start || entries[i].line != entries[i - 1].line || entries[i].seq != entries[i - 1].seq)
+		{
+			(*addrs)[count++] = entries[i].addr;
+		}
+	}
+	return (long)count;
+}
@@ -0,0 +1,157 @@
+#ifndef DWARF_H
+#define DWARF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "str_table.h"
+
+// Row flags
+#define LINE_IS_STMT 0x01
+#define LINE_END_SEQUENCE 0x02
+#define LINE_PROLOGUE_END 0x04
+
+// A row of the line number matrix produced by running a line number program
+typedef struct LineRow {
+	uint64_t addr;
+	// index into the file names of the table the row belongs to
+	uint32_t file_idx;
+	uint32_t line;
+	uint8_t flags;
+} LineRow;
+
+// The DWARF sections needed to decode line number programs. Only .debug_line is required.
+typedef struct DwarfSections {
+	const uint8_t *debug_line;
+	uint64_t debug_line_size;
+	// string sections referenced by DWARF 5 file tables
+	const uint8_t *debug_line_str;
+	uint64_t debug_line_str_size;
+	const uint8_t *debug_str;
+	uint64_t debug_str_size;
+	// address ranges of each compilation unit and the unit headers needed to find
+	// the unit's line program
+	const uint8_t *debug_aranges;
+	uint64_t debug_aranges_size;
+	const uint8_t *debug_info;
+	uint64_t debug_info_size;
+	const uint8_t *debug_abbrev;
+	uint64_t debug_abbrev_size;
+} DwarfSections;
+
+// Unit states
+#define UNIT_PENDING 0
+#define UNIT_DECODED 1
+#define UNIT_FAILED 2
+
+// A compilation unit in .debug_line. Only its header is read up front, the line
+// number program is run the first time an address or file inside the unit is looked up.
+typedef struct LineUnitInfo {
+	// offset of the unit's header in .debug_line
+	uint64_t offset;
+	// ids of the files in the unit's file table
+	uint32_t *file_ids;
+	uint32_t file_count;
+	uint8_t state;
+	// set if .debug_aranges lists the addresses of the unit
+	bool has_ranges;
+} LineUnitInfo;
+
+// An address range belonging to a unit
+typedef struct UnitRange {
+	uint64_t low;
+	uint64_t high;
+	uint32_t unit;
+} UnitRange;
+
+// A statement's line and address
+typedef struct LineAddr {
+	uint32_t line;
+	// the sequence the row came from, rows in different sequences belong to different blocks of code
+	uint32_t seq;
+	uint64_t addr;
+} LineAddr;
+
+// A file's statements sorted by line so a line is found with a binary search
+typedef struct FileLines {
+	LineAddr *entries;
+	size_t count;
+	size_t capacity;
+} FileLines;
+
+// Reverse index from file and line to addresses. Each file keeps its own statements so the
+// rows of a newly decoded unit only have to be merged into the files they are in.
+typedef struct LineIndex {
+	// statements of each of the table's files by file index
+	FileLines *files;
+	size_t file_count;
+	// sequence number given to the next rows added, rows in different sequences belong to
+	// different blocks of code
+	uint32_t next_seq;
+	// base names of the files. Files sharing base name i are
+	// name_files[name_starts[i]] up to name_files[name_starts[i + 1]].
+	StrTable *names;
+	size_t *name_starts;
+	uint32_t *name_files;
+} LineIndex;
+
+// The rows of every decoded compilation unit merged into one array sorted by address so
+// that an address can be mapped to its line with a binary search. Units are decoded on
+// demand so the rows only cover the parts of the program that have been looked up.
+typedef struct LineTable {
+	LineRow *rows;
+	size_t row_count;
+	// full paths of the source files of every unit
+	StrTable *files;
+	// main source file of the first compilation unit
+	uint32_t primary_file;
+	// built the first time a file and line is looked up and kept up to date as more units
+	// are decoded
+	LineIndex *index;
+	// the sections must outlive the table
+	DwarfSections sections;
+	LineUnitInfo *units;
+	size_t unit_count;
+	// address ranges from .debug_aranges sorted by low address
+	UnitRange *ranges;
+	size_t range_count;
+	// set once the units missing from .debug_aranges have been decoded
+	bool unranged_loaded;
+	// the rows live in this mapped cache file instead of the heap when set
+	void *mapping;
+	size_t mapping_size;
+} LineTable;
+
+// Reads the header of every compilation unit in .debug_line and the address ranges
+// of the units. No line number programs are run until they are needed.
+LineTable *build_line_table(const DwarfSections *sections);
+
+void free_line_table(LineTable *table);
+
+// Decodes every unit that hasnt been decoded yet. Returns -1 for errors.
+int line_table_load_all(LineTable *table);
+
+// Returns true once every unit has been decoded
+bool line_table_complete(const LineTable *table);
+
+// Returns the row describing the given address or NULL if the address isnt covered.
+// The row is only valid until the next lookup.
+const LineRow *line_table_lookup(LineTable *table, uint64_t addr);
+
+void free_line_index(LineIndex *index);
+
+// Finds the addresses of the given line in every file whose path ends with the given name.
+// A NULL file means the main source file. Returns the number of addresses written to addrs
+// or -1 for errors.
+long line_table_resolve(LineTable *table, const char *file, uint32_t line, uint64_t *addrs, size_t max_addrs);
+
+// Finds the id of the file whose path ends with the given name. Returns -1 if no file
+// matches.
+long line_table_find_file(LineTable *table, const char *file);
+
+// Collects the address of every line in the file with the given id, one per line and
+// sequence. Returns the number of addresses or -1 for errors.
+long line_table_file_addresses(LineTable *table, uint32_t file_idx, uint64_t **addrs);
+
+#endif
@@ -0,0 +1,139 @@
+// The agent edb loads into the tracee for fast tracepoints. It is built on its own as
+// edb_agent.so without libc and without touching vector registers, so the trampolines that
+// call it only have to save the general purpose registers and flags.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "agent_abi.h"
+
+// set by edb once it has mapped the shared memory into the tracee
+AgentShared *edb_agent_shared = NULL;
+
+static long raw_syscall6(long number, long a1, long a2, long a3, long a4, long a5, long a6)
+{
+	long res;
+	register long r10 __asm__("r10") = a4;
+	register long r8 __asm__("r8") = a5;
+	register long r9 __asm__("r9") = a6;
+	__asm__ volatile("syscall"
+		: "=a"(res)
+		: "a"(number), "D"(a1), "S"(a2), "d"(a3), "r"(r10), "r"(r8), "r"(r9)
+		: "rcx", "r11", "memory");
+	return res;
+}
+
+static void copy_bytes(uint8_t *dest, const uint8_t *src, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		dest[i] = src[i];
+	}
+}
+
+// Makes room for a record at the head of the ring, padding out the end of the ring if the
+// record doesnt fit before it. Returns NULL if the ring is full.
+static uint8_t *reserve_record(AgentShared *shared, uint32_t size, uint64_t *new_head)
+{
+	uint64_t head = shared->head;
+	uint64_t tail = __atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE);
+	uint64_t offset = head % shared->capacity;
+	uint64_t pad = shared->capacity - offset < size ? shared->capacity - offset : 0;
+	if (head + pad + size - tail > shared->capacity)
+	{
+		return NULL;
+	}
+
+	if (pad > 0)
+	{
+		TraceRecord *filler = (TraceRecord *)(shared->ring + offset);
+		filler->size = (uint32_t)pad;
+		filler->spec = AGENT_PAD_RECORD;
+		head += pad;
+		offset = 0;
+	}
+
+	*new_head = head + size;
+	return shared->ring + offset;
+}
+
+// Called by the trampoline of a fast tracepoint with the registers the tracee had when it
+// reached the tracepoint. Records the tracepoint's items into the ring.
+void edb_agent_hit(uint32_t point_idx, const uint8_t *regs)
+{
+	AgentShared *shared = edb_agent_shared;
+	AgentPoint *point = &shared->points[point_idx];
+	uint64_t hit = __atomic_add_fetch(&point->hits, 1, __ATOMIC_RELAXED);
+
+	// a signal handler hitting a tracepoint while we hold the lock mustnt wait for it
+	if (__atomic_exchange_n(&shared->lock, 1, __ATOMIC_ACQUIRE) != 0)
+	{
+		__atomic_add_fetch(&shared->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	uint64_t new_head;
+	uint8_t *record = reserve_record(shared, point->record_size, &new_head);
+	if (record == NULL)
+	{
+		__atomic_add_fetch(&shared->dropped, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&shared->lock, 0, __ATOMIC_RELEASE);
+		return;
+	}
+
+	TraceRecord *header = (TraceRecord *)record;
+	header->size = point->record_size;
+	header->spec = point->spec;
+	header->time_ns = __builtin_ia32_rdtsc();
+	header->hit = hit;
+	header->flags = 0;
+	header->reserved = 0;
+
+	// memory is read with one syscall so a bad address fails rather than crashing the tracee
+	struct iovec local[MAX_TRACE_ITEMS];
+	struct iovec remote[MAX_TRACE_ITEMS];
+	long range_count = 0;
+	long expected = 0;
+	uint8_t *payload = record + sizeof(TraceRecord);
+	for (uint32_t i = 0; i < point->item_count; i++)
+	{
+		const AgentItem *item = &point->items[i];
+		if (item->kind == TRACE_REG)
+		{
+			copy_bytes(payload, regs + item->reg_offset, sizeof(uint64_t));
+		}
+		else
+		{
+			uint64_t addr = item->addr;
+			if (item->kind == TRACE_REG_MEM)
+			{
+				copy_bytes((uint8_t *)&addr, regs + item->reg_offset, sizeof(uint64_t));
+			}
+			local[range_count].iov_base = payload;
+			local[range_count].iov_len = item->len;
+			remote[range_count].iov_base = (void *)addr;
+			remote[range_count].iov_len = item->len;
+			expected += item->len;
+			range_count++;
+		}
+		payload += item->len;
+	}
+
+	if (range_count > 0 &&
+		raw_syscall6(SYS_process_vm_readv, shared->pid, (long)local, range_count, (long)remote, range_count, 0) != expected)
+	{
+		header->flags |= TRACE_MEM_FAILED;
+		for (long i = 0; i < range_count; i++)
+		{
+			for (size_t j = 0; j < local[i].iov_len; j++)
+			{
+				((uint8_t *)local[i].iov_base)[j] = 0;
+			}
+		}
+	}
+
+	__atomic_store_n(&shared->head, new_head, __ATOMIC_RELEASE);
+	__atomic_store_n(&shared->lock, 0, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "elf_image.h"
+#include "logger.h"
+
+#define ELF_IDENT_SIZE 16
+#define ELF_CLASS_64 2
+#define ELF_DATA_LITTLE_ENDIAN 1
+#define SECTION_TYPE_NOBITS 8
+#define BUILD_ID_SECTION ".note.gnu.build-id"
+#define NT_GNU_BUILD_ID 3
+
+// Returns true if the range lies within the mapped file
+static inline int in_bounds(const ElfImage *image, uint64_t offset, uint64_t size)
+{
+	return offset <= image->size && size <= image->size - offset;
+}
+
+// Checks the identifier and headers of the mapped file
+static int validate_elf(ElfImage *image)
+{
+	char elf_identifier[] = {0x7f, 'E', 'L', 'F'};
+	if (image->size < ELF_IDENT_SIZE + sizeof(ElfInfo) || memcmp(image->base, elf_identifier, 4) != 0)
+	{
+		logger(ERROR, "Program is not ELF format.");
+		return -1;
+	}
+
+	// only 64 bit little endian files are supported
+	if (image->base[4] != ELF_CLASS_64 || image->base[5] != ELF_DATA_LITTLE_ENDIAN)
+	{
+		logger(ERROR, "Only 64 bit little endian ELF files are supported.");
+		return -1;
+	}
+
+	image->info = (const ElfInfo *)(image->base + ELF_IDENT_SIZE);
+	const ElfInfo *info = image->info;
+	if (info->e_shnum == 0 || info->e_shentsize != sizeof(ElfSectionHeader) ||
+		!in_bounds(image, info->e_shoff, (uint64_t)info->e_shnum * sizeof(ElfSectionHeader)) ||
+		info->e_shstrndx >= info->e_shnum)
+	{
+		logger(ERROR, "Invalid section header table.");
+		return -1;
+	}
+
+	image->sections = (const ElfSectionHeader *)(image->base + info->e_shoff);
+	image->section_count = info->e_shnum;
+
+	const ElfSectionHeader *names_header = &image->sections[info->e_shstrndx];
+	if (!in_bounds(image, names_header->sh_offset, names_header->sh_size) || names_header->sh_size == 0 ||
+		image->base[names_header->sh_offset + names_header->sh_size - 1] != '\0')
+	{
+		logger(ERROR, "Invalid section name table.");
+		return -1;
+	}
+
+	image->section_names = (const char *)(image->base + names_header->sh_offset);
+	image->section_names_size = names_header->sh_size;
+	logger(DEBUG, "Section header table found at offset %p with %d entries.", (void *)info->e_shoff, image->section_count);
+	return 0;
+}
+
+// Maps and validates the ELF file at the given path. Returns NULL for errors.
+ElfImage *elf_open(const char *path)
+{
+	ElfImage *image = (ElfImage *)calloc(1, sizeof(ElfImage));
+	if (image == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for elf image. %s", strerror(errno));
+		return NULL;
+	}
+
+	image->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (image->fd == -1)
+	{
+		logger(ERROR, "Failed to open file. %s", strerror(errno));
+		free(image);
+		return NULL;
+	}
+
+	struct stat file_info;
+	if (fstat(image->fd, &file_info) == -1)
+	{
+		logger(ERROR, "Failed to stat file. %s", strerror(errno));
+		close(image->fd);
+		free(image);
+		return NULL;
+	}
+
+	image->size = file_info.st_size;
+	image->dev = file_info.st_dev;
+	image->ino = file_info.st_ino;
+	image->mtime_sec = file_info.st_mtim.tv_sec;
+	image->mtime_nsec = file_info.st_mtim.tv_nsec;
+	void *base = image->size > 0 ? mmap(NULL, image->size, PROT_READ, MAP_PRIVATE, image->fd, 0) : MAP_FAILED;
+	if (base == MAP_FAILED)
+	{
+		logger(ERROR, "Failed to map file. %s", strerror(errno));
+		close(image->fd);
+		free(image);
+		return NULL;
+	}
+	image->base = (const uint8_t *)base;
+
+	if (validate_elf(image) == -1)
+	{
+		elf_close(image);
+		return NULL;
+	}
+	return image;
+}
+
+void elf_close(ElfImage *image)
+{
+	munmap((void *)image->base, image->size);
+	close(image->fd);
+	free(image);
+}
+
+// Returns true if the file at the given path is still the one that was mapped
+bool elf_unchanged(const ElfImage *image, const char *path)
+{
+	struct stat file_info;
+	if (stat(path, &file_info) == -1)
+	{
+		return false;
+	}
+	return file_info.st_dev == image->dev && file_info.st_ino == image->ino && (size_t)file_info.st_size == image->size &&
+		file_info.st_mtim.tv_sec == image->mtime_sec && file_info.st_mtim.tv_nsec == image->mtime_nsec;
+}
+
+// Returns the index of the section header with the given name or -1
+static int find_section(const ElfImage *image, const char *name)
+{
+	for (int i = 0; i < image->section_count; i++)
+	{
+		const ElfSectionHeader *header = &image->sections[i];
+		if (header->sh_name < image->section_names_size && strcmp(name, image->section_names + header->sh_name) == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Finds the section with the given name. Returns -1 if it doesnt exist or lies outside the file.
+int elf_section(const ElfImage *image, const char *name, ElfSection *section)
+{
+	int idx = find_section(image, name);
+	if (idx == -1)
+	{
+		return -1;
+	}
+
+	const ElfSectionHeader *header = &image->sections[idx];
+
+	// sections like .bss take up no space in the file
+	if (header->sh_type == SECTION_TYPE_NOBITS)
+	{
+		section->data = NULL;
+		section->size = 0;
+		section->addr = header->sh_addr;
+		return 0;
+	}
+
+	if (!in_bounds(image, header->sh_offset, header->sh_size))
+	{
+		logger(ERROR, "%s section lies outside the file.", (char *)name);
+		return -1;
+	}
+
+	section->data = image->base + header->sh_offset;
+	section->size = header->sh_size;
+	section->addr = header->sh_addr;
+	logger(DEBUG, "%s section found at offset %p.", (char *)name, (void *)header->sh_offset);
+	return 0;
+}
+
+// Finds the symbol table section with the given name and the string table its names are
+// in. Returns -1 if it doesnt exist or is malformed.
+int elf_symbol_table(const ElfImage *image, const char *name, ElfSymbolTable *table)
+{
+	int idx = find_section(image, name);
+	if (idx == -1)
+	{
+		return -1;
+	}
+
+	const ElfSectionHeader *header = &image->sections[idx];
+	if (header->sh_entsize != sizeof(ElfSymbol) || !in_bounds(image, header->sh_offset, header->sh_size) ||
+		header->sh_offset % sizeof(uint64_t) != 0 || header->sh_link >= image->section_count)
+	{
+		logger(WARN, "Malformed symbol table %s.", (char *)name);
+		return -1;
+	}
+
+	// names must be NUL terminated within the string table
+	const ElfSectionHeader *names = &image->sections[header->sh_link];
+	if (!in_bounds(image, names->sh_offset, names->sh_size) || names->sh_size == 0 ||
+		image->base[names->sh_offset + names->sh_size - 1] != '\0')
+	{
+		logger(WARN, "Malformed string table for %s.", (char *)name);
+		return -1;
+	}
+
+	table->symbols = (const ElfSymbol *)(image->base + header->sh_offset);
+	table->count = header->sh_size / sizeof(ElfSymbol);
+	table->names = (const char *)(image->base + names->sh_offset);
+	table->names_size = names->sh_size;
+	return 0;
+}
+
+// Hints that the section is about to be read from start to finish
+void elf_advise_sequential(const ElfSection *section)
+{
+	if (section->data == NULL || section->size == 0)
+	{
+		return;
+	}
+
+	// madvise works on whole pages
+	uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)section->data & ~(page_size - 1);
+	size_t len = (uintptr_t)section->data + section->size - start;
+	madvise((void *)start, len, MADV_SEQUENTIAL);
+	madvise((void *)start, len, MADV_WILLNEED);
+}
+
+// Finds the build id in the GNU build id note. Returns -1 if the file doesnt have one.
+int elf_build_id(const ElfImage *image, const uint8_t **id, size_t *len)
+{
+	ElfSection notes;
+	if (elf_section(image, BUILD_ID_SECTION, &notes) == -1 || notes.data == NULL)
+	{
+		return -1;
+	}
+
+	// each note is a name size, description size and type followed by the name and
+	// description, both padded to 4 bytes
+	uint64_t pos = 0;
+	while (pos + 12 <= notes.size)
+	{
+		uint32_t name_size;
+		uint32_t desc_size;
+		uint32_t type;
+		memcpy(&name_size, notes.data + pos, 4);
+		memcpy(&desc_size, notes.data + pos + 4, 4);
+		memcpy(&type, notes.data + pos + 8, 4);
+		pos += 12;
+
+		uint64_t name_start = pos;
+		uint64_t desc_start = name_start + (((uint64_t)name_size + 3) & ~3ULL);
+		uint64_t next = desc_start + (((uint64_t)desc_size + 3) & ~3ULL);
+		if (next > notes.size)
+		{
+			return -1;
+		}
+
+		if (type == NT_GNU_BUILD_ID && name_size == 4 && memcmp(notes.data + name_start, "GNU", 4) == 0 && desc_size > 0)
+		{
+			*id = notes.data + desc_start;
+			*len = desc_size;
+			return 0;
+		}
+		pos = next;
+	}
+	return -1;
+}
@@ -0,0 +1,127 @@
+#ifndef ELF_IMAGE_H
+#define ELF_IMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// General info about the ELF file
+typedef struct ElfInfo {
+	uint16_t e_type;
+	uint16_t e_machine;
+	uint32_t e_version;
+
+	// location of the binary in memory
+	uint64_t e_entry;
+
+	// program header table offset
+	uint64_t e_phoff;
+
+	// section header table offset
+	uint64_t e_shoff;
+	uint32_t e_flags;
+	uint16_t e_ehsize;
+	uint16_t e_phentsize;
+	uint16_t e_phnum;
+
+	// size of a section header table entry
+	uint16_t e_shentsize;
+
+	// number of section header table entries
+	uint16_t e_shnum;
+
+	// index of the section name string table in the header table
+	uint16_t e_shstrndx;
+} ElfInfo;
+
+// Info about a specific elf section
+typedef struct ElfSectionHeader {
+	// name of the section as an offset into the section name string table
+    uint32_t sh_name;
+
+    uint32_t sh_type;
+    uint64_t sh_flags;
+    uint64_t sh_addr;
+
+	// the sections offset in memory from the begining of the elf
+    uint64_t sh_offset;
+
+	// size of the section
+    uint64_t sh_size;
+
+    uint32_t sh_link;
+    uint32_t sh_info;
+    uint64_t sh_addralign;
+    uint64_t sh_entsize;
+} ElfSectionHeader;
+
+// An entry of a symbol table
+typedef struct ElfSymbol {
+	// name of the symbol as an offset into the linked string table
+	uint32_t st_name;
+	// type in the low 4 bits and binding in the high 4 bits
+	uint8_t st_info;
+	uint8_t st_other;
+	// index of the section the symbol is defined in, 0 for undefined symbols
+	uint16_t st_shndx;
+	uint64_t st_value;
+	uint64_t st_size;
+} ElfSymbol;
+
+// Bounds checked view of a symbol table and the string table holding its names
+typedef struct ElfSymbolTable {
+	const ElfSymbol *symbols;
+	size_t count;
+	const char *names;
+	uint64_t names_size;
+} ElfSymbolTable;
+
+// Bounds checked view of a section's contents inside the mapped file
+typedef struct ElfSection {
+	const uint8_t *data;
+	uint64_t size;
+	// address the section is loaded at, 0 for sections that arent loaded
+	uint64_t addr;
+} ElfSection;
+
+// An ELF file mapped read only into memory. The headers are validated when the file is
+// opened and every other structure is read directly from the mapping.
+typedef struct ElfImage {
+	int fd;
+	const uint8_t *base;
+	size_t size;
+	const ElfInfo *info;
+	const ElfSectionHeader *sections;
+	uint16_t section_count;
+	// the section name string table
+	const char *section_names;
+	uint64_t section_names_size;
+	// identity of the file when it was opened
+	uint64_t dev;
+	uint64_t ino;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+} ElfImage;
+
+// Maps and validates the ELF file at the given path. Returns NULL for errors.
+ElfImage *elf_open(const char *path);
+
+void elf_close(ElfImage *image);
+
+// Returns true if the file at the given path is still the one that was mapped
+bool elf_unchanged(const ElfImage *image, const char *path);
+
+// Finds the section with the given name. Returns -1 if it doesnt exist or lies outside the file.
+int elf_section(const ElfImage *image, const char *name, ElfSection *section);
+
+// Finds the symbol table section with the given name and the string table its names are
+// in. Returns -1 if it doesnt exist or is malformed.
+int elf_symbol_table(const ElfImage *image, const char *name, ElfSymbolTable *table);
+
+// Finds the build id in the GNU build id note. Returns -1 if the file doesnt have one.
+int elf_build_id(const ElfImage *image, const uint8_t **id, size_t *len);
+
+// Hints that the section is about to be read from start to finish
+void elf_advise_sequential(const ElfSection *section);
+
+#endif
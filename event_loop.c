@@ -0,0 +1,263 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "event_loop.h"
+#include "logger.h"
+
+#define NS_PER_SEC 1000000000ull
+// every source can be ready at once
+#define MAX_EPOLL_EVENTS 3
+
+// Adds the descriptor to the epoll set. Returns -1 for errors, with errno set.
+static int watch_fd(EventLoop *loop, int fd)
+{
+	struct epoll_event event = {.events = EPOLLIN, .data.fd = fd};
+	return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+// Starts or stops waiting on the input. A full buffer isnt read into until lines are taken
+// and ended input would keep being reported as ready.
+static int set_input_watched(EventLoop *loop, bool watched)
+{
+	if (loop->input_always_ready || loop->input_watched == watched)
+	{
+		return 0;
+	}
+
+	int res = watched ? watch_fd(loop, loop->input_fd) : epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, loop->input_fd, NULL);
+	if (res == -1)
+	{
+		logger(ERROR, "Failed to change the input waited on. %s", strerror(errno));
+		return -1;
+	}
+	loop->input_watched = watched;
+	return 0;
+}
+
+// Blocks SIGCHLD and SIGINT and creates the descriptors waited on. Returns NULL for errors.
+EventLoop *new_event_loop(int input_fd)
+{
+	EventLoop *loop = calloc(1, sizeof(EventLoop));
+	if (loop == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for the event loop. %s", strerror(errno));
+		return NULL;
+	}
+	loop->input_fd = input_fd;
+
+	// a tracee stopping raises SIGCHLD in the tracer, Ctrl-C interrupts the tracee rather
+	// than killing the debugger
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGCHLD);
+	sigaddset(&signals, SIGINT);
+	if (sigprocmask(SIG_BLOCK, &signals, &loop->old_mask) == -1)
+	{
+		logger(ERROR, "Failed to block signals. %s", strerror(errno));
+		free(loop);
+		return NULL;
+	}
+
+	// none of them should be inherited by the tracee
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	loop->signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (loop->epoll_fd == -1 || loop->signal_fd == -1 || loop->timer_fd == -1 ||
+		watch_fd(loop, loop->signal_fd) == -1 || watch_fd(loop, loop->timer_fd) == -1)
+	{
+		logger(ERROR, "Failed to set up the event loop. %s", strerror(errno));
+		free_event_loop(loop);
+		return NULL;
+	}
+
+	if (watch_fd(loop, input_fd) == 0)
+	{
+		loop->input_watched = true;
+	}
+	else if (errno == EPERM)
+	{
+		// regular files cant be waited on but reading them never blocks
+		loop->input_always_ready = true;
+	}
+	else
+	{
+		logger(ERROR, "Failed to wait on the input. %s", strerror(errno));
+		free_event_loop(loop);
+		return NULL;
+	}
+	return loop;
+}
+
+// Closes the descriptors and unblocks the signals again
+void free_event_loop(EventLoop *loop)
+{
+	int fds[] = {loop->epoll_fd, loop->signal_fd, loop->timer_fd};
+	for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+	{
+		if (fds[i] > 0)
+		{
+			close(fds[i]);
+		}
+	}
+	sigprocmask(SIG_SETMASK, &loop->old_mask, NULL);
+	free(loop);
+}
+
+// Reads what input is available into the buffer. Returns -1 for errors.
+static int read_input(EventLoop *loop)
+{
+	ssize_t n = read(loop->input_fd, loop->input + loop->input_len, EL_INPUT_SIZE - loop->input_len);
+	if (n == -1)
+	{
+		if (errno == EINTR || errno == EAGAIN)
+		{
+			return 0;
+		}
+		logger(ERROR, "Failed to read input. %s", strerror(errno));
+		return -1;
+	}
+
+	if (n == 0)
+	{
+		loop->input_closed = true;
+		return set_input_watched(loop, false);
+	}
+	loop->input_len += (size_t)n;
+	return 0;
+}
+
+// Reads every signal waiting on the signal descriptor. Returns the EL_ flags for them or
+// -1 for errors.
+static int read_signals(EventLoop *loop)
+{
+	int ready = 0;
+	struct signalfd_siginfo info;
+	ssize_t n;
+	while ((n = read(loop->signal_fd, &info, sizeof(info))) == sizeof(info))
+	{
+		ready |= info.ssi_signo == SIGINT ? EL_INTERRUPT : EL_TRACEE;
+	}
+
+	if (n == -1 && errno != EAGAIN && errno != EINTR)
+	{
+		logger(ERROR, "Failed to read signals. %s", strerror(errno));
+		return -1;
+	}
+	return ready;
+}
+
+// Blocks until input, a tracee event, Ctrl-C or the timer is ready and consumes it, reading
+// any input into the buffer. Returns the EL_ flags of what was ready or -1 for errors.
+int el_wait(EventLoop *loop)
+{
+	bool has_room = !loop->input_closed && loop->input_len < EL_INPUT_SIZE;
+	if (set_input_watched(loop, has_room) == -1)
+	{
+		return -1;
+	}
+
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+	bool read_now = loop->input_always_ready && has_room;
+	int count;
+	while ((count = epoll_wait(loop->epoll_fd, events, MAX_EPOLL_EVENTS, read_now ? 0 : -1)) == -1)
+	{
+		if (errno != EINTR)
+		{
+			logger(ERROR, "Failed to wait for events. %s", strerror(errno));
+			return -1;
+		}
+	}
+
+	int ready = 0;
+	if (read_now)
+	{
+		if (read_input(loop) == -1)
+		{
+			return -1;
+		}
+		ready |= EL_INPUT;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		int fd = events[i].data.fd;
+		if (fd == loop->input_fd)
+		{
+			if (read_input(loop) == -1)
+			{
+				return -1;
+			}
+			ready |= EL_INPUT;
+		}
+		else if (fd == loop->signal_fd)
+		{
+			int signals = read_signals(loop);
+			if (signals == -1)
+			{
+				return -1;
+			}
+			ready |= signals;
+		}
+		else if (fd == loop->timer_fd)
+		{
+			// only that it went off matters, not how many times
+			uint64_t expirations;
+			if (read(loop->timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+			{
+				ready |= EL_TIMER;
+			}
+		}
+	}
+	return ready;
+}
+
+// Makes the timer go off every period_ns, or stops it if period_ns is 0. Returns -1 for errors.
+int el_set_timer(EventLoop *loop, uint64_t period_ns)
+{
+	struct timespec period = {.tv_sec = period_ns / NS_PER_SEC, .tv_nsec = period_ns % NS_PER_SEC};
+	struct itimerspec spec = {.it_interval = period, .it_value = period};
+	if (timerfd_settime(loop->timer_fd, 0, &spec, NULL) == -1)
+	{
+		logger(ERROR, "Failed to set the timer. %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// Takes the first complete line of input accept returns true for, or the first line if accept
+// is NULL, leaving the lines before it to be taken later. The rest of the input counts as a
+// line once it has ended. Returns false if there is no such line.
+bool el_take_line(EventLoop *loop, char *line, size_t size, bool (*accept)(const char *line))
+{
+	size_t start = 0;
+	while (start < loop->input_len)
+	{
+		char *newline = memchr(loop->input + start, '\n', loop->input_len - start);
+
+		// a line too long for the buffer is taken as it is
+		bool full = start == 0 && loop->input_len == EL_INPUT_SIZE;
+		if (newline == NULL && !loop->input_closed && !full)
+		{
+			return false;
+		}
+
+		size_t end = newline != NULL ? (size_t)(newline - loop->input) + 1 : loop->input_len;
+		size_t len = end - start < size - 1 ? end - start : size - 1;
+		memcpy(line, loop->input + start, len);
+		line[len] = '\0';
+
+		if (accept == NULL || accept(line))
+		{
+			memmove(loop->input + start, loop->input + end, loop->input_len - end);
+			loop->input_len -= end - start;
+			return true;
+		}
+		start = end;
+	}
+	return false;
+}
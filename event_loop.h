@@ -0,0 +1,60 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// input read ahead of the commands being run, enough for a long script piped in
+#define EL_INPUT_SIZE (64 * 1024)
+
+// What el_wait found ready
+// input was read, there may be new lines to take
+#define EL_INPUT 0x01
+// a SIGCHLD arrived so the tracee may have stopped or exited
+#define EL_TRACEE 0x02
+// Ctrl-C was pressed
+#define EL_INTERRUPT 0x04
+// the timer went off
+#define EL_TIMER 0x08
+
+// Waits on the debugger's input, the tracee and a timer at once so none holds up the others
+typedef struct EventLoop {
+	int epoll_fd;
+	// SIGCHLD and SIGINT are blocked and read from here instead of being handled
+	int signal_fd;
+	int timer_fd;
+	int input_fd;
+	// mask from before the signals were blocked, which children have to get back
+	sigset_t old_mask;
+	// input read but not yet taken as lines
+	char input[EL_INPUT_SIZE];
+	size_t input_len;
+	// the input has ended, what is left in the buffer is all there is
+	bool input_closed;
+	// input epoll cant wait on, such as a regular file, which is always ready
+	bool input_always_ready;
+	// whether the input is in the epoll set, it is taken out while the buffer is full
+	bool input_watched;
+} EventLoop;
+
+// Blocks SIGCHLD and SIGINT and creates the descriptors waited on. Returns NULL for errors.
+EventLoop *new_event_loop(int input_fd);
+
+// Closes the descriptors and unblocks the signals again
+void free_event_loop(EventLoop *loop);
+
+// Blocks until input, a tracee event, Ctrl-C or the timer is ready and consumes it, reading
+// any input into the buffer. Returns the EL_ flags of what was ready or -1 for errors.
+int el_wait(EventLoop *loop);
+
+// Makes the timer go off every period_ns, or stops it if period_ns is 0. Returns -1 for errors.
+int el_set_timer(EventLoop *loop, uint64_t period_ns);
+
+// Takes the first complete line of input accept returns true for, or the first line if accept
+// is NULL, leaving the lines before it to be taken later. The rest of the input counts as a
+// line once it has ended. Returns false if there is no such line.
+bool el_take_line(EventLoop *loop, char *line, size_t size, bool (*accept)(const char *line));
+
+#endif
@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+
+#include "hw_break.h"
+#include "logger.h"
+#include "utils.h"
+
+// DR6 has a bit per debug register set when it fires
+#define DR6_HIT_MASK 0xf
+#define DR_STATUS 6
+#define DR_CONTROL 7
+
+// DR7 has a local enable bit per register at bit 2 * slot, then a 4 bit field per
+// register from bit 16 holding the R/W type and the length
+#define DR7_ENABLE(slot) (1ull << ((slot) * 2))
+#define DR7_FIELD_SHIFT(slot) (16 + (slot) * 4)
+
+// Returns the DR7 length encoding for a watched size. 8 bytes is out of order.
+static uint64_t len_bits(uint8_t len)
+{
+    switch (len)
+    {
+        case 2:
+            return 1;
+        case 8:
+            return 2;
+        case 4:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+// Writes a debug register of the tracee through its user area
+static int write_debug_reg(int pid, int reg, uint64_t val)
+{
+    void *offset = (void *)(offsetof(struct user, u_debugreg) + reg * sizeof(unsigned long));
+    ErrResult res = ptrace_with_error(PTRACE_POKEUSER, pid, offset, (void *)val);
+    if (!res.success)
+    {
+        logger(ERROR, "Failed to write debug register %d.", reg);
+        return -1;
+    }
+    return 0;
+}
+
+// Returns DR7 with the given slot programmed as its breakpoint describes
+static uint64_t dr7_with_slot(uint64_t dr7, size_t slot, const HwBreakPoint *bp)
+{
+    dr7 &= ~(DR7_ENABLE(slot) | (0xfull << DR7_FIELD_SHIFT(slot)));
+    if (bp->used)
+    {
+        uint64_t field = bp->type | (len_bits(bp->len) << 2);
+        dr7 |= DR7_ENABLE(slot) | (field << DR7_FIELD_SHIFT(slot));
+    }
+    return dr7;
+}
+
+// Creates a store with every debug register free
+HwBreakStore *new_hw_store()
+{
+    HwBreakStore *store = (HwBreakStore *)calloc(1, sizeof(HwBreakStore));
+    if (store == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory for hardware breakpoints. %s", strerror(errno));
+        return NULL;
+    }
+    return store;
+}
+
+void free_hw_store(HwBreakStore *store)
+{
+    free(store);
+}
+
+// Returns the first free debug register or -1 if they are all in use
+long hw_free_slot(HwBreakStore *store)
+{
+    for (size_t slot = 0; slot < HW_SLOT_COUNT; slot++)
+    {
+        if (!store->slots[slot].used)
+        {
+            return (long)slot;
+        }
+    }
+    return -1;
+}
+
+// Programs the debug register in the given slot to trap on len bytes at the address.
+// The address must be aligned to len. Rebase is set if the address should follow the
+// executable into a new run. Returns -1 for errors.
+int hw_set(HwBreakStore *store, int pid, size_t slot, uint64_t addr, HwBreakType type, uint8_t len, bool rebase)
+{
+    if (type == HW_EXECUTE)
+    {
+        len = 1;
+    }
+
+    if ((len != 1 && len != 2 && len != 4 && len != 8) || addr % len != 0)
+    {
+        logger(ERROR, "Hardware breakpoints must cover 1, 2, 4 or 8 aligned bytes.");
+        return -1;
+    }
+
+    HwBreakPoint bp = {.addr = addr, .len = len, .type = type, .used = true, .rebase = rebase, .value = 0};
+    uint64_t dr7 = dr7_with_slot(store->dr7, slot, &bp);
+
+    // the kernel checks the address against DR7 so the address has to go in first
+    if (write_debug_reg(pid, (int)slot, addr) == -1 || write_debug_reg(pid, DR_CONTROL, dr7) == -1)
+    {
+        return -1;
+    }
+
+    store->slots[slot] = bp;
+    store->dr7 = dr7;
+    return 0;
+}
+
+// Frees the debug register in the given slot. Returns -1 for errors.
+int hw_remove(HwBreakStore *store, int pid, size_t slot)
+{
+    HwBreakPoint unused = {0};
+    uint64_t dr7 = dr7_with_slot(store->dr7, slot, &unused);
+    if (write_debug_reg(pid, DR_CONTROL, dr7) == -1)
+    {
+        return -1;
+    }
+
+    store->slots[slot] = unused;
+    store->dr7 = dr7;
+    return 0;
+}
+
+// Programs every hardware breakpoint into a new run of the program. The addresses are
+// moved by delta if the program was loaded somewhere else, so any set at raw addresses
+// should be dropped with hw_clear_raw first. Returns the number of
+// breakpoints installed or -1 for errors.
+long hw_rearm_all(HwBreakStore *store, int pid, int64_t delta)
+{
+    long count = 0;
+    for (size_t slot = 0; slot < HW_SLOT_COUNT; slot++)
+    {
+        if (store->slots[slot].used)
+        {
+            store->slots[slot].addr += delta;
+            count++;
+        }
+    }
+
+    if (count > 0 && hw_program(store, pid) == -1)
+    {
+        return -1;
+    }
+    return count;
+}
+
+// Writes every hardware breakpoint into the debug registers of the given thread, which
+// threads dont inherit from the one that started them. Returns -1 for errors.
+int hw_program(HwBreakStore *store, int pid)
+{
+    for (size_t slot = 0; slot < HW_SLOT_COUNT; slot++)
+    {
+        HwBreakPoint *bp = &store->slots[slot];
+        if (bp->used && write_debug_reg(pid, (int)slot, bp->addr) == -1)
+        {
+            return -1;
+        }
+    }
+
+    // one write enables all of them
+    return write_debug_reg(pid, DR_CONTROL, store->dr7);
+}
+
+// Turns off every debug register in the tracee, which keeps them after being detached
+// from. The breakpoints are kept so hw_rearm_all can program them again. Returns -1 for errors.
+int hw_disarm_all(HwBreakStore *store, int pid)
+{
+    if (store->dr7 == 0)
+    {
+        return 0;
+    }
+    return write_debug_reg(pid, DR_CONTROL, 0);
+}
+
+// Forgets every hardware breakpoint without touching the tracee
+void hw_clear(HwBreakStore *store)
+{
+    memset(store, 0, sizeof(HwBreakStore));
+}
+
+// Forgets the hardware breakpoints set at raw addresses without touching the tracee.
+// Returns the number forgotten.
+long hw_clear_raw(HwBreakStore *store)
+{
+    HwBreakPoint unused = {0};
+    long count = 0;
+    for (size_t slot = 0; slot < HW_SLOT_COUNT; slot++)
+    {
+        if (store->slots[slot].used && !store->slots[slot].rebase)
+        {
+            store->slots[slot] = unused;
+            store->dr7 = dr7_with_slot(store->dr7, slot, &unused);
+            count++;
+        }
+    }
+    return count;
+}
+
+// Reads DR6 to see which hardware breakpoint caused the current stop and clears it for the
+// next one. Returns 1 and sets slot if one fired, 0 if none did and -1 for errors.
+int hw_find_hit(HwBreakStore *store, int pid, long *slot)
+{
+    if (store->dr7 == 0)
+    {
+        return 0;
+    }
+
+    void *offset = (void *)(offsetof(struct user, u_debugreg) + DR_STATUS * sizeof(unsigned long));
+    ErrResult res = ptrace_with_error(PTRACE_PEEKUSER, pid, offset, NULL);
+    if (!res.success)
+    {
+        logger(ERROR, "Failed to read debug status register.");
+        return -1;
+    }
+
+    uint64_t hits = (uint64_t)res.val & DR6_HIT_MASK;
+    if (hits == 0)
+    {
+        return 0;
+    }
+
+    // the bits are sticky so they have to be cleared before the next stop
+    if (write_debug_reg(pid, DR_STATUS, 0) == -1)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < HW_SLOT_COUNT; i++)
+    {
+        if ((hits & (1ull << i)) && store->slots[i].used)
+        {
+            *slot = (long)i;
+            return 1;
+        }
+    }
+    return 0;
+}
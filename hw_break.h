@@ -0,0 +1,80 @@
+#ifndef HW_BREAK_H
+#define HW_BREAK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// x86 has four debug address registers, DR0 to DR3
+#define HW_SLOT_COUNT 4
+
+// What a hardware breakpoint traps on. The values are the DR7 R/W field encodings.
+typedef enum HwBreakType {
+    HW_EXECUTE = 0,
+    HW_WRITE = 1,
+    HW_READ_WRITE = 3,
+} HwBreakType;
+
+// A breakpoint or watchpoint held in one of the debug registers
+typedef struct HwBreakPoint {
+    uint64_t addr;
+    // 1, 2, 4 or 8 bytes. Always 1 for execute breakpoints.
+    uint8_t len;
+    uint8_t type;
+    bool used;
+    // the address came from a symbol or line so it moves with the executable
+    bool rebase;
+    // contents of the watched memory when last seen so changes can be shown
+    uint64_t value;
+} HwBreakPoint;
+
+// Hardware breakpoints indexed by the debug register they use. Unlike int3 breakpoints
+// they dont modify the tracee so data can be watched without single stepping.
+typedef struct HwBreakStore {
+    HwBreakPoint slots[HW_SLOT_COUNT];
+    // the value last written to DR7
+    uint64_t dr7;
+} HwBreakStore;
+
+// Creates a store with every debug register free
+HwBreakStore *new_hw_store();
+
+void free_hw_store(HwBreakStore *store);
+
+// Returns the first free debug register or -1 if they are all in use
+long hw_free_slot(HwBreakStore *store);
+
+// Programs the debug register in the given slot to trap on len bytes at the address.
+// The address must be aligned to len. Rebase is set if the address should follow the
+// executable into a new run. Returns -1 for errors.
+int hw_set(HwBreakStore *store, int pid, size_t slot, uint64_t addr, HwBreakType type, uint8_t len, bool rebase);
+
+// Frees the debug register in the given slot. Returns -1 for errors.
+int hw_remove(HwBreakStore *store, int pid, size_t slot);
+
+// Programs every hardware breakpoint into a new run of the program. The addresses are
+// moved by delta if the program was loaded somewhere else, so any set at raw addresses
+// should be dropped with hw_clear_raw first. Returns the number of
+// breakpoints installed or -1 for errors.
+long hw_rearm_all(HwBreakStore *store, int pid, int64_t delta);
+
+// Writes every hardware breakpoint into the debug registers of the given thread, which
+// threads dont inherit from the one that started them. Returns -1 for errors.
+int hw_program(HwBreakStore *store, int pid);
+
+// Turns off every debug register in the tracee, which keeps them after being detached
+// from. The breakpoints are kept so hw_rearm_all can program them again. Returns -1 for errors.
+int hw_disarm_all(HwBreakStore *store, int pid);
+
+// Forgets every hardware breakpoint without touching the tracee
+void hw_clear(HwBreakStore *store);
+
+// Forgets the hardware breakpoints set at raw addresses without touching the tracee.
+// Returns the number forgotten.
+long hw_clear_raw(HwBreakStore *store);
+
+// Reads DR6 to see which hardware breakpoint caused the current stop and clears it for the
+// next one. Returns 1 and sets slot if one fired, 0 if none did and -1 for errors.
+int hw_find_hit(HwBreakStore *store, int pid, long *slot);
+
+#endif
@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "index_cache.h"
+#include "logger.h"
+
+#define CACHE_MAGIC "EDBIDX1"
+#define CACHE_VERSION 2
+#define CACHE_DIR "edb"
+#define MAX_BUILD_ID_SIZE 32
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+// The start of a cache file. The rows follow the header, then the offset of each file
+// name, the sorted symbols, the symbol name slots and finally the file names themselves.
+typedef struct CacheHeader {
+	char magic[8];
+	uint32_t version;
+	// rows are stored as they are in memory so the layout has to match
+	uint32_t row_size;
+	char key[CACHE_KEY_SIZE];
+	uint64_t row_count;
+	uint64_t file_count;
+	uint64_t blob_size;
+	uint32_t primary_file;
+	// symbols are also stored as they are in memory
+	uint32_t symbol_size;
+	uint64_t symbol_count;
+	uint64_t slot_count;
+} CacheHeader;
+
+// Hashes the file 8 bytes at a time, only used when there is no build id
+static uint64_t hash_contents(const uint8_t *data, size_t size)
+{
+	uint64_t hash = FNV_OFFSET;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * FNV_PRIME;
+	}
+	for (; i < size; i++)
+	{
+		hash = (hash ^ data[i]) * FNV_PRIME;
+	}
+	return hash;
+}
+
+// Works out the key the debug index of the executable is cached under. This is the
+// build id when the executable has one and a hash of its contents otherwise.
+void index_cache_key(const ElfImage *elf, char *key, size_t key_size)
+{
+	const uint8_t *id;
+	size_t id_len;
+	if (elf_build_id(elf, &id, &id_len) == 0 && id_len <= MAX_BUILD_ID_SIZE)
+	{
+		for (size_t i = 0; i < id_len; i++)
+		{
+			snprintf(key + 2 * i, key_size - 2 * i, "%02x", id[i]);
+		}
+		return;
+	}
+
+	snprintf(key, key_size, "hash-%016llx-%llx", (unsigned long long)hash_contents(elf->base, elf->size), (unsigned long long)elf->size);
+}
+
+// Builds the path of the cache file for the key. Returns -1 if there is nowhere to put it.
+static int cache_path(const char *key, char *path, size_t path_size, int create_dir)
+{
+	char dir[PATH_MAX];
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	if (xdg != NULL && xdg[0] != '\0')
+	{
+		snprintf(dir, PATH_MAX, "%s", xdg);
+	}
+	else if (home != NULL && home[0] != '\0')
+	{
+		snprintf(dir, PATH_MAX, "%s/.cache", home);
+	}
+	else
+	{
+		return -1;
+	}
+
+	if (create_dir)
+	{
+		mkdir(dir, 0755);
+	}
+
+	size_t len = strlen(dir);
+	snprintf(dir + len, PATH_MAX - len, "/%s", CACHE_DIR);
+	if (create_dir && mkdir(dir, 0755) == -1 && errno != EEXIST)
+	{
+		logger(WARN, "Failed to create cache directory %s. %s", dir, strerror(errno));
+		return -1;
+	}
+
+	int written = snprintf(path, path_size, "%s/%s.idx", dir, key);
+	return written < 0 || (size_t)written >= path_size ? -1 : 0;
+}
+
+// Checks the mapped cache file was written for the key by this version of edb and that
+// every part of it lies within the file
+static int validate_cache(const uint8_t *data, size_t size, const char *key)
+{
+	if (size < sizeof(CacheHeader))
+	{
+		return -1;
+	}
+
+	const CacheHeader *header = (const CacheHeader *)data;
+	if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 || header->version != CACHE_VERSION ||
+		header->row_size != sizeof(LineRow) || header->symbol_size != sizeof(Symbol) || strncmp(header->key, key, CACHE_KEY_SIZE) != 0)
+	{
+		return -1;
+	}
+
+	uint64_t remaining = size - sizeof(CacheHeader);
+	if (header->row_count > remaining / sizeof(LineRow))
+	{
+		return -1;
+	}
+	remaining -= header->row_count * sizeof(LineRow);
+
+	if (header->file_count == 0 || header->file_count > remaining / sizeof(uint64_t))
+	{
+		return -1;
+	}
+	remaining -= header->file_count * sizeof(uint64_t);
+
+	if (header->symbol_count > remaining / sizeof(Symbol))
+	{
+		return -1;
+	}
+	remaining -= header->symbol_count * sizeof(Symbol);
+
+	if (header->slot_count > remaining / sizeof(uint32_t))
+	{
+		return -1;
+	}
+	remaining -= header->slot_count * sizeof(uint32_t);
+
+	if (header->blob_size != remaining || header->blob_size == 0 || data[size - 1] != '\0' || header->primary_file >= header->file_count)
+	{
+		return -1;
+	}
+
+	const uint64_t *offsets = (const uint64_t *)(data + sizeof(CacheHeader) + header->row_count * sizeof(LineRow));
+	for (uint64_t i = 0; i < header->file_count; i++)
+	{
+		if (offsets[i] >= header->blob_size)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Maps the cached line table stored under the key and restores the symbol table of the
+// executable it was cached for into symbols. Returns NULL if there isnt a usable cache.
+LineTable *load_index_cache(const char *key, const ElfImage *elf, SymbolTable **symbols)
+{
+	char path[PATH_MAX];
+	if (cache_path(key, path, PATH_MAX, 0) == -1)
+	{
+		return NULL;
+	}
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		logger(DEBUG, "No debug index cached at %s.", path);
+		return NULL;
+	}
+
+	struct stat file_info;
+	void *data = MAP_FAILED;
+	if (fstat(fd, &file_info) == 0 && file_info.st_size > 0)
+	{
+		data = mmap(NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	// the mapping keeps the file alive
+	close(fd);
+
+	if (data == MAP_FAILED)
+	{
+		logger(WARN, "Failed to map debug index cache %s.", path);
+		return NULL;
+	}
+
+	size_t size = file_info.st_size;
+	if (validate_cache((const uint8_t *)data, size, key) == -1)
+	{
+		// remove it so a later session can write a good one
+		logger(WARN, "Ignoring invalid debug index cache %s.", path);
+		munmap(data, size);
+		unlink(path);
+		return NULL;
+	}
+
+	const CacheHeader *header = (const CacheHeader *)data;
+	const uint8_t *rows = (const uint8_t *)data + sizeof(CacheHeader);
+	const uint64_t *offsets = (const uint64_t *)(rows + header->row_count * sizeof(LineRow));
+	const Symbol *cached_symbols = (const Symbol *)(offsets + header->file_count);
+	const uint32_t *slots = (const uint32_t *)(cached_symbols + header->symbol_count);
+	const char *blob = (const char *)(slots + header->slot_count);
+
+	// the symbols are copied out so the symbol table doesnt depend on the line table's mapping
+	*symbols = restore_symbol_table(elf, cached_symbols, header->symbol_count, slots, header->slot_count);
+	if (*symbols == NULL)
+	{
+		logger(WARN, "Ignoring invalid debug index cache %s.", path);
+		munmap(data, size);
+		unlink(path);
+		return NULL;
+	}
+
+	LineTable *table = (LineTable *)calloc(1, sizeof(LineTable));
+	if (table == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for line table. %s", strerror(errno));
+		munmap(data, size);
+		free_symbol_table(*symbols);
+		*symbols = NULL;
+		return NULL;
+	}
+
+	// the rows are used straight from the mapping while the file names go back into a
+	// string table so they can be looked up
+	table->mapping = data;
+	table->mapping_size = size;
+	table->rows = (LineRow *)rows;
+	table->row_count = header->row_count;
+	table->primary_file = header->primary_file;
+	table->unranged_loaded = true;
+	table->files = new_str_table();
+	if (table->files == NULL)
+	{
+		free_line_table(table);
+		free_symbol_table(*symbols);
+		*symbols = NULL;
+		return NULL;
+	}
+
+	for (uint64_t i = 0; i < header->file_count; i++)
+	{
+		if (st_intern(table->files, blob + offsets[i]) != (long)i)
+		{
+			logger(WARN, "Ignoring invalid debug index cache %s.", path);
+			free_line_table(table);
+			free_symbol_table(*symbols);
+			*symbols = NULL;
+			return NULL;
+		}
+	}
+
+	logger(DEBUG, "Loaded %d line table rows and %d symbols from %s.", (int)table->row_count, (int)(*symbols)->count, path);
+	return table;
+}
+
+// Writes a fully decoded line table and the symbol table of the same executable to the
+// cache under the key. Returns -1 for errors.
+int save_index_cache(const LineTable *table, const SymbolTable *symbols, const char *key)
+{
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX];
+	if (cache_path(key, path, PATH_MAX, 1) == -1 || snprintf(tmp_path, PATH_MAX, "%s.%d", path, (int)getpid()) >= PATH_MAX)
+	{
+		return -1;
+	}
+
+	CacheHeader header;
+	memset(&header, 0, sizeof(CacheHeader));
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.version = CACHE_VERSION;
+	header.row_size = sizeof(LineRow);
+	snprintf(header.key, CACHE_KEY_SIZE, "%s", key);
+	header.row_count = table->row_count;
+	header.file_count = table->files->count;
+	header.blob_size = table->files->blob_size;
+	header.primary_file = table->primary_file;
+	header.symbol_size = sizeof(Symbol);
+	header.symbol_count = symbols->count;
+	header.slot_count = symbols->slot_count;
+
+	FILE *file = fopen(tmp_path, "wb");
+	if (file == NULL)
+	{
+		logger(WARN, "Failed to open %s. %s", tmp_path, strerror(errno));
+		return -1;
+	}
+
+	int ok = fwrite(&header, sizeof(CacheHeader), 1, file) == 1;
+	ok = ok && fwrite(table->rows, sizeof(LineRow), table->row_count, file) == table->row_count;
+	ok = ok && fwrite(table->files->offsets, sizeof(uint64_t), table->files->count, file) == table->files->count;
+	ok = ok && fwrite(symbols->symbols, sizeof(Symbol), symbols->count, file) == symbols->count;
+	ok = ok && fwrite(symbols->slots, sizeof(uint32_t), symbols->slot_count, file) == symbols->slot_count;
+	ok = ok && fwrite(table->files->blob, 1, table->files->blob_size, file) == table->files->blob_size;
+	ok = fclose(file) == 0 && ok;
+
+	// write to a temporary file then rename it so a concurrent session never maps a partial cache
+	if (!ok || rename(tmp_path, path) == -1)
+	{
+		logger(WARN, "Failed to write debug index cache %s. %s", path, strerror(errno));
+		unlink(tmp_path);
+		return -1;
+	}
+
+	logger(DEBUG, "Cached %d line table rows and %d symbols in %s.", (int)table->row_count, (int)symbols->count, path);
+	return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef INDEX_CACHE_H
+#define INDEX_CACHE_H
+
+#include <stddef.h>
+
+#include "dwarf.h"
+#include "elf_image.h"
+#include "symbols.h"
+
+// enough for a hex encoded 32 byte build id
+#define CACHE_KEY_SIZE 80
+
+// Works out the key the debug index of the executable is cached under. This is the
+// build id when the executable has one and a hash of its contents otherwise.
+void index_cache_key(const ElfImage *elf, char *key, size_t key_size);
+
+// Maps the cached line table stored under the key and restores the symbol table of the
+// executable it was cached for into symbols. Returns NULL if there isnt a usable cache.
+LineTable *load_index_cache(const char *key, const ElfImage *elf, SymbolTable **symbols);
+
+// Writes a fully decoded line table and the symbol table of the same executable to the
+// cache under the key. Returns -1 for errors.
+int save_index_cache(const LineTable *table, const SymbolTable *symbols, const char *key);
+
+#endif
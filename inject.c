@@ -0,0 +1,329 @@
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#include "inject.h"
+#include "logger.h"
+#include "utils.h"
+#include "x86_insn.h"
+
+#define MAX_SYSCALL_ARGS 6
+// bytes below the stack pointer functions may use without moving it
+#define RED_ZONE_SIZE 128
+#define STEP_AREA_SIZE 4096
+// how far below the instruction the step area is placed, tried in turn
+#define STEP_AREA_DISTANCE (64ull * 1024 * 1024)
+#define STEP_AREA_TRIES 16
+
+// the x86-64 syscall instruction
+static const uint8_t SYSCALL_INSN[] = {0x0f, 0x05};
+
+// Waits for the given thread to stop, going past stops left over from an earlier
+// PTRACE_INTERRUPT by resuming it with req again. Returns -1 for errors.
+static int wait_past_interrupts(int tid, enum __ptrace_request req, int *status)
+{
+	while (true)
+	{
+		if (waitpid(tid, status, __WALL) == -1)
+		{
+			logger(ERROR, "Failed to wait for thread %d. %s", tid, strerror(errno));
+			return -1;
+		}
+		if (!WIFSTOPPED(*status) || *status >> 16 != PTRACE_EVENT_STOP)
+		{
+			return 0;
+		}
+		if (!ptrace_with_error(req, tid, NULL, NULL).success)
+		{
+			return -1;
+		}
+	}
+}
+
+// Makes the stopped tracee run a system call with up to six arguments and stores what it
+// returned, -errno on failure, in result. The tracee's registers, code and stop status are
+// left as they were. Returns -1 if the call couldnt be made.
+int inject_syscall(DebugSession *session, long number, const uint64_t *args, size_t arg_count, long *result)
+{
+	if (arg_count > MAX_SYSCALL_ARGS)
+	{
+		logger(ERROR, "System calls take at most %d arguments.", MAX_SYSCALL_ARGS);
+		return -1;
+	}
+
+	if (load_reg_cache(session->regs) == -1)
+	{
+		return -1;
+	}
+
+	// anything still waiting to be flushed is kept in the saved copy
+	struct user_regs_struct saved = session->regs->regs;
+	uint32_t saved_dirty = session->regs->dirty;
+	int saved_status = session->wait_status;
+	// the call is made on the current thread, the others are left as they are
+	int tid = session->current->tid;
+
+	// the instruction at the current ip is borrowed for the syscall, whatever is there
+	// including any int3 is put back afterwards. Other threads could run into it so they
+	// are stopped until then.
+	uint64_t ip = saved.rip;
+	uint8_t saved_code[sizeof(SYSCALL_INSN)];
+	if (halt_threads(session, true) != 0)
+	{
+		return -1;
+	}
+	if (read_memory(&session->mem, ip, saved_code, sizeof(saved_code)) == -1 ||
+		write_memory(&session->mem, ip, SYSCALL_INSN, sizeof(SYSCALL_INSN)) == -1)
+	{
+		logger(ERROR, "Failed to place syscall at %p.", (void *)ip);
+		resume_halted(session);
+		return -1;
+	}
+
+	struct user_regs_struct regs = saved;
+	unsigned long long *arg_regs[MAX_SYSCALL_ARGS] = {&regs.rdi, &regs.rsi, &regs.rdx, &regs.r10, &regs.r8, &regs.r9};
+	for (size_t i = 0; i < arg_count; i++)
+	{
+		*arg_regs[i] = args[i];
+	}
+	regs.rax = number;
+	// stops us being treated as an interrupted syscall the kernel should restart
+	regs.orig_rax = -1;
+	regs.rip = ip;
+
+	int res = -1;
+	int status;
+	if (ptrace_with_error(PTRACE_SETREGS, tid, NULL, &regs).success &&
+		ptrace_with_error(PTRACE_SINGLESTEP, tid, NULL, NULL).success)
+	{
+		bool waited = wait_past_interrupts(tid, PTRACE_SINGLESTEP, &status) == 0;
+		if (waited && (!WIFSTOPPED(status) || WSTOPSIG(status) != SIGTRAP))
+		{
+			logger(ERROR, "Process %d didnt stop after the injected syscall.", session->pid);
+		}
+		else if (waited && ptrace_with_error(PTRACE_GETREGS, tid, NULL, &regs).success)
+		{
+			*result = (long)regs.rax;
+			res = 0;
+		}
+	}
+
+	if (write_memory(&session->mem, ip, saved_code, sizeof(saved_code)) == -1 ||
+		!ptrace_with_error(PTRACE_SETREGS, tid, NULL, &saved).success)
+	{
+		logger(ERROR, "Failed to restore process %d after injected syscall.", session->pid);
+		res = -1;
+	}
+	else
+	{
+		session->regs->regs = saved;
+		session->regs->valid = true;
+		session->regs->dirty = saved_dirty;
+		session->wait_status = saved_status;
+	}
+
+	// the other threads are resumed whatever happened so none is left halted for good
+	return resume_halted(session) == -1 ? -1 : res;
+}
+
+// Makes the stopped tracee call the function at the given address with up to six integer
+// arguments and stores what it returned in result. The call runs on the tracee's stack below
+// the red zone and returns to address 0 so the fault marks its end. Signals that arrive
+// during the call are delivered. The tracee's registers and stop status are left as they
+// were. Returns -1 if the call couldnt be made or crashed.
+int inject_call(DebugSession *session, uint64_t func, const uint64_t *args, size_t arg_count, uint64_t *result)
+{
+	if (arg_count > MAX_SYSCALL_ARGS)
+	{
+		logger(ERROR, "Injected calls take at most %d arguments.", MAX_SYSCALL_ARGS);
+		return -1;
+	}
+
+	if (load_reg_cache(session->regs) == -1)
+	{
+		return -1;
+	}
+
+	struct user_regs_struct saved = session->regs->regs;
+	uint32_t saved_dirty = session->regs->dirty;
+	int saved_status = session->wait_status;
+	int tid = session->current->tid;
+
+	struct user_regs_struct regs = saved;
+	unsigned long long *arg_regs[MAX_SYSCALL_ARGS] = {&regs.rdi, &regs.rsi, &regs.rdx, &regs.rcx, &regs.r8, &regs.r9};
+	for (size_t i = 0; i < arg_count; i++)
+	{
+		*arg_regs[i] = args[i];
+	}
+
+	// the return address is pushed onto a 16 byte aligned stack as a call would
+	uint64_t return_addr = 0;
+	regs.rsp = ((saved.rsp - RED_ZONE_SIZE) & ~(uint64_t)0xf) - sizeof(return_addr);
+	regs.rip = func;
+	regs.rax = 0;
+	regs.orig_rax = -1;
+	if (write_memory(&session->mem, regs.rsp, &return_addr, sizeof(return_addr)) == -1 ||
+		!ptrace_with_error(PTRACE_SETREGS, tid, NULL, &regs).success)
+	{
+		logger(ERROR, "Failed to set up call to %p in process %d.", (void *)func, session->pid);
+		return -1;
+	}
+
+	int res = -1;
+	int sig = 0;
+	while (true)
+	{
+		int status;
+		if (!ptrace_with_error(PTRACE_CONT, tid, NULL, (void *)(long)sig).success)
+		{
+			break;
+		}
+		if (wait_past_interrupts(tid, PTRACE_CONT, &status) == -1)
+		{
+			break;
+		}
+		if (!WIFSTOPPED(status))
+		{
+			logger(ERROR, "Process %d exited during an injected call.", session->pid);
+			session->wait_status = status;
+			session->active = false;
+			return -1;
+		}
+		if (!ptrace_with_error(PTRACE_GETREGS, tid, NULL, &regs).success)
+		{
+			break;
+		}
+
+		if (WSTOPSIG(status) == SIGSEGV && regs.rip == return_addr)
+		{
+			*result = regs.rax;
+			res = 0;
+			break;
+		}
+		if (WSTOPSIG(status) == SIGSEGV || WSTOPSIG(status) == SIGTRAP || WSTOPSIG(status) == SIGBUS)
+		{
+			logger(ERROR, "Injected call to %p crashed at %p.", (void *)func, (void *)regs.rip);
+			break;
+		}
+		sig = WSTOPSIG(status);
+	}
+
+	if (!ptrace_with_error(PTRACE_SETREGS, tid, NULL, &saved).success)
+	{
+		logger(ERROR, "Failed to restore process %d after injected call.", session->pid);
+		return -1;
+	}
+
+	session->regs->regs = saved;
+	session->regs->valid = true;
+	session->regs->dirty = saved_dirty;
+	session->wait_status = saved_status;
+	return res;
+}
+
+// Maps the page instructions are stepped through out of line below addr, where there is
+// usually free space within reach of rip relative operands. Returns 1 if there is no room and
+// -1 for errors.
+static int map_step_area(DebugSession *session, uint64_t addr)
+{
+	for (int i = 1; i <= STEP_AREA_TRIES; i++)
+	{
+		uint64_t hint = (addr & ~(uint64_t)0xfff) - i * STEP_AREA_DISTANCE;
+		uint64_t args[] = {hint, STEP_AREA_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, (uint64_t)-1, 0};
+		long area;
+		if (inject_syscall(session, SYS_mmap, args, 6, &area) == -1)
+		{
+			return -1;
+		}
+		if (area == (long)hint)
+		{
+			session->step_area = hint;
+			return 0;
+		}
+		if (area >= 0 || area < -4095)
+		{
+			// older kernels treat the flag as a hint and can put the area anywhere
+			uint64_t unmap_args[] = {(uint64_t)area, STEP_AREA_SIZE};
+			inject_syscall(session, SYS_munmap, unmap_args, 2, &area);
+		}
+	}
+
+	logger(DEBUG, "No room to step instructions out of line near %p.", (void *)addr);
+	session->no_step_area = true;
+	return 1;
+}
+
+// Single steps the current thread through a copy of the instruction in code, which holds the
+// original bytes at its ip, so a breakpoint over the original can stay in while other threads
+// run past it. The ip, and the return address a call pushes, are put back in terms of the
+// original afterwards. Returns 1 if the instruction cant be run anywhere else and -1 for errors.
+int step_out_of_line(DebugSession *session, const uint8_t *code, size_t avail)
+{
+	if (session->no_step_area || load_reg_cache(session->regs) == -1)
+	{
+		return session->no_step_area ? 1 : -1;
+	}
+
+	uint64_t ip = (uint64_t)get_ip(session->regs);
+	X86Insn insn;
+	if (decode_insn(code, avail, &insn) == -1)
+	{
+		return 1;
+	}
+	if (session->step_area == 0)
+	{
+		int mapped = map_step_area(session, ip);
+		if (mapped != 0)
+		{
+			return mapped;
+		}
+	}
+
+	// instructions out of reach of the page or that only come in short forms stay where they are
+	uint8_t copy[MAX_INSN_LEN];
+	int len = insn_relocate(code, &insn, ip, session->step_area, copy);
+	if (len == -1)
+	{
+		return 1;
+	}
+
+	if (write_memory(&session->mem, session->step_area, copy, (size_t)len) == -1 || set_ip(session->regs, (void *)session->step_area) == -1 ||
+		resume_tracee(session, PTRACE_SINGLESTEP) == -1 || wait_for_tracee(session) == -1)
+	{
+		logger(ERROR, "Failed to step the instruction at %p out of line.", (void *)ip);
+		return -1;
+	}
+	if (!WIFSTOPPED(session->wait_status))
+	{
+		return 0;
+	}
+
+	if (load_reg_cache(session->regs) == -1)
+	{
+		return -1;
+	}
+	uint64_t new_ip = (uint64_t)get_ip(session->regs);
+	uint64_t next_ip = ip + insn.len;
+	if (new_ip == session->step_area)
+	{
+		// it stopped for something else before the instruction ran
+		return set_ip(session->regs, (void *)ip);
+	}
+
+	// branches went to the original targets, only falling through lands back in the copy
+	if (insn_is_call(code, &insn) && write_memory(&session->mem, session->regs->regs.rsp, &next_ip, sizeof(next_ip)) == -1)
+	{
+		logger(ERROR, "Failed to fix the return address of the call at %p.", (void *)ip);
+		return -1;
+	}
+	if (new_ip == session->step_area + (uint64_t)len)
+	{
+		return set_ip(session->regs, (void *)next_ip);
+	}
+	return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef INJECT_H
+#define INJECT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "session.h"
+
+// Makes the stopped tracee run a system call with up to six arguments and stores what it
+// returned, -errno on failure, in result. The tracee's registers, code and stop status are
+// left as they were. Returns -1 if the call couldnt be made.
+int inject_syscall(DebugSession *session, long number, const uint64_t *args, size_t arg_count, long *result);
+
+// Makes the stopped tracee call the function at the given address with up to six integer
+// arguments and stores what it returned in result. The call runs on the tracee's stack below
+// the red zone and returns to address 0 so the fault marks its end. Signals that arrive
+// during the call are delivered. The tracee's registers and stop status are left as they
+// were. Returns -1 if the call couldnt be made or crashed.
+int inject_call(DebugSession *session, uint64_t func, const uint64_t *args, size_t arg_count, uint64_t *result);
+
+// Single steps the current thread through a copy of the instruction in code, which holds the
+// original bytes at its ip, so a breakpoint over the original can stay in while other threads
+// run past it. The ip, and the return address a call pushes, are put back in terms of the
+// original afterwards. Returns 1 if the instruction cant be run anywhere else and -1 for errors.
+int step_out_of_line(DebugSession *session, const uint8_t *code, size_t avail);
+
+#endif
@@ -6,7 +6,7 @@
 
 #include "logger.h"
 
-#define MAX_MSG_SIZE 100
+#define MAX_MSG_SIZE 512
 #define MAX_ARG_SIZE 32
 
 static LogLevel log_level = INFO;
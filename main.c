@@ -7,22 +7,69 @@
 
 #include "logger.h"
 #include "debugger.h"
+#include "profile.h"
 #include "utils.h"
 
+// Runs edb profile <prog> [--hz N] [-o file]. Returns -1 for errors.
+static int profile_cmd(int argc, char *argv[])
+{
+    char *prog = NULL;
+    unsigned long hz = DEFAULT_PROFILE_HZ;
+    const char *out_path = DEFAULT_PROFILE_FILE;
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--hz") == 0 && i + 1 < argc)
+        {
+            hz = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            out_path = argv[++i];
+        }
+        else if (prog == NULL && argv[i][0] != '-')
+        {
+            prog = argv[i];
+        }
+        else
+        {
+            prog = NULL;
+            break;
+        }
+    }
+
+    if (prog == NULL || hz == 0 || hz > MAX_PROFILE_HZ)
+    {
+        logger(ERROR, "Usage: edb profile <prog> [--hz N] [-o file] with N from 1 to %d.", MAX_PROFILE_HZ);
+        return -1;
+    }
+    return profile_program(prog, (unsigned)hz, out_path);
+}
+
 int main(int argc, char *argv[])
 {
     set_log_level(DEBUG);
 
+    if (argc >= 2 && strcmp(argv[1], "profile") == 0)
+    {
+        return profile_cmd(argc, argv) == -1 ? EXIT_FAILURE : 0;
+    }
+
     char *prog = NULL;
+    char *pid = NULL;
 
-    if (argc >= 2)
+    if (argc >= 3 && strcmp(argv[1], "-p") == 0)
+    {
+        pid = argv[2];
+    }
+    else if (argc >= 2)
     {
         prog = argv[1];
     }
 
     Debugger * db = new_debugger();
 
-    int res = run_cmd_loop(db, prog);
+    int res = run_cmd_loop(db, prog, pid);
     if (res == -1) {
         logger(ERROR, "Failed to run command loop");
     }
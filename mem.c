@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+
+#include "mem.h"
+#include "logger.h"
+
+#define MEM_PATH_SIZE 32
+
+// max number of iovecs the kernel accepts in a single process_vm_readv call
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// Sets up a memory handle for the given process
+void init_tracee_mem(TraceeMem *mem, int pid)
+{
+	mem->pid = pid;
+	mem->fd = -1;
+}
+
+// Closes the handle to /proc/<pid>/mem if it is open
+void close_tracee_mem(TraceeMem *mem)
+{
+	if (mem->fd != -1)
+	{
+		close(mem->fd);
+		mem->fd = -1;
+	}
+}
+
+// Opens /proc/<pid>/mem if we havent already
+static int open_mem_file(TraceeMem *mem)
+{
+	if (mem->fd != -1)
+	{
+		return 0;
+	}
+
+	char path[MEM_PATH_SIZE];
+	snprintf(path, MEM_PATH_SIZE, "/proc/%d/mem", mem->pid);
+
+	mem->fd = open(path, O_RDWR | O_CLOEXEC);
+	if (mem->fd == -1)
+	{
+		logger(ERROR, "Failed to open memory of process %d. %s", mem->pid, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// Reads a single range through /proc/<pid>/mem. This works for pages that
+// process_vm_readv refuses such as ones without read permission.
+static int pread_range(TraceeMem *mem, uint64_t addr, void *buf, size_t len)
+{
+	if (open_mem_file(mem) == -1)
+	{
+		return -1;
+	}
+
+	size_t done = 0;
+	while (done < len)
+	{
+		ssize_t n = pread(mem->fd, (char *)buf + done, len - done, (off_t)(addr + done));
+		if (n <= 0)
+		{
+			logger(ERROR, "Failed to read tracee memory at %p. %s", (void *)(addr + done), n == 0 ? "EOF" : strerror(errno));
+			return -1;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+// Reads len bytes from the tracee starting at addr. Returns -1 for errors.
+int read_memory(TraceeMem *mem, uint64_t addr, void *buf, size_t len)
+{
+	MemRange range = {.addr = addr, .buf = buf, .len = len};
+	return read_memory_v(mem, &range, 1);
+}
+
+// Writes len bytes to the tracee starting at addr. Writes to read only pages such as
+// .text are allowed. Returns -1 for errors.
+int write_memory(TraceeMem *mem, uint64_t addr, const void *buf, size_t len)
+{
+	if (open_mem_file(mem) == -1)
+	{
+		return -1;
+	}
+
+	// process_vm_writev respects page protections so we cant use it to patch code. Writes
+	// through /proc/<pid>/mem are forced like PTRACE_POKEDATA.
+	size_t done = 0;
+	while (done < len)
+	{
+		ssize_t n = pwrite(mem->fd, (const char *)buf + done, len - done, (off_t)(addr + done));
+		if (n <= 0)
+		{
+			logger(ERROR, "Failed to write tracee memory at %p. %s", (void *)(addr + done), n == 0 ? "EOF" : strerror(errno));
+			return -1;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+// Reads each of the given ranges from the tracee using as few syscalls as possible.
+// Returns -1 if any of the ranges could not be read.
+int read_memory_v(TraceeMem *mem, MemRange *ranges, int count)
+{
+	struct iovec local[IOV_MAX];
+	struct iovec remote[IOV_MAX];
+
+	int first = 0;
+	while (first < count)
+	{
+		int batch = count - first < IOV_MAX ? count - first : IOV_MAX;
+		size_t expected = 0;
+		for (int i = 0; i < batch; i++)
+		{
+			MemRange *r = &ranges[first + i];
+			local[i].iov_base = r->buf;
+			local[i].iov_len = r->len;
+			remote[i].iov_base = (void *)r->addr;
+			remote[i].iov_len = r->len;
+			expected += r->len;
+		}
+
+		ssize_t n = process_vm_readv(mem->pid, local, batch, remote, batch, 0);
+		if (n < 0 || (size_t)n != expected)
+		{
+			// A range was unreadable or the syscall isnt available. The transfer stops at the
+			// first failing range so retry the rest of the batch one at a time.
+			size_t done = n < 0 ? 0 : (size_t)n;
+			for (int i = 0; i < batch; i++)
+			{
+				MemRange *r = &ranges[first + i];
+				if (done >= r->len)
+				{
+					done -= r->len;
+					continue;
+				}
+				if (pread_range(mem, r->addr + done, (char *)r->buf + done, r->len - done) == -1)
+				{
+					return -1;
+				}
+				done = 0;
+			}
+		}
+		first += batch;
+	}
+	return 0;
+}
+
+// Writes each of the given ranges to the tracee. Returns -1 if any of the ranges could not
+// be written.
+int write_memory_v(TraceeMem *mem, const MemRange *ranges, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (write_memory(mem, ranges[i].addr, ranges[i].buf, ranges[i].len) == -1)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A range of tracee memory along with the local buffer it is copied to or from
+typedef struct MemRange {
+	uint64_t addr;
+	void *buf;
+	size_t len;
+} MemRange;
+
+// Handle for reading and writing the memory of a stopped tracee in bulk
+typedef struct TraceeMem {
+	int pid;
+	// file descriptor for /proc/<pid>/mem. Opened lazily as the file must be opened
+	// after the tracee has called exec.
+	int fd;
+} TraceeMem;
+
+// Sets up a memory handle for the given process
+void init_tracee_mem(TraceeMem *mem, int pid);
+
+// Closes the handle to /proc/<pid>/mem if it is open
+void close_tracee_mem(TraceeMem *mem);
+
+// Reads len bytes from the tracee starting at addr. Returns -1 for errors.
+int read_memory(TraceeMem *mem, uint64_t addr, void *buf, size_t len);
+
+// Writes len bytes to the tracee starting at addr. Writes to read only pages such as
+// .text are allowed. Returns -1 for errors.
+int write_memory(TraceeMem *mem, uint64_t addr, const void *buf, size_t len);
+
+// Reads each of the given ranges from the tracee using as few syscalls as possible.
+// Returns -1 if any of the ranges could not be read.
+int read_memory_v(TraceeMem *mem, MemRange *ranges, int count);
+
+// Writes each of the given ranges to the tracee. Returns -1 if any of the ranges could not
+// be written.
+int write_memory_v(TraceeMem *mem, const MemRange *ranges, int count);
+
+#endif
@@ -0,0 +1,348 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "page_watch.h"
+#include "inject.h"
+#include "logger.h"
+
+#define INITIAL_CAPACITY 16
+#define MAPS_PATH_SIZE 32
+#define MAPS_LINE_SIZE 512
+
+// Returns the size of a page in the tracee
+static uint64_t page_size()
+{
+    return (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+// Makes the tracee change the protection of len bytes of its memory. Returns -1 for errors.
+static int tracee_mprotect(DebugSession *session, uint64_t addr, uint64_t len, int prot)
+{
+    uint64_t args[] = {addr, len, (uint64_t)prot};
+    long result;
+    if (inject_syscall(session, SYS_mprotect, args, 3, &result) == -1)
+    {
+        return -1;
+    }
+
+    if (result < 0)
+    {
+        logger(ERROR, "mprotect of %p in the tracee failed. %s", (void *)addr, strerror((int)-result));
+        return -1;
+    }
+    return 0;
+}
+
+// Changes the protection of the pages between first and last inclusive, with one mprotect
+// per run of adjacent pages sharing a protection. Returns -1 for errors.
+static int protect_range(PageWatchStore *store, DebugSession *session, size_t first, size_t last, bool protect)
+{
+    uint64_t size = page_size();
+    size_t run_start = first;
+    for (size_t i = first; i <= last; i++)
+    {
+        ProtectedPage *page = &store->pages[i];
+        bool ends_run = i == last || store->pages[i + 1].addr != page->addr + size ||
+            store->pages[i + 1].prot != page->prot;
+        if (!ends_run)
+        {
+            continue;
+        }
+
+        int prot = protect ? page->prot & ~PROT_WRITE : page->prot;
+        uint64_t start = store->pages[run_start].addr;
+        if (tracee_mprotect(session, start, page->addr + size - start, prot) == -1)
+        {
+            return -1;
+        }
+
+        for (size_t j = run_start; j <= i; j++)
+        {
+            store->pages[j].protected = protect;
+        }
+        run_start = i + 1;
+    }
+    return 0;
+}
+
+// Looks up the protection of the page at the given address in /proc/<pid>/maps. Returns -1
+// if the page isnt mapped.
+static int read_page_prot(int pid, uint64_t addr)
+{
+    char path[MAPS_PATH_SIZE];
+    snprintf(path, MAPS_PATH_SIZE, "/proc/%d/maps", pid);
+    FILE *maps = fopen(path, "r");
+    if (maps == NULL)
+    {
+        logger(ERROR, "Failed to open %s. %s", path, strerror(errno));
+        return -1;
+    }
+
+    int prot = -1;
+    char line[MAPS_LINE_SIZE];
+    while (prot == -1 && fgets(line, MAPS_LINE_SIZE, maps) != NULL)
+    {
+        unsigned long start, end;
+        char perms[5];
+        if (sscanf(line, "%lx-%lx %4s", &start, &end, perms) != 3 || addr < start || addr >= end)
+        {
+            continue;
+        }
+
+        prot = (perms[0] == 'r' ? PROT_READ : 0) | (perms[1] == 'w' ? PROT_WRITE : 0) |
+            (perms[2] == 'x' ? PROT_EXEC : 0);
+    }
+    fclose(maps);
+    return prot;
+}
+
+// Returns the index of the first page at or after the address
+static size_t lower_bound(const PageWatchStore *store, uint64_t addr)
+{
+    size_t low = 0;
+    size_t high = store->page_count;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (store->pages[mid].addr < addr)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Returns true if any region overlaps the page at the given address
+static bool page_in_use(const PageWatchStore *store, uint64_t page)
+{
+    for (size_t i = 0; i < store->count; i++)
+    {
+        const WatchRegion *region = &store->regions[i];
+        if (region->addr < page + page_size() && page < region->addr + region->len)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Gives back the original protection of every page no region overlaps any more and stops
+// tracking them. Returns -1 for errors.
+static int release_unused_pages(PageWatchStore *store, DebugSession *session)
+{
+    int res = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < store->page_count;)
+    {
+        if (page_in_use(store, store->pages[i].addr))
+        {
+            store->pages[kept++] = store->pages[i++];
+            continue;
+        }
+
+        // restore runs of unused pages together
+        size_t run_end = i;
+        while (run_end + 1 < store->page_count && store->pages[run_end + 1].protected == store->pages[i].protected &&
+            !page_in_use(store, store->pages[run_end + 1].addr))
+        {
+            run_end++;
+        }
+        if (store->pages[i].protected && protect_range(store, session, i, run_end, false) == -1)
+        {
+            res = -1;
+        }
+        i = run_end + 1;
+    }
+    store->page_count = kept;
+    return res;
+}
+
+// Creates a store with nothing watched
+PageWatchStore *new_page_watch_store()
+{
+    PageWatchStore *store = (PageWatchStore *)calloc(1, sizeof(PageWatchStore));
+    if (store == NULL)
+    {
+        logger(ERROR, "Failed to allocate heap memory for region watchpoints. %s", strerror(errno));
+        return NULL;
+    }
+    return store;
+}
+
+void free_page_watch_store(PageWatchStore *store)
+{
+    free(store->regions);
+    free(store->pages);
+    free(store);
+}
+
+// Watches len bytes at the given address for writes. Returns the region's id or -1 for errors.
+long pw_add(PageWatchStore *store, DebugSession *session, uint64_t addr, uint64_t len)
+{
+    if (len == 0)
+    {
+        logger(ERROR, "Cant watch an empty region.");
+        return -1;
+    }
+
+    uint64_t size = page_size();
+    uint64_t first_page = addr & ~(size - 1);
+    uint64_t end_page = (addr + len + size - 1) & ~(size - 1);
+    size_t new_pages = (end_page - first_page) / size;
+
+    if (store->count == store->capacity)
+    {
+        size_t capacity = store->capacity == 0 ? INITIAL_CAPACITY : store->capacity * 2;
+        WatchRegion *regions = (WatchRegion *)realloc(store->regions, capacity * sizeof(WatchRegion));
+        if (regions == NULL)
+        {
+            logger(ERROR, "Failed to allocate heap memory for region watchpoints. %s", strerror(errno));
+            return -1;
+        }
+        store->regions = regions;
+        store->capacity = capacity;
+    }
+
+    if (store->page_count + new_pages > store->page_capacity)
+    {
+        size_t capacity = store->page_capacity == 0 ? INITIAL_CAPACITY : store->page_capacity;
+        while (capacity < store->page_count + new_pages)
+        {
+            capacity *= 2;
+        }
+        ProtectedPage *pages = (ProtectedPage *)realloc(store->pages, capacity * sizeof(ProtectedPage));
+        if (pages == NULL)
+        {
+            logger(ERROR, "Failed to allocate heap memory for region watchpoints. %s", strerror(errno));
+            return -1;
+        }
+        store->pages = pages;
+        store->page_capacity = capacity;
+    }
+
+    // add the pages no other region has protected yet, keeping them sorted
+    for (uint64_t page = first_page; page < end_page; page += size)
+    {
+        size_t idx = lower_bound(store, page);
+        if (idx < store->page_count && store->pages[idx].addr == page)
+        {
+            continue;
+        }
+
+        int prot = read_page_prot(session->pid, page);
+        if (prot == -1 || !(prot & PROT_WRITE))
+        {
+            logger(ERROR, "Page %p isnt writable memory.", (void *)page);
+            release_unused_pages(store, session);
+            return -1;
+        }
+
+        memmove(&store->pages[idx + 1], &store->pages[idx], (store->page_count - idx) * sizeof(ProtectedPage));
+        store->pages[idx] = (ProtectedPage){.addr = page, .prot = (uint8_t)prot, .protected = false};
+        store->page_count++;
+    }
+
+    // protect the new pages with as few mprotects as possible
+    size_t first = lower_bound(store, first_page);
+    size_t last = lower_bound(store, end_page) - 1;
+    for (size_t i = first; i <= last; i++)
+    {
+        if (store->pages[i].protected)
+        {
+            continue;
+        }
+
+        size_t run_end = i;
+        while (run_end < last && !store->pages[run_end + 1].protected)
+        {
+            run_end++;
+        }
+        if (protect_range(store, session, i, run_end, true) == -1)
+        {
+            release_unused_pages(store, session);
+            return -1;
+        }
+        i = run_end;
+    }
+
+    WatchRegion *region = &store->regions[store->count++];
+    region->addr = addr;
+    region->len = len;
+    region->id = store->next_id++;
+    return region->id;
+}
+
+// Stops watching the region with the given id, giving back the protection of pages no other
+// region needs. Returns 1 if there is no such region and -1 for errors.
+int pw_remove(PageWatchStore *store, DebugSession *session, uint32_t id)
+{
+    for (size_t i = 0; i < store->count; i++)
+    {
+        if (store->regions[i].id == id)
+        {
+            store->regions[i] = store->regions[--store->count];
+            return release_unused_pages(store, session);
+        }
+    }
+    return 1;
+}
+
+// Stops watching every region, giving back the protection of all their pages. Returns -1
+// for errors.
+int pw_remove_all(PageWatchStore *store, DebugSession *session)
+{
+    store->count = 0;
+    return release_unused_pages(store, session);
+}
+
+// Forgets every region without touching the tracee
+void pw_clear(PageWatchStore *store)
+{
+    store->count = 0;
+    store->page_count = 0;
+}
+
+// Returns the index of the protected page containing the address or -1 if there isnt one
+long pw_find_page(const PageWatchStore *store, uint64_t addr)
+{
+    size_t idx = lower_bound(store, addr & ~(page_size() - 1));
+    if (idx < store->page_count && store->pages[idx].addr == (addr & ~(page_size() - 1)))
+    {
+        return (long)idx;
+    }
+    return -1;
+}
+
+// Returns the region containing the address or NULL if there isnt one
+const WatchRegion *pw_find_region(const PageWatchStore *store, uint64_t addr)
+{
+    for (size_t i = 0; i < store->count; i++)
+    {
+        const WatchRegion *region = &store->regions[i];
+        if (addr >= region->addr && addr < region->addr + region->len)
+        {
+            return region;
+        }
+    }
+    return NULL;
+}
+
+// Makes the page at the given index read only again or lifts the protection so an access
+// can go through. Returns -1 for errors.
+int pw_protect_page(PageWatchStore *store, DebugSession *session, size_t idx, bool protect)
+{
+    if (store->pages[idx].protected == protect)
+    {
+        return 0;
+    }
+    return protect_range(store, session, idx, idx, protect);
+}
@@ -0,0 +1,71 @@
+#ifndef PAGE_WATCH_H
+#define PAGE_WATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "session.h"
+
+// A range of tracee memory watched for writes
+typedef struct WatchRegion {
+    uint64_t addr;
+    uint64_t len;
+    // number the user refers to the region by
+    uint32_t id;
+} WatchRegion;
+
+// A page made read only for one or more regions
+typedef struct ProtectedPage {
+    uint64_t addr;
+    // protection to put back once no region needs the page
+    uint8_t prot;
+    // false while the page is briefly writable to let an access through
+    bool protected;
+} ProtectedPage;
+
+// Watches regions too large for the debug registers by making the pages holding them read
+// only in the tracee. Writes anywhere on those pages fault so the debugger has to filter
+// out the ones outside the regions. Writes made by the kernel on the tracee's behalf, such
+// as a read into a watched buffer, fail with EFAULT rather than faulting.
+typedef struct PageWatchStore {
+    WatchRegion *regions;
+    size_t count;
+    size_t capacity;
+    uint32_t next_id;
+    // sorted by address
+    ProtectedPage *pages;
+    size_t page_count;
+    size_t page_capacity;
+} PageWatchStore;
+
+// Creates a store with nothing watched
+PageWatchStore *new_page_watch_store();
+
+void free_page_watch_store(PageWatchStore *store);
+
+// Watches len bytes at the given address for writes. Returns the region's id or -1 for errors.
+long pw_add(PageWatchStore *store, DebugSession *session, uint64_t addr, uint64_t len);
+
+// Stops watching the region with the given id, giving back the protection of pages no other
+// region needs. Returns 1 if there is no such region and -1 for errors.
+int pw_remove(PageWatchStore *store, DebugSession *session, uint32_t id);
+
+// Stops watching every region, giving back the protection of all their pages. Returns -1
+// for errors.
+int pw_remove_all(PageWatchStore *store, DebugSession *session);
+
+// Forgets every region without touching the tracee
+void pw_clear(PageWatchStore *store);
+
+// Returns the index of the protected page containing the address or -1 if there isnt one
+long pw_find_page(const PageWatchStore *store, uint64_t addr);
+
+// Returns the region containing the address or NULL if there isnt one
+const WatchRegion *pw_find_region(const PageWatchStore *store, uint64_t addr);
+
+// Makes the page at the given index read only again or lifts the protection so an access
+// can go through. Returns -1 for errors.
+int pw_protect_page(PageWatchStore *store, DebugSession *session, size_t idx, bool protect);
+
+#endif
@@ -0,0 +1,541 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include "logger.h"
+#include "profile.h"
+#include "reg.h"
+#include "session.h"
+#include "utils.h"
+
+#define NS_PER_SEC 1000000000ull
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+// longest name kept for a frame, longer names are cut short
+#define MAX_FRAME_NAME 256
+
+// State of a profiling run
+typedef struct ProfileRun {
+	int pid;
+	Profile *profile;
+	Unwinder *unwinder;
+	RegCache regs;
+	TraceeMem mem;
+	UnwindFrame *frames;
+	// set once the tracee has executed prog, before then it is still our fork
+	bool exec_seen;
+	// a PTRACE_INTERRUPT has been sent and its stop not yet seen
+	bool interrupt_pending;
+	bool running;
+} ProfileRun;
+
+static Profile *new_profile()
+{
+	Profile *profile = malloc(sizeof(Profile));
+	if (profile == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for the profile. %s", strerror(errno));
+		return NULL;
+	}
+
+	profile->stacks = new_addr_map();
+	profile->frame_names = new_addr_map();
+	profile->names = new_str_table();
+	profile->stack_count = 0;
+	profile->samples = 0;
+	if (profile->stacks == NULL || profile->frame_names == NULL || profile->names == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for the profile.");
+		if (profile->stacks != NULL)
+		{
+			free_addr_map(profile->stacks);
+		}
+		if (profile->frame_names != NULL)
+		{
+			free_addr_map(profile->frame_names);
+		}
+		if (profile->names != NULL)
+		{
+			free_str_table(profile->names);
+		}
+		free(profile);
+		return NULL;
+	}
+	return profile;
+}
+
+static void free_profile(Profile *profile)
+{
+	for (size_t i = 0; i < profile->stacks->capacity; i++)
+	{
+		ProfileStack *stack = profile->stacks->entries[i].val;
+		while (stack != NULL)
+		{
+			ProfileStack *next = stack->next;
+			free(stack);
+			stack = next;
+		}
+	}
+	free_addr_map(profile->stacks);
+	free_addr_map(profile->frame_names);
+	free_str_table(profile->names);
+	free(profile);
+}
+
+// Returns the address a frame's function is looked up at. Return addresses are looked up a
+// byte back as the call they follow can be the last instruction of a function.
+static inline uint64_t frame_lookup_addr(const UnwindFrame *frames, long i)
+{
+	return i > 0 ? frames[i].pc - 1 : frames[i].pc;
+}
+
+// Names the functions of a newly seen stack's frames. Each address is only named once.
+static int name_frames(Profile *profile, Unwinder *unwinder, const UnwindFrame *frames, long depth)
+{
+	for (long i = 0; i < depth; i++)
+	{
+		uint64_t addr = frame_lookup_addr(frames, i);
+		if (am_get(profile->frame_names, addr) != NULL)
+		{
+			continue;
+		}
+
+		char name[MAX_FRAME_NAME];
+		const char *func = unwind_func_name(unwinder, addr);
+		const char *path = func == NULL ? unwind_module_path(unwinder, addr) : NULL;
+		if (func != NULL)
+		{
+			snprintf(name, MAX_FRAME_NAME, "%s", func);
+		}
+		else if (path != NULL)
+		{
+			snprintf(name, MAX_FRAME_NAME, "[%s]", strrchr(path, '/') + 1);
+		}
+		else
+		{
+			snprintf(name, MAX_FRAME_NAME, "[unknown]");
+		}
+
+		// ; separates the frames of a folded stack so it cant be in a name
+		for (char *c = name; *c != '\0'; c++)
+		{
+			*c = *c == ';' ? ':' : *c;
+		}
+
+		long id = st_intern(profile->names, name);
+		if (id == -1 || am_set(profile->frame_names, addr, (void *)(uintptr_t)(id + 1)) == -1)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Counts a sample of the given stack, adding the stack if it hasnt been seen before
+static int add_stack(Profile *profile, Unwinder *unwinder, const UnwindFrame *frames, long depth)
+{
+	uint64_t id = FNV_OFFSET;
+	for (long i = 0; i < depth; i++)
+	{
+		id = (id ^ frames[i].pc) * FNV_PRIME;
+	}
+
+	ProfileStack *first = am_get(profile->stacks, id);
+	for (ProfileStack *stack = first; stack != NULL; stack = stack->next)
+	{
+		bool same = stack->depth == (uint32_t)depth;
+		for (long i = 0; same && i < depth; i++)
+		{
+			same = stack->pcs[i] == frames[i].pc;
+		}
+		if (same)
+		{
+			stack->count++;
+			return 0;
+		}
+	}
+
+	ProfileStack *stack = malloc(sizeof(ProfileStack) + depth * sizeof(uint64_t));
+	if (stack == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for a stack. %s", strerror(errno));
+		return -1;
+	}
+	stack->id = id;
+	stack->count = 1;
+	stack->next = first;
+	stack->depth = (uint32_t)depth;
+	for (long i = 0; i < depth; i++)
+	{
+		stack->pcs[i] = frames[i].pc;
+	}
+
+	if (am_set(profile->stacks, id, stack) == -1)
+	{
+		free(stack);
+		return -1;
+	}
+	profile->stack_count++;
+	return name_frames(profile, unwinder, frames, depth);
+}
+
+// Records the stack of the tracee, which is stopped
+static int take_sample(ProfileRun *run)
+{
+	invalidate_reg_cache(&run->regs);
+	if (load_reg_cache(&run->regs) == -1)
+	{
+		return -1;
+	}
+
+	long depth = unwind_stack(run->unwinder, &run->regs.regs, run->frames, MAX_PROFILE_FRAMES);
+	if (depth == -1)
+	{
+		return -1;
+	}
+	run->profile->samples++;
+	return add_stack(run->profile, run->unwinder, run->frames, depth);
+}
+
+// Handles a stop of the tracee and resumes it straight away
+static int handle_stop(ProfileRun *run, int status)
+{
+	int sig = WSTOPSIG(status);
+	int event = status >> 16;
+	int deliver = 0;
+
+	if (event == PTRACE_EVENT_EXEC)
+	{
+		run->exec_seen = true;
+		run->unwinder = new_unwinder(run->pid, &run->mem);
+		if (run->unwinder == NULL)
+		{
+			return -1;
+		}
+	}
+	else if (event == PTRACE_EVENT_STOP)
+	{
+		if (sig == SIGSTOP || sig == SIGTSTP || sig == SIGTTIN || sig == SIGTTOU)
+		{
+			// a group stop, the tracee stays stopped until something sends it SIGCONT
+			run->interrupt_pending = false;
+			return ptrace_with_error(PTRACE_LISTEN, run->pid, NULL, NULL).success ? 0 : -1;
+		}
+
+		if (run->interrupt_pending && run->exec_seen)
+		{
+			run->interrupt_pending = false;
+			if (take_sample(run) == -1)
+			{
+				return -1;
+			}
+		}
+	}
+	else if (event == 0)
+	{
+		// the tracee was sent a signal, which it still gets
+		deliver = sig;
+	}
+
+	return ptrace_with_error(PTRACE_CONT, run->pid, NULL, (void *)(long)deliver).success ? 0 : -1;
+}
+
+// Handles every stop and exit of the tracee that is waiting to be reaped
+static int handle_events(ProfileRun *run)
+{
+	int status;
+	int waited = 0;
+	while (run->running && (waited = waitpid(run->pid, &status, WNOHANG | __WALL)) > 0)
+	{
+		if (WIFEXITED(status) || WIFSIGNALED(status))
+		{
+			if (WIFEXITED(status))
+			{
+				logger(INFO, "Profiled process %d exited with status %d.", run->pid, WEXITSTATUS(status));
+			}
+			else
+			{
+				logger(INFO, "Profiled process %d was killed by signal %d.", run->pid, WTERMSIG(status));
+			}
+			run->running = false;
+		}
+		else if (WIFSTOPPED(status) && handle_stop(run, status) == -1)
+		{
+			return -1;
+		}
+	}
+
+	if (waited == -1 && errno != EINTR)
+	{
+		logger(ERROR, "Failed to wait for process %d. %s", run->pid, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// Appends to a growable buffer. Returns -1 if it couldnt grow.
+static int append(char **buf, size_t *len, size_t *capacity, const char *str)
+{
+	size_t str_len = strlen(str);
+	if (*len + str_len + 1 > *capacity)
+	{
+		size_t new_capacity = (*len + str_len + 1) * 2;
+		char *grown = realloc(*buf, new_capacity);
+		if (grown == NULL)
+		{
+			logger(ERROR, "Failed to allocate heap memory for a folded stack. %s", strerror(errno));
+			return -1;
+		}
+		*buf = grown;
+		*capacity = new_capacity;
+	}
+	memcpy(*buf + *len, str, str_len + 1);
+	*len += str_len;
+	return 0;
+}
+
+// Writes the stacks outermost frame first with their frames separated by ; and followed
+// by their count, the folded format flame graph tools read. Stacks of different pcs in
+// the same functions fold into one line.
+static int write_folded(const Profile *profile, const char *out_path)
+{
+	StrTable *lines = new_str_table();
+	if (lines == NULL)
+	{
+		return -1;
+	}
+
+	uint64_t *counts = NULL;
+	size_t counts_size = 0;
+	char *line = NULL;
+	size_t line_capacity = 0;
+	int res = 0;
+
+	for (size_t i = 0; i < profile->stacks->capacity && res == 0; i++)
+	{
+		for (const ProfileStack *stack = profile->stacks->entries[i].val; stack != NULL && res == 0; stack = stack->next)
+		{
+			size_t line_len = 0;
+			for (long frame = (long)stack->depth - 1; frame >= 0 && res == 0; frame--)
+			{
+				uint64_t addr = frame > 0 ? stack->pcs[frame] - 1 : stack->pcs[frame];
+				uint32_t name_id = (uint32_t)(uintptr_t)am_get(profile->frame_names, addr) - 1;
+				res = append(&line, &line_len, &line_capacity, st_get(profile->names, name_id));
+				if (res == 0 && frame > 0)
+				{
+					res = append(&line, &line_len, &line_capacity, ";");
+				}
+			}
+
+			long id = res == 0 ? st_intern(lines, line != NULL ? line : "") : -1;
+			if (id == -1)
+			{
+				res = -1;
+				break;
+			}
+
+			if ((size_t)id >= counts_size)
+			{
+				size_t new_size = counts_size == 0 ? 64 : counts_size * 2;
+				uint64_t *grown = realloc(counts, new_size * sizeof(uint64_t));
+				if (grown == NULL)
+				{
+					logger(ERROR, "Failed to allocate heap memory for stack counts. %s", strerror(errno));
+					res = -1;
+					break;
+				}
+				memset(grown + counts_size, 0, (new_size - counts_size) * sizeof(uint64_t));
+				counts = grown;
+				counts_size = new_size;
+			}
+			counts[id] += stack->count;
+		}
+	}
+
+	FILE *out = res == 0 ? fopen(out_path, "w") : NULL;
+	if (res == 0 && out == NULL)
+	{
+		logger(ERROR, "Failed to open %s. %s", (char *)out_path, strerror(errno));
+		res = -1;
+	}
+	if (out != NULL)
+	{
+		for (size_t id = 0; id < lines->count; id++)
+		{
+			fprintf(out, "%s %llu\n", st_get(lines, (uint32_t)id), (unsigned long long)counts[id]);
+		}
+		if (fclose(out) != 0)
+		{
+			logger(ERROR, "Failed to write %s. %s", (char *)out_path, strerror(errno));
+			res = -1;
+		}
+	}
+
+	if (res == 0)
+	{
+		logger(INFO, "Wrote %d samples of %d stacks to %s.", (int)profile->samples, (int)lines->count, (char *)out_path);
+	}
+	free(line);
+	free(counts);
+	free_str_table(lines);
+	return res;
+}
+
+// Samples the tracee on a timer until it exits. Events from the tracee and the timer are
+// both waited for with sigtimedwait so neither holds up the other.
+static int sample_loop(ProfileRun *run, unsigned hz, const sigset_t *wait_set)
+{
+	uint64_t period_ns = NS_PER_SEC / hz;
+	uint64_t next_tick = monotonic_ns() + period_ns;
+
+	while (run->running)
+	{
+		uint64_t now = monotonic_ns();
+		if (now >= next_tick)
+		{
+			// a tick is skipped rather than queued while the last one's stop is outstanding.
+			// The tracee may have exited under us so a failure is left to waitpid to report.
+			if (run->exec_seen && !run->interrupt_pending && ptrace(PTRACE_INTERRUPT, run->pid, NULL, NULL) == 0)
+			{
+				run->interrupt_pending = true;
+			}
+			next_tick += period_ns;
+			if (next_tick <= now)
+			{
+				next_tick = now + period_ns;
+			}
+		}
+
+		uint64_t wait_ns = next_tick - now;
+		struct timespec timeout = {.tv_sec = wait_ns / NS_PER_SEC, .tv_nsec = wait_ns % NS_PER_SEC};
+		int sig = sigtimedwait(wait_set, NULL, &timeout);
+		if (sig == -1)
+		{
+			if (errno == EAGAIN || errno == EINTR)
+			{
+				continue;
+			}
+			logger(ERROR, "Failed to wait for the profiled process. %s", strerror(errno));
+			return -1;
+		}
+
+		if (sig == SIGINT)
+		{
+			logger(INFO, "Stopping the profiled process.");
+			kill(run->pid, SIGKILL);
+		}
+		if (handle_events(run) == -1)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int profile_program(char *prog, unsigned hz, const char *out_path)
+{
+	Profile *profile = new_profile();
+	if (profile == NULL)
+	{
+		return -1;
+	}
+
+	ProfileRun run = {.profile = profile, .running = true};
+	run.frames = malloc(MAX_PROFILE_FRAMES * sizeof(UnwindFrame));
+	if (run.frames == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for frames. %s", strerror(errno));
+		free_profile(profile);
+		return -1;
+	}
+
+	// the tracee's events arrive as SIGCHLD which is waited for rather than handled, and
+	// an interrupt ends the profile early with what has been collected
+	sigset_t wait_set;
+	sigset_t old_mask;
+	sigemptyset(&wait_set);
+	sigaddset(&wait_set, SIGCHLD);
+	sigaddset(&wait_set, SIGINT);
+	int ready[2];
+	if (sigprocmask(SIG_BLOCK, &wait_set, &old_mask) == -1 || pipe(ready) == -1)
+	{
+		logger(ERROR, "Failed to set up the profiler. %s", strerror(errno));
+		free(run.frames);
+		free_profile(profile);
+		return -1;
+	}
+
+	// anything buffered would otherwise be written by the child as well
+	fflush(stdout);
+	run.pid = fork();
+	if (run.pid == -1)
+	{
+		logger(ERROR, "Failed to fork. %s", strerror(errno));
+		close(ready[0]);
+		close(ready[1]);
+		sigprocmask(SIG_SETMASK, &old_mask, NULL);
+		free(run.frames);
+		free_profile(profile);
+		return -1;
+	}
+
+	if (run.pid == 0)
+	{
+		// the signal mask survives exec
+		close(ready[1]);
+		sigprocmask(SIG_SETMASK, &old_mask, NULL);
+		start_seized(prog, ready[0]);
+		fflush(stdout);
+		_exit(EXIT_FAILURE);
+	}
+
+	close(ready[0]);
+	init_reg_cache(&run.regs, run.pid);
+	init_tracee_mem(&run.mem, run.pid);
+
+	// the tracee is killed if we exit first so it is never left stopped
+	int res = -1;
+	if (ptrace_with_error(PTRACE_SEIZE, run.pid, NULL, (void *)(PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL)).success)
+	{
+		// lets the child go on to exec now it is traced
+		close(ready[1]);
+		logger(INFO, "Profiling %s at %d Hz. Session PID: %d.", prog, (int)hz, run.pid);
+		res = sample_loop(&run, hz, &wait_set);
+	}
+	else
+	{
+		close(ready[1]);
+	}
+
+	if (run.running)
+	{
+		kill(run.pid, SIGKILL);
+		waitpid(run.pid, NULL, __WALL);
+	}
+	sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+	if (res == 0 && !run.exec_seen)
+	{
+		logger(ERROR, "Failed to execute %s.", prog);
+		res = -1;
+	}
+	if (res == 0)
+	{
+		res = write_folded(profile, out_path);
+	}
+
+	if (run.unwinder != NULL)
+	{
+		free_unwinder(run.unwinder);
+	}
+	close_tracee_mem(&run.mem);
+	free(run.frames);
+	free_profile(profile);
+	return res;
+}
@@ -0,0 +1,47 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "addr_map.h"
+#include "str_table.h"
+#include "unwind.h"
+
+// off a round number so samples dont keep landing on the tracee's own timers
+#define DEFAULT_PROFILE_HZ 99
+#define MAX_PROFILE_HZ 10000
+#define DEFAULT_PROFILE_FILE "edb.folded"
+// deepest stack a sample records, deeper ones lose their outermost frames
+#define MAX_PROFILE_FRAMES 1024
+
+// A distinct stack that was sampled and how many times it was
+typedef struct ProfileStack {
+	// the stack's id, a hash of its pcs
+	uint64_t id;
+	uint64_t count;
+	// the next stack whose pcs hash to the same id
+	struct ProfileStack *next;
+	uint32_t depth;
+	// innermost first
+	uint64_t pcs[];
+} ProfileStack;
+
+// Samples of a tracee's stacks aggregated by stack
+typedef struct Profile {
+	// stack id to the stacks with that id
+	AddrMap *stacks;
+	size_t stack_count;
+	uint64_t samples;
+	// names of the functions the sampled pcs are in, as id + 1 in names. Keyed by the
+	// address looked up, which for return addresses is the byte before.
+	AddrMap *frame_names;
+	StrTable *names;
+} Profile;
+
+// Runs prog under the sampling profiler, interrupting it hz times a second to record its
+// stack, and writes the stacks in folded format to out_path once it exits.
+// Returns -1 for errors.
+int profile_program(char *prog, unsigned hz, const char *out_path);
+
+#endif
@@ -45,16 +45,68 @@ const reg_info registers[REGISTER_COUNT] = {
 	{FS, "fs", 54},
 	{GS, "gs", 55}};
 
-// Retrieves the value of the given register. Returns a pointer to the register's
-// position in the given struct;
-unsigned long long *get_register(int pid, struct user_regs_struct *regs, Reg reg)
+// Sets up an empty register cache for the given process
+void init_reg_cache(RegCache *cache, int pid)
+{
+	cache->pid = pid;
+	cache->valid = false;
+	cache->dirty = 0;
+}
+
+// Marks the cached registers as stale. Must be called every time the tracee stops.
+void invalidate_reg_cache(RegCache *cache)
+{
+	cache->valid = false;
+	cache->dirty = 0;
+}
+
+// Fetches the registers for the current stop if we havent already
+int load_reg_cache(RegCache *cache)
 {
-	ErrResult regs_res = ptrace_with_error(PTRACE_GETREGS, pid, NULL, (void *)regs);
+	if (cache->valid)
+	{
+		return 0;
+	}
+
+	ErrResult regs_res = ptrace_with_error(PTRACE_GETREGS, cache->pid, NULL, (void *)&cache->regs);
 	if (!regs_res.success)
 	{
 		logger(ERROR, "failed to get register values");
+		return -1;
+	}
+	cache->valid = true;
+	return 0;
+}
+
+// Writes back any modified registers with a single PTRACE_SETREGS. Must be called
+// before the tracee is resumed.
+int flush_reg_cache(RegCache *cache)
+{
+	if (!cache->valid || cache->dirty == 0)
+	{
+		return 0;
+	}
+
+	ErrResult set_regs_res = ptrace_with_error(PTRACE_SETREGS, cache->pid, NULL, (void *)&cache->regs);
+	if (!set_regs_res.success)
+	{
+		logger(ERROR, "Failed to set register values");
+		return -1;
+	}
+	cache->dirty = 0;
+	return 0;
+}
+
+// Retrieves the value of the given register. Returns a pointer to the register's
+// position in the cache. The registers are only fetched from the tracee once per stop.
+unsigned long long *get_register(RegCache *cache, Reg reg)
+{
+	if (load_reg_cache(cache) == -1)
+	{
 		return NULL;
 	}
+
+	struct user_regs_struct *regs = &cache->regs;
 	switch (reg)
 	{
 	case R15:
@@ -115,7 +167,7 @@ unsigned long long *get_register(int pid, struct user_regs_struct *regs, Reg reg
 		return &regs->eflags;
 		break;
 	case RSP:
-		return &regs->r13;
+		return &regs->rsp;
 		break;
 	case SS:
 		return &regs->ss;
@@ -143,8 +195,22 @@ unsigned long long *get_register(int pid, struct user_regs_struct *regs, Reg reg
 	}
 }
 
+// Finds the register with the given name. Returns -1 if there is no such register.
+int find_reg_by_name(const char *reg_name, Reg *reg)
+{
+	for (int i = 0; i < REGISTER_COUNT; i++)
+	{
+		if (strcmp(registers[i].name, reg_name) == 0)
+		{
+			*reg = registers[i].id;
+			return 0;
+		}
+	}
+	return -1;
+}
+
 // Gets the value of a given register by its name
-ErrResult get_reg_value_by_name(int pid, char *reg_name)
+ErrResult get_reg_value_by_name(RegCache *cache, char *reg_name)
 {
 	ErrResult res = {.success = false};
 
@@ -154,13 +220,11 @@ ErrResult get_reg_value_by_name(int pid, char *reg_name)
 		return res;
 	}
 
-	struct user_regs_struct regs;
-
 	for (int i = 0; i < REGISTER_COUNT; i++)
 	{
 		if (strcmp(registers[i].name, reg_name) == 0)
 		{
-			int *reg = (int *)get_register(pid, &regs, registers[i].id);
+			unsigned long long *reg = get_register(cache, registers[i].id);
 			if (reg == NULL)
 			{
 				logger(ERROR, "Failed to get register");
@@ -177,33 +241,24 @@ ErrResult get_reg_value_by_name(int pid, char *reg_name)
 	return res;
 }
 
-// set the value of the given register
-int set_reg_value(int pid, Reg reg, unsigned long long val)
+// Sets the value of the given register. The new value is only written to the tracee
+// when the cache is flushed.
+int set_reg_value(RegCache *cache, Reg reg, unsigned long long val)
 {
-	struct user_regs_struct regs;
-
-	unsigned long long *reg_addr = get_register(pid, &regs, reg);
+	unsigned long long *reg_addr = get_register(cache, reg);
 	if (reg_addr == NULL)
 	{
 		logger(ERROR, "Failed to get register");
 		return -1;
 	}
 
-	// set the value
 	*reg_addr = val;
-
-	// write the result back
-	ErrResult set_regs_res = ptrace_with_error(PTRACE_SETREGS, pid, NULL, (void *)&regs);
-	if (!set_regs_res.success)
-	{
-		logger(ERROR, "Failed to set register values");
-		return -1;
-	}
+	cache->dirty |= (uint32_t)1 << reg;
 	return 0;
 }
 
 // sets the value of the given register by its name
-int set_reg_value_by_name(int pid, char *reg_name, int val)
+int set_reg_value_by_name(RegCache *cache, char *reg_name, unsigned long long val)
 {
 	if (reg_name == NULL)
 	{
@@ -215,7 +270,7 @@ int set_reg_value_by_name(int pid, char *reg_name, int val)
 	{
 		if (strcmp(registers[i].name, reg_name) == 0)
 		{
-			return set_reg_value(pid, registers[i].id, val);
+			return set_reg_value(cache, registers[i].id, val);
 		}
 	}
 	logger(WARN, "Unknown register name");
@@ -223,12 +278,11 @@ int set_reg_value_by_name(int pid, char *reg_name, int val)
 }
 
 // Gets the value of the instruction pointer. Returns NULL for errors
-void * get_ip(int pid)
+void * get_ip(RegCache *cache)
 {
 	// Get register returns a pointer to the register value. In the case of RIP this value is itself
 	// a memory address so we cast it to a void pointer to make this obvious to the caller.
-	struct user_regs_struct regs;
-	unsigned long long *reg = get_register(pid, &regs, RIP);
+	unsigned long long *reg = get_register(cache, RIP);
 	if (reg == NULL)
 	{
 		logger(ERROR, "Failed to get instruction pointer");
@@ -239,7 +293,7 @@ void * get_ip(int pid)
 }
 
 // sets the value of the instruction pointer (this is always a memory address so takes a void pointer)
-int set_ip(int pid, void * val)
+int set_ip(RegCache *cache, void * val)
 {
-	return set_reg_value(pid, RIP, (unsigned long long)val);
+	return set_reg_value(cache, RIP, (unsigned long long)val);
 }
@@ -1,6 +1,8 @@
 #ifndef REG_H
 #define REG_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/user.h>
 
 #include "utils.h"
@@ -36,24 +38,51 @@ typedef enum Reg {
 	GS,
 } Reg;
 
+// Snapshot of the tracee's registers for the current stop. Reads are served from
+// memory and writes are held back until the tracee is resumed.
+typedef struct RegCache {
+	int pid;
+	struct user_regs_struct regs;
+	// true once the registers for the current stop have been fetched
+	bool valid;
+	// bitmask of the registers modified since the last flush, indexed by Reg
+	uint32_t dirty;
+} RegCache;
+
+// Sets up an empty register cache for the given process
+void init_reg_cache(RegCache *cache, int pid);
+
+// Marks the cached registers as stale. Must be called every time the tracee stops.
+void invalidate_reg_cache(RegCache *cache);
+
+// Fetches the registers for the current stop if we havent already
+int load_reg_cache(RegCache *cache);
+
+// Writes back any modified registers with a single PTRACE_SETREGS. Must be called
+// before the tracee is resumed.
+int flush_reg_cache(RegCache *cache);
+
 // Retrieves the value of the given register. Returns a pointer to the register's
-// position in the given struct;
-unsigned long long * get_register(int pid, struct user_regs_struct * regs, Reg reg);
+// position in the cache.
+unsigned long long * get_register(RegCache *cache, Reg reg);
+
+// Finds the register with the given name. Returns -1 if there is no such register.
+int find_reg_by_name(const char *reg_name, Reg *reg);
 
 // Gets the value of a given register by its name. Returns -1 if the requested register is
 // not found.
-ErrResult get_reg_value_by_name(int pid, char *reg_name);
+ErrResult get_reg_value_by_name(RegCache *cache, char *reg_name);
 
 // set the value of the given register
-int set_reg_value(int pid, Reg reg, unsigned long long val);
+int set_reg_value(RegCache *cache, Reg reg, unsigned long long val);
 
 // sets the value of the given register by its name
-int set_reg_value_by_name(int pid, char *reg_name, int val);
+int set_reg_value_by_name(RegCache *cache, char *reg_name, unsigned long long val);
 
 // Gets the value of the instruction pointer. Returns NULL for errors
-void * get_ip(int pid);
+void * get_ip(RegCache *cache);
 
 // sets the value of the instruction pointer (this is always a memory address so takes a void pointer)
-int set_ip(int pid, void * val);
+int set_ip(RegCache *cache, void * val);
 
 #endif
\ No newline at end of file
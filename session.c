@@ -6,15 +6,22 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <elf.h>
+#include <dirent.h>
 
 #include "session.h"
 #include "logger.h"
 #include "utils.h"
 
-#define MAX_PROG_NAME_SIZE 32
-#define MAX_HEADER_NAME_SIZE 32
-#define FILE_TABLE_SIZE 128
+#define PROC_PATH_SIZE 32
 #define DEBUG_LINE_HEADER ".debug_line"
+#define DEBUG_LINE_STR_HEADER ".debug_line_str"
+#define DEBUG_STR_HEADER ".debug_str"
+#define DEBUG_ARANGES_HEADER ".debug_aranges"
+#define DEBUG_INFO_HEADER ".debug_info"
+#define DEBUG_ABBREV_HEADER ".debug_abbrev"
 
 DebugSession *new_debug_session(char *prog, int pid)
 {
@@ -25,49 +32,142 @@ DebugSession *new_debug_session(char *prog, int pid)
 		return NULL;
 	}
 
-	char *prog_name_buf = (char *)malloc(MAX_PROG_NAME_SIZE);
+	// the path is compared on restart so it has to be copied whole
+	char *prog_name_buf = strdup(prog);
 	if (prog_name_buf == NULL)
 	{
 		logger(ERROR, "Failed to allocate heap memory for program name. %s", strerror(errno));
+		free(dbs);
 		return NULL;
 	}
-
-	memcpy(prog_name_buf, prog, MAX_PROG_NAME_SIZE);
 	dbs->prog = prog_name_buf;
 
 	dbs->pid = pid;
 	dbs->wait_status = 0;
+	dbs->active = false;
+	dbs->attached = false;
+	dbs->threads = new_thread_table();
+	TraceeThread *main_thread = dbs->threads == NULL ? NULL : thread_add(dbs->threads, pid, THREAD_RUNNING);
+	if (main_thread == NULL)
+	{
+		if (dbs->threads != NULL)
+		{
+			free_thread_table(dbs->threads);
+		}
+		free(prog_name_buf);
+		free(dbs);
+		return NULL;
+	}
+	dbs->current = main_thread;
+	dbs->regs = &main_thread->regs;
+	dbs->halt_depth = 0;
+	dbs->step_area = 0;
+	dbs->no_step_area = false;
+	init_tracee_mem(&dbs->mem, pid);
+	dbs->elf = NULL;
+	dbs->line_table = NULL;
+	dbs->symbols = NULL;
+	dbs->cache_key[0] = '\0';
+	dbs->entry = 0;
+	dbs->load_bias = 0;
 	return dbs;
 }
 
 void remove_debug_session(DebugSession *session)
 {
+	close_tracee_mem(&session->mem);
+	if (session->line_table != NULL)
+	{
+		save_debug_index(session);
+		free_line_table(session->line_table);
+	}
+	if (session->symbols != NULL)
+	{
+		free_symbol_table(session->symbols);
+	}
+	if (session->elf != NULL)
+	{
+		elf_close(session->elf);
+	}
+	free_thread_table(session->threads);
 	free(session->prog);
 	free(session);
 }
 
-int start_tracing(char *prog)
+// Kills the tracee and reaps it so it isnt left behind
+void kill_tracee(DebugSession *session)
 {
-	// we are the child process we should allow the parent to trace us
-	// and start executing the program we wish to debug.
+	if (!session->active)
+	{
+		return;
+	}
 
-	// We return the EXIT code on any errors so that the child process terminates and
-	// isnt left hanging around.
+	if (kill(session->pid, SIGKILL) == -1)
+	{
+		logger(ERROR, "Failed to terminate on going debug session with pid %d. %s", session->pid, strerror(errno));
+	}
+	else
+	{
+		// the main thread is only reported once every other thread has been reaped
+		int pid;
+		while ((pid = waitpid(-1, NULL, __WALL)) != session->pid && (pid != -1 || errno == EINTR))
+		{
+		}
+	}
+	session->active = false;
+}
+
+// Takes over the mapped executable and decoded debug info of an earlier session if it
+// ran the same file and the file hasnt changed since. Returns true if they were taken.
+bool reuse_debug_info(DebugSession *session, DebugSession *old)
+{
+	if (old->elf == NULL || strcmp(old->prog, session->prog) != 0 || !elf_unchanged(old->elf, session->prog))
+	{
+		return false;
+	}
+
+	session->elf = old->elf;
+	session->line_table = old->line_table;
+	session->symbols = old->symbols;
+	session->entry = old->entry;
+	memcpy(session->cache_key, old->cache_key, CACHE_KEY_SIZE);
+	old->elf = NULL;
+	old->line_table = NULL;
+	old->symbols = NULL;
+	logger(DEBUG, "Reusing debug info for %s.", session->prog);
+	return true;
+}
 
+// Turns off address randomisation for the child so addresses are the same every run
+static int disable_aslr()
+{
 	int last_persona = personality(ADDR_NO_RANDOMIZE);
 	if (last_persona < 0)
 	{
 		logger(ERROR, "Failed to set child personaility. ERRNO: %d\n", errno);
-		return EXIT;
+		return -1;
 	}
+	return 0;
+}
 
-	ErrResult trace_res = ptrace_with_error(PTRACE_TRACEME, 0, NULL, NULL);
-	if (!trace_res.success)
+// Runs in the forked child of a new session. Waits for the parent to attach with
+// PTRACE_SEIZE, which it has done once it closes its end of the ready_fd pipe, then executes
+// prog. Only returns, with EXIT, if prog couldnt be executed.
+int start_seized(char *prog, int ready_fd)
+{
+	// We return the EXIT code on any errors so that the child process terminates and
+	// isnt left hanging around.
+	if (disable_aslr() == -1)
 	{
-		logger(ERROR, "Failed to start tracing child.");
 		return EXIT;
 	}
 
+	char byte;
+	while (read(ready_fd, &byte, 1) == -1 && errno == EINTR)
+	{
+	}
+	close(ready_fd);
+
 	if (execl(prog, prog, NULL) < 0)
 	{
 		logger(ERROR, "Failed to execute %s. %s", prog, strerror(errno));
@@ -76,217 +176,738 @@ int start_tracing(char *prog)
 	return EXIT;
 }
 
-// TODO:
-//	- Load first part of elf into memory
-//	- Look up section header table and load (some sections) into memory
-// 	- find .debug_line section by cross referencing with header name string table
-// 	- load .debug_line section into memory and parse to create map of line numbers to memory addresses
+// Attaches to the forked child of a new session, which then stops once it has executed its
+// program. Threads it starts are traced too. Returns -1 for errors.
+int seize_child(DebugSession *session)
+{
+	// the child is killed if we exit first so it is never left stopped
+	long options = PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL;
+	ErrResult res = ptrace_with_error(PTRACE_SEIZE, session->pid, NULL, (void *)options);
+	if (!res.success)
+	{
+		logger(ERROR, "Failed to trace process %d.", session->pid);
+		return -1;
+	}
+	session->active = true;
+	return 0;
+}
 
-int validate_elf(FILE *elf_file)
+// Attaches to every thread of the already running process of the session with PTRACE_SEIZE,
+// which leaves them running. Threads they start are traced too. Returns -1 for errors.
+int seize_tracee(DebugSession *session)
 {
-	char elf_identifier[] = {0x7f, 'E', 'L', 'F'};
-	// check the elf identifier header
-	char ident_buf[16];
-	size_t ident_bytes_read = fread(ident_buf, 1, 16, elf_file);
-	if (ident_bytes_read == 0)
+	// no PTRACE_O_EXITKILL, the process outlives us if we go away
+	ErrResult res = ptrace_with_error(PTRACE_SEIZE, session->pid, NULL, (void *)PTRACE_O_TRACECLONE);
+	if (!res.success)
 	{
-		logger(ERROR, "Failed to read elf itentifier. %s", strerror(errno));
+		logger(ERROR, "Failed to attach to process %d.", session->pid);
 		return -1;
 	}
+	session->attached = true;
+	session->active = true;
 
-	for (int i = 0; i < 4; i++)
+	char task_path[PROC_PATH_SIZE];
+	snprintf(task_path, PROC_PATH_SIZE, "/proc/%d/task", session->pid);
+
+	// threads can start while the others are being seized so the list is read again until
+	// it has no new ones
+	bool found = true;
+	while (found)
 	{
-		if (ident_buf[i] != elf_identifier[i])
+		found = false;
+		DIR *tasks = opendir(task_path);
+		if (tasks == NULL)
 		{
-			logger(ERROR, "Program is not ELF format.");
+			logger(ERROR, "Failed to list the threads of process %d. %s", session->pid, strerror(errno));
 			return -1;
 		}
+
+		struct dirent *entry;
+		while ((entry = readdir(tasks)) != NULL)
+		{
+			int tid = atoi(entry->d_name);
+			if (tid <= 0 || thread_find(session->threads, tid) != NULL)
+			{
+				continue;
+			}
+
+			ThreadState state = THREAD_RUNNING;
+			if (ptrace(PTRACE_SEIZE, tid, NULL, (void *)PTRACE_O_TRACECLONE) == -1)
+			{
+				// the thread has exited, or was started by one already traced so is ours already
+				if (errno == ESRCH)
+				{
+					continue;
+				}
+				if (errno != EPERM)
+				{
+					logger(ERROR, "Failed to attach to thread %d. %s", tid, strerror(errno));
+					closedir(tasks);
+					return -1;
+				}
+				state = THREAD_STARTING;
+			}
+
+			found = true;
+			if (thread_add(session->threads, tid, state) == NULL)
+			{
+				closedir(tasks);
+				return -1;
+			}
+		}
+		closedir(tasks);
 	}
 	return 0;
 }
 
-// Finds the the elf section header matching the given input string
-int locate_elf_section(char *section_name, char *name_table, uint32_t name_table_size, ElfSectionHeader header_table[], uint16_t header_count, ElfSectionHeader *header)
+// Makes the given thread the one commands act on
+void select_thread(DebugSession *session, TraceeThread *thread)
+{
+	session->current = thread;
+	session->regs = &thread->regs;
+	session->wait_status = thread->status;
+}
+
+// Forgets threads that have exited, other than the current one
+void prune_threads(DebugSession *session)
 {
-	char *current_header_name = NULL;
-	for (int i = 0; i <= header_count; i++)
+	ThreadTable *threads = session->threads;
+	for (size_t i = threads->count; i > 0; i--)
 	{
-		current_header_name = (char *)(name_table + header_table[i].sh_name);
-		if (strcmp(section_name, current_header_name) == 0)
+		TraceeThread *thread = threads->threads[i - 1];
+		if (thread->state == THREAD_EXITED && thread != session->current)
 		{
-			*header = header_table[i];
-			logger(DEBUG, "%s section found at offset %p.", section_name, (void *)header_table[i].sh_offset);
-			return 0;
+			thread_remove(threads, thread->tid);
 		}
 	}
+}
 
-	return -1;
+// Returns true once the whole process has exited, rather than just one of its threads
+bool tracee_exited(DebugSession *session)
+{
+	return !WIFSTOPPED(session->wait_status) && session->current->tid == session->pid;
 }
 
-// Extracts a map of memory addresses to line numbers from the given buffer containing a .debug_section
-Map *get_line_numbers(uint8_t *debug_line_section, uint64_t section_size)
+// Resumes the given thread with the given ptrace request (PTRACE_CONT or PTRACE_SINGLESTEP),
+// writing back any modified registers first. A pending signal is delivered when it is
+// continued. Returns -1 for errors.
+int resume_thread(TraceeThread *thread, enum __ptrace_request req)
 {
-	Map *line_numbers = new_map();
-	if (line_numbers == NULL)
+	if (flush_reg_cache(&thread->regs) == -1)
 	{
-		logger(ERROR, "Failed to initialise map");
-		return NULL;
+		logger(ERROR, "Failed to write back registers for thread %d", thread->tid);
+		return -1;
+	}
+
+	// a signal would send a single step into its handler
+	long sig = req == PTRACE_CONT ? thread->pending_signal : 0;
+	ErrResult res = ptrace_with_error(req, thread->tid, NULL, (void *)sig);
+	if (!res.success)
+	{
+		return -1;
+	}
+
+	if (req == PTRACE_CONT)
+	{
+		thread->pending_signal = 0;
+	}
+	thread->state = THREAD_RUNNING;
+	thread->stepping = req == PTRACE_SINGLESTEP;
+	thread->halted = false;
+	return 0;
+}
+
+// Resumes the current thread with the given ptrace request (PTRACE_CONT or PTRACE_SINGLESTEP),
+// writing back any modified registers first.
+int resume_tracee(DebugSession *session, enum __ptrace_request req)
+{
+	return resume_thread(session->current, req);
+}
+
+// What a wait status meant to the debugger
+typedef enum ThreadEvent {
+	// dealt with, such as a new thread starting
+	EVENT_HANDLED,
+	// a thread stopped somewhere the debugger has to look at
+	EVENT_STOPPED,
+	// a thread other than the main one exited
+	EVENT_THREAD_EXITED,
+	// the whole process exited
+	EVENT_EXITED,
+} ThreadEvent;
+
+// Works out what the given wait status of the given thread means, dealing with the stops the
+// debugger causes itself. Returns the event, with the thread it happened to, or -1 for errors.
+static int handle_thread_event(DebugSession *session, int tid, int status, TraceeThread **out)
+{
+	TraceeThread *thread = thread_find(session->threads, tid);
+	if (!WIFSTOPPED(status))
+	{
+		// the main thread is only reported once all the others are gone
+		if (tid == session->pid)
+		{
+			*out = thread;
+			return EVENT_EXITED;
+		}
+		if (thread == NULL)
+		{
+			return EVENT_HANDLED;
+		}
+
+		thread->state = THREAD_EXITED;
+		thread->status = status;
+		thread->halting = false;
+		*out = thread;
+		return EVENT_THREAD_EXITED;
+	}
+
+	// a new thread's first stop can come before the clone that created it is reported
+	if (thread == NULL && (thread = thread_add(session->threads, tid, THREAD_STARTING)) == NULL)
+	{
+		return -1;
+	}
+	invalidate_reg_cache(&thread->regs);
+	ThreadState was = thread->state;
+	thread->state = THREAD_STOPPED;
+	thread->status = status;
+	*out = thread;
+
+	bool halting = thread->halting;
+	thread->halting = false;
+	int event = status >> 16;
+	if (event == PTRACE_EVENT_CLONE)
+	{
+		unsigned long new_tid;
+		if (!ptrace_with_error(PTRACE_GETEVENTMSG, tid, NULL, &new_tid).success)
+		{
+			return -1;
+		}
+
+		TraceeThread *child = thread_add(session->threads, (int)new_tid, THREAD_STARTING);
+		if (child == NULL)
+		{
+			return -1;
+		}
+		logger(DEBUG, "Thread %d started thread %d.", tid, (int)new_tid);
+
+		// a thread started while the others are being halted is halted with them
+		if (halting && child->state == THREAD_STARTING)
+		{
+			child->halting = true;
+			child->halted = thread->halted;
+		}
+		if (halting)
+		{
+			return EVENT_HANDLED;
+		}
+		return resume_thread(thread, thread->stepping ? PTRACE_SINGLESTEP : PTRACE_CONT) == -1 ? -1 : EVENT_HANDLED;
+	}
+
+	if (event == PTRACE_EVENT_STOP)
+	{
+		// a new thread is handed to the debugger to be set up unless it is being halted
+		if (was == THREAD_STARTING)
+		{
+			return halting ? EVENT_HANDLED : EVENT_STOPPED;
+		}
+		if (halting)
+		{
+			return EVENT_HANDLED;
+		}
+
+		// an interrupt sent while the thread was already stopped for something else, or a
+		// group stop, which doesnt stop a traced thread for long anyway
+		return resume_thread(thread, thread->stepping ? PTRACE_SINGLESTEP : PTRACE_CONT) == -1 ? -1 : EVENT_HANDLED;
+	}
+
+	// anything else is kept until the thread is resumed again
+	if (halting)
+	{
+		thread->status_pending = true;
+		return EVENT_HANDLED;
+	}
+	return EVENT_STOPPED;
+}
+
+// Records the exit of the whole process, making the main thread current if it is still known
+static void select_exit(DebugSession *session, TraceeThread *main_thread, int status)
+{
+	// the registers of an exited process cant be read, only its status
+	if (main_thread != NULL)
+	{
+		main_thread->state = THREAD_EXITED;
+		main_thread->status = status;
+		select_thread(session, main_thread);
+	}
+	session->wait_status = status;
+}
+
+// Blocks until the current thread stops again or exits. Stops of other threads seen in the
+// meantime are kept to be handled later. Returns -1 for errors.
+int wait_for_tracee(DebugSession *session)
+{
+	TraceeThread *target = session->current;
+	while (true)
+	{
+		int status;
+		int tid = waitpid(-1, &status, __WALL);
+		if (tid == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			logger(ERROR, "failed to wait for process %d. %s", session->pid, strerror(errno));
+			return -1;
+		}
+
+		TraceeThread *thread = NULL;
+		int event = handle_thread_event(session, tid, status, &thread);
+		switch (event)
+		{
+		case -1:
+			return -1;
+		case EVENT_EXITED:
+			select_exit(session, thread, status);
+			return 0;
+		case EVENT_THREAD_EXITED:
+			if (thread == target)
+			{
+				select_thread(session, thread);
+				return 0;
+			}
+			thread_remove(session->threads, thread->tid);
+			break;
+		case EVENT_STOPPED:
+			if (thread == target)
+			{
+				select_thread(session, thread);
+				return 0;
+			}
+			thread->status_pending = true;
+			break;
+		}
 	}
-	// TODO: parse dwarf using statemachine
+}
 
-	DwarfParserStateMachine state_machine = {
-		.addr = 0,
-		.line_number = 0,
-		.src_file = NULL,
-	};
+// Makes the first thread with a stop kept from earlier the current one. Returns false if
+// there isnt one.
+static bool select_pending(DebugSession *session)
+{
+	ThreadTable *threads = session->threads;
+	for (size_t i = 0; i < threads->count; i++)
+	{
+		TraceeThread *thread = threads->threads[i];
+		if (thread->status_pending)
+		{
+			thread->status_pending = false;
+			select_thread(session, thread);
+			return true;
+		}
+	}
+	return false;
+}
 
-	DwarfDebugLineHeader current_cu_header;
-	int file_table_buf_idx = 0;
-	// buffer containing both the directory and file tables
-	uint8_t file_table_buffer[FILE_TABLE_SIZE];
-	int compilation_unit = 0;
-	bool parsing_file_table = false;
-	uint64_t section_current_byte = 0;
+// Makes the next thread that stopped somewhere the debugger has to look at the current one
+// without blocking. Every stop and exit waiting to be reaped is reaped in one batch, dealing
+// with thread creation and exit, and the stops are kept to be handled in turn. Returns 1 if no
+// thread has stopped yet, 0 once one is current or the process has exited and -1 for errors.
+int poll_event(DebugSession *session)
+{
+	if (select_pending(session))
+	{
+		return 0;
+	}
 
-	// keeps track of the current byte we are on in the CU
-	uint64_t cu_current_byte = 0;
-	while(section_current_byte < section_size)
+	while (true)
 	{
+		int status;
+		int tid = waitpid(-1, &status, __WALL | WNOHANG);
+		if (tid == 0)
+		{
+			break;
+		}
+		if (tid == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			logger(ERROR, "failed to wait for process %d. %s", session->pid, strerror(errno));
+			return -1;
+		}
 
-		if (cu_current_byte < sizeof(DwarfDebugLineHeader))
+		TraceeThread *thread = NULL;
+		int event = handle_thread_event(session, tid, status, &thread);
+		switch (event)
 		{
-			// read the header for the current CU
-			logger(DEBUG, "Reading header of CU %d.", compilation_unit);
-			memcpy(&current_cu_header, debug_line_section, sizeof(DwarfDebugLineHeader));
+		case -1:
+			return -1;
+		case EVENT_EXITED:
+			select_exit(session, thread, status);
+			return 0;
+		case EVENT_THREAD_EXITED:
+			if (thread != session->current)
+			{
+				thread_remove(session->threads, thread->tid);
+			}
+			break;
+		case EVENT_STOPPED:
+			thread->status_pending = true;
+			break;
+		}
+	}
+	return select_pending(session) ? 0 : 1;
+}
 
-			cu_current_byte += sizeof(DwarfDebugLineHeader);
-			section_current_byte += sizeof(DwarfDebugLineHeader);
+// Stops every running thread of the tracee. Stops other than the ones asked for are kept to be
+// handled later. Threads are marked halted when for_op is set so resume_halted carries them
+// on again, and each such call that returns 0 has to be matched by one to resume_halted.
+// Returns 1 if the process exited instead and -1 for errors.
+int halt_threads(DebugSession *session, bool for_op)
+{
+	ThreadTable *threads = session->threads;
+	bool waiting = false;
+	for (size_t i = 0; i < threads->count; i++)
+	{
+		TraceeThread *thread = threads->threads[i];
+		if (thread->state != THREAD_RUNNING && thread->state != THREAD_STARTING)
+		{
+			continue;
+		}
 
-			logger(DEBUG, "Found %d lines in CU %d.", current_cu_header.line_range, compilation_unit);
-			parsing_file_table = true;
+		// a thread that has just exited is reaped below
+		if (thread->state == THREAD_RUNNING && ptrace(PTRACE_INTERRUPT, thread->tid, NULL, NULL) == -1 && errno != ESRCH)
+		{
+			logger(ERROR, "Failed to interrupt thread %d. %s", thread->tid, strerror(errno));
+			return -1;
 		}
+		thread->halting = true;
+		thread->halted = for_op;
+		waiting = true;
+	}
 
-		if (parsing_file_table)
+	while (waiting)
+	{
+		int status;
+		int tid = waitpid(-1, &status, __WALL);
+		if (tid == -1)
 		{
-			// the opcodes offset from the beginning of the CU. Plus 18 as the header length field doesnt
-			// include the field itself or the previous two fields
-			uint64_t opcodes_offset = current_cu_header.header_length + 18;
-			logger(DEBUG, "Opcodes for CU %d found at offset %d.", compilation_unit, opcodes_offset);
-			// read the file and directory table
-			while(cu_current_byte < opcodes_offset && section_current_byte < section_size) {
-				file_table_buffer[file_table_buf_idx] = debug_line_section[section_current_byte];
-				
-				file_table_buf_idx++;
-				section_current_byte++;
-				cu_current_byte++;
-				printf("%c\n", file_table_buffer[file_table_buf_idx]);
+			if (errno == EINTR)
+			{
+				continue;
 			}
-			parsing_file_table = true;
+			logger(ERROR, "failed to wait for process %d. %s", session->pid, strerror(errno));
+			return -1;
+		}
+
+		TraceeThread *thread = NULL;
+		int event = handle_thread_event(session, tid, status, &thread);
+		if (event == -1)
+		{
+			return -1;
+		}
+		if (event == EVENT_EXITED)
+		{
+			select_exit(session, thread, status);
+			return 1;
+		}
+		if (event == EVENT_THREAD_EXITED && thread != session->current)
+		{
+			thread_remove(threads, thread->tid);
 		}
+		if (event == EVENT_STOPPED)
+		{
+			// a thread that wasnt known about yet, it stays stopped with the rest
+			thread->halted = for_op;
+			thread->status_pending = (thread->status >> 16) != PTRACE_EVENT_STOP;
+		}
+
+		waiting = false;
+		for (size_t i = 0; i < threads->count && !waiting; i++)
+		{
+			waiting = threads->threads[i]->halting;
+		}
+	}
+
+	// only a halt that worked has to be undone, the next resume_threads resumes the rest
+	if (for_op)
+	{
+		session->halt_depth++;
 	}
-	printf("%s\n", file_table_buffer);
-	return line_numbers;
+	return 0;
+}
+
+// Resumes the threads stopped by halt_threads for an operation once every nested operation
+// is done. Returns -1 for errors.
+int resume_halted(DebugSession *session)
+{
+	if (session->halt_depth > 0 && --session->halt_depth > 0)
+	{
+		return 0;
+	}
+
+	ThreadTable *threads = session->threads;
+	for (size_t i = 0; i < threads->count; i++)
+	{
+		TraceeThread *thread = threads->threads[i];
+		if (thread->halted && thread->state == THREAD_STOPPED && !thread->status_pending &&
+			resume_thread(thread, PTRACE_CONT) == -1)
+		{
+			return -1;
+		}
+		thread->halted = false;
+	}
+	return 0;
 }
 
-// Parses the dwarf info from the program path in the given session
+// Lets go of every thread of an attached tracee so it carries on untraced, writing back any
+// modified registers first. Every thread must be stopped. Returns -1 for errors.
+int detach_tracee(DebugSession *session)
+{
+	ThreadTable *threads = session->threads;
+	int res = 0;
+	for (size_t i = 0; i < threads->count; i++)
+	{
+		TraceeThread *thread = threads->threads[i];
+		if (thread->state == THREAD_EXITED)
+		{
+			continue;
+		}
+
+		if (flush_reg_cache(&thread->regs) == -1)
+		{
+			logger(ERROR, "Failed to write back registers for thread %d", thread->tid);
+			res = -1;
+		}
+
+		// a signal that stopped the thread and hasnt been delivered is passed on
+		long sig = thread->pending_signal;
+		if (ptrace(PTRACE_DETACH, thread->tid, NULL, (void *)sig) == -1 && errno != ESRCH)
+		{
+			logger(ERROR, "Failed to detach from thread %d. %s", thread->tid, strerror(errno));
+			res = -1;
+		}
+	}
+	session->active = false;
+	return res;
+}
+
+// Parses the dwarf info from the program path in the given session. The executable stays
+// mapped for the rest of the session and the sections are read straight from the mapping.
 int parse_dwarf_info(DebugSession *session)
 {
-	FILE *elf_file = fopen(session->prog, "rb");
-	if (elf_file == NULL)
+	ElfImage *elf = elf_open(session->prog);
+	if (elf == NULL)
 	{
-		logger(ERROR, "Failed to open file. %s", strerror(errno));
+		logger(ERROR, "Failed to load elf file %s.", session->prog);
 		return -1;
 	}
 
-	if (validate_elf(elf_file) == -1)
+	if (session->elf != NULL)
 	{
-		logger(ERROR, "Failed to validate elf file. %s", strerror(errno));
-		return -1;
+		elf_close(session->elf);
+	}
+	session->elf = elf;
+	session->entry = elf->info->e_entry;
+
+	// a previous session on the same build may have already decoded everything
+	index_cache_key(elf, session->cache_key, CACHE_KEY_SIZE);
+	session->line_table = load_index_cache(session->cache_key, elf, &session->symbols);
+	if (session->line_table != NULL)
+	{
+		return 0;
 	}
 
 	logger(DEBUG, "Parsing DWARF info from %s.", session->prog);
 
-	// read the general file info
-	ElfInfo info;
-	if (fread(&info, 1, sizeof(ElfInfo), elf_file) == 0)
+	// the debug line section is comprised of a CUs each with a header, then a directory
+	// table, then a file name table and finally the line number program. DWARF 5 file tables
+	// can refer to strings in .debug_line_str and .debug_str so pass those too if present.
+	ElfSection debug_line;
+	if (elf_section(elf, DEBUG_LINE_HEADER, &debug_line) == -1)
 	{
-		logger(ERROR, "Failed to read elf file info. %s", strerror(errno));
-		return -1;
+		// the symbols can still be used
+		logger(WARN, "No line information found in %s.", session->prog);
+		return 0;
 	}
 
-	uint16_t header_count = info.e_shnum;
-	logger(DEBUG, "Section header table found at offset %p with %d entries.", (void *)info.e_shoff, header_count);
+	DwarfSections sections = {0};
+	sections.debug_line = debug_line.data;
+	sections.debug_line_size = debug_line.size;
 
-	// get the section header table
-	ElfSectionHeader header_table[header_count];
-	if (fseek(elf_file, info.e_shoff, SEEK_SET) < 0)
+	ElfSection str_section;
+	if (elf_section(elf, DEBUG_LINE_STR_HEADER, &str_section) == 0)
 	{
-		logger(ERROR, "Failed to look ahead for header table. %s", strerror(errno));
-		return -1;
+		sections.debug_line_str = str_section.data;
+		sections.debug_line_str_size = str_section.size;
 	}
 
-	if (fread(header_table, sizeof(char), header_count * sizeof(ElfSectionHeader), elf_file) == 0)
+	if (elf_section(elf, DEBUG_STR_HEADER, &str_section) == 0)
 	{
-		logger(ERROR, "Failed to read header table. %s", strerror(errno));
-		return -1;
+		sections.debug_str = str_section.data;
+		sections.debug_str_size = str_section.size;
 	}
 
-	ElfSectionHeader names_header = header_table[info.e_shstrndx];
-	uint64_t names_table_pos = names_header.sh_offset;
-	uint64_t name_table_size = names_header.sh_size;
-	logger(DEBUG, "Header names found at offset %p.", (void *)names_table_pos);
+	// .debug_aranges maps addresses to compilation units so a unit's line program only has to
+	// be run once something inside it is looked up. Finding a unit's line program takes the
+	// first entry of the unit from .debug_info.
+	ElfSection aranges;
+	if (elf_section(elf, DEBUG_ARANGES_HEADER, &aranges) == 0)
+	{
+		sections.debug_aranges = aranges.data;
+		sections.debug_aranges_size = aranges.size;
+		// the address ranges are read front to back
+		elf_advise_sequential(&aranges);
+	}
 
-	if (fseek(elf_file, names_table_pos, SEEK_SET) < 0)
+	ElfSection info_section;
+	ElfSection abbrev_section;
+	if (elf_section(elf, DEBUG_INFO_HEADER, &info_section) == 0 && elf_section(elf, DEBUG_ABBREV_HEADER, &abbrev_section) == 0)
 	{
-		logger(ERROR, "Failed to look ahead for section name table. %s", strerror(errno));
-		return -1;
+		sections.debug_info = info_section.data;
+		sections.debug_info_size = info_section.size;
+		sections.debug_abbrev = abbrev_section.data;
+		sections.debug_abbrev_size = abbrev_section.size;
 	}
 
-	// get header name table
-	char name_table[name_table_size];
-	if (fread(name_table, sizeof(char), name_table_size, elf_file) != name_table_size)
+	logger(DEBUG, "Indexing .debug_line section.");
+	session->line_table = build_line_table(&sections);
+	if (session->line_table == NULL)
 	{
-		logger(ERROR, "Failed to read name table. %s", strerror(errno));
+		logger(ERROR, "Failed to extract line numbers");
 		return -1;
 	}
+	return 0;
+}
+
+// Caches the line table and symbol table if they didnt come from the cache already. Units the
+// session never looked in are decoded first so the next session finds every unit. Returns -1
+// for errors.
+int save_debug_index(DebugSession *session)
+{
+	LineTable *table = session->line_table;
+	if (table == NULL || table->mapping != NULL || session->cache_key[0] == '\0')
+	{
+		return 0;
+	}
 
-	// find .debug_line section
-	ElfSectionHeader debug_line_section_table_header;
-	if (locate_elf_section(DEBUG_LINE_HEADER, name_table, name_table_size, header_table, header_count, &debug_line_section_table_header) == -1)
+	if (line_table_load_all(table) == -1 || !line_table_complete(table))
 	{
-		logger(ERROR, "Failed to locate %s section.", DEBUG_LINE_HEADER);
+		logger(WARN, "Not caching the debug index of %s since some units couldnt be decoded.", session->prog);
 		return -1;
 	}
 
-	if (fseek(elf_file, debug_line_section_table_header.sh_offset, SEEK_SET) == -1)
+	// the symbols are indexed now if nothing has needed them yet so the next session doesnt have to
+	SymbolTable *symbols = get_symbols(session);
+	if (symbols == NULL)
 	{
-		logger(ERROR, "Failed to look ahead for .debug_line section. %s", strerror(errno));
 		return -1;
 	}
+	return save_index_cache(table, symbols, session->cache_key);
+}
+
+// Works out where the executable was loaded from the tracee's auxiliary vector.
+// The tracee must have called exec.
+int read_load_bias(DebugSession *session)
+{
+	char path[PROC_PATH_SIZE];
+	snprintf(path, PROC_PATH_SIZE, "/proc/%d/auxv", session->pid);
 
-	// the debug line section is comprised of a CUs each with a header struct,
-	// then a directory table then a file name table and finally a list of opcodes encoding a line number and memory address.
-	// We read the whole section into memory then break it up into the CUs.
-	uint8_t debug_line_section[debug_line_section_table_header.sh_size];
-	if (fread(debug_line_section, sizeof(char), debug_line_section_table_header.sh_size, elf_file) != debug_line_section_table_header.sh_size)
+	FILE *auxv = fopen(path, "rb");
+	if (auxv == NULL)
 	{
-		logger(ERROR, "Failed to read .debug_line section header. %s", strerror(errno));
+		logger(ERROR, "Failed to open auxiliary vector. %s", strerror(errno));
 		return -1;
 	}
 
-	logger(DEBUG, "Parsing .debug_line section.");
+	// the entry point the kernel jumped to is the one from the ELF header plus the load bias
+	Elf64_auxv_t entry;
+	int res = -1;
+	while (fread(&entry, sizeof(entry), 1, auxv) == 1 && entry.a_type != AT_NULL)
+	{
+		if (entry.a_type == AT_ENTRY)
+		{
+			session->load_bias = entry.a_un.a_val - session->entry;
+			logger(DEBUG, "Executable loaded with bias %p.", (void *)session->load_bias);
+			res = 0;
+			break;
+		}
+	}
+
+	fclose(auxv);
+	return res;
+}
 
-	Map *line_numbers = get_line_numbers(debug_line_section, debug_line_section_table_header.sh_size);
-	if (line_numbers == NULL)
+// Finds the source line containing the given address. Returns -1 if there is no line
+// information for the address.
+int lookup_line(DebugSession *session, uint64_t addr, LineNumberInfo *info)
+{
+	if (session->line_table == NULL)
 	{
-		logger(ERROR, "Failed to extract line numbers");
 		return -1;
 	}
 
-	if (fclose(elf_file) != 0)
+	const LineRow *row = line_table_lookup(session->line_table, addr - session->load_bias);
+	if (row == NULL)
 	{
-		logger(ERROR, "Failed to close file. %s", strerror(errno));
 		return -1;
 	}
+
+	info->line_number = row->line;
+	info->file = st_get(session->line_table->files, row->file_idx);
 	return 0;
-}
\ No newline at end of file
+}
+
+// Returns the symbols of the executable, indexing them the first time they are needed.
+// Returns NULL if they cant be indexed.
+SymbolTable *get_symbols(DebugSession *session)
+{
+	if (session->symbols == NULL && session->elf != NULL)
+	{
+		session->symbols = build_symbol_table(session->elf);
+	}
+	return session->symbols;
+}
+
+// Finds the symbol containing the given address. Returns NULL if there isnt one.
+const Symbol *lookup_symbol(DebugSession *session, uint64_t addr)
+{
+	SymbolTable *symbols = get_symbols(session);
+	if (symbols == NULL)
+	{
+		return NULL;
+	}
+	return symbol_by_addr(symbols, addr - session->load_bias);
+}
+
+// Finds the addresses of the symbols with the given name, either as it is in the symbol table
+// or demangled, where a C++ name without its parameter list finds every overload. Returns the
+// number of addresses found, at most max_addrs, or -1 for errors.
+long resolve_symbol(DebugSession *session, const char *name, uint64_t *addrs, size_t max_addrs)
+{
+	SymbolTable *symbols = get_symbols(session);
+	if (symbols == NULL)
+	{
+		return -1;
+	}
+
+	long found = 0;
+	const Symbol *symbol = symbol_by_name(symbols, name);
+	if (symbol != NULL)
+	{
+		addrs[0] = symbol->addr;
+		found = 1;
+	}
+	else
+	{
+		// C++ names are mostly written demangled
+		found = lookup_display_name(symbols, name, addrs, max_addrs);
+	}
+
+	for (long i = 0; i < found; i++)
+	{
+		addrs[i] += session->load_bias;
+	}
+	return found;
+}
@@ -3,99 +3,156 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/ptrace.h>
 
-#include "map.h"
+#include "dwarf.h"
+#include "elf_image.h"
+#include "index_cache.h"
+#include "mem.h"
+#include "reg.h"
+#include "symbols.h"
+#include "thread_table.h"
 
 // The magic number to exit the program
 #define EXIT -73
 
 typedef struct DebugSession {
 	char * prog;
+	// process id, which is also the id of the main thread
 	int pid;
+	// wait status of the current thread's latest stop, or of the process once it has exited
 	int wait_status;
 	bool active;
-	Map * line_numbers;
+	// set when an already running process was attached to, it is detached from rather
+	// than killed
+	bool attached;
+	// read only mapping of the executable the debug info is parsed from
+	ElfImage * elf;
+	// addresses to source lines for the executable
+	LineTable * line_table;
+	// function and variable names, built the first time a symbol is looked up
+	SymbolTable * symbols;
+	// what the decoded debug info is cached under
+	char cache_key[CACHE_KEY_SIZE];
+	// entry point from the ELF header
+	uint64_t entry;
+	// difference between the addresses in the debug info and where the executable was
+	// actually loaded. Non zero for position independent executables.
+	uint64_t load_bias;
+	// every thread of the tracee the debugger knows of
+	ThreadTable * threads;
+	// the thread whose stop is being looked at, which commands act on
+	TraceeThread * current;
+	// number of operations the threads are halted for, which can nest. They are only
+	// resumed once the outermost one is done.
+	int halt_depth;
+	// executable page in the tracee instructions are single stepped through out of line, 0
+	// until it is first needed
+	uint64_t step_area;
+	// set once there was no room for the page so it isnt tried again on every step
+	bool no_step_area;
+	// registers of the current thread at its current stop
+	RegCache * regs;
+	// bulk access to the tracee's memory
+	TraceeMem mem;
 } DebugSession;
 
-// General info about the ELF file
-typedef struct ElfInfo {
-	uint16_t e_type;
-	uint16_t e_machine;
-	uint32_t e_version;
-
-	// location of the binary in memory
-	uint64_t e_entry;
-
-	// program header table offset
-	uint64_t e_phoff;
-
-	// section header table offset
-	uint64_t e_shoff;
-	uint32_t e_flags;
-	uint16_t e_ehsize;
-	uint16_t e_phentsize;
-	uint16_t e_phnum;
-
-	// size of a section header table entry
-	uint16_t e_shentsize;
-
-	// number of section header table entries
-	uint16_t e_shnum;
-
-	// index of the section name string table in the header table
-	uint16_t e_shstrndx;
-} ElfInfo;
-
-// Info about a specific elf section
-typedef struct ElfSectionHeader {
-	// name of the section as an offset into the section name string table
-    uint32_t sh_name;
-
-    uint32_t sh_type;
-    uint64_t sh_flags;
-    uint64_t sh_addr;
-
-	// the sections offset in memory from the begining of the elf
-    uint64_t sh_offset;
-
-	// size of the section
-    uint64_t sh_size;
-
-    uint32_t sh_link;
-    uint32_t sh_info;
-    uint64_t sh_addralign;
-    uint64_t sh_entsize;
-} ElfSectionHeader;
-
-typedef struct DwarfDebugLineHeader {
-    uint64_t length;
-    uint16_t version;
-    uint64_t header_length;
-    uint8_t min_instruction_length;
-    uint8_t default_is_stmt;
-    int8_t line_base;
-    uint8_t line_range;
-    uint8_t opcode_base;
-    uint8_t std_opcode_lengths[12];
-} __attribute__((packed)) DwarfDebugLineHeader;
-
-typedef struct {
-	uint64_t addr;
-	char * src_file;
-	uint64_t line_number;
-} DwarfParserStateMachine;
-
 typedef struct {
 	uint32_t line_number;
-	char * file;
+	const char * file;
 } LineNumberInfo;
 
 DebugSession *new_debug_session(char *prog, int pid);
 
 void remove_debug_session(DebugSession *session);
 
-int start_tracing(char *prog);
+// Kills the tracee and reaps it so it isnt left behind
+void kill_tracee(DebugSession *session);
+
+// Takes over the mapped executable and decoded debug info of an earlier session if it
+// ran the same file and the file hasnt changed since. Returns true if they were taken.
+bool reuse_debug_info(DebugSession *session, DebugSession *old);
+
+// Runs in the forked child of a new session. Waits for the parent to attach with
+// PTRACE_SEIZE, which it has done once it closes its end of the ready_fd pipe, then executes
+// prog. Only returns, with EXIT, if prog couldnt be executed.
+int start_seized(char *prog, int ready_fd);
+
+// Attaches to the forked child of a new session, which then stops once it has executed its
+// program. Threads it starts are traced too. Returns -1 for errors.
+int seize_child(DebugSession *session);
+
+// Attaches to every thread of the already running process of the session with PTRACE_SEIZE,
+// which leaves them running. Threads they start are traced too. Returns -1 for errors.
+int seize_tracee(DebugSession *session);
+
+// Stops every running thread of the tracee. Stops other than the ones asked for are kept to be
+// handled later. Threads are marked halted when for_op is set so resume_halted carries them
+// on again, and each such call that returns 0 has to be matched by one to resume_halted.
+// Returns 1 if the process exited instead and -1 for errors.
+int halt_threads(DebugSession *session, bool for_op);
+
+// Resumes the threads stopped by halt_threads for an operation once every nested operation
+// is done. Returns -1 for errors.
+int resume_halted(DebugSession *session);
+
+// Lets go of every thread of an attached tracee so it carries on untraced, writing back any
+// modified registers first. Every thread must be stopped. Returns -1 for errors.
+int detach_tracee(DebugSession *session);
+
+// Makes the given thread the one commands act on
+void select_thread(DebugSession *session, TraceeThread *thread);
+
+// Forgets threads that have exited, other than the current one
+void prune_threads(DebugSession *session);
+
+// Returns true once the whole process has exited, rather than just one of its threads
+bool tracee_exited(DebugSession *session);
+
+// Resumes the given thread with the given ptrace request (PTRACE_CONT or PTRACE_SINGLESTEP),
+// writing back any modified registers first. A pending signal is delivered when it is
+// continued. Returns -1 for errors.
+int resume_thread(TraceeThread *thread, enum __ptrace_request req);
+
+// Resumes the current thread with the given ptrace request (PTRACE_CONT or PTRACE_SINGLESTEP),
+// writing back any modified registers first.
+int resume_tracee(DebugSession *session, enum __ptrace_request req);
+
+// Blocks until the current thread stops again or exits. Stops of other threads seen in the
+// meantime are kept to be handled later. Returns -1 for errors.
+int wait_for_tracee(DebugSession *session);
+
+// Makes the next thread that stopped somewhere the debugger has to look at the current one
+// without blocking. Every stop and exit waiting to be reaped is reaped in one batch, dealing
+// with thread creation and exit, and the stops are kept to be handled in turn. Returns 1 if no
+// thread has stopped yet, 0 once one is current or the process has exited and -1 for errors.
+int poll_event(DebugSession *session);
 
 int parse_dwarf_info(DebugSession * session);
 
+// Caches the line table and symbol table if they didnt come from the cache already. Units the
+// session never looked in are decoded first so the next session finds every unit. Returns -1
+// for errors.
+int save_debug_index(DebugSession *session);
+
+// Works out where the executable was loaded from the tracee's auxiliary vector.
+// The tracee must have called exec.
+int read_load_bias(DebugSession *session);
+
+// Finds the source line containing the given address. Returns -1 if there is no line
+// information for the address.
+int lookup_line(DebugSession *session, uint64_t addr, LineNumberInfo *info);
+
+// Returns the symbols of the executable, indexing them the first time they are needed.
+// Returns NULL if they cant be indexed.
+SymbolTable *get_symbols(DebugSession *session);
+
+// Finds the symbol containing the given address. Returns NULL if there isnt one.
+const Symbol *lookup_symbol(DebugSession *session, uint64_t addr);
+
+// Finds the addresses of the symbols with the given name, either as it is in the symbol table
+// or demangled, where a C++ name without its parameter list finds every overload. Returns the
+// number of addresses found, at most max_addrs, or -1 for errors.
+long resolve_symbol(DebugSession *session, const char *name, uint64_t *addrs, size_t max_addrs);
+
 #endif
\ No newline at end of file
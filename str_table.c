@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include "str_table.h"
+#include "logger.h"
+
+#define INITIAL_SLOTS 64
+#define INITIAL_BLOB_SIZE 1024
+
+// Hashes the given string using the FNV-1a algorithm
+static uint64_t hash_str(const char *str)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	while (*str)
+	{
+		hash ^= (uint8_t)*str++;
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+// Creates an empty string table
+StrTable *new_str_table()
+{
+	StrTable *table = (StrTable *)calloc(1, sizeof(StrTable));
+	if (table == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for string table. %s", strerror(errno));
+		return NULL;
+	}
+
+	table->slots = (uint32_t *)calloc(INITIAL_SLOTS, sizeof(uint32_t));
+	if (table->slots == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for string table. %s", strerror(errno));
+		free(table);
+		return NULL;
+	}
+	table->slot_count = INITIAL_SLOTS;
+	return table;
+}
+
+void free_str_table(StrTable *table)
+{
+	free(table->blob);
+	free(table->offsets);
+	free(table->slots);
+	free(table);
+}
+
+// Returns the slot holding the string or the empty slot where it should go
+static size_t find_str_slot(StrTable *table, const char *str, uint64_t hash)
+{
+	size_t mask = table->slot_count - 1;
+	size_t idx = hash & mask;
+	while (table->slots[idx] != 0 && strcmp(st_get(table, table->slots[idx] - 1), str) != 0)
+	{
+		idx = (idx + 1) & mask;
+	}
+	return idx;
+}
+
+// Doubles the number of hash slots and reinserts every string
+static int grow_slots(StrTable *table)
+{
+	size_t slot_count = table->slot_count * 2;
+	uint32_t *slots = (uint32_t *)calloc(slot_count, sizeof(uint32_t));
+	if (slots == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for string table. %s", strerror(errno));
+		return -1;
+	}
+
+	free(table->slots);
+	table->slots = slots;
+	table->slot_count = slot_count;
+	for (size_t id = 0; id < table->count; id++)
+	{
+		const char *str = st_get(table, id);
+		table->slots[find_str_slot(table, str, hash_str(str))] = id + 1;
+	}
+	return 0;
+}
+
+// Adds the string to the table if it isnt already there. Returns its id or -1 for errors.
+long st_intern(StrTable *table, const char *str)
+{
+	uint64_t hash = hash_str(str);
+	size_t slot = find_str_slot(table, str, hash);
+	if (table->slots[slot] != 0)
+	{
+		return table->slots[slot] - 1;
+	}
+
+	size_t len = strlen(str) + 1;
+	if (table->blob_size + len > table->blob_capacity)
+	{
+		size_t blob_capacity = table->blob_capacity == 0 ? INITIAL_BLOB_SIZE : table->blob_capacity;
+		while (table->blob_size + len > blob_capacity)
+		{
+			blob_capacity *= 2;
+		}
+		char *blob = (char *)realloc(table->blob, blob_capacity);
+		if (blob == NULL)
+		{
+			logger(ERROR, "Failed to allocate heap memory for string table. %s", strerror(errno));
+			return -1;
+		}
+		table->blob = blob;
+		table->blob_capacity = blob_capacity;
+	}
+
+	if (table->count == table->capacity)
+	{
+		size_t capacity = table->capacity == 0 ? INITIAL_SLOTS : table->capacity * 2;
+		uint64_t *offsets = (uint64_t *)realloc(table->offsets, capacity * sizeof(uint64_t));
+		if (offsets == NULL)
+		{
+			logger(ERROR, "Failed to allocate heap memory for string table. %s", strerror(errno));
+			return -1;
+		}
+		table->offsets = offsets;
+		table->capacity = capacity;
+	}
+
+	memcpy(table->blob + table->blob_size, str, len);
+	table->offsets[table->count] = table->blob_size;
+	table->blob_size += len;
+	table->slots[slot] = table->count + 1;
+	long id = table->count++;
+
+	// keep the hash at most half full
+	if (table->count * 2 > table->slot_count && grow_slots(table) == -1)
+	{
+		return -1;
+	}
+	return id;
+}
+
+// Returns the id of the given string or -1 if it isnt in the table
+long st_find(StrTable *table, const char *str)
+{
+	size_t slot = find_str_slot(table, str, hash_str(str));
+	return (long)table->slots[slot] - 1;
+}
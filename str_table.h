@@ -0,0 +1,40 @@
+#ifndef STR_TABLE_H
+#define STR_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Interned strings stored back to back in a single blob. Each distinct string is
+// stored once and identified by the order it was added in.
+typedef struct StrTable {
+	// NUL terminated strings stored back to back
+	char *blob;
+	size_t blob_size;
+	size_t blob_capacity;
+	// offset of each string in the blob, indexed by id
+	uint64_t *offsets;
+	size_t count;
+	size_t capacity;
+	// open addressing hash of string to id + 1. 0 marks an empty slot.
+	uint32_t *slots;
+	size_t slot_count;
+} StrTable;
+
+// Creates an empty string table
+StrTable *new_str_table();
+
+void free_str_table(StrTable *table);
+
+// Adds the string to the table if it isnt already there. Returns its id or -1 for errors.
+long st_intern(StrTable *table, const char *str);
+
+// Returns the id of the given string or -1 if it isnt in the table
+long st_find(StrTable *table, const char *str);
+
+// Returns the string with the given id
+static inline const char *st_get(const StrTable *table, uint32_t id)
+{
+	return table->blob + table->offsets[id];
+}
+
+#endif
@@ -0,0 +1,635 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include <regex.h>
+
+#include "symbols.h"
+#include "demangle.h"
+#include "logger.h"
+#include "thread_pool.h"
+
+#define SYMTAB_HEADER ".symtab"
+#define DYNSYM_HEADER ".dynsym"
+
+// symbol types and bindings kept in the table
+#define STT_OBJECT 1
+#define STT_FUNC 2
+#define STT_GNU_IFUNC 10
+#define STB_LOCAL 0
+#define STB_GLOBAL 1
+#define SHN_UNDEF 0
+
+// symbols demangled by each thread before the names are interned
+#define MIN_DEMANGLES_PER_THREAD 1024
+// names matched against the pattern by each task. Each task compiles its own copy of the
+// pattern since threads sharing one serialise on its lock.
+#define NAMES_PER_SEARCH_TASK 16384
+
+// Symbols to demangle and the demangled names, NULL for names that arent mangled
+typedef struct DemangleJob {
+	const SymbolTable *table;
+	const uint32_t *pending;
+	char **results;
+} DemangleJob;
+
+// Matches a range of the demangled names against the pattern
+typedef struct SearchJob {
+	const StrTable *names;
+	const char *pattern;
+	// set for every name id that matched
+	uint8_t *matched;
+} SearchJob;
+
+// The hash function used by .gnu.hash
+static uint32_t gnu_hash(const char *name)
+{
+	uint32_t hash = 5381;
+	for (const unsigned char *c = (const unsigned char *)name; *c != '\0'; c++)
+	{
+		hash = hash * 33 + *c;
+	}
+	return hash;
+}
+
+// Returns true if the symbol names code or data at a known address
+static bool is_indexed(const ElfSymbolTable *elf_symbols, const ElfSymbol *symbol)
+{
+	uint8_t type = symbol->st_info & 0xf;
+	return (type == STT_FUNC || type == STT_OBJECT || type == STT_GNU_IFUNC) && symbol->st_shndx != SHN_UNDEF &&
+		symbol->st_value != 0 && symbol->st_name != 0 && symbol->st_name < elf_symbols->names_size;
+}
+
+// Orders by address. Symbols sharing an address put the global and then the largest first
+// so they are the ones reported for the address.
+static int compare_symbols(const void *a, const void *b)
+{
+	const Symbol *x = (const Symbol *)a;
+	const Symbol *y = (const Symbol *)b;
+	if (x->addr != y->addr)
+	{
+		return (x->addr > y->addr) - (x->addr < y->addr);
+	}
+	if ((x->bind == STB_GLOBAL) != (y->bind == STB_GLOBAL))
+	{
+		return x->bind == STB_GLOBAL ? -1 : 1;
+	}
+	return (x->size < y->size) - (x->size > y->size);
+}
+
+// Hashes every symbol by name. Where names clash global symbols win over the rest,
+// otherwise the lowest address wins.
+static int build_name_index(SymbolTable *table)
+{
+	table->slot_count = 16;
+	while (table->slot_count < table->count * 2)
+	{
+		table->slot_count *= 2;
+	}
+
+	table->slots = (uint32_t *)calloc(table->slot_count, sizeof(uint32_t));
+	if (table->slots == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for symbol index. %s", strerror(errno));
+		return -1;
+	}
+
+	size_t mask = table->slot_count - 1;
+	for (size_t i = 0; i < table->count; i++)
+	{
+		const char *name = symbol_name(table, &table->symbols[i]);
+		size_t slot = gnu_hash(name) & mask;
+		while (table->slots[slot] != 0)
+		{
+			const Symbol *existing = &table->symbols[table->slots[slot] - 1];
+			if (strcmp(symbol_name(table, existing), name) == 0)
+			{
+				break;
+			}
+			slot = (slot + 1) & mask;
+		}
+
+		if (table->slots[slot] == 0 || (table->symbols[i].bind == STB_GLOBAL && table->symbols[table->slots[slot] - 1].bind != STB_GLOBAL))
+		{
+			table->slots[slot] = (uint32_t)(i + 1);
+		}
+	}
+	return 0;
+}
+
+// Finds .symtab, or .dynsym if the executable is stripped. An executable without either
+// gets an empty table.
+static void find_elf_symbols(const ElfImage *elf, ElfSymbolTable *elf_symbols)
+{
+	// .dynsym only holds the exported symbols which .symtab already has
+	if (elf_symbol_table(elf, SYMTAB_HEADER, elf_symbols) == -1 && elf_symbol_table(elf, DYNSYM_HEADER, elf_symbols) == -1)
+	{
+		logger(DEBUG, "No symbol table found.");
+		elf_symbols->count = 0;
+		elf_symbols->names = NULL;
+		elf_symbols->names_size = 0;
+	}
+}
+
+// Allocates the demangled names, which are filled in as they are shown. Returns -1 for errors.
+static int new_display_names(SymbolTable *table)
+{
+	table->display_names = new_str_table();
+	table->display_ids = (uint32_t *)calloc(table->count + 1, sizeof(uint32_t));
+	return table->display_names == NULL || table->display_ids == NULL ? -1 : 0;
+}
+
+// Indexes the functions and variables in .symtab, or .dynsym if the executable is stripped.
+// The executable must stay mapped for as long as the table is used. Returns NULL for errors.
+SymbolTable *build_symbol_table(const ElfImage *elf)
+{
+	SymbolTable *table = (SymbolTable *)calloc(1, sizeof(SymbolTable));
+	if (table == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for symbol table. %s", strerror(errno));
+		return NULL;
+	}
+
+	ElfSymbolTable elf_symbols;
+	find_elf_symbols(elf, &elf_symbols);
+	table->names = elf_symbols.names;
+
+	table->symbols = (Symbol *)malloc((elf_symbols.count + 1) * sizeof(Symbol));
+	if (table->symbols == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for symbol table. %s", strerror(errno));
+		free(table);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < elf_symbols.count; i++)
+	{
+		const ElfSymbol *elf_symbol = &elf_symbols.symbols[i];
+		if (!is_indexed(&elf_symbols, elf_symbol))
+		{
+			continue;
+		}
+
+		Symbol *symbol = &table->symbols[table->count++];
+		symbol->addr = elf_symbol->st_value;
+		symbol->size = elf_symbol->st_size;
+		symbol->name = elf_symbol->st_name;
+		symbol->bind = elf_symbol->st_info >> 4;
+		symbol->type = elf_symbol->st_info & 0xf;
+	}
+
+	qsort(table->symbols, table->count, sizeof(Symbol), compare_symbols);
+
+	if (new_display_names(table) == -1 || build_name_index(table) == -1)
+	{
+		free_symbol_table(table);
+		return NULL;
+	}
+
+	logger(DEBUG, "Indexed %d symbols.", (int)table->count);
+	return table;
+}
+
+// Rebuilds the table from the sorted symbols and name slots of an earlier build_symbol_table
+// on the same executable, which are copied. Returns NULL for errors or if they dont fit the
+// executable.
+SymbolTable *restore_symbol_table(const ElfImage *elf, const Symbol *symbols, size_t count, const uint32_t *slots,
+	size_t slot_count)
+{
+	ElfSymbolTable elf_symbols;
+	find_elf_symbols(elf, &elf_symbols);
+
+	// every probe has to reach an empty slot and every name has to be in the string table
+	if (slot_count < 16 || (slot_count & (slot_count - 1)) != 0 || count > slot_count / 2 || count > elf_symbols.count)
+	{
+		return NULL;
+	}
+	for (size_t i = 0; i < slot_count; i++)
+	{
+		if (slots[i] > count)
+		{
+			return NULL;
+		}
+	}
+	for (size_t i = 0; i < count; i++)
+	{
+		if (symbols[i].name == 0 || symbols[i].name >= elf_symbols.names_size)
+		{
+			return NULL;
+		}
+	}
+
+	SymbolTable *table = (SymbolTable *)calloc(1, sizeof(SymbolTable));
+	if (table == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for symbol table. %s", strerror(errno));
+		return NULL;
+	}
+	table->names = elf_symbols.names;
+	table->count = count;
+	table->slot_count = slot_count;
+	table->symbols = (Symbol *)malloc((count + 1) * sizeof(Symbol));
+	table->slots = (uint32_t *)malloc(slot_count * sizeof(uint32_t));
+	if (table->symbols == NULL || table->slots == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for symbol table. %s", strerror(errno));
+		free_symbol_table(table);
+		return NULL;
+	}
+	memcpy(table->symbols, symbols, count * sizeof(Symbol));
+	memcpy(table->slots, slots, slot_count * sizeof(uint32_t));
+
+	if (new_display_names(table) == -1)
+	{
+		free_symbol_table(table);
+		return NULL;
+	}
+	return table;
+}
+
+void free_symbol_table(SymbolTable *table)
+{
+	free(table->symbols);
+	free(table->slots);
+	if (table->display_names != NULL)
+	{
+		free_str_table(table->display_names);
+	}
+	free(table->display_ids);
+	if (table->lookup_names != NULL)
+	{
+		free_str_table(table->lookup_names);
+	}
+	free(table->lookup_starts);
+	free(table->lookup_symbols);
+	free(table);
+}
+
+// Returns the symbol with the given name or NULL. Global symbols win over local ones
+// with the same name.
+const Symbol *symbol_by_name(const SymbolTable *table, const char *name)
+{
+	size_t mask = table->slot_count - 1;
+	size_t slot = gnu_hash(name) & mask;
+	while (table->slots[slot] != 0)
+	{
+		const Symbol *symbol = &table->symbols[table->slots[slot] - 1];
+		if (strcmp(symbol_name(table, symbol), name) == 0)
+		{
+			return symbol;
+		}
+		slot = (slot + 1) & mask;
+	}
+	return NULL;
+}
+
+// Returns the symbol containing the given address or NULL
+const Symbol *symbol_by_addr(const SymbolTable *table, uint64_t addr)
+{
+	// find the first symbol past the address, the one before it may contain it
+	size_t low = 0;
+	size_t high = table->count;
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+		if (table->symbols[mid].addr <= addr)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	if (low == 0)
+	{
+		return NULL;
+	}
+
+	// symbols sharing the address are ordered with the preferred one first
+	size_t idx = low - 1;
+	while (idx > 0 && table->symbols[idx - 1].addr == table->symbols[idx].addr)
+	{
+		idx--;
+	}
+
+	const Symbol *symbol = &table->symbols[idx];
+	if (addr < symbol->addr + symbol->size || addr == symbol->addr)
+	{
+		return symbol;
+	}
+	return NULL;
+}
+
+// Remembers the demangled name of the symbol. The plain name is kept for names that
+// arent mangled. Returns -1 for errors.
+static int set_display_name(SymbolTable *table, size_t idx, const char *demangled)
+{
+	const char *name = demangled != NULL ? demangled : symbol_name(table, &table->symbols[idx]);
+	long id = st_intern(table->display_names, name);
+	if (id == -1)
+	{
+		return -1;
+	}
+	table->display_ids[idx] = (uint32_t)(id + 1);
+	return 0;
+}
+
+// Returns the demangled name of the symbol, demangling it if it hasnt been already.
+// Returns NULL for errors.
+const char *symbol_display_name(SymbolTable *table, const Symbol *symbol)
+{
+	size_t idx = symbol - table->symbols;
+	if (table->display_ids[idx] == 0)
+	{
+		char *demangled = demangle(symbol_name(table, symbol));
+		int err = set_display_name(table, idx, demangled);
+		free(demangled);
+		if (err == -1)
+		{
+			return NULL;
+		}
+	}
+	return st_get(table->display_names, table->display_ids[idx] - 1);
+}
+
+static void demangle_symbol(void *ctx, size_t item)
+{
+	DemangleJob *job = (DemangleJob *)ctx;
+	const Symbol *symbol = &job->table->symbols[job->pending[item]];
+	job->results[item] = demangle(symbol_name(job->table, symbol));
+}
+
+// Demangles every symbol that hasnt been already. The demangling runs across threads and
+// the names are interned afterwards on this one. Returns -1 for errors.
+static int demangle_all(SymbolTable *table)
+{
+	size_t pending_count = 0;
+	for (size_t i = 0; i < table->count; i++)
+	{
+		pending_count += table->display_ids[i] == 0;
+	}
+	if (pending_count == 0)
+	{
+		return 0;
+	}
+
+	uint32_t *pending = (uint32_t *)malloc(pending_count * sizeof(uint32_t));
+	char **results = (char **)calloc(pending_count, sizeof(char *));
+	if (pending == NULL || results == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for demangled names. %s", strerror(errno));
+		free(pending);
+		free(results);
+		return -1;
+	}
+
+	size_t n = 0;
+	for (size_t i = 0; i < table->count; i++)
+	{
+		if (table->display_ids[i] == 0)
+		{
+			pending[n++] = (uint32_t)i;
+		}
+	}
+
+	DemangleJob job = {table, pending, results};
+	run_parallel(pending_count, MIN_DEMANGLES_PER_THREAD, demangle_symbol, &job);
+
+	int err = 0;
+	for (size_t i = 0; i < pending_count; i++)
+	{
+		if (err == 0 && set_display_name(table, pending[i], results[i]) == -1)
+		{
+			err = -1;
+		}
+		free(results[i]);
+	}
+
+	free(pending);
+	free(results);
+	return err;
+}
+
+// Returns the length of the demangled name without its parameter list and any qualifiers
+// after it. The list is the last bracketed part, as earlier ones can be part of the name
+// like in (anonymous namespace)::f(int) or a::operator()(int).
+static size_t base_name_len(const char *name)
+{
+	size_t len = strlen(name);
+	const char *close = strrchr(name, ')');
+	if (close == NULL)
+	{
+		return len;
+	}
+
+	int depth = 0;
+	for (const char *c = close; c >= name; c--)
+	{
+		if (*c == ')')
+		{
+			depth++;
+		}
+		else if (*c == '(' && --depth == 0)
+		{
+			// a name that is all brackets has no parameter list
+			return c == name ? len : (size_t)(c - name);
+		}
+	}
+	return len;
+}
+
+// Adds the symbol under the name to the pairs the lookup index is built from. Returns -1 for
+// errors.
+static int add_lookup_name(SymbolTable *table, const char *name, size_t len, uint32_t idx, uint32_t *ids,
+	uint32_t *idxs, size_t *pair_count)
+{
+	char *copy = strndup(name, len);
+	long id = copy != NULL ? st_intern(table->lookup_names, copy) : -1;
+	free(copy);
+	if (id == -1)
+	{
+		logger(ERROR, "Failed to index the demangled name %s.", (char *)name);
+		return -1;
+	}
+	ids[*pair_count] = (uint32_t)id;
+	idxs[(*pair_count)++] = idx;
+	return 0;
+}
+
+// Indexes every symbol by its demangled name and by that name without its parameter list.
+// Clones such as f(int) [clone .cold] are only found by their full name so a::b doesnt break
+// in them. Returns -1 for errors.
+static int build_lookup_index(SymbolTable *table)
+{
+	if (demangle_all(table) == -1)
+	{
+		return -1;
+	}
+
+	table->lookup_names = new_str_table();
+	uint32_t *ids = (uint32_t *)malloc((2 * table->count + 1) * sizeof(uint32_t));
+	uint32_t *idxs = (uint32_t *)malloc((2 * table->count + 1) * sizeof(uint32_t));
+	if (table->lookup_names == NULL || ids == NULL || idxs == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for the demangled name index. %s", strerror(errno));
+		free(ids);
+		free(idxs);
+		return -1;
+	}
+
+	int res = 0;
+	size_t pair_count = 0;
+	for (size_t i = 0; i < table->count && res == 0; i++)
+	{
+		const char *name = st_get(table->display_names, table->display_ids[i] - 1);
+		size_t len = strlen(name);
+		size_t base_len = base_name_len(name);
+		res = add_lookup_name(table, name, len, (uint32_t)i, ids, idxs, &pair_count);
+		if (res == 0 && base_len != len && strstr(name, " [clone ") == NULL)
+		{
+			res = add_lookup_name(table, name, base_len, (uint32_t)i, ids, idxs, &pair_count);
+		}
+	}
+
+	// the pairs are grouped by name with a counting sort, keeping address order within a name
+	size_t name_count = table->lookup_names->count;
+	table->lookup_starts = res == 0 ? (uint32_t *)calloc(name_count + 2, sizeof(uint32_t)) : NULL;
+	table->lookup_symbols = res == 0 ? (uint32_t *)malloc((pair_count + 1) * sizeof(uint32_t)) : NULL;
+	if (res == 0 && (table->lookup_starts == NULL || table->lookup_symbols == NULL))
+	{
+		logger(ERROR, "Failed to allocate heap memory for the demangled name index. %s", strerror(errno));
+		res = -1;
+	}
+
+	if (res == 0)
+	{
+		for (size_t i = 0; i < pair_count; i++)
+		{
+			table->lookup_starts[ids[i] + 2]++;
+		}
+		for (size_t id = 0; id < name_count; id++)
+		{
+			table->lookup_starts[id + 2] += table->lookup_starts[id + 1];
+		}
+		// lookup_starts[id + 1] is where the next symbol with name id goes, it ends up as the
+		// end of the name's symbols
+		for (size_t i = 0; i < pair_count; i++)
+		{
+			table->lookup_symbols[table->lookup_starts[ids[i] + 1]++] = idxs[i];
+		}
+	}
+
+	free(ids);
+	free(idxs);
+	if (res == -1)
+	{
+		free_str_table(table->lookup_names);
+		free(table->lookup_starts);
+		free(table->lookup_symbols);
+		table->lookup_names = NULL;
+		table->lookup_starts = NULL;
+		table->lookup_symbols = NULL;
+	}
+	return res;
+}
+
+// Finds the addresses of the symbols with the given demangled name, such as a::b(int), or
+// the name without its parameter list, such as a::b, which finds every overload. Returns the
+// number of addresses found, at most max_addrs, or -1 for errors.
+long lookup_display_name(SymbolTable *table, const char *name, uint64_t *addrs, size_t max_addrs)
+{
+	if (table->lookup_names == NULL && build_lookup_index(table) == -1)
+	{
+		return -1;
+	}
+
+	long id = st_find(table->lookup_names, name);
+	if (id == -1)
+	{
+		return 0;
+	}
+
+	// aliases such as the complete and base object constructors share an address
+	size_t count = 0;
+	for (uint32_t i = table->lookup_starts[id]; i < table->lookup_starts[id + 1] && count < max_addrs; i++)
+	{
+		uint64_t addr = table->symbols[table->lookup_symbols[i]].addr;
+		if (count == 0 || addrs[count - 1] != addr)
+		{
+			addrs[count++] = addr;
+		}
+	}
+	return (long)count;
+}
+
+static void search_names(void *ctx, size_t item)
+{
+	SearchJob *job = (SearchJob *)ctx;
+	regex_t regex;
+	// the pattern already compiled on the calling thread so this cant fail
+	if (regcomp(&regex, job->pattern, REG_EXTENDED | REG_NOSUB) != 0)
+	{
+		return;
+	}
+
+	size_t end = (item + 1) * NAMES_PER_SEARCH_TASK;
+	end = end < job->names->count ? end : job->names->count;
+	for (size_t id = item * NAMES_PER_SEARCH_TASK; id < end; id++)
+	{
+		job->matched[id] = regexec(&regex, st_get(job->names, id), 0, NULL, 0) == 0;
+	}
+	regfree(&regex);
+}
+
+// Finds the functions whose demangled name matches the extended regular expression.
+// The indexes of the matching symbols are returned in address order in a heap allocated
+// array the caller frees. Returns the number of matches or -1 for errors.
+long search_functions(SymbolTable *table, const char *pattern, size_t **matches)
+{
+	regex_t regex;
+	int err = regcomp(&regex, pattern, REG_EXTENDED | REG_NOSUB);
+	if (err != 0)
+	{
+		char msg[256];
+		regerror(err, &regex, msg, sizeof(msg));
+		logger(ERROR, "Invalid pattern %s. %s", (char *)pattern, msg);
+		return -1;
+	}
+	regfree(&regex);
+
+	if (demangle_all(table) == -1)
+	{
+		return -1;
+	}
+
+	// each distinct name is matched once however many symbols share it
+	size_t name_count = table->display_names->count;
+	uint8_t *matched = (uint8_t *)calloc(name_count + 1, sizeof(uint8_t));
+	*matches = (size_t *)malloc((table->count + 1) * sizeof(size_t));
+	if (matched == NULL || *matches == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for symbol search. %s", strerror(errno));
+		free(matched);
+		free(*matches);
+		*matches = NULL;
+		return -1;
+	}
+
+	SearchJob job = {table->display_names, pattern, matched};
+	run_parallel((name_count + NAMES_PER_SEARCH_TASK - 1) / NAMES_PER_SEARCH_TASK, 1, search_names, &job);
+
+	long count = 0;
+	for (size_t i = 0; i < table->count; i++)
+	{
+		uint8_t type = table->symbols[i].type;
+		if ((type == STT_FUNC || type == STT_GNU_IFUNC) && matched[table->display_ids[i] - 1])
+		{
+			(*matches)[count++] = i;
+		}
+	}
+
+	free(matched);
+	return count;
+}
@@ -0,0 +1,85 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "elf_image.h"
+#include "str_table.h"
+
+// A function or variable from the ELF symbol table
+typedef struct Symbol {
+	uint64_t addr;
+	uint64_t size;
+	// offset of the name in the table's names
+	uint32_t name;
+	// global, local or weak binding from the ELF symbol
+	uint8_t bind;
+	// function, object or indirect function from the ELF symbol
+	uint8_t type;
+} Symbol;
+
+// The symbols of an executable sorted by address so an address is found with a binary
+// search, and hashed by name so a name is found in constant time. The names are read
+// straight from the mapped executable. Names are demangled the first time they are
+// shown and kept so each is only demangled once.
+typedef struct SymbolTable {
+	Symbol *symbols;
+	size_t count;
+	const char *names;
+	// open addressing hash of name to symbol index + 1. 0 marks an empty slot.
+	uint32_t *slots;
+	// always a power of two
+	size_t slot_count;
+	// demangled names, or the plain name for C symbols, back to back so they can be searched
+	StrTable *display_names;
+	// id + 1 of each symbol's name in display_names. 0 if it hasnt been demangled yet.
+	uint32_t *display_ids;
+	// demangled names, and the same names without their parameter lists such as a::b, that
+	// symbols can be looked up by. Built the first time a name isnt found as it is.
+	StrTable *lookup_names;
+	// the symbols with lookup name id are lookup_symbols[lookup_starts[id]] up to
+	// lookup_symbols[lookup_starts[id + 1]]
+	uint32_t *lookup_starts;
+	uint32_t *lookup_symbols;
+} SymbolTable;
+
+// Indexes the functions and variables in .symtab, or .dynsym if the executable is stripped.
+// The executable must stay mapped for as long as the table is used. Returns NULL for errors.
+SymbolTable *build_symbol_table(const ElfImage *elf);
+
+// Rebuilds the table from the sorted symbols and name slots of an earlier build_symbol_table
+// on the same executable, which are copied. Returns NULL for errors or if they dont fit the
+// executable.
+SymbolTable *restore_symbol_table(const ElfImage *elf, const Symbol *symbols, size_t count, const uint32_t *slots,
+	size_t slot_count);
+
+void free_symbol_table(SymbolTable *table);
+
+// Returns the symbol with the given name or NULL. Global symbols win over local ones
+// with the same name.
+const Symbol *symbol_by_name(const SymbolTable *table, const char *name);
+
+// Finds the addresses of the symbols with the given demangled name, such as a::b(int), or
+// the name without its parameter list, such as a::b, which finds every overload. Returns the
+// number of addresses found, at most max_addrs, or -1 for errors.
+long lookup_display_name(SymbolTable *table, const char *name, uint64_t *addrs, size_t max_addrs);
+
+// Returns the symbol containing the given address or NULL
+const Symbol *symbol_by_addr(const SymbolTable *table, uint64_t addr);
+
+// Returns the demangled name of the symbol, demangling it if it hasnt been already.
+// Returns NULL for errors.
+const char *symbol_display_name(SymbolTable *table, const Symbol *symbol);
+
+// Finds the functions whose demangled name matches the extended regular expression.
+// The indexes of the matching symbols are returned in address order in a heap allocated
+// array the caller frees. Returns the number of matches or -1 for errors.
+long search_functions(SymbolTable *table, const char *pattern, size_t **matches);
+
+static inline const char *symbol_name(const SymbolTable *table, const Symbol *symbol)
+{
+	return table->names + symbol->name;
+}
+
+#endif
@@ -0,0 +1,65 @@
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+#include "logger.h"
+
+#define MAX_THREADS 64
+
+typedef struct WorkQueue {
+	size_t count;
+	// next item to claim
+	size_t next;
+	WorkFn work;
+	void *ctx;
+} WorkQueue;
+
+static void *work_loop(void *arg)
+{
+	WorkQueue *queue = (WorkQueue *)arg;
+	size_t item;
+	while ((item = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) < queue->count)
+	{
+		queue->work(queue->ctx, item);
+	}
+	return NULL;
+}
+
+void run_parallel(size_t count, size_t min_items_per_thread, WorkFn work, void *ctx)
+{
+	WorkQueue queue = {.count = count, .next = 0, .work = work, .ctx = ctx};
+
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t thread_count = cores > 0 ? (size_t)cores : 1;
+	if (min_items_per_thread > 0 && count / min_items_per_thread < thread_count)
+	{
+		thread_count = count / min_items_per_thread;
+	}
+	if (thread_count > MAX_THREADS)
+	{
+		thread_count = MAX_THREADS;
+	}
+
+	// the calling thread is one of the workers
+	pthread_t threads[MAX_THREADS];
+	size_t started = 0;
+	for (size_t i = 1; i < thread_count; i++)
+	{
+		int res = pthread_create(&threads[started], NULL, work_loop, &queue);
+		if (res != 0)
+		{
+			// whatever is left is picked up by the threads we did start
+			logger(WARN, "Failed to start worker thread. %s", strerror(res));
+			break;
+		}
+		started++;
+	}
+
+	work_loop(&queue);
+
+	for (size_t i = 0; i < started; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+}
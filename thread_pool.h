@@ -0,0 +1,15 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+// Called once for every item with the context given to run_parallel
+typedef void (*WorkFn)(void *ctx, size_t item);
+
+// Runs work for every item below count across one thread per online core. Workers
+// claim items one at a time so items of uneven cost still balance out. The calling
+// thread works too and returns once every item is done. Small counts run on the
+// calling thread alone.
+void run_parallel(size_t count, size_t min_items_per_thread, WorkFn work, void *ctx);
+
+#endif
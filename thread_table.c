@@ -0,0 +1,111 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "thread_table.h"
+#include "logger.h"
+
+#define INITIAL_THREAD_CAPACITY 8
+
+// Creates an empty thread table
+ThreadTable *new_thread_table()
+{
+	ThreadTable *table = calloc(1, sizeof(ThreadTable));
+	if (table == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for threads. %s", strerror(errno));
+		return NULL;
+	}
+
+	table->by_tid = new_addr_map();
+	if (table->by_tid == NULL)
+	{
+		free(table);
+		return NULL;
+	}
+	return table;
+}
+
+void free_thread_table(ThreadTable *table)
+{
+	for (size_t i = 0; i < table->count; i++)
+	{
+		free(table->threads[i]);
+	}
+	free(table->threads);
+	free_addr_map(table->by_tid);
+	free(table);
+}
+
+// Adds a thread with the given tid in the given state. Returns the thread, the existing one
+// if the tid is already known, or NULL for errors.
+TraceeThread *thread_add(ThreadTable *table, int tid, ThreadState state)
+{
+	TraceeThread *thread = thread_find(table, tid);
+	if (thread != NULL)
+	{
+		return thread;
+	}
+
+	if (table->count == table->capacity)
+	{
+		size_t capacity = table->capacity == 0 ? INITIAL_THREAD_CAPACITY : table->capacity * 2;
+		TraceeThread **threads = realloc(table->threads, capacity * sizeof(TraceeThread *));
+		if (threads == NULL)
+		{
+			logger(ERROR, "Failed to allocate heap memory for threads. %s", strerror(errno));
+			return NULL;
+		}
+		table->threads = threads;
+		table->capacity = capacity;
+	}
+
+	// threads are allocated one by one so the register cache of the current one stays put
+	thread = calloc(1, sizeof(TraceeThread));
+	if (thread == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for thread %d. %s", tid, strerror(errno));
+		return NULL;
+	}
+	thread->tid = tid;
+	thread->state = state;
+	thread->needs_setup = true;
+	init_reg_cache(&thread->regs, tid);
+
+	if (am_set(table->by_tid, (uint64_t)tid, thread) == -1)
+	{
+		free(thread);
+		return NULL;
+	}
+	table->threads[table->count++] = thread;
+	return thread;
+}
+
+// Returns the thread with the given tid or NULL if it isnt known
+TraceeThread *thread_find(ThreadTable *table, int tid)
+{
+	return am_get(table->by_tid, (uint64_t)tid);
+}
+
+// Forgets the thread with the given tid
+void thread_remove(ThreadTable *table, int tid)
+{
+	TraceeThread *thread = thread_find(table, tid);
+	if (thread == NULL)
+	{
+		return;
+	}
+
+	am_remove(table->by_tid, (uint64_t)tid);
+	for (size_t i = 0; i < table->count; i++)
+	{
+		if (table->threads[i] == thread)
+		{
+			// keeps the main thread first
+			memmove(&table->threads[i], &table->threads[i + 1], (table->count - i - 1) * sizeof(TraceeThread *));
+			table->count--;
+			break;
+		}
+	}
+	free(thread);
+}
@@ -0,0 +1,73 @@
+#ifndef THREAD_TABLE_H
+#define THREAD_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "addr_map.h"
+#include "reg.h"
+
+typedef enum ThreadState {
+	THREAD_RUNNING,
+	THREAD_STOPPED,
+	// created by a clone the debugger has seen but hasnt stopped for the first time yet
+	THREAD_STARTING,
+	// exited while it was the current thread, forgotten once another thread is current
+	THREAD_EXITED,
+} ThreadState;
+
+// A thread of the tracee and what the debugger knows about it
+typedef struct TraceeThread {
+	int tid;
+	ThreadState state;
+	// wait status of the thread's latest stop
+	int status;
+	// set if that stop hasnt been handled yet as it came while the thread was being halted
+	// or another thread was being waited for. The thread stays stopped until it is handled.
+	bool status_pending;
+	// registers of the thread at its current stop
+	RegCache regs;
+	// signal delivered to the thread when it is next continued, 0 if there isnt one
+	int pending_signal;
+	// resumed for a single step, which a stop the debugger handles itself resumes again
+	bool stepping;
+	// interrupted and its stop not seen yet
+	bool halting;
+	// stopped only so the debugger could do something that needs every thread stopped, it
+	// is resumed once that is done
+	bool halted;
+	// created since the debugger last set up threads, its debug registers still need
+	// programming as threads dont inherit them
+	bool needs_setup;
+	// address of the breakpoint the thread reported stopping at, which it steps over rather
+	// than trapping on again when resumed. 0 if there isnt one.
+	uint64_t reported_bp;
+} TraceeThread;
+
+// The known threads of the tracee
+typedef struct ThreadTable {
+	// in the order they were seen, the main thread first
+	TraceeThread **threads;
+	size_t count;
+	size_t capacity;
+	// tid to thread
+	AddrMap *by_tid;
+} ThreadTable;
+
+// Creates an empty thread table
+ThreadTable *new_thread_table();
+
+void free_thread_table(ThreadTable *table);
+
+// Adds a thread with the given tid in the given state. Returns the thread, the existing one
+// if the tid is already known, or NULL for errors.
+TraceeThread *thread_add(ThreadTable *table, int tid, ThreadState state);
+
+// Returns the thread with the given tid or NULL if it isnt known
+TraceeThread *thread_find(ThreadTable *table, int tid);
+
+// Forgets the thread with the given tid
+void thread_remove(ThreadTable *table, int tid);
+
+#endif
@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "trace.h"
+#include "logger.h"
+#include "session.h"
+
+// most bytes of memory a single item can collect
+#define MAX_TRACE_MEM 4096
+#define INITIAL_SPECS 8
+// bytes of collected memory shown per line of a dump
+#define BYTES_PER_DUMP_LINE 16
+
+// Creates a log with a ring buffer of the given size allocated up front
+TraceLog *new_trace_log(size_t capacity)
+{
+	TraceLog *log = (TraceLog *)calloc(1, sizeof(TraceLog));
+	if (log == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for trace log. %s", strerror(errno));
+		return NULL;
+	}
+
+	log->data = (uint8_t *)malloc(capacity);
+	if (log->data == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for trace log. %s", strerror(errno));
+		free(log);
+		return NULL;
+	}
+	log->capacity = capacity;
+	return log;
+}
+
+void free_trace_log(TraceLog *log)
+{
+	free(log->data);
+	free(log->specs);
+	free(log);
+}
+
+// Parses one item to collect. Returns -1 for errors.
+static int parse_item(const char *text, TraceItem *item, struct DebugSession *session)
+{
+	memset(item, 0, sizeof(TraceItem));
+	snprintf(item->label, MAX_TRACE_LABEL, "%s", text);
+
+	char name[MAX_TRACE_LABEL];
+	snprintf(name, MAX_TRACE_LABEL, "%s", text);
+	char *len_str = strchr(name, ':');
+	if (len_str != NULL)
+	{
+		*len_str++ = '\0';
+		item->len = (uint32_t)strtoul(len_str, NULL, 0);
+		if (item->len == 0 || item->len > MAX_TRACE_MEM)
+		{
+			logger(WARN, "Trace lengths must be between 1 and %d bytes.", MAX_TRACE_MEM);
+			return -1;
+		}
+	}
+
+	if (name[0] == '$')
+	{
+		if (find_reg_by_name(name + 1, &item->reg) == -1)
+		{
+			logger(WARN, "Unknown register %s.", name);
+			return -1;
+		}
+		item->kind = len_str != NULL ? TRACE_REG_MEM : TRACE_REG;
+		item->len = len_str != NULL ? item->len : sizeof(uint64_t);
+		return 0;
+	}
+
+	item->kind = TRACE_MEM;
+	if (isdigit((unsigned char)name[0]))
+	{
+		if (len_str == NULL)
+		{
+			logger(WARN, "Give a length for address %s.", name);
+			return -1;
+		}
+		item->addr = strtoull(name, NULL, 0);
+		return 0;
+	}
+
+	SymbolTable *symbols = get_symbols(session);
+	const Symbol *symbol = symbols != NULL ? symbol_by_name(symbols, name) : NULL;
+	if (symbol == NULL)
+	{
+		logger(WARN, "No symbol named %s.", name);
+		return -1;
+	}
+
+	item->addr = symbol->addr;
+	item->relocated = true;
+	if (len_str == NULL)
+	{
+		item->len = symbol->size > MAX_TRACE_MEM ? MAX_TRACE_MEM : (uint32_t)symbol->size;
+	}
+	if (item->len == 0)
+	{
+		logger(WARN, "Give a length for %s.", name);
+		return -1;
+	}
+	return 0;
+}
+
+// Parses a whitespace separated list of things to collect: registers ($rdi), the memory a
+// register points to ($rdi:16), globals (name or name:len) and fixed addresses (0x1000:8).
+// Returns the index of the new spec or -1 for errors.
+long trace_add_spec(TraceLog *log, const char *items, uint32_t bp_id, uint64_t addr, struct DebugSession *session)
+{
+	TraceSpec spec = {.bp_id = bp_id, .addr = addr, .item_count = 0, .record_size = sizeof(TraceRecord)};
+
+	const char *pos = items;
+	while (*pos != '\0')
+	{
+		while (isspace((unsigned char)*pos) || *pos == ',')
+		{
+			pos++;
+		}
+		size_t len = strcspn(pos, " \t\n,");
+		if (len == 0)
+		{
+			break;
+		}
+
+		if (spec.item_count == MAX_TRACE_ITEMS || len >= MAX_TRACE_LABEL)
+		{
+			logger(WARN, "Tracepoints collect at most %d items of up to %d characters.", MAX_TRACE_ITEMS, MAX_TRACE_LABEL - 1);
+			return -1;
+		}
+
+		char text[MAX_TRACE_LABEL];
+		memcpy(text, pos, len);
+		text[len] = '\0';
+		pos += len;
+
+		TraceItem *item = &spec.items[spec.item_count];
+		if (parse_item(text, item, session) == -1)
+		{
+			return -1;
+		}
+		spec.item_count++;
+		spec.record_size += item->len;
+	}
+
+	// keep the records aligned
+	spec.record_size = (spec.record_size + 7) & ~(size_t)7;
+	if (spec.record_size > log->capacity)
+	{
+		logger(WARN, "Tracepoint records wont fit in the trace buffer.");
+		return -1;
+	}
+
+	if (log->spec_count == log->spec_capacity)
+	{
+		size_t capacity = log->spec_capacity == 0 ? INITIAL_SPECS : log->spec_capacity * 2;
+		TraceSpec *specs = (TraceSpec *)realloc(log->specs, capacity * sizeof(TraceSpec));
+		if (specs == NULL)
+		{
+			logger(ERROR, "Failed to allocate heap memory for tracepoints. %s", strerror(errno));
+			return -1;
+		}
+		log->specs = specs;
+		log->spec_capacity = capacity;
+	}
+
+	log->specs[log->spec_count] = spec;
+	return (long)log->spec_count++;
+}
+
+// Drops the oldest record
+static void drop_oldest(TraceLog *log)
+{
+	const TraceRecord *record = (const TraceRecord *)(log->data + log->tail);
+	log->tail += record->size;
+	log->count--;
+	log->dropped++;
+
+	if (log->wrapped && log->tail == log->wrap_at)
+	{
+		log->tail = 0;
+		log->wrapped = false;
+	}
+}
+
+// Makes room for a record of the given size, dropping the oldest records if needed. Returns
+// where the record goes.
+static uint8_t *reserve_record(TraceLog *log, size_t size)
+{
+	while (true)
+	{
+		if (log->count == 0)
+		{
+			log->head = 0;
+			log->tail = 0;
+			log->wrapped = false;
+		}
+
+		if (!log->wrapped)
+		{
+			if (log->capacity - log->head >= size)
+			{
+				break;
+			}
+			// carry on from the start of the buffer if the oldest records have moved out of the way
+			if (log->tail >= size)
+			{
+				log->wrap_at = log->head;
+				log->head = 0;
+				log->wrapped = true;
+				break;
+			}
+		}
+		else if (log->tail - log->head >= size)
+		{
+			break;
+		}
+		drop_oldest(log);
+	}
+
+	uint8_t *record = log->data + log->head;
+	log->head += size;
+	log->count++;
+	return record;
+}
+
+// Appends a record of the given spec's items as they are at the tracee's current stop.
+// Returns -1 for errors.
+int trace_capture(TraceLog *log, uint32_t spec_idx, RegCache *regs, TraceeMem *mem, uint64_t load_bias, uint64_t time_ns, uint64_t hit)
+{
+	const TraceSpec *spec = &log->specs[spec_idx];
+	uint8_t *record = reserve_record(log, spec->record_size);
+
+	TraceRecord *header = (TraceRecord *)record;
+	header->size = (uint32_t)spec->record_size;
+	header->spec = spec_idx;
+	header->time_ns = time_ns;
+	header->hit = hit;
+	header->flags = 0;
+	header->reserved = 0;
+
+	// memory is read straight into the record with one batched read
+	MemRange ranges[MAX_TRACE_ITEMS];
+	int range_count = 0;
+	uint8_t *payload = record + sizeof(TraceRecord);
+	for (size_t i = 0; i < spec->item_count; i++)
+	{
+		const TraceItem *item = &spec->items[i];
+		if (item->kind == TRACE_MEM)
+		{
+			ranges[range_count++] = (MemRange){item->addr + (item->relocated ? load_bias : 0), payload, item->len};
+		}
+		else
+		{
+			unsigned long long *reg = get_register(regs, item->reg);
+			if (reg == NULL)
+			{
+				return -1;
+			}
+
+			if (item->kind == TRACE_REG)
+			{
+				memcpy(payload, reg, sizeof(uint64_t));
+			}
+			else
+			{
+				ranges[range_count++] = (MemRange){*reg, payload, item->len};
+			}
+		}
+		payload += item->len;
+	}
+
+	if (range_count > 0 && read_memory_v(mem, ranges, range_count) == -1)
+	{
+		header->flags |= TRACE_MEM_FAILED;
+		for (int i = 0; i < range_count; i++)
+		{
+			memset(ranges[i].buf, 0, ranges[i].len);
+		}
+	}
+	return 0;
+}
+
+// Appends a record written elsewhere, such as by the agent in the tracee, stamped with the
+// given time. Returns -1 if it doesnt match its spec.
+int trace_append(TraceLog *log, const TraceRecord *record, uint64_t time_ns)
+{
+	if (record->spec >= log->spec_count || record->size != log->specs[record->spec].record_size)
+	{
+		logger(ERROR, "Trace record for unknown tracepoint %d.", (int)record->spec);
+		return -1;
+	}
+
+	TraceRecord *copy = (TraceRecord *)reserve_record(log, record->size);
+	memcpy(copy, record, record->size);
+	copy->time_ns = time_ns;
+	return 0;
+}
+
+// Prints one record
+static void dump_record(const TraceLog *log, const TraceRecord *record, uint64_t start_ns)
+{
+	const TraceSpec *spec = &log->specs[record->spec];
+	uint64_t rel_ns = record->time_ns - start_ns;
+	printf("[%6llu.%06llu] tp%u %016lx hit %llu%s\n", (unsigned long long)(rel_ns / 1000000000ull),
+		(unsigned long long)(rel_ns / 1000 % 1000000), spec->bp_id, (unsigned long)spec->addr,
+		(unsigned long long)record->hit, record->flags & TRACE_MEM_FAILED ? " (unreadable memory zeroed)" : "");
+
+	const uint8_t *payload = (const uint8_t *)record + sizeof(TraceRecord);
+	for (size_t i = 0; i < spec->item_count; i++)
+	{
+		const TraceItem *item = &spec->items[i];
+		if (item->kind == TRACE_REG)
+		{
+			uint64_t val;
+			memcpy(&val, payload, sizeof(uint64_t));
+			printf("    %s = 0x%lx\n", item->label, (unsigned long)val);
+		}
+		else
+		{
+			printf("    %s =", item->label);
+			for (uint32_t j = 0; j < item->len; j++)
+			{
+				if (j > 0 && j % BYTES_PER_DUMP_LINE == 0)
+				{
+					printf("\n     ");
+				}
+				printf(" %02x", payload[j]);
+			}
+			printf("\n");
+		}
+		payload += item->len;
+	}
+}
+
+// Prints the newest last records, or all of them if last is 0
+void trace_dump(const TraceLog *log, size_t last)
+{
+	if (log->dropped > 0)
+	{
+		printf("%llu older records were dropped from the full buffer.\n", (unsigned long long)log->dropped);
+	}
+
+	size_t skip = last != 0 && last < log->count ? log->count - last : 0;
+	uint64_t start_ns = log->count > 0 ? ((const TraceRecord *)(log->data + log->tail))->time_ns : 0;
+
+	size_t offset = log->tail;
+	for (size_t i = 0; i < log->count; i++)
+	{
+		if (log->wrapped && offset == log->wrap_at)
+		{
+			offset = 0;
+		}
+
+		const TraceRecord *record = (const TraceRecord *)(log->data + offset);
+		if (i >= skip)
+		{
+			dump_record(log, record, start_ns);
+		}
+		offset += record->size;
+	}
+}
@@ -0,0 +1,103 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mem.h"
+#include "reg.h"
+
+#define MAX_TRACE_ITEMS 16
+#define MAX_TRACE_LABEL 32
+
+typedef enum TraceItemKind {
+	// the value of a register
+	TRACE_REG,
+	// len bytes at a fixed address
+	TRACE_MEM,
+	// len bytes at the address held in a register
+	TRACE_REG_MEM,
+} TraceItemKind;
+
+// record flag set when a memory item couldnt be read and was left zeroed
+#define TRACE_MEM_FAILED 0x1
+
+// Precedes the collected items in every record. The agent in the tracee writes records in
+// this format too.
+typedef struct TraceRecord {
+	uint32_t size;
+	uint32_t spec;
+	uint64_t time_ns;
+	uint64_t hit;
+	uint32_t flags;
+	uint32_t reserved;
+} TraceRecord;
+
+// Something a tracepoint collects on every hit
+typedef struct TraceItem {
+	uint8_t kind;
+	Reg reg;
+	uint64_t addr;
+	// the address is from the symbol table and moves with the load bias
+	bool relocated;
+	uint32_t len;
+	// the item as the user wrote it
+	char label[MAX_TRACE_LABEL];
+} TraceItem;
+
+// What a tracepoint collects. Specs are kept until the log is freed so records of removed
+// tracepoints can still be decoded.
+typedef struct TraceSpec {
+	uint32_t bp_id;
+	uint64_t addr;
+	TraceItem items[MAX_TRACE_ITEMS];
+	size_t item_count;
+	// bytes in each record including the header
+	size_t record_size;
+} TraceSpec;
+
+// Binary records of tracepoint hits kept in a fixed size ring buffer, the oldest records are
+// dropped once it is full. Records are never split across the end of the buffer so they can
+// be written and decoded in place.
+typedef struct TraceLog {
+	uint8_t *data;
+	size_t capacity;
+	// offset the next record is written at and of the oldest record
+	size_t head;
+	size_t tail;
+	// set once the writer has wrapped round behind the oldest record, the records then run
+	// from tail to wrap_at and from the start of the buffer to head
+	bool wrapped;
+	size_t wrap_at;
+	size_t count;
+	uint64_t dropped;
+	TraceSpec *specs;
+	size_t spec_count;
+	size_t spec_capacity;
+} TraceLog;
+
+struct DebugSession;
+
+// Creates a log with a ring buffer of the given size allocated up front
+TraceLog *new_trace_log(size_t capacity);
+
+void free_trace_log(TraceLog *log);
+
+// Parses a whitespace separated list of things to collect: registers ($rdi), the memory a
+// register points to ($rdi:16), globals (name or name:len) and fixed addresses (0x1000:8).
+// Returns the index of the new spec or -1 for errors.
+long trace_add_spec(TraceLog *log, const char *items, uint32_t bp_id, uint64_t addr, struct DebugSession *session);
+
+// Appends a record of the given spec's items as they are at the tracee's current stop.
+// Returns -1 for errors.
+int trace_capture(TraceLog *log, uint32_t spec_idx, RegCache *regs, TraceeMem *mem, uint64_t load_bias, uint64_t time_ns, uint64_t hit);
+
+// Appends a record written elsewhere, such as by the agent in the tracee, stamped with the
+// given time. Returns -1 if it doesnt match its spec.
+int trace_append(TraceLog *log, const TraceRecord *record, uint64_t time_ns);
+
+// Prints the newest last records, or all of them if last is 0
+void trace_dump(const TraceLog *log, size_t last);
+
+#endif
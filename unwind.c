@@ -0,0 +1,1439 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/ucontext.h>
+
+#include "logger.h"
+#include "unwind.h"
+
+#define MAPS_PATH_SIZE 32
+#define MAPS_LINE_SIZE 512
+#define MAP_FILE_PATH_SIZE 80
+#define DELETED_SUFFIX " (deleted)"
+#define SECTION_FLAG_EXEC 0x4
+
+// DWARF numbers of the registers with a part in unwinding
+#define DW_RBP 6
+#define DW_RSP 7
+#define DW_RA 16
+
+// how pointers in .eh_frame and .eh_frame_hdr are encoded
+#define DW_EH_PE_ABSPTR 0x00
+#define DW_EH_PE_ULEB128 0x01
+#define DW_EH_PE_UDATA2 0x02
+#define DW_EH_PE_UDATA4 0x03
+#define DW_EH_PE_UDATA8 0x04
+#define DW_EH_PE_SLEB128 0x09
+#define DW_EH_PE_SDATA2 0x0a
+#define DW_EH_PE_SDATA4 0x0b
+#define DW_EH_PE_SDATA8 0x0c
+#define DW_EH_PE_PCREL 0x10
+#define DW_EH_PE_DATAREL 0x30
+#define DW_EH_PE_OMIT 0xff
+// the search table encoding linkers write, which can be read straight from the file
+#define HDR_TABLE_ENC (DW_EH_PE_DATAREL | DW_EH_PE_SDATA4)
+
+// call frame instructions, the first three keep an operand in the low 6 bits
+#define DW_CFA_ADVANCE_LOC 0x40
+#define DW_CFA_OFFSET 0x80
+#define DW_CFA_RESTORE 0xc0
+#define DW_CFA_NOP 0x00
+#define DW_CFA_SET_LOC 0x01
+#define DW_CFA_ADVANCE_LOC1 0x02
+#define DW_CFA_ADVANCE_LOC2 0x03
+#define DW_CFA_ADVANCE_LOC4 0x04
+#define DW_CFA_OFFSET_EXTENDED 0x05
+#define DW_CFA_RESTORE_EXTENDED 0x06
+#define DW_CFA_UNDEFINED 0x07
+#define DW_CFA_SAME_VALUE 0x08
+#define DW_CFA_REGISTER 0x09
+#define DW_CFA_REMEMBER_STATE 0x0a
+#define DW_CFA_RESTORE_STATE 0x0b
+#define DW_CFA_DEF_CFA 0x0c
+#define DW_CFA_DEF_CFA_REGISTER 0x0d
+#define DW_CFA_DEF_CFA_OFFSET 0x0e
+#define DW_CFA_DEF_CFA_EXPRESSION 0x0f
+#define DW_CFA_EXPRESSION 0x10
+#define DW_CFA_OFFSET_EXTENDED_SF 0x11
+#define DW_CFA_DEF_CFA_SF 0x12
+#define DW_CFA_DEF_CFA_OFFSET_SF 0x13
+#define DW_CFA_VAL_OFFSET 0x14
+#define DW_CFA_VAL_OFFSET_SF 0x15
+#define DW_CFA_VAL_EXPRESSION 0x16
+#define DW_CFA_GNU_ARGS_SIZE 0x2e
+#define DW_CFA_GNU_NEGATIVE_OFFSET_EXTENDED 0x2f
+
+// deepest DW_CFA_remember_state nesting we follow
+#define MAX_REMEMBERED_STATES 8
+
+// where the signal context keeps each register, by DWARF number
+static const int signal_regs[UNWIND_REG_COUNT] = {
+	REG_RAX, REG_RDX, REG_RCX, REG_RBX, REG_RSI, REG_RDI, REG_RBP, REG_RSP,
+	REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15, REG_RIP,
+};
+
+// Bounds checked reader of call frame info
+typedef struct Cursor {
+	const uint8_t *data;
+	uint64_t size;
+	uint64_t pos;
+	bool overflow;
+} Cursor;
+
+// The parts of a common information entry used to run an FDE's instructions
+typedef struct Cie {
+	uint64_t code_align;
+	int64_t data_align;
+	uint64_t ra_reg;
+	uint8_t fde_enc;
+	// how the FDEs point to their language specific data, DW_EH_PE_OMIT if they dont
+	uint8_t lsda_enc;
+	// the FDEs have augmentation data to skip
+	bool has_aug_data;
+	bool signal_frame;
+	const uint8_t *insns;
+	uint64_t insns_len;
+	// address of the instructions in the tracee's view of the file
+	uint64_t insns_addr;
+} Cie;
+
+// A frame description entry and its CIE
+typedef struct Fde {
+	Cie cie;
+	uint64_t pc_begin;
+	uint64_t pc_end;
+	// address of the language specific data holding the exception landing pads, 0 if
+	// there isnt any
+	uint64_t lsda;
+	const uint8_t *insns;
+	uint64_t insns_len;
+	uint64_t insns_addr;
+} Fde;
+
+// A row of the call frame table as the instructions are run
+typedef struct CfaState {
+	uint64_t cfa_reg;
+	int64_t cfa_offset;
+	// the cfa is computed by an expression we dont evaluate
+	bool cfa_expr;
+	uint8_t kinds[UNWIND_REG_COUNT];
+	int64_t offsets[UNWIND_REG_COUNT];
+} CfaState;
+
+// Registers of the frame being unwound
+typedef struct RegState {
+	uint64_t vals[UNWIND_REG_COUNT];
+	// bitmask of the registers whose values are known
+	uint32_t known;
+} RegState;
+
+static inline bool can_read(Cursor *c, uint64_t n)
+{
+	if (c->overflow || n > c->size - c->pos)
+	{
+		c->overflow = true;
+		return false;
+	}
+	return true;
+}
+
+// Reads a little endian value of n bytes
+static uint64_t read_fixed(Cursor *c, int n)
+{
+	if (!can_read(c, n))
+	{
+		return 0;
+	}
+
+	uint64_t val = 0;
+	for (int i = 0; i < n; i++)
+	{
+		val |= (uint64_t)c->data[c->pos + i] << (8 * i);
+	}
+	c->pos += n;
+	return val;
+}
+
+static uint64_t read_uleb(Cursor *c)
+{
+	uint64_t val = 0;
+	int shift = 0;
+	while (can_read(c, 1))
+	{
+		uint8_t byte = c->data[c->pos++];
+		if (shift < 64)
+		{
+			val |= (uint64_t)(byte & 0x7f) << shift;
+		}
+		shift += 7;
+		if (!(byte & 0x80))
+		{
+			break;
+		}
+	}
+	return val;
+}
+
+static int64_t read_sleb(Cursor *c)
+{
+	int64_t val = 0;
+	int shift = 0;
+	uint8_t byte = 0;
+	while (can_read(c, 1))
+	{
+		byte = c->data[c->pos++];
+		if (shift < 64)
+		{
+			val |= (int64_t)(byte & 0x7f) << shift;
+		}
+		shift += 7;
+		if (!(byte & 0x80))
+		{
+			break;
+		}
+	}
+
+	// sign extend
+	if (shift < 64 && (byte & 0x40))
+	{
+		val |= -((int64_t)1 << shift);
+	}
+	return val;
+}
+
+static void skip(Cursor *c, uint64_t n)
+{
+	if (can_read(c, n))
+	{
+		c->pos += n;
+	}
+}
+
+// Returns the NUL terminated string at the cursor
+static const char *read_str(Cursor *c)
+{
+	const char *str = (const char *)c->data + c->pos;
+	const void *nul = c->pos < c->size ? memchr(str, '\0', c->size - c->pos) : NULL;
+	if (nul == NULL)
+	{
+		c->overflow = true;
+		return NULL;
+	}
+	c->pos += (const char *)nul - str + 1;
+	return str;
+}
+
+// Reads a pointer in the given encoding. base is the address of the cursor's data for pc
+// relative pointers and data_base the address data relative ones are from. The other
+// relative forms arent used on x86-64 and are left as they are.
+static uint64_t read_encoded(Cursor *c, uint8_t enc, uint64_t base, uint64_t data_base)
+{
+	uint64_t field = base + c->pos;
+	uint64_t val;
+	switch (enc & 0x0f)
+	{
+	case DW_EH_PE_ABSPTR:
+	case DW_EH_PE_UDATA8:
+	case DW_EH_PE_SDATA8:
+		val = read_fixed(c, 8);
+		break;
+	case DW_EH_PE_ULEB128:
+		val = read_uleb(c);
+		break;
+	case DW_EH_PE_UDATA2:
+		val = read_fixed(c, 2);
+		break;
+	case DW_EH_PE_UDATA4:
+		val = read_fixed(c, 4);
+		break;
+	case DW_EH_PE_SLEB128:
+		val = (uint64_t)read_sleb(c);
+		break;
+	case DW_EH_PE_SDATA2:
+		val = (uint64_t)(int64_t)(int16_t)read_fixed(c, 2);
+		break;
+	case DW_EH_PE_SDATA4:
+		val = (uint64_t)(int64_t)(int32_t)read_fixed(c, 4);
+		break;
+	default:
+		c->overflow = true;
+		return 0;
+	}
+
+	switch (enc & 0x70)
+	{
+	case DW_EH_PE_PCREL:
+		return val + field;
+	case DW_EH_PE_DATAREL:
+		return val + data_base;
+	default:
+		return val;
+	}
+}
+
+// Positions a cursor over the body of the .eh_frame entry at offset, after its CIE id or
+// pointer. Returns -1 for the terminator or an entry running off the section.
+static int read_entry(const ElfSection *eh_frame, uint64_t offset, Cursor *c, uint64_t *id_offset, uint32_t *id)
+{
+	Cursor head = {eh_frame->data, eh_frame->size, offset, false};
+	uint64_t len = read_fixed(&head, 4);
+	if (len == 0xffffffff)
+	{
+		len = read_fixed(&head, 8);
+	}
+	if (head.overflow || len < 4 || len > head.size - head.pos)
+	{
+		return -1;
+	}
+
+	*id_offset = head.pos;
+	*id = (uint32_t)read_fixed(&head, 4);
+	// the cursor ends with the entry
+	c->data = eh_frame->data;
+	c->size = *id_offset + len;
+	c->pos = head.pos;
+	c->overflow = false;
+	return 0;
+}
+
+// Reads the CIE at the given offset in .eh_frame. Returns -1 if it is malformed.
+static int parse_cie(const ElfSection *eh_frame, uint64_t offset, Cie *cie)
+{
+	Cursor c;
+	uint64_t id_offset;
+	uint32_t id;
+	if (read_entry(eh_frame, offset, &c, &id_offset, &id) == -1 || id != 0)
+	{
+		return -1;
+	}
+
+	uint8_t version = (uint8_t)read_fixed(&c, 1);
+	const char *aug = read_str(&c);
+	if (aug == NULL || (version != 1 && version != 3 && version != 4) || (aug[0] != '\0' && aug[0] != 'z'))
+	{
+		return -1;
+	}
+	if (version == 4)
+	{
+		// address and segment selector sizes
+		skip(&c, 2);
+	}
+
+	cie->code_align = read_uleb(&c);
+	cie->data_align = read_sleb(&c);
+	cie->ra_reg = version == 1 ? read_fixed(&c, 1) : read_uleb(&c);
+	cie->fde_enc = DW_EH_PE_ABSPTR;
+	cie->lsda_enc = DW_EH_PE_OMIT;
+	cie->has_aug_data = aug[0] == 'z';
+	cie->signal_frame = false;
+
+	if (cie->has_aug_data)
+	{
+		uint64_t aug_len = read_uleb(&c);
+		uint64_t aug_end = c.pos + aug_len;
+		// letters we dont know end the walk, the length lets us skip their data
+		bool known = true;
+		for (const char *letter = aug + 1; *letter != '\0' && known; letter++)
+		{
+			switch (*letter)
+			{
+			case 'R':
+				cie->fde_enc = (uint8_t)read_fixed(&c, 1);
+				break;
+			case 'P':
+			{
+				uint8_t enc = (uint8_t)read_fixed(&c, 1);
+				read_encoded(&c, enc, eh_frame->addr, 0);
+				break;
+			}
+			case 'L':
+				cie->lsda_enc = (uint8_t)read_fixed(&c, 1);
+				break;
+			case 'S':
+				cie->signal_frame = true;
+				break;
+			default:
+				known = false;
+				break;
+			}
+		}
+		if (aug_end > c.size)
+		{
+			return -1;
+		}
+		c.pos = aug_end;
+	}
+
+	if (c.overflow)
+	{
+		return -1;
+	}
+	cie->insns = c.data + c.pos;
+	cie->insns_len = c.size - c.pos;
+	cie->insns_addr = eh_frame->addr + c.pos;
+	return 0;
+}
+
+// Reads the FDE at the given offset in .eh_frame along with its CIE. Returns -1 if it is
+// malformed or is a CIE.
+static int parse_fde(const ElfSection *eh_frame, uint64_t offset, Fde *fde)
+{
+	Cursor c;
+	uint64_t id_offset;
+	uint32_t id;
+	if (read_entry(eh_frame, offset, &c, &id_offset, &id) == -1 || id == 0 || id > id_offset)
+	{
+		return -1;
+	}
+
+	// the CIE pointer is relative to where it is stored
+	if (parse_cie(eh_frame, id_offset - id, &fde->cie) == -1)
+	{
+		return -1;
+	}
+
+	fde->pc_begin = read_encoded(&c, fde->cie.fde_enc, eh_frame->addr, 0);
+	fde->pc_end = fde->pc_begin + read_encoded(&c, fde->cie.fde_enc & 0x0f, 0, 0);
+	fde->lsda = 0;
+	if (fde->cie.has_aug_data)
+	{
+		uint64_t aug_len = read_uleb(&c);
+		uint64_t aug_end = c.pos + aug_len;
+		if (fde->cie.lsda_enc != DW_EH_PE_OMIT && aug_len > 0)
+		{
+			fde->lsda = read_encoded(&c, fde->cie.lsda_enc, eh_frame->addr, 0);
+		}
+		if (aug_end > c.size)
+		{
+			return -1;
+		}
+		c.pos = aug_end;
+	}
+
+	if (c.overflow)
+	{
+		return -1;
+	}
+	fde->insns = c.data + c.pos;
+	fde->insns_len = c.size - c.pos;
+	fde->insns_addr = eh_frame->addr + c.pos;
+	return 0;
+}
+
+// Copies the search table out of .eh_frame_hdr. Returns -1 if it isnt in the usual encoding.
+static int load_hdr_table(UnwindModule *module, const ElfSection *hdr)
+{
+	Cursor c = {hdr->data, hdr->size, 0, false};
+	uint8_t version = (uint8_t)read_fixed(&c, 1);
+	uint8_t ptr_enc = (uint8_t)read_fixed(&c, 1);
+	uint8_t count_enc = (uint8_t)read_fixed(&c, 1);
+	uint8_t table_enc = (uint8_t)read_fixed(&c, 1);
+	if (c.overflow || version != 1 || count_enc == DW_EH_PE_OMIT || table_enc != HDR_TABLE_ENC)
+	{
+		return -1;
+	}
+
+	if (ptr_enc != DW_EH_PE_OMIT)
+	{
+		read_encoded(&c, ptr_enc, hdr->addr, hdr->addr);
+	}
+	uint64_t count = read_encoded(&c, count_enc, hdr->addr, hdr->addr);
+	if (c.overflow || count > (c.size - c.pos) / 8)
+	{
+		return -1;
+	}
+
+	module->fdes = malloc((count > 0 ? count : 1) * sizeof(UnwindFde));
+	if (module->fdes == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for the FDE table. %s", strerror(errno));
+		return -1;
+	}
+
+	for (uint64_t i = 0; i < count; i++)
+	{
+		uint64_t pc = hdr->addr + (int64_t)(int32_t)read_fixed(&c, 4);
+		uint64_t fde = hdr->addr + (int64_t)(int32_t)read_fixed(&c, 4);
+		if (fde < module->eh_frame.addr || fde - module->eh_frame.addr >= module->eh_frame.size)
+		{
+			free(module->fdes);
+			module->fdes = NULL;
+			return -1;
+		}
+		module->fdes[i].pc = pc;
+		module->fdes[i].offset = fde - module->eh_frame.addr;
+	}
+	module->fde_count = count;
+	return 0;
+}
+
+static int compare_fdes(const void *a, const void *b)
+{
+	uint64_t pc_a = ((const UnwindFde *)a)->pc;
+	uint64_t pc_b = ((const UnwindFde *)b)->pc;
+	return pc_a < pc_b ? -1 : pc_a > pc_b;
+}
+
+// Builds the search table by walking every entry of .eh_frame, for files without an
+// .eh_frame_hdr. Returns -1 for errors.
+static int scan_eh_frame(UnwindModule *module)
+{
+	size_t capacity = 0;
+	uint64_t offset = 0;
+	Cursor c;
+	uint64_t id_offset;
+	uint32_t id;
+	while (read_entry(&module->eh_frame, offset, &c, &id_offset, &id) == 0)
+	{
+		Fde fde;
+		if (id != 0 && parse_fde(&module->eh_frame, offset, &fde) == 0 && fde.pc_end > fde.pc_begin)
+		{
+			if (module->fde_count == capacity)
+			{
+				capacity = capacity == 0 ? 64 : capacity * 2;
+				UnwindFde *fdes = realloc(module->fdes, capacity * sizeof(UnwindFde));
+				if (fdes == NULL)
+				{
+					logger(ERROR, "Failed to allocate heap memory for the FDE table. %s", strerror(errno));
+					return -1;
+				}
+				module->fdes = fdes;
+			}
+			module->fdes[module->fde_count].pc = fde.pc_begin;
+			module->fdes[module->fde_count].offset = offset;
+			module->fde_count++;
+		}
+		offset = c.size;
+	}
+
+	qsort(module->fdes, module->fde_count, sizeof(UnwindFde), compare_fdes);
+	return 0;
+}
+
+// Opens the file of an executable mapping and finds its call frame info. A file that cant
+// be read leaves the module without any.
+static void open_module(UnwindModule *module, int pid, uint64_t offset)
+{
+	// a file deleted or replaced since it was mapped is still reachable through the mapping
+	char map_file[MAP_FILE_PATH_SIZE];
+	const char *path = module->path;
+	size_t path_len = strlen(path);
+	if (path_len > strlen(DELETED_SUFFIX) && strcmp(path + path_len - strlen(DELETED_SUFFIX), DELETED_SUFFIX) == 0)
+	{
+		snprintf(map_file, MAP_FILE_PATH_SIZE, "/proc/%d/map_files/%lx-%lx", pid, (unsigned long)module->start,
+			(unsigned long)module->end);
+		path = map_file;
+	}
+
+	module->image = elf_open(path);
+	if (module->image == NULL)
+	{
+		return;
+	}
+
+	// any code section in the mapping gives the difference between file and tracee addresses
+	bool found = false;
+	for (uint16_t i = 0; i < module->image->section_count && !found; i++)
+	{
+		const ElfSectionHeader *section = &module->image->sections[i];
+		if ((section->sh_flags & SECTION_FLAG_EXEC) && section->sh_offset >= offset &&
+			section->sh_offset - offset < module->end - module->start)
+		{
+			module->bias = module->start + (section->sh_offset - offset) - section->sh_addr;
+			found = true;
+		}
+	}
+
+	if (!found || elf_section(module->image, ".eh_frame", &module->eh_frame) == -1 || module->eh_frame.data == NULL)
+	{
+		logger(DEBUG, "No call frame info for %s.", module->path);
+		return;
+	}
+
+	ElfSection hdr;
+	if (elf_section(module->image, ".eh_frame_hdr", &hdr) == 0 && hdr.data != NULL && load_hdr_table(module, &hdr) == 0)
+	{
+		return;
+	}
+	logger(DEBUG, "No usable .eh_frame_hdr in %s, scanning .eh_frame.", module->path);
+	scan_eh_frame(module);
+}
+
+static void free_module(UnwindModule *module)
+{
+	if (module->symbols != NULL)
+	{
+		free_symbol_table(module->symbols);
+	}
+	if (module->image != NULL)
+	{
+		elf_close(module->image);
+	}
+	free(module->fdes);
+	free(module->path);
+}
+
+// Drops every cached rule
+static void clear_rules(Unwinder *unwinder)
+{
+	for (size_t i = 0; i < unwinder->rules->capacity; i++)
+	{
+		free(unwinder->rules->entries[i].val);
+	}
+	free_addr_map(unwinder->rules);
+	unwinder->rules = new_addr_map();
+}
+
+// Reads the tracee's mappings and opens the files mapped executable. Files still mapped
+// where they were keep what was already read of them. Returns -1 for errors.
+static int read_mappings(Unwinder *unwinder)
+{
+	char maps_path[MAPS_PATH_SIZE];
+	snprintf(maps_path, MAPS_PATH_SIZE, "/proc/%d/maps", unwinder->pid);
+	FILE *maps = fopen(maps_path, "r");
+	if (maps == NULL)
+	{
+		logger(ERROR, "Failed to open %s. %s", maps_path, strerror(errno));
+		return -1;
+	}
+
+	UnwindModule *old_modules = unwinder->modules;
+	size_t old_count = unwinder->module_count;
+	unwinder->modules = NULL;
+	unwinder->module_count = 0;
+	unwinder->mapping_count = 0;
+	size_t module_capacity = 0;
+	size_t mapping_capacity = 0;
+	int res = 0;
+
+	char line[MAPS_LINE_SIZE];
+	while (res == 0 && fgets(line, MAPS_LINE_SIZE, maps) != NULL)
+	{
+		unsigned long start, end, offset;
+		char perms[5];
+		int path_start = 0;
+		if (sscanf(line, "%lx-%lx %4s %lx %*s %*s %n", &start, &end, perms, &offset, &path_start) != 4)
+		{
+			continue;
+		}
+		line[strcspn(line, "\n")] = '\0';
+
+		if (unwinder->mapping_count == mapping_capacity)
+		{
+			mapping_capacity = mapping_capacity == 0 ? 64 : mapping_capacity * 2;
+			UnwindRange *mappings = realloc(unwinder->mappings, mapping_capacity * sizeof(UnwindRange));
+			if (mappings == NULL)
+			{
+				logger(ERROR, "Failed to allocate heap memory for mappings. %s", strerror(errno));
+				res = -1;
+				break;
+			}
+			unwinder->mappings = mappings;
+		}
+		UnwindRange *range = &unwinder->mappings[unwinder->mapping_count++];
+		range->start = start;
+		range->end = end;
+		range->exec = perms[2] == 'x';
+
+		const char *path = line + path_start;
+		if (!range->exec || path[0] != '/')
+		{
+			continue;
+		}
+
+		if (unwinder->module_count == module_capacity)
+		{
+			module_capacity = module_capacity == 0 ? 16 : module_capacity * 2;
+			UnwindModule *modules = realloc(unwinder->modules, module_capacity * sizeof(UnwindModule));
+			if (modules == NULL)
+			{
+				logger(ERROR, "Failed to allocate heap memory for modules. %s", strerror(errno));
+				res = -1;
+				break;
+			}
+			unwinder->modules = modules;
+		}
+		UnwindModule *module = &unwinder->modules[unwinder->module_count];
+
+		// take over the module if the same file is still mapped in the same place
+		bool reused = false;
+		for (size_t i = 0; i < old_count && !reused; i++)
+		{
+			if (old_modules[i].path != NULL && old_modules[i].start == start && old_modules[i].end == end &&
+				strcmp(old_modules[i].path, path) == 0)
+			{
+				*module = old_modules[i];
+				old_modules[i].path = NULL;
+				reused = true;
+			}
+		}
+
+		if (!reused)
+		{
+			memset(module, 0, sizeof(UnwindModule));
+			module->start = start;
+			module->end = end;
+			module->path = strdup(path);
+			if (module->path == NULL)
+			{
+				logger(ERROR, "Failed to allocate heap memory for a module path. %s", strerror(errno));
+				res = -1;
+				break;
+			}
+			open_module(module, unwinder->pid, offset);
+		}
+		unwinder->module_count++;
+	}
+	fclose(maps);
+
+	// rules for code that is no longer mapped could be wrong for whatever replaces it
+	bool dropped = false;
+	for (size_t i = 0; i < old_count; i++)
+	{
+		if (old_modules[i].path != NULL)
+		{
+			free_module(&old_modules[i]);
+			dropped = true;
+		}
+	}
+	free(old_modules);
+
+	if (dropped)
+	{
+		clear_rules(unwinder);
+		if (unwinder->rules == NULL)
+		{
+			return -1;
+		}
+	}
+	return res;
+}
+
+// Returns the mapping containing the address, reading the mappings again once per walk if
+// it isnt in the ones we know
+static const UnwindRange *find_mapping(Unwinder *unwinder, uint64_t addr)
+{
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		size_t low = 0;
+		size_t high = unwinder->mapping_count;
+		while (low < high)
+		{
+			size_t mid = low + (high - low) / 2;
+			if (unwinder->mappings[mid].end <= addr)
+			{
+				low = mid + 1;
+			}
+			else
+			{
+				high = mid;
+			}
+		}
+		if (low < unwinder->mapping_count && unwinder->mappings[low].start <= addr)
+		{
+			return &unwinder->mappings[low];
+		}
+
+		if (unwinder->refreshed)
+		{
+			return NULL;
+		}
+		unwinder->refreshed = true;
+		if (read_mappings(unwinder) == -1)
+		{
+			return NULL;
+		}
+	}
+	return NULL;
+}
+
+// Returns the module whose code contains the address, NULL if there isnt one
+static UnwindModule *find_module(Unwinder *unwinder, uint64_t addr)
+{
+	if (find_mapping(unwinder, addr) == NULL)
+	{
+		return NULL;
+	}
+
+	size_t low = 0;
+	size_t high = unwinder->module_count;
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+		if (unwinder->modules[mid].end <= addr)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+	if (low < unwinder->module_count && unwinder->modules[low].start <= addr)
+	{
+		return &unwinder->modules[low];
+	}
+	return NULL;
+}
+
+// Finds the FDE covering a file address with a binary search of the module's table.
+// Returns -1 if there isnt one.
+static int find_fde(const UnwindModule *module, uint64_t pc, Fde *fde)
+{
+	size_t low = 0;
+	size_t high = module->fde_count;
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+		if (module->fdes[mid].pc <= pc)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	if (low == 0 || parse_fde(&module->eh_frame, module->fdes[low - 1].offset, fde) == -1)
+	{
+		return -1;
+	}
+	return pc >= fde->pc_begin && pc < fde->pc_end ? 0 : -1;
+}
+
+static void set_reg_rule(CfaState *state, uint64_t reg, uint8_t kind, int64_t offset)
+{
+	if (reg < UNWIND_REG_COUNT)
+	{
+		state->kinds[reg] = kind;
+		state->offsets[reg] = offset;
+	}
+}
+
+// Sets a register back to its rule from the CIE's instructions
+static void restore_reg_rule(CfaState *state, const CfaState *initial, uint64_t reg)
+{
+	if (reg < UNWIND_REG_COUNT)
+	{
+		state->kinds[reg] = initial != NULL ? initial->kinds[reg] : REG_SAME;
+		state->offsets[reg] = initial != NULL ? initial->offsets[reg] : 0;
+	}
+}
+
+// Runs call frame instructions starting from loc until they move past pc. initial is the
+// state after the CIE's instructions, NULL while running them. Returns -1 for instructions
+// that are malformed or that we dont handle.
+static int run_cfa_program(const Cie *cie, const uint8_t *insns, uint64_t len, uint64_t insns_addr, uint64_t loc, uint64_t pc,
+	CfaState *state, const CfaState *initial)
+{
+	CfaState remembered[MAX_REMEMBERED_STATES];
+	size_t depth = 0;
+	Cursor c = {insns, len, 0, false};
+
+	while (c.pos < c.size && !c.overflow)
+	{
+		uint8_t op = (uint8_t)read_fixed(&c, 1);
+		uint64_t delta = 0;
+		uint64_t reg;
+
+		switch (op & 0xc0)
+		{
+		case DW_CFA_ADVANCE_LOC:
+			delta = op & 0x3f;
+			break;
+		case DW_CFA_OFFSET:
+			set_reg_rule(state, op & 0x3f, REG_OFFSET, (int64_t)read_uleb(&c) * cie->data_align);
+			continue;
+		case DW_CFA_RESTORE:
+			restore_reg_rule(state, initial, op & 0x3f);
+			continue;
+		default:
+			switch (op)
+			{
+			case DW_CFA_NOP:
+				continue;
+			case DW_CFA_GNU_ARGS_SIZE:
+				read_uleb(&c);
+				continue;
+			case DW_CFA_SET_LOC:
+				loc = read_encoded(&c, cie->fde_enc, insns_addr, 0);
+				if (loc > pc)
+				{
+					return 0;
+				}
+				continue;
+			case DW_CFA_ADVANCE_LOC1:
+				delta = read_fixed(&c, 1);
+				break;
+			case DW_CFA_ADVANCE_LOC2:
+				delta = read_fixed(&c, 2);
+				break;
+			case DW_CFA_ADVANCE_LOC4:
+				delta = read_fixed(&c, 4);
+				break;
+			case DW_CFA_OFFSET_EXTENDED:
+				reg = read_uleb(&c);
+				set_reg_rule(state, reg, REG_OFFSET, (int64_t)read_uleb(&c) * cie->data_align);
+				continue;
+			case DW_CFA_OFFSET_EXTENDED_SF:
+				reg = read_uleb(&c);
+				set_reg_rule(state, reg, REG_OFFSET, read_sleb(&c) * cie->data_align);
+				continue;
+			case DW_CFA_GNU_NEGATIVE_OFFSET_EXTENDED:
+				reg = read_uleb(&c);
+				set_reg_rule(state, reg, REG_OFFSET, -(int64_t)read_uleb(&c) * cie->data_align);
+				continue;
+			case DW_CFA_VAL_OFFSET:
+				reg = read_uleb(&c);
+				set_reg_rule(state, reg, REG_VAL_OFFSET, (int64_t)read_uleb(&c) * cie->data_align);
+				continue;
+			case DW_CFA_VAL_OFFSET_SF:
+				reg = read_uleb(&c);
+				set_reg_rule(state, reg, REG_VAL_OFFSET, read_sleb(&c) * cie->data_align);
+				continue;
+			case DW_CFA_RESTORE_EXTENDED:
+				restore_reg_rule(state, initial, read_uleb(&c));
+				continue;
+			case DW_CFA_UNDEFINED:
+				set_reg_rule(state, read_uleb(&c), REG_UNDEFINED, 0);
+				continue;
+			case DW_CFA_SAME_VALUE:
+				set_reg_rule(state, read_uleb(&c), REG_SAME, 0);
+				continue;
+			case DW_CFA_REGISTER:
+			{
+				reg = read_uleb(&c);
+				uint64_t other = read_uleb(&c);
+				set_reg_rule(state, reg, other < UNWIND_REG_COUNT ? REG_REGISTER : REG_UNDEFINED, (int64_t)other);
+				continue;
+			}
+			case DW_CFA_EXPRESSION:
+			case DW_CFA_VAL_EXPRESSION:
+				// registers saved by expressions are treated as lost
+				set_reg_rule(state, read_uleb(&c), REG_UNDEFINED, 0);
+				skip(&c, read_uleb(&c));
+				continue;
+			case DW_CFA_REMEMBER_STATE:
+				if (depth == MAX_REMEMBERED_STATES)
+				{
+					return -1;
+				}
+				remembered[depth++] = *state;
+				continue;
+			case DW_CFA_RESTORE_STATE:
+				if (depth == 0)
+				{
+					return -1;
+				}
+				*state = remembered[--depth];
+				continue;
+			case DW_CFA_DEF_CFA:
+				state->cfa_reg = read_uleb(&c);
+				state->cfa_offset = (int64_t)read_uleb(&c);
+				state->cfa_expr = false;
+				continue;
+			case DW_CFA_DEF_CFA_SF:
+				state->cfa_reg = read_uleb(&c);
+				state->cfa_offset = read_sleb(&c) * cie->data_align;
+				state->cfa_expr = false;
+				continue;
+			case DW_CFA_DEF_CFA_REGISTER:
+				state->cfa_reg = read_uleb(&c);
+				state->cfa_expr = false;
+				continue;
+			case DW_CFA_DEF_CFA_OFFSET:
+				state->cfa_offset = (int64_t)read_uleb(&c);
+				continue;
+			case DW_CFA_DEF_CFA_OFFSET_SF:
+				state->cfa_offset = read_sleb(&c) * cie->data_align;
+				continue;
+			case DW_CFA_DEF_CFA_EXPRESSION:
+				skip(&c, read_uleb(&c));
+				state->cfa_expr = true;
+				continue;
+			default:
+				logger(DEBUG, "Unknown call frame instruction %d.", op);
+				return -1;
+			}
+		}
+
+		loc += delta * cie->code_align;
+		if (loc > pc)
+		{
+			return 0;
+		}
+	}
+	return c.overflow ? -1 : 0;
+}
+
+// Turns the row of the call frame table for a pc into a rule
+static void fill_rule(const Cie *cie, const CfaState *state, UnwindRule *rule)
+{
+	rule->signal_frame = cie->signal_frame;
+	if (state->cfa_expr)
+	{
+		// the signal trampoline finds the cfa in the signal context, which we know the
+		// layout of. Other expressions are left to frame pointers.
+		rule->type = cie->signal_frame ? RULE_SIGNAL : RULE_NONE;
+		return;
+	}
+	if (state->cfa_reg >= UNWIND_REG_COUNT || cie->ra_reg != DW_RA || state->cfa_offset < INT32_MIN ||
+		state->cfa_offset > INT32_MAX)
+	{
+		return;
+	}
+
+	rule->type = RULE_CFI;
+	rule->cfa_reg = (uint8_t)state->cfa_reg;
+	rule->cfa_offset = (int32_t)state->cfa_offset;
+	rule->read_lo = 0;
+	rule->read_hi = 0;
+	bool other_saved = false;
+	for (int reg = 0; reg < UNWIND_REG_COUNT; reg++)
+	{
+		int64_t offset = state->offsets[reg];
+		if ((state->kinds[reg] == REG_OFFSET || state->kinds[reg] == REG_VAL_OFFSET) && (offset < INT32_MIN || offset > INT32_MAX - 8))
+		{
+			rule->type = RULE_NONE;
+			return;
+		}
+		rule->kinds[reg] = state->kinds[reg];
+		rule->offsets[reg] = (int32_t)offset;
+
+		if (state->kinds[reg] == REG_OFFSET)
+		{
+			if (rule->read_lo == rule->read_hi)
+			{
+				rule->read_lo = (int32_t)offset;
+				rule->read_hi = (int32_t)offset + 8;
+			}
+			rule->read_lo = offset < rule->read_lo ? (int32_t)offset : rule->read_lo;
+			rule->read_hi = offset + 8 > rule->read_hi ? (int32_t)offset + 8 : rule->read_hi;
+		}
+		if (reg != DW_RBP && reg != DW_RA && state->kinds[reg] != REG_SAME)
+		{
+			other_saved = true;
+		}
+	}
+
+	// the usual push rbp, mov rsp rbp frame which can be walked by the rbp chain alone
+	if (!other_saved && !cie->signal_frame && rule->cfa_reg == DW_RBP && rule->cfa_offset == 16 &&
+		rule->kinds[DW_RBP] == REG_OFFSET && rule->offsets[DW_RBP] == -16 &&
+		rule->kinds[DW_RA] == REG_OFFSET && rule->offsets[DW_RA] == -8)
+	{
+		rule->type = RULE_FRAME_POINTER;
+	}
+}
+
+// Works out how to unwind from the given pc using the call frame info of its module
+static void compute_rule(Unwinder *unwinder, uint64_t pc, UnwindRule *rule)
+{
+	memset(rule, 0, sizeof(UnwindRule));
+	rule->type = RULE_NONE;
+
+	const UnwindModule *module = find_module(unwinder, pc);
+	Fde fde;
+	if (module == NULL || module->fde_count == 0 || find_fde(module, pc - module->bias, &fde) == -1)
+	{
+		return;
+	}
+
+	CfaState initial;
+	memset(&initial, 0, sizeof(CfaState));
+	if (run_cfa_program(&fde.cie, fde.cie.insns, fde.cie.insns_len, fde.cie.insns_addr, fde.pc_begin, UINT64_MAX, &initial, NULL) == -1)
+	{
+		return;
+	}
+
+	CfaState state = initial;
+	if (run_cfa_program(&fde.cie, fde.insns, fde.insns_len, fde.insns_addr, fde.pc_begin, pc - module->bias, &state, &initial) == -1)
+	{
+		return;
+	}
+	fill_rule(&fde.cie, &state, rule);
+}
+
+// Returns the rule for unwinding from pc, computing it the first time the pc is seen.
+// Returns NULL for errors.
+static const UnwindRule *get_rule(Unwinder *unwinder, uint64_t pc)
+{
+	UnwindRule *rule = am_get(unwinder->rules, pc);
+	if (rule != NULL)
+	{
+		return rule;
+	}
+
+	rule = malloc(sizeof(UnwindRule));
+	if (rule == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for an unwind rule. %s", strerror(errno));
+		return NULL;
+	}
+	compute_rule(unwinder, pc, rule);
+
+	// computing the rule can read the mappings again which can replace the cache
+	if (unwinder->rules == NULL || am_set(unwinder->rules, pc, rule) == -1)
+	{
+		free(rule);
+		return NULL;
+	}
+	return rule;
+}
+
+// Makes sure the window holds the stack from addr to addr + len. When it doesnt the window
+// is refilled with one read from addr upwards, where the callers' frames are. Returns -1
+// if the memory isnt mapped.
+static int load_stack(Unwinder *unwinder, uint64_t addr, uint64_t len)
+{
+	if (addr >= unwinder->window_addr && addr + len >= addr &&
+		addr + len <= unwinder->window_addr + unwinder->window_len)
+	{
+		return 0;
+	}
+
+	// only read what is mapped so a read never fails part way
+	const UnwindRange *mapping = find_mapping(unwinder, addr);
+	if (mapping == NULL || len > mapping->end - addr)
+	{
+		return -1;
+	}
+
+	uint64_t size = mapping->end - addr < STACK_WINDOW_SIZE ? mapping->end - addr : STACK_WINDOW_SIZE;
+	if (len > size)
+	{
+		return -1;
+	}
+	MemRange range = {.addr = addr, .buf = unwinder->window, .len = size};
+	if (read_memory_v(unwinder->mem, &range, 1) == -1)
+	{
+		unwinder->window_len = 0;
+		return -1;
+	}
+	unwinder->window_addr = addr;
+	unwinder->window_len = size;
+	return 0;
+}
+
+// Returns the word at addr, which must be in the window
+static inline uint64_t stack_word(const Unwinder *unwinder, uint64_t addr)
+{
+	uint64_t val;
+	memcpy(&val, unwinder->window + (addr - unwinder->window_addr), sizeof(val));
+	return val;
+}
+
+// Follows the rbp chain one frame. Unless the call frame info said the frame uses rbp as a
+// frame pointer, rbp is checked to point into the stack above the frame first.
+static bool frame_pointer_step(Unwinder *unwinder, RegState *regs, bool check)
+{
+	uint64_t rbp = regs->vals[DW_RBP];
+	if (!(regs->known & (1u << DW_RBP)))
+	{
+		return false;
+	}
+	if (check && (rbp % 8 != 0 || !(regs->known & (1u << DW_RSP)) || rbp < regs->vals[DW_RSP]))
+	{
+		return false;
+	}
+	if (load_stack(unwinder, rbp, 16) == -1)
+	{
+		return false;
+	}
+
+	regs->vals[DW_RBP] = stack_word(unwinder, rbp);
+	regs->vals[DW_RA] = stack_word(unwinder, rbp + 8);
+	regs->vals[DW_RSP] = rbp + 16;
+	regs->known |= (1u << DW_RBP) | (1u << DW_RA) | (1u << DW_RSP);
+	return true;
+}
+
+// Applies a rule from the call frame info, reading every saved register with one read
+static bool cfi_step(Unwinder *unwinder, const UnwindRule *rule, RegState *regs)
+{
+	if (!(regs->known & (1u << rule->cfa_reg)))
+	{
+		return false;
+	}
+
+	uint64_t cfa = regs->vals[rule->cfa_reg] + (int64_t)rule->cfa_offset;
+	if (rule->read_hi > rule->read_lo &&
+		load_stack(unwinder, cfa + (int64_t)rule->read_lo, (uint64_t)(rule->read_hi - rule->read_lo)) == -1)
+	{
+		return false;
+	}
+
+	RegState caller = {.known = 0};
+	for (int reg = 0; reg < UNWIND_REG_COUNT; reg++)
+	{
+		int32_t offset = rule->offsets[reg];
+		switch (rule->kinds[reg])
+		{
+		case REG_SAME:
+			caller.vals[reg] = regs->vals[reg];
+			caller.known |= regs->known & (1u << reg);
+			break;
+		case REG_OFFSET:
+			caller.vals[reg] = stack_word(unwinder, cfa + (int64_t)offset);
+			caller.known |= 1u << reg;
+			break;
+		case REG_VAL_OFFSET:
+			caller.vals[reg] = cfa + (int64_t)offset;
+			caller.known |= 1u << reg;
+			break;
+		case REG_REGISTER:
+			caller.vals[reg] = regs->vals[offset];
+			caller.known |= (regs->known >> offset & 1u) << reg;
+			break;
+		default:
+			break;
+		}
+	}
+
+	// the cfa is the stack pointer before the call
+	caller.vals[DW_RSP] = cfa;
+	caller.known |= 1u << DW_RSP;
+	*regs = caller;
+	return (regs->known & (1u << DW_RA)) != 0;
+}
+
+// Unwinds the signal trampoline by reloading every register from the signal context the
+// kernel pushed, which starts at the trampoline's stack pointer
+static bool signal_step(Unwinder *unwinder, RegState *regs)
+{
+	if (!(regs->known & (1u << DW_RSP)))
+	{
+		return false;
+	}
+
+	uint64_t gregs = regs->vals[DW_RSP] + offsetof(ucontext_t, uc_mcontext.gregs);
+	if (load_stack(unwinder, gregs, NGREG * sizeof(greg_t)) == -1)
+	{
+		return false;
+	}
+
+	for (int reg = 0; reg < UNWIND_REG_COUNT; reg++)
+	{
+		regs->vals[reg] = stack_word(unwinder, gregs + signal_regs[reg] * sizeof(greg_t));
+	}
+	regs->known = (1u << UNWIND_REG_COUNT) - 1;
+	return true;
+}
+
+Unwinder *new_unwinder(int pid, TraceeMem *mem)
+{
+	Unwinder *unwinder = malloc(sizeof(Unwinder));
+	if (unwinder == NULL)
+	{
+		logger(ERROR, "Failed to allocate heap memory for the unwinder. %s", strerror(errno));
+		return NULL;
+	}
+
+	memset(unwinder, 0, offsetof(Unwinder, window));
+	unwinder->pid = pid;
+	unwinder->mem = mem;
+	unwinder->rules = new_addr_map();
+	if (unwinder->rules == NULL)
+	{
+		free(unwinder);
+		return NULL;
+	}
+	return unwinder;
+}
+
+void free_unwinder(Unwinder *unwinder)
+{
+	for (size_t i = 0; i < unwinder->module_count; i++)
+	{
+		free_module(&unwinder->modules[i]);
+	}
+	free(unwinder->modules);
+	free(unwinder->mappings);
+	if (unwinder->rules != NULL)
+	{
+		for (size_t i = 0; i < unwinder->rules->capacity; i++)
+		{
+			free(unwinder->rules->entries[i].val);
+		}
+		free_addr_map(unwinder->rules);
+	}
+	free(unwinder);
+}
+
+long unwind_stack(Unwinder *unwinder, const struct user_regs_struct *regs, UnwindFrame *frames, size_t max_frames)
+{
+	if (unwinder->rules == NULL)
+	{
+		return -1;
+	}
+
+	// the stack has changed since the last walk
+	unwinder->window_len = 0;
+	unwinder->refreshed = false;
+
+	RegState state = {
+		.vals = {regs->rax, regs->rdx, regs->rcx, regs->rbx, regs->rsi, regs->rdi, regs->rbp, regs->rsp,
+			regs->r8, regs->r9, regs->r10, regs->r11, regs->r12, regs->r13, regs->r14, regs->r15, regs->rip},
+		.known = (1u << UNWIND_REG_COUNT) - 1,
+	};
+
+	// the innermost pc is where the tracee stopped, the others are return addresses which
+	// are looked up one byte back so they land in the call rather than after it
+	bool exact_pc = true;
+	size_t count = 0;
+	while (count < max_frames)
+	{
+		uint64_t pc = state.vals[DW_RA];
+		uint64_t sp = state.vals[DW_RSP];
+		frames[count].pc = pc;
+		frames[count].sp = sp;
+		count++;
+
+		// copied as reading the mappings again can drop the cached rules
+		const UnwindRule *cached = get_rule(unwinder, exact_pc ? pc : pc - 1);
+		if (cached == NULL)
+		{
+			return -1;
+		}
+		UnwindRule rule = *cached;
+
+		bool unwound;
+		switch (rule.type)
+		{
+		case RULE_FRAME_POINTER:
+			unwound = frame_pointer_step(unwinder, &state, false);
+			break;
+		case RULE_CFI:
+			unwound = cfi_step(unwinder, &rule, &state);
+			break;
+		case RULE_SIGNAL:
+			unwound = signal_step(unwinder, &state);
+			break;
+		default:
+			unwound = frame_pointer_step(unwinder, &state, true);
+			break;
+		}
+
+		// callers are further up the stack, except past a signal which may have been
+		// handled on another stack
+		if (!unwound || state.vals[DW_RA] == 0 || (rule.type != RULE_SIGNAL && state.vals[DW_RSP] <= sp))
+		{
+			break;
+		}
+
+		const UnwindRange *mapping = find_mapping(unwinder, state.vals[DW_RA]);
+		if (mapping == NULL || !mapping->exec)
+		{
+			break;
+		}
+		exact_pc = rule.signal_frame;
+	}
+	return (long)count;
+}
+
+const char *unwind_module_path(Unwinder *unwinder, uint64_t addr)
+{
+	const UnwindModule *module = find_module(unwinder, addr);
+	return module != NULL ? module->path : NULL;
+}
+
+const char *unwind_func_name(Unwinder *unwinder, uint64_t addr)
+{
+	UnwindModule *module = find_module(unwinder, addr);
+	if (module == NULL || module->image == NULL)
+	{
+		return NULL;
+	}
+
+	if (module->symbols == NULL)
+	{
+		module->symbols = build_symbol_table(module->image);
+		if (module->symbols == NULL)
+		{
+			return NULL;
+		}
+	}
+
+	const Symbol *symbol = symbol_by_addr(module->symbols, addr - module->bias);
+	if (symbol == NULL)
+	{
+		return NULL;
+	}
+	const char *name = symbol_display_name(module->symbols, symbol);
+	return name != NULL ? name : symbol_name(module->symbols, symbol);
+}
+
+// Returns 1 if an exception landing pad of the function containing the file address pc lies
+// inside [addr, addr + len) rather than at its start. Returns -1 if the call frame info or the
+// function's language specific data cant be read.
+int landing_pad_into(const ElfImage *image, uint64_t pc, uint64_t addr, uint64_t len)
+{
+	UnwindModule module = {0};
+	if (elf_section(image, ".eh_frame", &module.eh_frame) == -1 || module.eh_frame.data == NULL)
+	{
+		// exceptions cant be thrown through code without call frame info
+		return 0;
+	}
+
+	ElfSection hdr;
+	bool have_table = elf_section(image, ".eh_frame_hdr", &hdr) == 0 && hdr.data != NULL && load_hdr_table(&module, &hdr) == 0;
+	if (!have_table && scan_eh_frame(&module) == -1)
+	{
+		free(module.fdes);
+		return -1;
+	}
+
+	Fde fde;
+	int found = find_fde(&module, pc, &fde);
+	free(module.fdes);
+	if (found == -1 || fde.lsda == 0)
+	{
+		return 0;
+	}
+
+	ElfSection except_table;
+	if (elf_section(image, ".gcc_except_table", &except_table) == -1 || except_table.data == NULL ||
+		fde.lsda < except_table.addr || fde.lsda - except_table.addr >= except_table.size)
+	{
+		return -1;
+	}
+
+	// the header gives where the landing pads are relative to, the function's start by
+	// default, and is followed by the call site table with the landing pad of each call
+	Cursor c = {except_table.data, except_table.size, fde.lsda - except_table.addr, false};
+	uint8_t start_enc = (uint8_t)read_fixed(&c, 1);
+	uint64_t pad_base = start_enc == DW_EH_PE_OMIT ? fde.pc_begin : read_encoded(&c, start_enc, except_table.addr, 0);
+	if ((uint8_t)read_fixed(&c, 1) != DW_EH_PE_OMIT)
+	{
+		// offset of the type table
+		read_uleb(&c);
+	}
+	uint8_t call_site_enc = (uint8_t)read_fixed(&c, 1);
+	uint64_t table_len = read_uleb(&c);
+	if (c.overflow || table_len > c.size - c.pos)
+	{
+		return -1;
+	}
+
+	c.size = c.pos + table_len;
+	while (c.pos < c.size)
+	{
+		// start and length of the call site, its landing pad and its action
+		read_encoded(&c, call_site_enc, except_table.addr, 0);
+		read_encoded(&c, call_site_enc, except_table.addr, 0);
+		uint64_t pad = read_encoded(&c, call_site_enc, except_table.addr, 0);
+		read_uleb(&c);
+		if (c.overflow)
+		{
+			return -1;
+		}
+		if (pad != 0 && pad_base + pad > addr && pad_base + pad < addr + len)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
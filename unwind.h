@@ -0,0 +1,136 @@
+#ifndef UNWIND_H
+#define UNWIND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/user.h>
+
+#include "addr_map.h"
+#include "elf_image.h"
+#include "mem.h"
+#include "symbols.h"
+
+// registers the unwinder follows by their DWARF numbers, the last is the return address
+#define UNWIND_REG_COUNT 17
+// stack copied out of the tracee in one read while walking it
+#define STACK_WINDOW_SIZE (64 * 1024)
+
+// Start of a function's call frame info in a module's .eh_frame
+typedef struct UnwindFde {
+	// first address covered as a file address
+	uint64_t pc;
+	uint64_t offset;
+} UnwindFde;
+
+// An executable mapping of a file in the tracee along with the file's call frame info
+typedef struct UnwindModule {
+	uint64_t start;
+	uint64_t end;
+	// added to the file's addresses to get the ones in the tracee
+	uint64_t bias;
+	char *path;
+	// NULL if the file couldnt be opened, the mapping is then unwound by frame pointers
+	ElfImage *image;
+	ElfSection eh_frame;
+	// sorted by pc for the binary search
+	UnwindFde *fdes;
+	size_t fde_count;
+	// the file's functions, indexed the first time one is named
+	SymbolTable *symbols;
+} UnwindModule;
+
+// A mapping of the tracee's address space
+typedef struct UnwindRange {
+	uint64_t start;
+	uint64_t end;
+	bool exec;
+} UnwindRange;
+
+// How a frame is unwound
+typedef enum UnwindRuleType {
+	// no call frame info covers the pc, frame pointers are tried if they look valid
+	RULE_NONE,
+	RULE_CFI,
+	// call frame info that only saves rbp and the return address above rbp
+	RULE_FRAME_POINTER,
+	// the signal trampoline, the caller's registers are in the signal frame's context
+	RULE_SIGNAL,
+} UnwindRuleType;
+
+// How a register of the caller is recovered
+typedef enum RegRuleKind {
+	REG_SAME,
+	REG_UNDEFINED,
+	// saved at cfa + offset
+	REG_OFFSET,
+	// is cfa + offset
+	REG_VAL_OFFSET,
+	// held in the register numbered offset
+	REG_REGISTER,
+} RegRuleKind;
+
+// How to get from a frame at a pc to its caller, computed once per pc
+typedef struct UnwindRule {
+	uint8_t type;
+	// the canonical frame address is cfa_reg + cfa_offset
+	uint8_t cfa_reg;
+	int32_t cfa_offset;
+	// set for the signal trampoline's frame, the pc it returns to wasnt a call
+	bool signal_frame;
+	// how each register of the caller is found
+	uint8_t kinds[UNWIND_REG_COUNT];
+	int32_t offsets[UNWIND_REG_COUNT];
+	// the span around the cfa the saved registers are read from
+	int32_t read_lo;
+	int32_t read_hi;
+} UnwindRule;
+
+// A frame of a backtrace
+typedef struct UnwindFrame {
+	uint64_t pc;
+	uint64_t sp;
+} UnwindFrame;
+
+// Walks the stacks of a tracee. The modules and rules are kept between walks.
+typedef struct Unwinder {
+	int pid;
+	TraceeMem *mem;
+	UnwindModule *modules;
+	size_t module_count;
+	// every mapping when the modules were last read, sorted by address
+	UnwindRange *mappings;
+	size_t mapping_count;
+	// rules keyed by the pc they were computed for
+	AddrMap *rules;
+	// set once the mappings have been read again during a walk so unknown addresses
+	// dont have them read over and over
+	bool refreshed;
+	// copy of the part of the stack being walked
+	uint64_t window_addr;
+	size_t window_len;
+	uint8_t window[STACK_WINDOW_SIZE];
+} Unwinder;
+
+// Creates an unwinder for the given process. Returns NULL for errors.
+Unwinder *new_unwinder(int pid, TraceeMem *mem);
+
+void free_unwinder(Unwinder *unwinder);
+
+// Walks the stack starting from the given registers, filling in at most max_frames frames
+// with the innermost first. Returns the number of frames found, at least one, or -1 for errors.
+long unwind_stack(Unwinder *unwinder, const struct user_regs_struct *regs, UnwindFrame *frames, size_t max_frames);
+
+// Returns the path of the file mapped at the given address, NULL if there isnt one
+const char *unwind_module_path(Unwinder *unwinder, uint64_t addr);
+
+// Returns the name of the function containing the address from the symbols of the file it
+// is in, NULL if it isnt known. The name lasts until the file is unmapped.
+const char *unwind_func_name(Unwinder *unwinder, uint64_t addr);
+
+// Returns 1 if an exception landing pad of the function containing the file address pc lies
+// inside [addr, addr + len) rather than at its start. Returns -1 if the call frame info or the
+// function's language specific data cant be read.
+int landing_pad_into(const ElfImage *image, uint64_t pc, uint64_t addr, uint64_t len);
+
+#endif
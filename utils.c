@@ -1,6 +1,7 @@
 #include <string.h>
 #include <sys/ptrace.h>
 #include <errno.h>
+#include <time.h>
 
 #include "utils.h"
 #include "logger.h"
@@ -11,6 +12,14 @@ bool has_prefix(char *target, char *prefix)
     return strncmp(target, prefix, strlen(prefix)) == 0;
 }
 
+// Returns the time from a monotonic clock in nanoseconds
+uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
 // Wraps ptrace with error handling by checking the value of errno. Returns a PtraceResult
 // which contains the value and whether the call succeeded.
 ErrResult ptrace_with_error(enum __ptrace_request req, int pid, void * addr, void * data)
@@ -2,10 +2,15 @@
 #define UTILS_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/ptrace.h>
 
 // Returns true if the target string contains the given prefix
 bool has_prefix(char *prefix, char *target);
 
+// Returns the time from a monotonic clock in nanoseconds
+uint64_t monotonic_ns();
+
 // helper struct to allow errors to be returned if the return value
 // could be negative
 typedef struct ErrResult {
@@ -0,0 +1,549 @@
+#include <string.h>
+
+#include "x86_insn.h"
+
+// How an opcode's operands are encoded
+#define OP_MODRM 0x01
+// 1 byte immediate
+#define OP_IMM8 0x02
+// 2 byte immediate, or 4 bytes without an operand size prefix
+#define OP_IMMZ 0x04
+#define OP_IMM16 0x08
+// 1 byte and 4 byte relative branch targets
+#define OP_REL8 0x10
+#define OP_REL32 0x20
+#define OP_ENDS_BLOCK 0x40
+#define OP_INVALID 0x80
+
+#define CALL_REL32 0xe8
+#define JMP_REL32 0xe9
+#define JMP_REL8 0xeb
+
+// Returns the operand encoding of an opcode from the one byte map
+static uint8_t one_byte_operands(uint8_t op)
+{
+	// the arithmetic ops in the first quarter share a pattern, the rest are prefixes or
+	// invalid in 64 bit mode
+	if (op < 0x40)
+	{
+		switch (op & 0x07)
+		{
+		case 0x04:
+			return OP_IMM8;
+		case 0x05:
+			return OP_IMMZ;
+		case 0x06:
+		case 0x07:
+			return OP_INVALID;
+		default:
+			return OP_MODRM;
+		}
+	}
+
+	if (op >= 0x50 && op <= 0x5f)
+	{
+		return 0;
+	}
+	if (op >= 0x70 && op <= 0x7f)
+	{
+		return OP_REL8;
+	}
+	if (op >= 0x84 && op <= 0x8f)
+	{
+		return OP_MODRM;
+	}
+	// the full address of a0 to a3 is added later as it depends on the address size
+	if ((op >= 0x90 && op <= 0x9f && op != 0x9a) || (op >= 0xa0 && op <= 0xa7) || (op >= 0xaa && op <= 0xaf))
+	{
+		return 0;
+	}
+	if (op >= 0xb0 && op <= 0xb7)
+	{
+		return OP_IMM8;
+	}
+	// the immediate depends on rex.w and is added later
+	if (op >= 0xb8 && op <= 0xbf)
+	{
+		return 0;
+	}
+	if (op >= 0xd8 && op <= 0xdf)
+	{
+		return OP_MODRM;
+	}
+	if (op >= 0xe0 && op <= 0xe3)
+	{
+		return OP_REL8;
+	}
+
+	switch (op)
+	{
+	case 0x63:
+	case 0xd0:
+	case 0xd1:
+	case 0xd2:
+	case 0xd3:
+	case 0xfe:
+		return OP_MODRM;
+	case 0x68:
+	case 0xa9:
+		return OP_IMMZ;
+	case 0x69:
+	case 0x81:
+	case 0xc7:
+		return OP_MODRM | OP_IMMZ;
+	case 0x6a:
+	case 0xa8:
+	case 0xcd:
+	case 0xe4:
+	case 0xe5:
+	case 0xe6:
+	case 0xe7:
+		return OP_IMM8;
+	case 0x6b:
+	case 0x80:
+	case 0x83:
+	case 0xc0:
+	case 0xc1:
+	case 0xc6:
+		return OP_MODRM | OP_IMM8;
+	case 0x6c:
+	case 0x6d:
+	case 0x6e:
+	case 0x6f:
+	case 0xc9:
+	case 0xd7:
+	case 0xec:
+	case 0xed:
+	case 0xee:
+	case 0xef:
+	case 0xf1:
+	case 0xf5:
+	case 0xf8:
+	case 0xf9:
+	case 0xfa:
+	case 0xfb:
+	case 0xfc:
+	case 0xfd:
+		return 0;
+	case 0xc2:
+	case 0xca:
+		return OP_IMM16 | OP_ENDS_BLOCK;
+	case 0xc3:
+	case 0xcb:
+	case 0xcc:
+	case 0xcf:
+	case 0xf4:
+		return OP_ENDS_BLOCK;
+	case 0xc8:
+		return OP_IMM16 | OP_IMM8;
+	case 0xe8:
+		return OP_REL32;
+	case 0xe9:
+		return OP_REL32 | OP_ENDS_BLOCK;
+	case 0xeb:
+		return OP_REL8 | OP_ENDS_BLOCK;
+	// the immediates of these depend on the modrm byte and are added once it is decoded
+	case 0xf6:
+	case 0xf7:
+	case 0xff:
+		return OP_MODRM;
+	default:
+		return OP_INVALID;
+	}
+}
+
+// Returns the operand encoding of an opcode from the 0f map
+static uint8_t two_byte_operands(uint8_t op)
+{
+	if ((op >= 0x10 && op <= 0x23) || (op >= 0x28 && op <= 0x2f) || (op >= 0x40 && op <= 0x6f) ||
+		(op >= 0x90 && op <= 0x9f) || op >= 0xd0)
+	{
+		return OP_MODRM;
+	}
+	if (op >= 0x80 && op <= 0x8f)
+	{
+		return OP_REL32;
+	}
+	if ((op >= 0x30 && op <= 0x37) || (op >= 0xc8 && op <= 0xcf))
+	{
+		return 0;
+	}
+
+	switch (op)
+	{
+	case 0x00:
+	case 0x01:
+	case 0x02:
+	case 0x03:
+	case 0x0d:
+	case 0x74:
+	case 0x75:
+	case 0x76:
+	case 0x78:
+	case 0x79:
+	case 0x7c:
+	case 0x7d:
+	case 0x7e:
+	case 0x7f:
+	case 0xa3:
+	case 0xa5:
+	case 0xab:
+	case 0xad:
+	case 0xae:
+	case 0xaf:
+	case 0xb0:
+	case 0xb1:
+	case 0xb2:
+	case 0xb3:
+	case 0xb4:
+	case 0xb5:
+	case 0xb6:
+	case 0xb7:
+	case 0xb8:
+	case 0xb9:
+	case 0xbb:
+	case 0xbc:
+	case 0xbd:
+	case 0xbe:
+	case 0xbf:
+	case 0xc0:
+	case 0xc1:
+	case 0xc3:
+	case 0xc7:
+		return OP_MODRM;
+	case 0x70:
+	case 0x71:
+	case 0x72:
+	case 0x73:
+	case 0xa4:
+	case 0xac:
+	case 0xba:
+	case 0xc2:
+	case 0xc4:
+	case 0xc5:
+	case 0xc6:
+		return OP_MODRM | OP_IMM8;
+	case 0x05:
+	case 0x06:
+	case 0x07:
+	case 0x08:
+	case 0x09:
+	case 0x0e:
+	case 0x77:
+	case 0xa0:
+	case 0xa1:
+	case 0xa2:
+	case 0xa8:
+	case 0xa9:
+	case 0xaa:
+		return 0;
+	case 0x0b:
+		return OP_ENDS_BLOCK;
+	default:
+		return OP_INVALID;
+	}
+}
+
+// Returns true for the legacy prefixes other than the operand and address size ones
+static bool is_prefix(uint8_t byte)
+{
+	switch (byte)
+	{
+	case 0xf0:
+	case 0xf2:
+	case 0xf3:
+	case 0x26:
+	case 0x2e:
+	case 0x36:
+	case 0x3e:
+	case 0x64:
+	case 0x65:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Decodes the length and operands of the instruction at the start of code. Returns -1 if it
+// isnt a valid instruction or runs past avail bytes.
+int decode_insn(const uint8_t *code, size_t avail, X86Insn *insn)
+{
+	memset(insn, 0, sizeof(X86Insn));
+	if (avail > MAX_INSN_LEN)
+	{
+		avail = MAX_INSN_LEN;
+	}
+
+	size_t pos = 0;
+	bool operand16 = false;
+	bool addr32 = false;
+	while (pos < avail && (code[pos] == 0x66 || code[pos] == 0x67 || is_prefix(code[pos])))
+	{
+		operand16 |= code[pos] == 0x66;
+		addr32 |= code[pos] == 0x67;
+		pos++;
+	}
+
+	bool rex_w = false;
+	if (pos < avail && (code[pos] & 0xf0) == 0x40)
+	{
+		rex_w = code[pos] & 0x08;
+		pos++;
+	}
+	if (pos >= avail)
+	{
+		return -1;
+	}
+
+	uint8_t op = code[pos++];
+	uint8_t operands;
+	insn->map = MAP_ONE_BYTE;
+	// amd xop instructions look like pop with a modrm byte but arent decoded
+	if (op == 0x8f && pos < avail && (code[pos] & 0x1f) >= 8)
+	{
+		return -1;
+	}
+
+	if (op == 0xc4 || op == 0xc5 || op == 0x62)
+	{
+		// vex and evex prefixes pick the map themselves and always have a modrm byte
+		size_t prefix_len = op == 0xc5 ? 1 : op == 0xc4 ? 2 : 3;
+		if (pos + prefix_len >= avail)
+		{
+			return -1;
+		}
+		insn->map = op == 0xc5 ? MAP_0F : code[pos] & (op == 0xc4 ? 0x1f : 0x07);
+		pos += prefix_len;
+		op = code[pos++];
+		if (insn->map == MAP_0F)
+		{
+			operands = two_byte_operands(op) & (OP_MODRM | OP_IMM8 | OP_INVALID);
+		}
+		else if (insn->map == MAP_0F38 || insn->map == MAP_0F3A)
+		{
+			operands = insn->map == MAP_0F38 ? OP_MODRM : OP_MODRM | OP_IMM8;
+		}
+		else
+		{
+			return -1;
+		}
+	}
+	else if (op == 0x0f)
+	{
+		if (pos >= avail)
+		{
+			return -1;
+		}
+		op = code[pos++];
+		if (op == 0x38 || op == 0x3a)
+		{
+			if (pos >= avail)
+			{
+				return -1;
+			}
+			insn->map = op == 0x38 ? MAP_0F38 : MAP_0F3A;
+			operands = op == 0x38 ? OP_MODRM : OP_MODRM | OP_IMM8;
+			op = code[pos++];
+		}
+		else
+		{
+			insn->map = MAP_0F;
+			operands = two_byte_operands(op);
+		}
+	}
+	else
+	{
+		operands = one_byte_operands(op);
+	}
+	insn->opcode = op;
+
+	if (operands & OP_INVALID)
+	{
+		return -1;
+	}
+
+	size_t imm_size = 0;
+	if (operands & OP_MODRM)
+	{
+		if (pos >= avail)
+		{
+			return -1;
+		}
+		uint8_t modrm = code[pos++];
+		uint8_t mod = modrm >> 6;
+		uint8_t reg = (modrm >> 3) & 0x07;
+		uint8_t rm = modrm & 0x07;
+
+		if (mod != 3)
+		{
+			size_t disp_size = mod == 1 ? 1 : mod == 2 ? 4 : 0;
+			if (rm == 4)
+			{
+				if (pos >= avail)
+				{
+					return -1;
+				}
+				uint8_t sib = code[pos++];
+				if (mod == 0 && (sib & 0x07) == 5)
+				{
+					disp_size = 4;
+				}
+			}
+			else if (mod == 0 && rm == 5)
+			{
+				insn->disp_offset = (uint8_t)pos;
+				disp_size = 4;
+			}
+			pos += disp_size;
+		}
+
+		if (insn->map == MAP_ONE_BYTE)
+		{
+			// test takes an immediate, the other f6 and f7 ops dont
+			if ((op == 0xf6 || op == 0xf7) && reg < 2)
+			{
+				imm_size = op == 0xf6 ? 1 : operand16 ? 2 : 4;
+			}
+			// indirect jmps
+			if (op == 0xff && (reg == 4 || reg == 5))
+			{
+				insn->ends_block = true;
+			}
+		}
+	}
+
+	if (operands & OP_IMM8)
+	{
+		imm_size += 1;
+	}
+	if (operands & OP_IMM16)
+	{
+		imm_size += 2;
+	}
+	if (operands & OP_IMMZ)
+	{
+		imm_size += operand16 ? 2 : 4;
+	}
+	if (insn->map == MAP_ONE_BYTE && op >= 0xb8 && op <= 0xbf)
+	{
+		imm_size = rex_w ? 8 : operand16 ? 2 : 4;
+	}
+	// moves to and from a full address
+	if (insn->map == MAP_ONE_BYTE && op >= 0xa0 && op <= 0xa3)
+	{
+		imm_size = addr32 ? 4 : 8;
+	}
+
+	if (operands & (OP_REL8 | OP_REL32))
+	{
+		insn->rel_offset = (uint8_t)pos;
+		insn->rel_size = operands & OP_REL8 ? 1 : 4;
+		imm_size = insn->rel_size;
+	}
+	insn->ends_block |= (operands & OP_ENDS_BLOCK) != 0;
+
+	pos += imm_size;
+	if (pos > avail)
+	{
+		return -1;
+	}
+	insn->len = (uint8_t)pos;
+	return 0;
+}
+
+// Returns the address a relative branch goes to
+uint64_t insn_branch_target(const uint8_t *code, const X86Insn *insn, uint64_t addr)
+{
+	int64_t rel;
+	if (insn->rel_size == 1)
+	{
+		rel = (int8_t)code[insn->rel_offset];
+	}
+	else
+	{
+		int32_t rel32;
+		memcpy(&rel32, code + insn->rel_offset, sizeof(rel32));
+		rel = rel32;
+	}
+	return addr + insn->len + rel;
+}
+
+// Returns which operation an ff instruction is from the reg field of its modrm byte, such as
+// 2 for an indirect call or 4 for an indirect jump, or -1 for other instructions
+int insn_ff_op(const uint8_t *code, const X86Insn *insn)
+{
+	if (insn->map != MAP_ONE_BYTE || insn->opcode != 0xff)
+	{
+		return -1;
+	}
+	// prefixes are never ff so the modrm byte comes straight after the first one
+	const uint8_t *op = memchr(code, 0xff, insn->len);
+	return (op[1] >> 3) & 0x07;
+}
+
+// Returns true for call instructions, direct or indirect
+bool insn_is_call(const uint8_t *code, const X86Insn *insn)
+{
+	if (insn->map == MAP_ONE_BYTE && insn->opcode == CALL_REL32)
+	{
+		return true;
+	}
+	int op = insn_ff_op(code, insn);
+	return op == 2 || op == 3;
+}
+
+// Writes a copy of the instruction that reads and branches to the same addresses when run
+// from new_addr. Relative branches and rip relative operands are adjusted and short branches
+// become near ones. Calls still push the address after the copy. Returns the length of the
+// copy, at most MAX_INSN_LEN, or -1 if it cant be moved.
+int insn_relocate(const uint8_t *code, const X86Insn *insn, uint64_t old_addr, uint64_t new_addr, uint8_t *out)
+{
+	size_t len;
+	if (insn->rel_size == 0)
+	{
+		memcpy(out, code, insn->len);
+		if (insn->disp_offset != 0)
+		{
+			int32_t disp;
+			memcpy(&disp, code + insn->disp_offset, sizeof(disp));
+			int64_t moved = (int64_t)disp + (int64_t)(old_addr - new_addr);
+			if (moved != (int32_t)moved)
+			{
+				return -1;
+			}
+			disp = (int32_t)moved;
+			memcpy(out + insn->disp_offset, &disp, sizeof(disp));
+		}
+		return insn->len;
+	}
+	else if (insn->rel_size == 4)
+	{
+		memcpy(out, code, insn->rel_offset);
+		len = insn->len;
+	}
+	else if (insn->map == MAP_ONE_BYTE && insn->opcode == JMP_REL8)
+	{
+		out[0] = JMP_REL32;
+		len = 5;
+	}
+	else if (insn->map == MAP_ONE_BYTE && insn->opcode >= 0x70 && insn->opcode <= 0x7f)
+	{
+		out[0] = 0x0f;
+		out[1] = 0x80 | (insn->opcode & 0x0f);
+		len = 6;
+	}
+	else
+	{
+		// loop and jrcxz only come in short forms
+		return -1;
+	}
+
+	int64_t rel = (int64_t)(insn_branch_target(code, insn, old_addr) - (new_addr + len));
+	if (rel != (int32_t)rel)
+	{
+		return -1;
+	}
+	int32_t rel32 = (int32_t)rel;
+	memcpy(out + len - sizeof(rel32), &rel32, sizeof(rel32));
+	return (int)len;
+}
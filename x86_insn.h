@@ -0,0 +1,57 @@
+#ifndef X86_INSN_H
+#define X86_INSN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// longest an x86 instruction can be
+#define MAX_INSN_LEN 15
+
+// Opcode maps an instruction can come from
+typedef enum InsnMap {
+	MAP_ONE_BYTE,
+	// 0f xx
+	MAP_0F,
+	// 0f 38 xx
+	MAP_0F38,
+	// 0f 3a xx
+	MAP_0F3A,
+} InsnMap;
+
+// The length of an x86-64 instruction and the parts of it that depend on where it is, which
+// is what matters when moving instructions somewhere else
+typedef struct X86Insn {
+	uint8_t len;
+	uint8_t map;
+	uint8_t opcode;
+	// offset of a rip relative displacement, 0 if there isnt one
+	uint8_t disp_offset;
+	// offset and size of a relative branch target, rel_size is 0 for other instructions
+	uint8_t rel_offset;
+	uint8_t rel_size;
+	// execution never carries on to the next instruction, such as for ret or jmp
+	bool ends_block;
+} X86Insn;
+
+// Decodes the length and operands of the instruction at the start of code. Returns -1 if it
+// isnt a valid instruction or runs past avail bytes.
+int decode_insn(const uint8_t *code, size_t avail, X86Insn *insn);
+
+// Returns the address a relative branch goes to
+uint64_t insn_branch_target(const uint8_t *code, const X86Insn *insn, uint64_t addr);
+
+// Returns which operation an ff instruction is from the reg field of its modrm byte, such as
+// 2 for an indirect call or 4 for an indirect jump, or -1 for other instructions
+int insn_ff_op(const uint8_t *code, const X86Insn *insn);
+
+// Returns true for call instructions, direct or indirect
+bool insn_is_call(const uint8_t *code, const X86Insn *insn);
+
+// Writes a copy of the instruction that reads and branches to the same addresses when run
+// from new_addr. Relative branches and rip relative operands are adjusted and short branches
+// become near ones. Calls still push the address after the copy. Returns the length of the
+// copy, at most MAX_INSN_LEN, or -1 if it cant be moved.
+int insn_relocate(const uint8_t *code, const X86Insn *insn, uint64_t old_addr, uint64_t new_addr, uint8_t *out);
+
+#endif